@@ -0,0 +1,87 @@
+#include "Logging.hpp"
+#include "RESP/Parsing.hpp"
+#include "RedisServer.hpp"
+#include <atomic>
+#include <chrono>
+#include <filesystem>
+#include <iostream>
+#include <string>
+#include <thread>
+#include <vector>
+
+/**
+ * @brief SET throughput with the append only file off and with every
+ * appendfsync policy, as the number of threads grows.
+ *
+ * Every client thread plays the role of an I/O thread: it feeds pipelined
+ * batches of SETs to Server::handleBuffer, which flushes the log once per
+ * batch. With always the threads share the fsyncs (group commit).
+ */
+
+namespace {
+constexpr std::size_t Pipeline = 16;
+constexpr auto Duration = std::chrono::seconds(1);
+
+std::string makeBatch(std::size_t thread) {
+  std::string batch;
+  for (std::size_t i = 0; i < Pipeline; ++i) {
+    batch += RESP::toStringArray(
+        {"SET", "key:" + std::to_string(thread) + ":" + std::to_string(i),
+         "value"});
+  }
+  return batch;
+}
+
+double run(std::size_t threads, const std::string &appendfsync) {
+  std::filesystem::path dir =
+      std::filesystem::temp_directory_path() / "aof_benchmark";
+  std::filesystem::remove_all(dir);
+  std::filesystem::create_directories(dir);
+  Redis::Config config;
+  config.dir = dir.string();
+  config.save = "";
+  config.appendonly = appendfsync.empty() ? "no" : "yes";
+  if (!appendfsync.empty()) {
+    config.appendfsync = appendfsync;
+  }
+  std::atomic<std::size_t> ops = 0;
+  {
+    Redis::Server server(6379, 0, config);
+    std::atomic<bool> stop = false;
+    std::vector<std::thread> clients;
+    for (std::size_t t = 0; t < threads; ++t) {
+      clients.emplace_back([&, t] {
+        std::string batch = makeBatch(t);
+        Redis::Server::Reply replies;
+        std::size_t done = 0;
+        while (!stop.load(std::memory_order_relaxed)) {
+          replies.clear();
+          server.handleBuffer(batch, replies, 0);
+          done += Pipeline;
+        }
+        ops += done;
+      });
+    }
+    std::this_thread::sleep_for(Duration);
+    stop = true;
+    for (auto &client : clients) {
+      client.join();
+    }
+  }
+  std::filesystem::remove_all(dir);
+  return ops / std::chrono::duration<double>(Duration).count();
+}
+} // namespace
+
+int main() {
+  setup_quill("aof_benchmark.log");
+  std::cout << "threads  off ops/s  no ops/s  everysec ops/s  always ops/s\n";
+  for (std::size_t threads : {1, 4, 16}) {
+    std::cout << threads;
+    for (const char *policy : {"", "no", "everysec", "always"}) {
+      std::cout << "\t " << static_cast<std::size_t>(run(threads, policy));
+    }
+    std::cout << "\n";
+  }
+  return 0;
+}
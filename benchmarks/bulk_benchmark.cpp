@@ -0,0 +1,67 @@
+#include "Logging.hpp"
+#include "RESP/Parsing.hpp"
+#include "RedisServer.hpp"
+#include <TCPServer.hpp>
+#include <asio.hpp>
+#include <chrono>
+#include <cstdlib>
+#include <iostream>
+#include <string>
+#include <thread>
+
+/**
+ * @brief Latency and throughput of SETs of 1KB, 1MB and 64MB values sent to a
+ * server over a local TCP connection.
+ *
+ * Big payloads are read with exact length reads straight into the stored
+ * value's buffer, the 1KB ones go through the read buffer.
+ *
+ * Usage: bulk_benchmark [port], 6390 by default.
+ */
+
+namespace {
+/**
+ * @brief Bytes sent per value size, so every size runs for a similar time.
+ */
+constexpr std::size_t BytesPerSize = 512 * 1024 * 1024;
+
+void benchmark(tcp::socket &socket, std::size_t size) {
+  std::string request =
+      RESP::toStringArray({"SET", "key", std::string(size, 'v')});
+  std::size_t iterations = std::max<std::size_t>(BytesPerSize / size, 4);
+  iterations = std::min<std::size_t>(iterations, 100000);
+  char reply[5];
+  auto start = std::chrono::steady_clock::now();
+  for (std::size_t i = 0; i < iterations; ++i) {
+    asio::write(socket, asio::buffer(request));
+    asio::read(socket, asio::buffer(reply));
+  }
+  double seconds = std::chrono::duration<double>(
+                       std::chrono::steady_clock::now() - start)
+                       .count();
+  std::cout << size / 1024 << " KB\t" << iterations << " SETs\t"
+            << seconds * 1e6 / iterations << " us/SET\t"
+            << size * iterations / seconds / (1024 * 1024) << " MB/s\n";
+}
+} // namespace
+
+int main(int argc, char **argv) {
+  int port = argc > 1 ? std::atoi(argv[1]) : 6390;
+  Redis::Server::SharedPtr redisServer = std::make_shared<Redis::Server>();
+  asio::io_context ioContext;
+  TCPServer server(ioContext, port, redisServer);
+  server.start();
+  std::thread serverThread([&] { ioContext.run(); });
+
+  asio::io_context clientContext;
+  tcp::socket socket(clientContext);
+  tcp::resolver resolver(clientContext);
+  asio::connect(socket, resolver.resolve("localhost", std::to_string(port)));
+  for (std::size_t size : {1024UL, 1024UL * 1024, 64UL * 1024 * 1024}) {
+    benchmark(socket, size);
+  }
+
+  ioContext.stop();
+  serverThread.join();
+  return 0;
+}
@@ -0,0 +1,80 @@
+#include "Glob.hpp"
+#include "RadixTree.hpp"
+#include <chrono>
+#include <cstdlib>
+#include <iostream>
+#include <regex>
+#include <string>
+#include <vector>
+
+/**
+ * @brief KEYS pattern matching time of the previous std::regex conversion
+ * against the glob matcher, scanning every key or only the keys under the
+ * pattern's literal prefix with the radix tree index.
+ *
+ * The keys look like "user:<id>:<field>" with 4 fields per user.
+ *
+ * Usage: glob_benchmark [keys], 1M keys by default.
+ */
+
+namespace {
+const char *Fields[] = {"name", "email", "age", "city"};
+
+/**
+ * @brief The pattern conversion KEYS used before the glob matcher.
+ */
+std::regex legacyRegex(std::string pattern) {
+  if (size_t loc = pattern.find('*'); loc != std::string::npos) {
+    pattern.insert(loc, ".");
+  }
+  return std::regex(pattern);
+}
+
+template <typename F> void time(const char *name, F &&fn) {
+  auto start = std::chrono::steady_clock::now();
+  std::size_t matches = fn();
+  double ms = std::chrono::duration<double, std::milli>(
+                  std::chrono::steady_clock::now() - start)
+                  .count();
+  std::cout << "  " << name << "\t" << ms << " ms\t" << matches
+            << " matches\n";
+}
+} // namespace
+
+int main(int argc, char **argv) {
+  std::size_t count = argc > 1 ? std::strtoull(argv[1], nullptr, 10) : 1000000;
+  std::vector<std::string> keys;
+  keys.reserve(count);
+  Redis::RadixTree index;
+  for (std::size_t i = 0; i < count; ++i) {
+    keys.push_back("user:" + std::to_string(i / 4) + ":" + Fields[i % 4]);
+    index.insert(keys.back());
+  }
+  for (std::string pattern : {"user:123:*", "user:12?:name", "*:email"}) {
+    std::cout << pattern << "\n";
+    time("regex\t", [&] {
+      std::regex regex = legacyRegex(pattern);
+      std::size_t matches = 0;
+      for (const auto &key : keys) {
+        matches += std::regex_match(key, regex);
+      }
+      return matches;
+    });
+    time("glob\t", [&] {
+      std::size_t matches = 0;
+      for (const auto &key : keys) {
+        matches += Redis::globMatch(pattern, key);
+      }
+      return matches;
+    });
+    time("glob+index", [&] {
+      std::size_t matches = 0;
+      index.forEachWithPrefix(Redis::globPrefix(pattern),
+                              [&](std::string_view key) {
+                                matches += Redis::globMatch(pattern, key);
+                              });
+      return matches;
+    });
+  }
+  return 0;
+}
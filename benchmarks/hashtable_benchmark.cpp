@@ -0,0 +1,64 @@
+#include "Types.hpp"
+#include <algorithm>
+#include <chrono>
+#include <iostream>
+#include <malloc.h>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+/**
+ * @brief Insert latency and memory per key of std::unordered_map against the
+ * keyspace's HashTable.
+ *
+ * Every insert is timed on its own, the tail (p99.9 and max) shows the stalls
+ * of the all-at-once rehash of std::unordered_map that the incremental rehash
+ * spreads over the following operations. The memory is measured with mallinfo2
+ * and includes the keys and values.
+ */
+
+namespace {
+constexpr std::size_t Keys = 4 * 1000 * 1000;
+
+using StdDatabase = std::unordered_map<std::string, Redis::Record,
+                                       Redis::StringHash, std::equal_to<>>;
+
+std::size_t heapUsed() {
+  struct mallinfo2 info = mallinfo2();
+  return info.uordblks + info.hblkhd;
+}
+
+template <typename Map> void run(const char *name) {
+  std::vector<double> latencies;
+  latencies.reserve(Keys);
+  std::size_t before = heapUsed();
+  Map map;
+  Redis::Record record;
+  record.data = "value";
+  auto start = std::chrono::steady_clock::now();
+  for (std::size_t i = 0; i < Keys; ++i) {
+    std::string key = "key:" + std::to_string(i);
+    auto begin = std::chrono::steady_clock::now();
+    map.insert_or_assign(key, record);
+    auto end = std::chrono::steady_clock::now();
+    latencies.push_back(std::chrono::duration<double, std::micro>(end - begin)
+                            .count());
+  }
+  double total = std::chrono::duration<double>(
+                     std::chrono::steady_clock::now() - start)
+                     .count();
+  double bytesPerKey = double(heapUsed() - before) / Keys;
+  std::sort(latencies.begin(), latencies.end());
+  std::cout << name << "\t" << static_cast<std::size_t>(Keys / total)
+            << "\t" << latencies[Keys / 2] << "\t"
+            << latencies[Keys * 999 / 1000] << "\t" << latencies.back()
+            << "\t" << bytesPerKey << "\n";
+}
+} // namespace
+
+int main() {
+  std::cout << "table\t\tinserts/s\tp50 us\tp99.9 us\tmax us\tbytes/key\n";
+  run<StdDatabase>("unordered_map");
+  run<Redis::Database>("HashTable\t");
+  return 0;
+}
@@ -0,0 +1,161 @@
+#include "Logging.hpp"
+#include "RedisServer.hpp"
+#include "UringServer.hpp"
+#include <TCPServer.hpp>
+#include <algorithm>
+#include <asio.hpp>
+#include <atomic>
+#include <chrono>
+#include <cstdlib>
+#include <filesystem>
+#include <iostream>
+#include <string>
+#include <thread>
+#include <vector>
+
+/**
+ * @brief PING latency and throughput of the network transports: asio over
+ * loopback TCP, asio over a Unix domain socket and io_uring over loopback
+ * TCP.
+ *
+ * Each one is measured with a single connection sending one PING at a time
+ * (latency percentiles), then with many connections sending pipelined
+ * batches (throughput).
+ *
+ * Usage: network_benchmark [port] [connections] [pipeline], 6391, 64 and 16
+ * by default. The io_uring backend is skipped when the kernel can't run it.
+ */
+
+namespace {
+constexpr std::size_t RoundTrips = 2000;
+constexpr std::size_t LatencyRoundTrips = 50000;
+const std::string Ping = "*1\r\n$4\r\nPING\r\n";
+
+template <typename Protocol>
+typename Protocol::socket connect(asio::io_context &context,
+                                  const typename Protocol::endpoint &endpoint) {
+  typename Protocol::socket socket(context);
+  socket.connect(endpoint);
+  return socket;
+}
+
+/**
+ * @brief Percentiles of the round trip of a single PING on one connection.
+ */
+template <typename Protocol>
+void latency(const std::string &transport,
+             const typename Protocol::endpoint &endpoint) {
+  asio::io_context context;
+  auto socket = connect<Protocol>(context, endpoint);
+  std::vector<double> samples;
+  samples.reserve(LatencyRoundTrips);
+  char reply[7];
+  for (std::size_t i = 0; i < LatencyRoundTrips; ++i) {
+    auto start = std::chrono::steady_clock::now();
+    asio::write(socket, asio::buffer(Ping));
+    asio::read(socket, asio::buffer(reply));
+    samples.push_back(std::chrono::duration<double, std::micro>(
+                          std::chrono::steady_clock::now() - start)
+                          .count());
+  }
+  std::sort(samples.begin(), samples.end());
+  std::cout << transport << "\t1 connection\tp50 "
+            << samples[samples.size() / 2] << " us\tp99 "
+            << samples[samples.size() * 99 / 100] << " us\n";
+}
+
+/**
+ * @brief Every connection sends its batch and waits for all the replies,
+ * RoundTrips times.
+ */
+template <typename Protocol>
+void throughput(const std::string &transport,
+                const typename Protocol::endpoint &endpoint,
+                std::size_t connections, std::size_t pipeline) {
+  std::string batch;
+  for (std::size_t i = 0; i < pipeline; ++i) {
+    batch += Ping;
+  }
+  std::atomic<bool> ready = false;
+  std::vector<std::thread> clients;
+  for (std::size_t c = 0; c < connections; ++c) {
+    clients.emplace_back([&] {
+      asio::io_context context;
+      auto socket = connect<Protocol>(context, endpoint);
+      std::string replies(pipeline * 7, '\0');
+      while (!ready) {
+        std::this_thread::yield();
+      }
+      for (std::size_t i = 0; i < RoundTrips; ++i) {
+        asio::write(socket, asio::buffer(batch));
+        asio::read(socket, asio::buffer(replies));
+      }
+    });
+  }
+  auto start = std::chrono::steady_clock::now();
+  ready = true;
+  for (auto &client : clients) {
+    client.join();
+  }
+  double seconds = std::chrono::duration<double>(
+                       std::chrono::steady_clock::now() - start)
+                       .count();
+  std::size_t commands = connections * RoundTrips * pipeline;
+  std::cout << transport << "\t" << connections << " connections\t"
+            << commands / seconds << " PINGs/s\t"
+            << seconds * 1e6 / RoundTrips << " us/round trip\n";
+}
+
+template <typename Protocol>
+void benchmark(const std::string &transport,
+               const typename Protocol::endpoint &endpoint,
+               std::size_t connections, std::size_t pipeline) {
+  latency<Protocol>(transport, endpoint);
+  throughput<Protocol>(transport, endpoint, connections, pipeline);
+}
+} // namespace
+
+int main(int argc, char **argv) {
+  int port = argc > 1 ? std::atoi(argv[1]) : 6391;
+  std::size_t connections = argc > 2 ? std::atoi(argv[2]) : 64;
+  std::size_t pipeline = argc > 3 ? std::atoi(argv[3]) : 16;
+  Redis::Server::SharedPtr redisServer = std::make_shared<Redis::Server>();
+  tcp::endpoint tcpEndpoint(asio::ip::make_address("127.0.0.1"), port);
+  {
+    asio::io_context ioContext;
+    TCPServer server(ioContext, port, redisServer);
+    server.start();
+    std::thread serverThread([&] { ioContext.run(); });
+    benchmark<tcp>("asio tcp", tcpEndpoint, connections, pipeline);
+    ioContext.stop();
+    serverThread.join();
+  }
+  {
+    std::string path = (std::filesystem::temp_directory_path() /
+                        ("network_benchmark_" + std::to_string(port)))
+                           .string();
+    asio::io_context ioContext;
+    UnixServer server(ioContext, path, std::filesystem::perms::owner_all,
+                      redisServer);
+    server.start();
+    std::thread serverThread([&] { ioContext.run(); });
+    benchmark<asio::local::stream_protocol>(
+        "asio unix", asio::local::stream_protocol::endpoint(path),
+        connections, pipeline);
+    ioContext.stop();
+    serverThread.join();
+  }
+#ifdef REDIS_SERVER_IO_URING
+  if (UringServer::supported()) {
+    UringServer server(port + 1, redisServer);
+    std::thread serverThread([&] { server.run(); });
+    tcpEndpoint.port(port + 1);
+    benchmark<tcp>("io_uring tcp", tcpEndpoint, connections, pipeline);
+    server.stop();
+    serverThread.join();
+    return 0;
+  }
+#endif
+  std::cout << "io_uring tcp\tnot supported\n";
+  return 0;
+}
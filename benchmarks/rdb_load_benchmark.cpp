@@ -0,0 +1,145 @@
+#include "CRC64.hpp"
+#include "Logging.hpp"
+#include "RDBFile.hpp"
+#include <chrono>
+#include <cstdlib>
+#include <filesystem>
+#include <fstream>
+#include <iostream>
+#include <string>
+#include <thread>
+#include <vector>
+
+/**
+ * @brief Startup time of loading a RDB file of string keys, with one
+ * decoding thread against one per core, into a single table and into one
+ * table per thread like a sharded server.
+ *
+ * Usage: rdb_load_benchmark [megabytes] [value size], 512 and 100 by default,
+ * e.g. `rdb_load_benchmark 5120` for the 5GB file. The file is generated in
+ * the temporary directory and loaded once before timing, so every run reads
+ * it from the page cache.
+ */
+
+namespace {
+/**
+ * @brief Writes a RDB file and its checksum as it goes.
+ */
+class Writer {
+public:
+  explicit Writer(const std::string &path) : file_(path, std::ios::binary) {}
+
+  void write(std::string_view bytes) {
+    crc_ = Redis::CRC64::update(crc_, bytes.data(), bytes.size());
+    file_.write(bytes.data(), bytes.size());
+  }
+
+  void byte(std::uint8_t value) {
+    char c = static_cast<char>(value);
+    write({&c, 1});
+  }
+
+  void length(std::uint64_t value) {
+    if (value < 64) {
+      byte(value);
+    } else if (value < 16384) {
+      byte(0x40 | value >> 8);
+      byte(value & 0xFF);
+    } else {
+      byte(0x80);
+      for (int i = 3; i >= 0; --i) {
+        byte(static_cast<std::uint8_t>(value >> (8 * i)));
+      }
+    }
+  }
+
+  void string(std::string_view value) {
+    length(value.size());
+    write(value);
+  }
+
+  void finish() {
+    byte(Redis::OpCodes::EORDBF);
+    std::uint64_t crc = crc_;
+    for (int i = 0; i < 8; ++i) {
+      char c = static_cast<char>(crc >> (8 * i));
+      file_.write(&c, 1);
+    }
+  }
+
+private:
+  std::ofstream file_;
+  std::uint64_t crc_ = 0;
+};
+
+std::size_t generate(const std::string &path, std::size_t bytes,
+                     std::size_t valueSize) {
+  std::size_t keys = bytes / (valueSize + 16);
+  Writer writer(path);
+  writer.write("REDIS0011");
+  writer.byte(Redis::OpCodes::SELECTDB);
+  writer.length(0);
+  writer.byte(Redis::OpCodes::RESIZEDB);
+  writer.length(keys);
+  writer.length(0);
+  std::string value(valueSize, 'v');
+  for (std::size_t i = 0; i < keys; ++i) {
+    writer.byte(0);
+    writer.string("key:" + std::to_string(i));
+    value[i % valueSize] = 'a' + i % 26;
+    writer.string(value);
+  }
+  writer.finish();
+  return keys;
+}
+
+void run(const std::string &path, std::size_t partitions,
+         std::size_t threads, double megabytes, bool report = true) {
+  std::vector<Redis::Database> tables(partitions);
+  Redis::RDBTarget target;
+  target.partitions = partitions;
+  target.partitionOf = [partitions](std::string_view key) {
+    return Redis::StringHash{}(key) % partitions;
+  };
+  target.reserve = [&tables](std::size_t partition, std::size_t count) {
+    tables[partition].reserve(count);
+  };
+  target.insert = [&tables](std::size_t partition, std::string_view key,
+                            Redis::Record record) {
+    tables[partition][key] = std::move(record);
+  };
+  auto start = std::chrono::steady_clock::now();
+  auto stats = Redis::loadRDBFile(path, target, threads);
+  double seconds = std::chrono::duration<double>(
+                       std::chrono::steady_clock::now() - start)
+                       .count();
+  if (!stats) {
+    std::cout << "load failed\n";
+    return;
+  }
+  if (!report) {
+    return;
+  }
+  std::cout << threads << "\t" << partitions << "\t\t" << seconds << "\t"
+            << megabytes / seconds << "\t" << stats->keys / seconds << "\n";
+}
+} // namespace
+
+int main(int argc, char **argv) {
+  std::size_t megabytes = argc > 1 ? std::atoi(argv[1]) : 512;
+  std::size_t valueSize = argc > 2 ? std::atoi(argv[2]) : 100;
+  std::string path =
+      (std::filesystem::temp_directory_path() / "rdb_load_benchmark.rdb")
+          .string();
+  std::size_t keys = generate(path, megabytes << 20, valueSize);
+  std::cout << keys << " keys in " << megabytes << "MB\n";
+  std::size_t cores = std::max(1u, std::thread::hardware_concurrency());
+  // Warm up the page cache
+  run(path, 1, cores, megabytes, false);
+  std::cout << "threads\tpartitions\tseconds\tMB/s\tkeys/s\n";
+  run(path, 1, 1, megabytes);
+  run(path, 1, cores, megabytes);
+  run(path, cores, cores, megabytes);
+  std::filesystem::remove(path);
+  return 0;
+}
@@ -0,0 +1,80 @@
+#include "Types.hpp"
+#include <chrono>
+#include <cstdlib>
+#include <iostream>
+#include <malloc.h>
+#include <optional>
+#include <string>
+
+/**
+ * @brief Memory per key of the keyspace with the previous Record layout (a
+ * std::string and an optional time_point) against the compact Record.
+ *
+ * The values mimic a cache of counters and small strings: 50% integers, 40%
+ * short strings and 10% 40 bytes strings, one key in four has an expiry.
+ * The memory is measured with mallinfo2 and includes the keys and values.
+ *
+ * Usage: record_benchmark [keys], 10M keys by default.
+ */
+
+namespace {
+struct LegacyRecord {
+  std::string data;
+  std::optional<std::chrono::time_point<std::chrono::system_clock>> expiry;
+};
+
+std::size_t heapUsed() {
+  struct mallinfo2 info = mallinfo2();
+  return info.uordblks + info.hblkhd;
+}
+
+std::string valueFor(std::size_t i) {
+  switch (i % 10) {
+  case 0:
+    return std::string(40, 'v');
+  case 1:
+  case 2:
+  case 3:
+  case 4:
+    return "value:" + std::to_string(i % 1000);
+  default:
+    return std::to_string(i);
+  }
+}
+
+template <typename Table, typename Fill>
+void run(const char *name, std::size_t keys, Fill fill) {
+  std::size_t before = heapUsed();
+  {
+    Table table;
+    for (std::size_t i = 0; i < keys; ++i) {
+      fill(table["key:" + std::to_string(i)], i);
+    }
+    double bytesPerKey = double(heapUsed() - before) / keys;
+    std::cout << name << "\t" << sizeof(typename Table::mapped_type) << "\t\t"
+              << bytesPerKey << "\n";
+  }
+}
+} // namespace
+
+int main(int argc, char **argv) {
+  std::size_t keys = argc > 1 ? std::strtoull(argv[1], nullptr, 10)
+                              : 10 * 1000 * 1000;
+  std::cout << "record\t\tsizeof(Record)\tbytes/key\n";
+  run<Redis::HashTable<LegacyRecord>>(
+      "legacy\t", keys, [](LegacyRecord &record, std::size_t i) {
+        record.data = valueFor(i);
+        if (i % 4 == 0) {
+          record.expiry =
+              std::chrono::system_clock::now() + std::chrono::hours(1);
+        }
+      });
+  run<Redis::Database>("compact\t", keys,
+                       [](Redis::Record &record, std::size_t i) {
+                         record.data = valueFor(i);
+                         if (i % 4 == 0) {
+                           record.setExpiry(3600 * 1000);
+                         }
+                       });
+  return 0;
+}
@@ -0,0 +1,82 @@
+#include "Logging.hpp"
+#include "RESP/Parsing.hpp"
+#include "RedisServer.hpp"
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <iostream>
+#include <random>
+#include <string>
+#include <thread>
+#include <vector>
+
+/**
+ * @brief GET/SET throughput of a shared keyspace (one mutex) against the
+ * sharded keyspace as the number of threads grows.
+ *
+ * Every client thread plays the role of an I/O thread: it feeds pipelined
+ * batches of 50% GET / 50% SET to Server::handleBuffer.
+ */
+
+namespace {
+constexpr std::size_t KeySpace = 100000;
+constexpr std::size_t Pipeline = 64;
+constexpr auto Duration = std::chrono::seconds(1);
+
+std::string makeBatch(std::size_t seed) {
+  std::mt19937 rng(seed);
+  std::uniform_int_distribution<std::size_t> keys(0, KeySpace - 1);
+  std::string batch;
+  for (std::size_t i = 0; i < Pipeline; ++i) {
+    std::string key = "key:" + std::to_string(keys(rng));
+    if (i % 2 == 0) {
+      batch += RESP::toStringArray({"SET", key, "value"});
+    } else {
+      batch += RESP::toStringArray({"GET", key});
+    }
+  }
+  return batch;
+}
+
+double run(std::size_t threads, std::size_t shards) {
+  Redis::Server server(6379, shards);
+  std::atomic<bool> stop = false;
+  std::atomic<std::size_t> ops = 0;
+  std::vector<std::thread> clients;
+  for (std::size_t t = 0; t < threads; ++t) {
+    clients.emplace_back([&, t] {
+      std::vector<std::string> batches;
+      for (std::size_t i = 0; i < 16; ++i) {
+        batches.push_back(makeBatch(t * 16 + i));
+      }
+      Redis::Server::Reply replies;
+      std::size_t done = 0;
+      for (std::size_t i = 0; !stop.load(std::memory_order_relaxed); ++i) {
+        replies.clear();
+        server.handleBuffer(batches[i % batches.size()], replies, 0);
+        done += Pipeline;
+      }
+      ops += done;
+    });
+  }
+  std::this_thread::sleep_for(Duration);
+  stop = true;
+  for (auto &client : clients) {
+    client.join();
+  }
+  return ops / std::chrono::duration<double>(Duration).count();
+}
+} // namespace
+
+int main() {
+  setup_quill("shard_benchmark.log");
+  std::size_t cores = std::max(1u, std::thread::hardware_concurrency());
+  std::cout << "threads  shared ops/s  sharded ops/s\n";
+  for (std::size_t threads = 1; threads <= cores; threads *= 2) {
+    double shared = run(threads, 0);
+    double sharded = run(threads, threads);
+    std::cout << threads << "\t " << static_cast<std::size_t>(shared)
+              << "\t       " << static_cast<std::size_t>(sharded) << "\n";
+  }
+  return 0;
+}
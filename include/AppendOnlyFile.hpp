@@ -0,0 +1,277 @@
+#ifndef __REDIS_SERVER_APPEND_ONLY_FILE_HPP__
+#define __REDIS_SERVER_APPEND_ONLY_FILE_HPP__
+#include <atomic>
+#include <condition_variable>
+#include <cstdint>
+#include <functional>
+#include <mutex>
+#include <optional>
+#include <span>
+#include <string>
+#include <string_view>
+#include <thread>
+
+namespace Redis {
+
+/**
+ * @brief When the log is synced to the disk, the appendfsync config.
+ */
+enum class FsyncPolicy {
+  /**
+   * @brief Before the replies of the commands are sent.
+   */
+  ALWAYS,
+  /**
+   * @brief Once per second from a background thread, a crash loses at most
+   * the last second of writes.
+   */
+  EVERYSEC,
+  /**
+   * @brief When the kernel decides to.
+   */
+  NO,
+};
+
+/**
+ * @brief Parse an appendfsync config: always, everysec or no.
+ *
+ * @return std::optional<FsyncPolicy> std::nullopt for an unknown policy.
+ */
+inline std::optional<FsyncPolicy> parseFsyncPolicy(std::string_view name) {
+  if (name == "always") {
+    return FsyncPolicy::ALWAYS;
+  }
+  if (name == "everysec") {
+    return FsyncPolicy::EVERYSEC;
+  }
+  if (name == "no") {
+    return FsyncPolicy::NO;
+  }
+  return std::nullopt;
+}
+
+/**
+ * @brief Serialize a command as a RESP array of bulk strings, the format of
+ * the log.
+ */
+void appendCommand(std::string &out, std::span<const std::string_view> command);
+
+/**
+ * @brief The append only file: the applied write commands, replayed at
+ * startup to rebuild the keyspace.
+ *
+ * The commands are appended to a memory buffer by the threads executing them
+ * and written out by @sa flush once per event loop turn. A thread flushing
+ * writes the commands of every other thread too, so with the always policy
+ * one fsync commits a whole group of them.
+ *
+ * A rewrite compacts the log: a child process writes the keyspace as
+ * commands, meanwhile the new commands also go to a rewrite buffer which is
+ * appended to the child's file before it replaces the log.
+ */
+class AppendOnlyFile {
+public:
+  enum class State {
+    /**
+     * @brief Commands are dropped.
+     */
+    OFF,
+    /**
+     * @brief Enabled without a log yet, the first rewrite creates it. The
+     * commands only go to the rewrite buffer.
+     */
+    WAIT_REWRITE,
+    ON,
+  };
+
+  AppendOnlyFile() = default;
+  /**
+   * @brief Writes and syncs the buffered commands.
+   */
+  ~AppendOnlyFile();
+  AppendOnlyFile(const AppendOnlyFile &) = delete;
+  AppendOnlyFile &operator=(const AppendOnlyFile &) = delete;
+
+  /**
+   * @brief Append the next commands to an existing log, it's created if
+   * missing.
+   *
+   * @return bool False if the file couldn't be opened.
+   */
+  bool open(const std::string &path);
+
+  /**
+   * @brief Accept commands before the log exists, @sa State::WAIT_REWRITE.
+   * Nothing changes unless the log is off.
+   */
+  void waitForRewrite();
+
+  /**
+   * @brief Write and sync the buffered commands and stop logging.
+   */
+  void close();
+
+  State state() const { return state_.load(std::memory_order_acquire); }
+
+  void setPolicy(FsyncPolicy policy) {
+    policy_.store(policy, std::memory_order_relaxed);
+  }
+
+  /**
+   * @brief Buffer an applied command, a no-op while the log is off. Thread
+   * safe.
+   *
+   * @param command The command and its arguments.
+   */
+  void append(std::span<const std::string_view> command);
+
+  /**
+   * @brief Write the buffered commands, and sync them with the always
+   * policy. Returns at once when another thread already did it for every
+   * command appended so far.
+   *
+   * With the other policies a thread finding another one writing leaves its
+   * commands to the next flush instead of waiting.
+   */
+  void flush();
+
+  /**
+   * @brief Start collecting the commands in the rewrite buffer, called when
+   * the child is forked: the previous commands are in its snapshot.
+   */
+  void startRewrite();
+
+  /**
+   * @brief Append the rewrite buffer to the file the child wrote, sync it and
+   * rename it over the log, which is appended to from now on. The commands
+   * not written to the old log yet are at the end of the rewrite buffer, they
+   * are dropped from the write buffer. When the rewrite started with the
+   * log off the file is only renamed.
+   *
+   * Every thread appending commands waits meanwhile.
+   *
+   * @return bool False if the log couldn't be replaced, the old one is kept
+   * and @sa abortRewrite must be called.
+   */
+  bool finishRewrite(const std::string &tempPath, const std::string &path);
+
+  /**
+   * @brief Drop the rewrite buffer, the child failed.
+   */
+  void abortRewrite();
+
+  /**
+   * @brief Bytes of the log, and after its last rewrite or its opening.
+   */
+  std::uint64_t size() const { return size_.load(std::memory_order_relaxed); }
+  std::uint64_t baseSize() const {
+    return baseSize_.load(std::memory_order_relaxed);
+  }
+
+  /**
+   * @brief Did the last write of the buffer succeed, a failed one is retried
+   * by the next flush.
+   */
+  bool lastWriteOk() const {
+    return lastWriteOk_.load(std::memory_order_relaxed);
+  }
+
+private:
+  /**
+   * @brief Write the buffer to the file, with @sa writeMutex_ held.
+   */
+  void writeBuffer();
+
+  /**
+   * @brief Sync the written commands, from the background thread with the
+   * everysec policy.
+   */
+  void syncWritten();
+
+  void syncLoop();
+
+  /**
+   * @brief Start the background sync thread once, with @sa writeMutex_ held.
+   */
+  void startSyncThread();
+
+  std::atomic<State> state_ = State::OFF;
+  std::atomic<FsyncPolicy> policy_ = FsyncPolicy::EVERYSEC;
+
+  /**
+   * @brief Guards the buffers, taken after @sa writeMutex_ when both are.
+   */
+  std::mutex bufferMutex_;
+  std::string buffer_;
+  bool rewriting_ = false;
+  std::string rewriteBuffer_;
+
+  /**
+   * @brief Serializes the writes of the file, guards the descriptor and the
+   * bytes being written.
+   */
+  std::mutex writeMutex_;
+  int fd_ = -1;
+  std::string writing_;
+
+  /**
+   * @brief Bytes appended to the buffer, written to the file and synced,
+   * since the log was opened or rewritten.
+   */
+  std::atomic<std::uint64_t> appended_ = 0;
+  std::atomic<std::uint64_t> written_ = 0;
+  std::atomic<std::uint64_t> synced_ = 0;
+
+  std::atomic<std::uint64_t> size_ = 0;
+  std::atomic<std::uint64_t> baseSize_ = 0;
+  std::atomic<bool> lastWriteOk_ = true;
+
+  std::thread syncThread_;
+  std::mutex syncMutex_;
+  std::condition_variable syncCondition_;
+  bool stopSync_ = false;
+};
+
+/**
+ * @brief Buffered writer of commands to a new log, @sa writeAppendOnlyFile.
+ */
+class CommandWriter {
+public:
+  explicit CommandWriter(int fd) : fd_(fd) {}
+
+  void write(std::span<const std::string_view> command);
+
+  /**
+   * @brief Write the rest of the buffer.
+   *
+   * @return bool False if any write failed.
+   */
+  bool finish();
+
+private:
+  void flush();
+
+  int fd_;
+  std::string buffer_;
+  bool failed_ = false;
+};
+
+/**
+ * @brief The file a rewrite of the log `filePath` from the process `pid`
+ * writes.
+ */
+std::string appendOnlyTempPath(const std::string &filePath, long pid);
+
+/**
+ * @brief Write a new log at `filePath` and sync it. Nothing is logged, a
+ * forked child can call it.
+ *
+ * @param fill Writes the commands.
+ * @return bool False if the file couldn't be written, it's removed then.
+ */
+bool writeAppendOnlyFile(const std::string &filePath,
+                         const std::function<void(CommandWriter &)> &fill);
+
+} // namespace Redis
+
+#endif
@@ -0,0 +1,130 @@
+#ifndef __REDIS_SERVER_CRC64_HPP__
+#define __REDIS_SERVER_CRC64_HPP__
+#include <array>
+#include <bit>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+
+namespace Redis {
+
+/**
+ * @brief The CRC-64 of the RDB files: Jones polynomial, reflected, initial
+ * value 0 and no final xor, like redis' crc64.
+ */
+namespace CRC64 {
+/**
+ * @brief The polynomial 0xad93d23594c935a9, bit reflected.
+ */
+constexpr std::uint64_t Polynomial = 0x95ac9329ac4bc9b5ULL;
+
+/**
+ * @brief Tables of the slice-by-8 kernel: Tables[k][b] is the CRC of the byte
+ * b followed by k zero bytes.
+ */
+inline constexpr auto Tables = [] {
+  std::array<std::array<std::uint64_t, 256>, 8> tables{};
+  for (std::uint64_t byte = 0; byte < 256; ++byte) {
+    std::uint64_t crc = byte;
+    for (int bit = 0; bit < 8; ++bit) {
+      crc = crc & 1 ? (crc >> 1) ^ Polynomial : crc >> 1;
+    }
+    tables[0][byte] = crc;
+  }
+  for (std::size_t k = 1; k < 8; ++k) {
+    for (std::size_t byte = 0; byte < 256; ++byte) {
+      std::uint64_t previous = tables[k - 1][byte];
+      tables[k][byte] = (previous >> 8) ^ tables[0][previous & 0xFF];
+    }
+  }
+  return tables;
+}();
+
+/**
+ * @brief Continue a CRC over `size` more bytes, 8 bytes per step.
+ *
+ * @param crc The CRC of the preceding bytes, 0 to start.
+ */
+inline std::uint64_t update(std::uint64_t crc, const void *data,
+                            std::size_t size) {
+  const auto *bytes = static_cast<const unsigned char *>(data);
+  if constexpr (std::endian::native == std::endian::little) {
+    for (; size >= 8; size -= 8, bytes += 8) {
+      std::uint64_t word;
+      std::memcpy(&word, bytes, 8);
+      crc ^= word;
+      crc = Tables[7][crc & 0xFF] ^ Tables[6][(crc >> 8) & 0xFF] ^
+            Tables[5][(crc >> 16) & 0xFF] ^ Tables[4][(crc >> 24) & 0xFF] ^
+            Tables[3][(crc >> 32) & 0xFF] ^ Tables[2][(crc >> 40) & 0xFF] ^
+            Tables[1][(crc >> 48) & 0xFF] ^ Tables[0][crc >> 56];
+    }
+  }
+  for (; size > 0; --size, ++bytes) {
+    crc = Tables[0][(crc ^ *bytes) & 0xFF] ^ (crc >> 8);
+  }
+  return crc;
+}
+
+namespace detail {
+inline std::uint64_t gf2Times(const std::uint64_t *matrix,
+                              std::uint64_t vector) {
+  std::uint64_t sum = 0;
+  for (; vector != 0; vector >>= 1, ++matrix) {
+    if (vector & 1) {
+      sum ^= *matrix;
+    }
+  }
+  return sum;
+}
+
+inline void gf2Square(std::uint64_t *square, const std::uint64_t *matrix) {
+  for (int n = 0; n < 64; ++n) {
+    square[n] = gf2Times(matrix, matrix[n]);
+  }
+}
+} // namespace detail
+
+/**
+ * @brief The CRC of two concatenated ranges from the CRCs of each of them,
+ * so the ranges of a big file can be checked in parallel. Like zlib's
+ * crc32_combine, in O(log(size2)).
+ *
+ * @param crc1 CRC of the first range.
+ * @param crc2 CRC of the second range, started from 0.
+ * @param size2 Bytes of the second range.
+ */
+inline std::uint64_t combine(std::uint64_t crc1, std::uint64_t crc2,
+                             std::size_t size2) {
+  if (size2 == 0) {
+    return crc1;
+  }
+  // Operators appending zero bits to a CRC, starting with a single one
+  std::uint64_t even[64];
+  std::uint64_t odd[64];
+  odd[0] = Polynomial;
+  for (int n = 1; n < 64; ++n) {
+    odd[n] = std::uint64_t(1) << (n - 1);
+  }
+  detail::gf2Square(even, odd);
+  detail::gf2Square(odd, even);
+  // Apply the operators of the bits of size2, in bytes
+  do {
+    detail::gf2Square(even, odd);
+    if (size2 & 1) {
+      crc1 = detail::gf2Times(even, crc1);
+    }
+    size2 >>= 1;
+    if (size2 == 0) {
+      break;
+    }
+    detail::gf2Square(odd, even);
+    if (size2 & 1) {
+      crc1 = detail::gf2Times(odd, crc1);
+    }
+    size2 >>= 1;
+  } while (size2 != 0);
+  return crc1 ^ crc2;
+}
+} // namespace CRC64
+} // namespace Redis
+#endif
@@ -0,0 +1,155 @@
+#ifndef __REDIS_SERVER_CLIENT_TABLE_HPP__
+#define __REDIS_SERVER_CLIENT_TABLE_HPP__
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <string>
+#include <utility>
+#include <vector>
+
+namespace Redis {
+
+/**
+ * @brief Table of the connected clients.
+ *
+ * A client id holds the index of its slot in the low 32 bits and the slot's
+ * generation in the 31 high ones, so ids fit a RESP integer and are never 0.
+ * Removing a client bumps the generation and puts the slot on a free list, so
+ * a slot is reused in O(1) by the next client while the ids of the removed
+ * clients never find it again.
+ *
+ * Not thread safe, the server guards it with a mutex.
+ *
+ * @tparam Client The connection type.
+ */
+template <typename Client> class ClientTable {
+public:
+  using Id = std::uint64_t;
+
+  /**
+   * @brief An id no client ever has.
+   */
+  static constexpr Id NoClient = 0;
+
+  /**
+   * @brief Add a client in a free slot.
+   *
+   * @return Id The id of the client, never @sa NoClient.
+   */
+  Id add(std::weak_ptr<Client> client) {
+    std::uint32_t index;
+    if (!free_.empty()) {
+      index = free_.back();
+      free_.pop_back();
+    } else {
+      index = static_cast<std::uint32_t>(slots_.size());
+      slots_.emplace_back();
+    }
+    Slot &slot = slots_[index];
+    slot.client = std::move(client);
+    slot.used = true;
+    ++size_;
+    return makeId(slot.generation, index);
+  }
+
+  /**
+   * @brief Remove a client, its slot is reused by the next one.
+   *
+   * @return bool False if no client has this id.
+   */
+  bool remove(Id id) {
+    Slot *slot = slotFor(id);
+    if (!slot) {
+      return false;
+    }
+    slot->client.reset();
+    slot->name.clear();
+    slot->used = false;
+    slot->generation = slot->generation % MaxGeneration + 1;
+    free_.push_back(static_cast<std::uint32_t>(id));
+    --size_;
+    return true;
+  }
+
+  /**
+   * @brief The client with this id, null if it was removed or is gone.
+   */
+  std::shared_ptr<Client> find(Id id) const {
+    const Slot *slot = slotFor(id);
+    return slot ? slot->client.lock() : nullptr;
+  }
+
+  /**
+   * @brief The name of a client set by CLIENT SETNAME, null for an unknown
+   * id.
+   */
+  std::string *name(Id id) {
+    Slot *slot = slotFor(id);
+    return slot ? &slot->name : nullptr;
+  }
+
+  /**
+   * @brief Call fn(id, client, name) for every client still alive, in slot
+   * order.
+   */
+  template <typename Fn> void forEach(Fn &&fn) const {
+    for (std::size_t i = 0; i < slots_.size(); ++i) {
+      const Slot &slot = slots_[i];
+      if (!slot.used) {
+        continue;
+      }
+      if (auto client = slot.client.lock()) {
+        fn(makeId(slot.generation, static_cast<std::uint32_t>(i)), client,
+           slot.name);
+      }
+    }
+  }
+
+  /**
+   * @brief Number of clients in the table.
+   */
+  std::size_t size() const { return size_; }
+
+  /**
+   * @brief Number of slots, used or free.
+   */
+  std::size_t slots() const { return slots_.size(); }
+
+private:
+  static constexpr std::uint32_t MaxGeneration = 0x7FFFFFFF;
+
+  struct Slot {
+    std::weak_ptr<Client> client;
+    std::string name;
+    std::uint32_t generation = 1;
+    bool used = false;
+  };
+
+  static Id makeId(std::uint32_t generation, std::uint32_t index) {
+    return (static_cast<Id>(generation) << 32) | index;
+  }
+
+  Slot *slotFor(Id id) {
+    return const_cast<Slot *>(std::as_const(*this).slotFor(id));
+  }
+
+  const Slot *slotFor(Id id) const {
+    std::size_t index = static_cast<std::uint32_t>(id);
+    if (index >= slots_.size()) {
+      return nullptr;
+    }
+    const Slot &slot = slots_[index];
+    if (!slot.used || slot.generation != static_cast<std::uint32_t>(id >> 32)) {
+      return nullptr;
+    }
+    return &slot;
+  }
+
+  std::vector<Slot> slots_;
+  std::vector<std::uint32_t> free_;
+  std::size_t size_ = 0;
+};
+
+} // namespace Redis
+
+#endif
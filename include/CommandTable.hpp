@@ -0,0 +1,142 @@
+#ifndef __REDIS_SERVER_COMMAND_TABLE_HPP__
+#define __REDIS_SERVER_COMMAND_TABLE_HPP__
+#include <array>
+#include <bit>
+#include <cstdint>
+#include <span>
+#include <stdexcept>
+#include <string_view>
+
+namespace Redis {
+
+/**
+ * @brief Command flags, named like redis' COMMAND INFO flags.
+ */
+namespace CommandFlag {
+constexpr std::uint32_t WRITE = 1 << 0;
+constexpr std::uint32_t READONLY = 1 << 1;
+constexpr std::uint32_t FAST = 1 << 2;
+} // namespace CommandFlag
+
+/**
+ * @brief A command and its metadata, as reported by COMMAND INFO.
+ *
+ * @tparam Handler The function executing the command.
+ */
+template <typename Handler> struct Command {
+  /**
+   * @brief Lowercase name.
+   */
+  std::string_view name;
+  /**
+   * @brief Number of arguments including the name, negative for at least
+   * -arity arguments.
+   */
+  int arity;
+  std::uint32_t flags;
+  /**
+   * @brief Position of the first and last keys and the step between keys, 0
+   * without keys. A negative last key counts from the end.
+   */
+  int firstKey;
+  int lastKey;
+  int keyStep;
+  Handler handler;
+
+  constexpr bool checkArity(std::size_t args) const {
+    return arity >= 0 ? args == static_cast<std::size_t>(arity)
+                      : args >= static_cast<std::size_t>(-arity);
+  }
+};
+
+/**
+ * @brief Case insensitive perfect hash table of commands, built at compile
+ * time: the constructor searches a seed for which no two names share a slot,
+ * so a lookup is one hash, one slot and one comparison, without allocation.
+ *
+ * @tparam Handler The function executing a command.
+ * @tparam N Number of commands.
+ */
+template <typename Handler, std::size_t N> class CommandTable {
+public:
+  static constexpr std::size_t Slots = std::bit_ceil(N * 2);
+  static_assert(N < 0xFF, "Slots hold 8 bits command indexes");
+
+  constexpr explicit CommandTable(
+      const std::array<Command<Handler>, N> &commands)
+      : commands_(commands) {
+    for (seed_ = 0; seed_ < MaxSeeds; ++seed_) {
+      if (tryFill()) {
+        return;
+      }
+    }
+    throw std::logic_error("No perfect hash seed for the command table");
+  }
+
+  /**
+   * @brief Find a command by name, in any case.
+   *
+   * @return const Command<Handler>* nullptr for an unknown command.
+   */
+  constexpr const Command<Handler> *find(std::string_view name) const {
+    std::uint8_t index = slots_[hash(name, seed_) & (Slots - 1)];
+    if (index == Empty) {
+      return nullptr;
+    }
+    const Command<Handler> &command = commands_[index];
+    if (command.name.size() != name.size()) {
+      return nullptr;
+    }
+    for (std::size_t i = 0; i < name.size(); ++i) {
+      if (toLower(name[i]) != command.name[i]) {
+        return nullptr;
+      }
+    }
+    return &command;
+  }
+
+  constexpr std::span<const Command<Handler>> commands() const {
+    return commands_;
+  }
+
+private:
+  static constexpr std::uint8_t Empty = 0xFF;
+  static constexpr std::uint64_t MaxSeeds = 1 << 16;
+
+  static constexpr char toLower(char c) {
+    return c >= 'A' && c <= 'Z' ? c + ('a' - 'A') : c;
+  }
+
+  /**
+   * @brief FNV-1a of the lowercase name mixed with the seed.
+   */
+  static constexpr std::uint64_t hash(std::string_view name,
+                                      std::uint64_t seed) {
+    std::uint64_t h = 0xcbf29ce484222325ULL ^ (seed * 0x9e3779b97f4a7c15ULL);
+    for (char c : name) {
+      h ^= static_cast<std::uint8_t>(toLower(c));
+      h *= 0x100000001b3ULL;
+    }
+    return h ^ (h >> 29);
+  }
+
+  constexpr bool tryFill() {
+    slots_.fill(Empty);
+    for (std::size_t i = 0; i < N; ++i) {
+      std::uint8_t &slot = slots_[hash(commands_[i].name, seed_) & (Slots - 1)];
+      if (slot != Empty) {
+        return false;
+      }
+      slot = static_cast<std::uint8_t>(i);
+    }
+    return true;
+  }
+
+  std::array<Command<Handler>, N> commands_;
+  std::array<std::uint8_t, Slots> slots_{};
+  std::uint64_t seed_ = 0;
+};
+
+} // namespace Redis
+
+#endif
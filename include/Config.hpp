@@ -1,5 +1,10 @@
 #ifndef __REDIS_SERVER_CONFIG_HPP__
 #define __REDIS_SERVER_CONFIG_HPP__
+#include "AppendOnlyFile.hpp"
+#include "Eviction.hpp"
+#include "OutputBufferLimit.hpp"
+#include "SavePoints.hpp"
+#include <cstdint>
 #include <rttr/registration>
 #include <string>
 using namespace rttr;
@@ -12,19 +17,173 @@ namespace Redis {
 struct Config {
   std::string dir = "/tmp/redis-data";
   std::string dbfilename = "dump.rdb";
+  /**
+   * @brief Frequency of the server's background tasks (active expiry) per
+   * second.
+   */
+  int hz = 10;
+  /**
+   * @brief From 1 to 10, higher values spend more CPU time on removing the
+   * expired keys.
+   */
+  int activeExpireEffort = 1;
+  /**
+   * @brief Memory limit of the keyspace in bytes, 0 for no limit.
+   */
+  std::uint64_t maxmemory = 0;
+  /**
+   * @brief How keys are evicted above maxmemory, @sa parseEvictionPolicy.
+   */
+  std::string maxmemoryPolicy = "noeviction";
+  /**
+   * @brief Keys sampled to find an eviction candidate.
+   */
+  int maxmemorySamples = 5;
+  /**
+   * @brief "yes" to index the keys in a radix tree, KEYS patterns starting
+   * with a literal prefix visit only the keys having it.
+   */
+  std::string keysPrefixIndex = "no";
+  /**
+   * @brief Maximum size of a bulk string in a request, a longer one is a
+   * protocol error as soon as its header is received. Up to 512MB.
+   */
+  std::int64_t protoMaxBulkLen = 512LL * 1024 * 1024;
+  /**
+   * @brief Output buffer limits per client class, @sa parseOutputBufferLimits.
+   */
+  std::string clientOutputBufferLimit =
+      "normal 0 0 0 replica 256mb 64mb 60 pubsub 32mb 8mb 60";
+  /**
+   * @brief Commands and request bytes a connection executes per turn, then
+   * the other connections of its event loop get theirs. At least one command
+   * runs per turn.
+   */
+  std::int64_t ioCommandsPerTurn = 128;
+  std::int64_t ioBytesPerTurn = 64 * 1024;
+  /**
+   * @brief How many times the budget of a normal client the replication
+   * links get per turn.
+   */
+  int replTurnWeight = 4;
+  /**
+   * @brief Seconds a full synchronization waits for more replicas, the
+   * replicas arriving meanwhile share its snapshot.
+   */
+  int replDisklessSyncDelay = 5;
+  /**
+   * @brief Bytes of the replication stream kept for the replicas reconnecting
+   * after a disconnection, at least 16KB.
+   */
+  std::int64_t replBacklogSize = 1024 * 1024;
+  /**
+   * @brief Seconds a replica may go without reading the snapshot sent to it
+   * before it's disconnected.
+   */
+  int replTimeout = 60;
+  /**
+   * @brief When to take a background snapshot, @sa parseSavePoints.
+   */
+  std::string save = "3600 1 300 100 60 10000";
+  /**
+   * @brief "yes" to LZF compress the long strings of the snapshots.
+   */
+  std::string rdbcompression = "yes";
+  /**
+   * @brief "yes" to log the write commands to the append only file, it's
+   * replayed instead of loading the snapshot at startup.
+   */
+  std::string appendonly = "no";
+  /**
+   * @brief Name of the append only file in dir.
+   */
+  std::string appendfilename = "appendonly.aof";
+  /**
+   * @brief When the log is synced, @sa parseFsyncPolicy.
+   */
+  std::string appendfsync = "everysec";
+  /**
+   * @brief The log is rewritten once it grew by this percentage since its
+   * last rewrite and is at least the minimum size in bytes. 0 disables the
+   * automatic rewrites.
+   */
+  int autoAofRewritePercentage = 100;
+  std::uint64_t autoAofRewriteMinSize = 64 * 1024 * 1024;
 
   rttr::variant getField(const std::string &fieldName) {
     property prop = type::get(*this).get_property(fieldName);
     variant varProp = prop.get_value(*this);
     return varProp;
   }
+
+  /**
+   * @brief Set a field from its string representation.
+   *
+   * @return bool False if the field doesn't exist or the value can't be
+   * converted to its type.
+   */
+  bool setField(const std::string &fieldName, const std::string &value) {
+    property prop = type::get(*this).get_property(fieldName);
+    if (!prop) {
+      return false;
+    }
+    variant varValue = value;
+    if (!varValue.convert(prop.get_type())) {
+      return false;
+    }
+    return prop.set_value(*this, varValue);
+  }
+
+  /**
+   * @brief Are the fields which can't be clamped valid.
+   */
+  bool valid() const {
+    return parseEvictionPolicy(maxmemoryPolicy).has_value() &&
+           maxmemorySamples >= 1 && maxmemorySamples <= 64 &&
+           (keysPrefixIndex == "yes" || keysPrefixIndex == "no") &&
+           protoMaxBulkLen >= 1 && protoMaxBulkLen <= 512LL * 1024 * 1024 &&
+           parseOutputBufferLimits(clientOutputBufferLimit).has_value() &&
+           ioCommandsPerTurn >= 1 && ioBytesPerTurn >= 1 &&
+           replTurnWeight >= 1 && replTurnWeight <= 1000 &&
+           replDisklessSyncDelay >= 0 && replBacklogSize >= 16 * 1024 &&
+           replTimeout >= 1 && parseSavePoints(save).has_value() &&
+           (rdbcompression == "yes" || rdbcompression == "no") &&
+           (appendonly == "yes" || appendonly == "no") &&
+           !appendfilename.empty() &&
+           appendfilename.find('/') == std::string::npos &&
+           parseFsyncPolicy(appendfsync).has_value() &&
+           autoAofRewritePercentage >= 0;
+  }
 };
 
 RTTR_REGISTRATION {
   registration::class_<Config>("Config")
       .constructor<>()
       .property("dir", &Config::dir)
-      .property("dbfilename", &Config::dbfilename);
+      .property("dbfilename", &Config::dbfilename)
+      .property("hz", &Config::hz)
+      .property("active-expire-effort", &Config::activeExpireEffort)
+      .property("maxmemory", &Config::maxmemory)
+      .property("maxmemory-policy", &Config::maxmemoryPolicy)
+      .property("maxmemory-samples", &Config::maxmemorySamples)
+      .property("keys-prefix-index", &Config::keysPrefixIndex)
+      .property("proto-max-bulk-len", &Config::protoMaxBulkLen)
+      .property("client-output-buffer-limit",
+                &Config::clientOutputBufferLimit)
+      .property("io-commands-per-turn", &Config::ioCommandsPerTurn)
+      .property("io-bytes-per-turn", &Config::ioBytesPerTurn)
+      .property("repl-turn-weight", &Config::replTurnWeight)
+      .property("repl-diskless-sync-delay", &Config::replDisklessSyncDelay)
+      .property("repl-backlog-size", &Config::replBacklogSize)
+      .property("repl-timeout", &Config::replTimeout)
+      .property("save", &Config::save)
+      .property("rdbcompression", &Config::rdbcompression)
+      .property("appendonly", &Config::appendonly)
+      .property("appendfilename", &Config::appendfilename)
+      .property("appendfsync", &Config::appendfsync)
+      .property("auto-aof-rewrite-percentage",
+                &Config::autoAofRewritePercentage)
+      .property("auto-aof-rewrite-min-size", &Config::autoAofRewriteMinSize);
 }
 } // namespace Redis
 
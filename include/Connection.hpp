@@ -0,0 +1,147 @@
+#ifndef __REDIS_SERVER_CONNECTION_HPP__
+#define __REDIS_SERVER_CONNECTION_HPP__
+#include "Logging.hpp"
+#include "RedisServer.hpp"
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <optional>
+#include <string>
+
+/**
+ * @brief A client connection, whatever network backend serves it.
+ *
+ * The server only talks to its clients through this interface: it queues
+ * messages for them, reads their counters and kills them. The counters live
+ * here, the backends update them from their event loop.
+ */
+class Connection {
+public:
+  /**
+   * @brief Reads from the client pause while this much output is waiting to
+   * be written, they resume once the client consumed it.
+   */
+  static constexpr std::size_t OutputPauseSize = 1024 * 1024;
+
+  explicit Connection(Redis::Server::SharedPtr redisPtr)
+      : rServer(std::move(redisPtr)) {}
+
+  virtual ~Connection() = default;
+
+  /**
+   * @brief Queue a message to the client, it's sent with the next batch of
+   * replies. Safe to call from any thread, the message is handed over to the
+   * event loop owning this connection.
+   *
+   * @param msg The message to send.
+   */
+  virtual void send_message(const std::string &msg) = 0;
+
+  /**
+   * @brief Close the connection, e.g. for CLIENT KILL. Safe to call from any
+   * thread, the connection closes on its event loop.
+   */
+  virtual void kill() = 0;
+
+  void setClientId(std::size_t id) { clientId = id; }
+
+  /**
+   * @brief Bytes of the replies queued or being written to the client.
+   */
+  std::size_t outputBytes() const { return outputBytes_; }
+
+  Redis::ClientClass clientClass() const { return clientClass_; }
+
+  /**
+   * @brief Change the class deciding the output buffer limit, e.g. when the
+   * client turns out to be a replica.
+   */
+  void setClientClass(Redis::ClientClass clientClass) {
+    clientClass_ = clientClass;
+  }
+
+  /**
+   * @brief Counters of the connection, as reported by CLIENT LIST.
+   */
+  struct Stats {
+    std::string addr;
+    std::string laddr;
+    std::chrono::seconds age;
+    std::chrono::seconds idle;
+    std::size_t queryBuffer;
+    std::size_t queryBufferFree;
+    std::size_t outputBytes;
+    std::uint64_t netIn;
+    std::uint64_t netOut;
+    std::uint64_t commands;
+  };
+
+  /**
+   * @brief Snapshot of the counters, safe to call from any thread once the
+   * connection started.
+   */
+  Stats stats() const {
+    auto now = Clock::now();
+    return {addr_,
+            laddr_,
+            std::chrono::duration_cast<std::chrono::seconds>(now - created_),
+            std::chrono::duration_cast<std::chrono::seconds>(
+                now - Clock::time_point(Clock::duration(lastInteraction_))),
+            queryBuffer_,
+            queryBufferFree_,
+            outputBytes_,
+            netIn_,
+            netOut_,
+            commands_};
+  }
+
+protected:
+  using Clock = std::chrono::steady_clock;
+
+  void touch() {
+    lastInteraction_ = Clock::now().time_since_epoch().count();
+  }
+
+  /**
+   * @brief Is the output over the limit of the client's class, @sa
+   * Redis::OutputBufferLimit. The caller disconnects the client if so.
+   */
+  bool outputLimitExceeded() {
+    Redis::OutputBufferLimit limit = rServer->outputBufferLimit(clientClass_);
+    if (!limit.exceeded(outputBytes_, softLimitSince_, Clock::now())) {
+      return false;
+    }
+    LOG_ERROR("Client {} ({}) output of {} bytes is over its limit, closing "
+              "the connection",
+              clientId, Redis::clientClassName(clientClass_),
+              outputBytes_.load());
+    return true;
+  }
+
+  Redis::Server::SharedPtr rServer;
+  std::size_t clientId = 0;
+  /**
+   * @brief Bytes of the pending and in flight replies, read by INFO from
+   * other threads.
+   */
+  std::atomic<std::size_t> outputBytes_ = 0;
+  std::atomic<Redis::ClientClass> clientClass_ = Redis::ClientClass::NORMAL;
+  /**
+   * @brief When the output went above the soft limit, if it still is.
+   */
+  std::optional<Clock::time_point> softLimitSince_;
+  /**
+   * @brief Counters read by CLIENT LIST from other threads.
+   */
+  std::string addr_;
+  std::string laddr_;
+  const Clock::time_point created_ = Clock::now();
+  std::atomic<Clock::rep> lastInteraction_ =
+      Clock::now().time_since_epoch().count();
+  std::atomic<std::size_t> queryBuffer_ = 0;
+  std::atomic<std::size_t> queryBufferFree_ = 0;
+  std::atomic<std::uint64_t> netIn_ = 0;
+  std::atomic<std::uint64_t> netOut_ = 0;
+  std::atomic<std::uint64_t> commands_ = 0;
+};
+#endif
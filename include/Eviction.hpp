@@ -0,0 +1,175 @@
+#ifndef __REDIS_SERVER_EVICTION_HPP__
+#define __REDIS_SERVER_EVICTION_HPP__
+#include <algorithm>
+#include <chrono>
+#include <cstdint>
+#include <optional>
+#include <random>
+#include <string>
+#include <string_view>
+#include <vector>
+
+namespace Redis {
+
+/**
+ * @brief What to do when a write needs memory above maxmemory, named like
+ * redis' maxmemory-policy.
+ */
+enum class EvictionPolicy : std::uint8_t {
+  NOEVICTION,
+  ALLKEYS_LRU,
+  ALLKEYS_LFU,
+  VOLATILE_TTL
+};
+
+inline std::optional<EvictionPolicy>
+parseEvictionPolicy(std::string_view name) {
+  if (name == "noeviction") {
+    return EvictionPolicy::NOEVICTION;
+  }
+  if (name == "allkeys-lru") {
+    return EvictionPolicy::ALLKEYS_LRU;
+  }
+  if (name == "allkeys-lfu") {
+    return EvictionPolicy::ALLKEYS_LFU;
+  }
+  if (name == "volatile-ttl") {
+    return EvictionPolicy::VOLATILE_TTL;
+  }
+  return std::nullopt;
+}
+
+/**
+ * @brief Access metadata kept in the 32 bits of @sa Record::access. With LRU
+ * it's the last access time in milliseconds, with LFU the last decrement time
+ * in minutes (24 bits) and a logarithmic access counter (8 bits), like redis.
+ */
+namespace Access {
+/**
+ * @brief Counter of new keys so they aren't evicted before being used.
+ */
+constexpr std::uint32_t LfuInitValue = 5;
+/**
+ * @brief Higher values need more accesses to increment the counter.
+ */
+constexpr double LfuLogFactor = 10;
+/**
+ * @brief Minutes without access decrementing the counter by one.
+ */
+constexpr std::uint32_t LfuDecayMinutes = 1;
+
+inline std::uint32_t lruClock() {
+  return static_cast<std::uint32_t>(
+      std::chrono::duration_cast<std::chrono::milliseconds>(
+          std::chrono::steady_clock::now().time_since_epoch())
+          .count());
+}
+
+inline std::uint32_t lfuMinutes() {
+  return static_cast<std::uint32_t>(
+             std::chrono::duration_cast<std::chrono::minutes>(
+                 std::chrono::steady_clock::now().time_since_epoch())
+                 .count()) &
+         0xFFFFFF;
+}
+
+/**
+ * @brief The LFU counter after its decay since the last decrement.
+ */
+inline std::uint32_t lfuDecayed(std::uint32_t access) {
+  std::uint32_t counter = access & 0xFF;
+  std::uint32_t elapsed = (lfuMinutes() - (access >> 8)) & 0xFFFFFF;
+  std::uint32_t periods = elapsed / LfuDecayMinutes;
+  return periods > counter ? 0 : counter - periods;
+}
+
+/**
+ * @brief Metadata of a new key.
+ */
+inline std::uint32_t init(EvictionPolicy policy) {
+  if (policy == EvictionPolicy::ALLKEYS_LFU) {
+    return lfuMinutes() << 8 | LfuInitValue;
+  }
+  return lruClock();
+}
+
+/**
+ * @brief Metadata after an access, the LFU counter is incremented with a
+ * probability decreasing as it grows.
+ */
+template <typename Rng>
+std::uint32_t touch(std::uint32_t access, EvictionPolicy policy, Rng &rng) {
+  if (policy != EvictionPolicy::ALLKEYS_LFU) {
+    return lruClock();
+  }
+  std::uint32_t counter = lfuDecayed(access);
+  if (counter < 255) {
+    double base = counter > LfuInitValue ? counter - LfuInitValue : 0;
+    double p = 1.0 / (base * LfuLogFactor + 1);
+    if (std::uniform_real_distribution<double>(0, 1)(rng) < p) {
+      ++counter;
+    }
+  }
+  return lfuMinutes() << 8 | counter;
+}
+} // namespace Access
+
+/**
+ * @brief The best eviction candidates seen by the samplings so far, like
+ * redis' eviction pool. Keeping them between evictions makes the sampled
+ * approximation closer to an exact LRU/LFU without a global list.
+ */
+class EvictionPool {
+public:
+  static constexpr std::size_t Size = 16;
+
+  /**
+   * @brief Offer a candidate, the higher the score the better the candidate.
+   */
+  void insert(std::string_view key, std::uint64_t score) {
+    if (entries_.size() == Size && score <= entries_.front().score) {
+      return;
+    }
+    for (const auto &entry : entries_) {
+      if (entry.key == key) {
+        return;
+      }
+    }
+    auto pos = std::lower_bound(
+        entries_.begin(), entries_.end(), score,
+        [](const Entry &entry, std::uint64_t s) { return entry.score < s; });
+    entries_.insert(pos, Entry{std::string(key), score});
+    if (entries_.size() > Size) {
+      entries_.erase(entries_.begin());
+    }
+  }
+
+  /**
+   * @brief Remove and return the best candidate.
+   */
+  std::optional<std::string> pop() {
+    if (entries_.empty()) {
+      return std::nullopt;
+    }
+    std::string key = std::move(entries_.back().key);
+    entries_.pop_back();
+    return key;
+  }
+
+  std::size_t size() const { return entries_.size(); }
+  void clear() { entries_.clear(); }
+
+private:
+  struct Entry {
+    std::string key;
+    std::uint64_t score;
+  };
+  /**
+   * @brief Sorted by increasing score.
+   */
+  std::vector<Entry> entries_;
+};
+
+} // namespace Redis
+
+#endif
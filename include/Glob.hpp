@@ -0,0 +1,123 @@
+#ifndef __REDIS_SERVER_GLOB_HPP__
+#define __REDIS_SERVER_GLOB_HPP__
+#include <string_view>
+#include <utility>
+
+namespace Redis {
+
+namespace detail {
+/**
+ * @brief Match one character against the pattern element at `pos` (a
+ * literal, an escaped character, `?` or a `[...]` class).
+ *
+ * @param next Set to the position of the following pattern element.
+ */
+inline bool globMatchOne(std::string_view pattern, std::size_t pos, char ch,
+                         std::size_t &next) {
+  std::size_t size = pattern.size();
+  switch (pattern[pos]) {
+  case '?':
+    next = pos + 1;
+    return true;
+  case '\\':
+    if (pos + 1 < size) {
+      next = pos + 2;
+      return pattern[pos + 1] == ch;
+    }
+    next = pos + 1;
+    return ch == '\\';
+  case '[': {
+    std::size_t i = pos + 1;
+    bool negate = i < size && pattern[i] == '^';
+    if (negate) {
+      ++i;
+    }
+    bool match = false;
+    while (i < size && pattern[i] != ']') {
+      if (pattern[i] == '\\' && i + 1 < size) {
+        match |= pattern[i + 1] == ch;
+        i += 2;
+      } else if (i + 2 < size && pattern[i + 1] == '-') {
+        char start = pattern[i];
+        char end = pattern[i + 2];
+        if (start > end) {
+          std::swap(start, end);
+        }
+        match |= ch >= start && ch <= end;
+        i += 3;
+      } else {
+        match |= pattern[i] == ch;
+        ++i;
+      }
+    }
+    // Like redis, an unterminated class ends with the pattern.
+    next = i < size ? i + 1 : size;
+    return match != negate;
+  }
+  default:
+    next = pos + 1;
+    return pattern[pos] == ch;
+  }
+}
+} // namespace detail
+
+/**
+ * @brief Match a string against a glob pattern with redis' syntax: `*`, `?`,
+ * `[abc]`, `[^abc]`, `[a-z]` and `\` to escape a special character.
+ *
+ * The matching doesn't allocate nor recurse: on a mismatch it backtracks to
+ * the last `*` only, which is enough since every other element matches one
+ * character. Worst case O(pattern * string).
+ */
+inline bool globMatch(std::string_view pattern, std::string_view str) {
+  constexpr std::size_t npos = std::string_view::npos;
+  std::size_t p = 0;
+  std::size_t s = 0;
+  // Pattern position after the last star and the string position it's
+  // currently matched up to.
+  std::size_t starP = npos;
+  std::size_t starS = 0;
+  while (s < str.size()) {
+    if (p < pattern.size()) {
+      if (pattern[p] == '*') {
+        while (p < pattern.size() && pattern[p] == '*') {
+          ++p;
+        }
+        if (p == pattern.size()) {
+          return true;
+        }
+        starP = p;
+        starS = s;
+        continue;
+      }
+      std::size_t next;
+      if (detail::globMatchOne(pattern, p, str[s], next)) {
+        p = next;
+        ++s;
+        continue;
+      }
+    }
+    if (starP == npos) {
+      return false;
+    }
+    // Let the last star eat one more character.
+    p = starP;
+    s = ++starS;
+  }
+  while (p < pattern.size() && pattern[p] == '*') {
+    ++p;
+  }
+  return p == pattern.size();
+}
+
+/**
+ * @brief The literal prefix every string matching a pattern starts with,
+ * e.g. "user:" for "user:*:name".
+ */
+inline std::string_view globPrefix(std::string_view pattern) {
+  return pattern.substr(0, pattern.find_first_of("*?[\\"));
+}
+
+} // namespace Redis
+
+#endif
@@ -0,0 +1,86 @@
+#ifndef __REDIS_SERVER_HANDLER_ALLOCATOR_HPP__
+#define __REDIS_SERVER_HANDLER_ALLOCATOR_HPP__
+#include <array>
+#include <cstddef>
+#include <new>
+
+/**
+ * @brief Memory for the asynchronous operations of one connection.
+ *
+ * A connection has at most a read, a write and a wait in flight, so a few
+ * blocks reused by every operation serve the whole request loop without
+ * touching the heap. Bigger or extra requests fall back to the heap. Not
+ * thread safe, used from the connection's event loop only.
+ */
+class HandlerMemory {
+public:
+  static constexpr std::size_t BlockSize = 512;
+  static constexpr std::size_t Blocks = 4;
+
+  HandlerMemory() = default;
+  HandlerMemory(const HandlerMemory &) = delete;
+  HandlerMemory &operator=(const HandlerMemory &) = delete;
+
+  void *allocate(std::size_t size) {
+    if (size <= BlockSize) {
+      for (std::size_t i = 0; i < Blocks; ++i) {
+        if (!used_[i]) {
+          used_[i] = true;
+          return blocks_[i].bytes;
+        }
+      }
+    }
+    return ::operator new(size);
+  }
+
+  void deallocate(void *pointer) {
+    for (std::size_t i = 0; i < Blocks; ++i) {
+      if (pointer == blocks_[i].bytes) {
+        used_[i] = false;
+        return;
+      }
+    }
+    ::operator delete(pointer);
+  }
+
+private:
+  struct Block {
+    alignas(std::max_align_t) std::byte bytes[BlockSize];
+  };
+
+  std::array<Block, Blocks> blocks_;
+  std::array<bool, Blocks> used_{};
+};
+
+/**
+ * @brief Allocator of the completion handlers of a connection, handing out
+ * the blocks of its @sa HandlerMemory.
+ */
+template <typename T> class HandlerAllocator {
+public:
+  using value_type = T;
+
+  explicit HandlerAllocator(HandlerMemory &memory) : memory_(&memory) {}
+
+  template <typename U>
+  HandlerAllocator(const HandlerAllocator<U> &other) noexcept
+      : memory_(other.memory_) {}
+
+  T *allocate(std::size_t n) {
+    return static_cast<T *>(memory_->allocate(sizeof(T) * n));
+  }
+
+  void deallocate(T *pointer, std::size_t) { memory_->deallocate(pointer); }
+
+  template <typename U>
+  bool operator==(const HandlerAllocator<U> &other) const {
+    return memory_ == other.memory_;
+  }
+
+private:
+  template <typename> friend class HandlerAllocator;
+
+  HandlerMemory *memory_;
+};
+
+#endif
@@ -0,0 +1,733 @@
+#ifndef __REDIS_SERVER_HASH_TABLE_HPP__
+#define __REDIS_SERVER_HASH_TABLE_HPP__
+#include <algorithm>
+#include <bit>
+#include <cstdint>
+#include <cstring>
+#include <functional>
+#include <iterator>
+#include <memory>
+#include <new>
+#include <stdexcept>
+#include <string>
+#include <string_view>
+#include <utility>
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#endif
+
+namespace Redis {
+
+/**
+ * @brief Transparent string hash, lets the database be searched with a
+ * std::string_view without building a temporary std::string.
+ *
+ */
+struct StringHash {
+  using is_transparent = void;
+  std::size_t operator()(std::string_view str) const {
+    return std::hash<std::string_view>{}(str);
+  }
+};
+
+namespace detail {
+/**
+ * @brief Control byte of a slot. Full slots store the 7 low bits of the key
+ * hash (H2), so the high bit tells free slots from used ones.
+ */
+constexpr std::int8_t CtrlEmpty = -128; // 0b10000000
+constexpr std::int8_t CtrlDeleted = -2; // 0b11111110
+constexpr std::size_t GroupSize = 16;
+
+/**
+ * @brief Metadata of 16 consecutive slots, matched against a key with a single
+ * SSE2 compare when available.
+ */
+class Group {
+public:
+  explicit Group(const std::int8_t *ctrl) {
+#if defined(__SSE2__)
+    ctrl_ = _mm_load_si128(reinterpret_cast<const __m128i *>(ctrl));
+#else
+    std::memcpy(ctrl_, ctrl, GroupSize);
+#endif
+  }
+
+  /**
+   * @brief Bit i is set if slot i holds the given H2.
+   */
+  std::uint32_t match(std::int8_t h2) const {
+#if defined(__SSE2__)
+    return _mm_movemask_epi8(_mm_cmpeq_epi8(_mm_set1_epi8(h2), ctrl_));
+#else
+    return maskOf([h2](std::int8_t c) { return c == h2; });
+#endif
+  }
+
+  std::uint32_t maskEmpty() const {
+#if defined(__SSE2__)
+    return _mm_movemask_epi8(_mm_cmpeq_epi8(_mm_set1_epi8(CtrlEmpty), ctrl_));
+#else
+    return maskOf([](std::int8_t c) { return c == CtrlEmpty; });
+#endif
+  }
+
+  /**
+   * @brief Empty and deleted slots are the ones with the high bit set.
+   */
+  std::uint32_t maskFree() const {
+#if defined(__SSE2__)
+    return _mm_movemask_epi8(ctrl_);
+#else
+    return maskOf([](std::int8_t c) { return c < 0; });
+#endif
+  }
+
+  std::uint32_t maskFull() const { return ~maskFree() & 0xFFFF; }
+
+private:
+#if defined(__SSE2__)
+  __m128i ctrl_;
+#else
+  template <typename Pred> std::uint32_t maskOf(Pred pred) const {
+    std::uint32_t mask = 0;
+    for (std::size_t i = 0; i < GroupSize; ++i) {
+      mask |= static_cast<std::uint32_t>(pred(ctrl_[i])) << i;
+    }
+    return mask;
+  }
+  std::int8_t ctrl_[GroupSize];
+#endif
+};
+
+inline std::size_t reverseBits(std::size_t v) {
+  std::size_t r = 0;
+  for (std::size_t i = 0; i < sizeof(v) * 8; ++i) {
+    r = (r << 1) | (v & 1);
+    v >>= 1;
+  }
+  return r;
+}
+} // namespace detail
+
+/**
+ * @brief Open addressing hash table with string keys used for the keyspace.
+ *
+ * - Entries live inline in a flat slot array, there is no node per entry.
+ * - Slots are grouped by 16 and every slot has a one byte control tag, a
+ *   lookup compares the tags of a whole group at once (Swiss table style) and
+ *   only touches the slots whose tag matches.
+ * - Growing doesn't rehash everything at once. Like redis' `dict` a second
+ *   table is allocated and every insert/erase migrates one group to it, while
+ *   lookups check both tables. @sa rehashSteps lets an idle loop finish the
+ *   migration earlier.
+ * - @sa forEach iterates safely even if the callback erases entries, and
+ *   @sa scan walks the table with a reverse binary cursor which stays valid
+ *   across resizes.
+ *
+ * Iterators are invalidated by any insert or erase outside @sa forEach.
+ *
+ * @tparam V The mapped value.
+ */
+template <typename V> class HashTable {
+public:
+  using key_type = std::string;
+  using mapped_type = V;
+  using value_type = std::pair<std::string, V>;
+
+  /**
+   * @brief Maximum fill (full and deleted slots) of a table is 7/8.
+   */
+  static constexpr std::size_t MaxLoadNum = 7;
+  static constexpr std::size_t MaxLoadDen = 8;
+
+  /**
+   * @brief Groups migrated by every insert or erase while rehashing.
+   */
+  static constexpr std::size_t RehashGroupsPerOp = 1;
+
+private:
+  struct Table {
+    std::int8_t *ctrl = nullptr;
+    value_type *slots = nullptr;
+    std::size_t groupMask = 0;
+    std::size_t size = 0;
+    std::size_t deleted = 0;
+
+    std::size_t groups() const { return ctrl ? groupMask + 1 : 0; }
+    std::size_t capacity() const { return groups() * detail::GroupSize; }
+    bool full(std::size_t i) const { return ctrl[i] >= 0; }
+  };
+
+  template <bool Const> class Iterator {
+  public:
+    using iterator_category = std::forward_iterator_tag;
+    using value_type = HashTable::value_type;
+    using difference_type = std::ptrdiff_t;
+    using reference =
+        std::conditional_t<Const, const value_type &, value_type &>;
+    using pointer =
+        std::conditional_t<Const, const value_type *, value_type *>;
+    using Owner = std::conditional_t<Const, const HashTable, HashTable>;
+
+    Iterator() = default;
+    Iterator(Owner *owner, int table, std::size_t index)
+        : owner_(owner), table_(table), index_(index) {
+      skipFree();
+    }
+    template <bool C = Const, typename = std::enable_if_t<C>>
+    Iterator(const Iterator<false> &other)
+        : owner_(other.owner_), table_(other.table_), index_(other.index_) {}
+
+    reference operator*() const {
+      return owner_->tables_[table_].slots[index_];
+    }
+    pointer operator->() const { return &**this; }
+    Iterator &operator++() {
+      ++index_;
+      skipFree();
+      return *this;
+    }
+    Iterator operator++(int) {
+      Iterator copy = *this;
+      ++*this;
+      return copy;
+    }
+    bool operator==(const Iterator &other) const {
+      return table_ == other.table_ && index_ == other.index_;
+    }
+
+  private:
+    friend class HashTable;
+    template <bool> friend class Iterator;
+
+    void skipFree() {
+      while (table_ < 2) {
+        const Table &table = owner_->tables_[table_];
+        while (index_ < table.capacity() && !table.full(index_)) {
+          ++index_;
+        }
+        if (index_ < table.capacity()) {
+          return;
+        }
+        ++table_;
+        index_ = 0;
+      }
+    }
+
+    Owner *owner_ = nullptr;
+    int table_ = 2;
+    std::size_t index_ = 0;
+  };
+
+public:
+  using iterator = Iterator<false>;
+  using const_iterator = Iterator<true>;
+
+  HashTable() = default;
+
+  HashTable(const HashTable &other) {
+    reserve(other.size());
+    for (const auto &entry : other) {
+      insert_or_assign(entry.first, entry.second);
+    }
+  }
+
+  HashTable(HashTable &&other) noexcept { swap(other); }
+
+  HashTable &operator=(HashTable other) noexcept {
+    swap(other);
+    return *this;
+  }
+
+  ~HashTable() {
+    release(tables_[0]);
+    release(tables_[1]);
+  }
+
+  void swap(HashTable &other) noexcept {
+    std::swap(tables_, other.tables_);
+    std::swap(rehashIdx_, other.rehashIdx_);
+    std::swap(pauseRehash_, other.pauseRehash_);
+  }
+
+  std::size_t size() const { return tables_[0].size + tables_[1].size; }
+  bool empty() const { return size() == 0; }
+
+  /**
+   * @brief Number of slots allocated in both tables.
+   */
+  std::size_t capacity() const {
+    return tables_[0].capacity() + tables_[1].capacity();
+  }
+
+  /**
+   * @brief Bytes allocated for the slots and their control bytes, not counting
+   * the memory owned by the keys and values.
+   */
+  std::size_t allocatedBytes() const {
+    return capacity() * (sizeof(value_type) + 1);
+  }
+
+  /**
+   * @brief Is an incremental rehash in progress.
+   */
+  bool rehashing() const { return rehashIdx_ >= 0; }
+
+  iterator begin() { return iterator(this, 0, 0); }
+  iterator end() { return iterator(this, 2, 0); }
+  const_iterator begin() const { return const_iterator(this, 0, 0); }
+  const_iterator end() const { return const_iterator(this, 2, 0); }
+
+  iterator find(std::string_view key) {
+    std::size_t hash = hashOf(key);
+    for (int t = 0; t < 2; ++t) {
+      std::size_t index = findIn(tables_[t], key, hash);
+      if (index != npos) {
+        return iterator(this, t, index);
+      }
+    }
+    return end();
+  }
+
+  const_iterator find(std::string_view key) const {
+    return const_cast<HashTable *>(this)->find(key);
+  }
+
+  /**
+   * @brief Find an entry stored under a hash without knowing its key, the
+   * first one of its probe sequence for which `pred(entry)` is true.
+   *
+   * @param hash The @sa hashOf the key.
+   */
+  template <typename Pred> iterator findIf(std::size_t hash, Pred pred) {
+    for (int t = 0; t < 2; ++t) {
+      std::size_t index = findIn(tables_[t], hash, pred);
+      if (index != npos) {
+        return iterator(this, t, index);
+      }
+    }
+    return end();
+  }
+
+  /**
+   * @brief The hash a key is stored under.
+   */
+  static std::size_t hashOf(std::string_view key) { return StringHash{}(key); }
+
+  bool contains(std::string_view key) const { return find(key) != end(); }
+
+  V &at(std::string_view key) {
+    auto it = find(key);
+    if (it == end()) {
+      throw std::out_of_range("HashTable::at");
+    }
+    return it->second;
+  }
+
+  const V &at(std::string_view key) const {
+    return const_cast<HashTable *>(this)->at(key);
+  }
+
+  V &operator[](std::string_view key) {
+    return try_emplace(key).first->second;
+  }
+
+  /**
+   * @brief Insert a default constructed value if the key doesn't exist.
+   *
+   * @return std::pair<iterator, bool> The entry and whether it was inserted.
+   */
+  std::pair<iterator, bool> try_emplace(std::string_view key) {
+    rehashSteps(RehashGroupsPerOp);
+    std::size_t hash = hashOf(key);
+    for (int t = 0; t < 2; ++t) {
+      std::size_t index = findIn(tables_[t], key, hash);
+      if (index != npos) {
+        return {iterator(this, t, index), false};
+      }
+    }
+    Table &target = growIfNeeded();
+    std::size_t index = insertSlot(target, hash);
+    std::construct_at(&target.slots[index], std::string(key), V{});
+    return {iterator(this, &target == &tables_[1] ? 1 : 0, index), true};
+  }
+
+  /**
+   * @brief Insert the value or replace the value of an existing key.
+   *
+   * @return std::pair<iterator, bool> The entry and whether it was inserted.
+   */
+  template <typename M>
+  std::pair<iterator, bool> insert_or_assign(std::string_view key,
+                                             M &&value) {
+    auto result = try_emplace(key);
+    result.first->second = std::forward<M>(value);
+    return result;
+  }
+
+  /**
+   * @brief Remove an entry, this invalidates the iterators.
+   */
+  void erase(iterator it) { eraseAt(tables_[it.table_], it.index_); }
+
+  /**
+   * @brief Remove a key.
+   *
+   * @return std::size_t 1 if the key existed, 0 otherwise.
+   */
+  std::size_t erase(std::string_view key) {
+    auto it = find(key);
+    if (it == end()) {
+      return 0;
+    }
+    erase(it);
+    return 1;
+  }
+
+  void clear() {
+    release(tables_[0]);
+    release(tables_[1]);
+    rehashIdx_ = -1;
+  }
+
+  /**
+   * @brief Allocate room for `count` entries at once, e.g. before a bulk load.
+   */
+  void reserve(std::size_t count) {
+    if (rehashing() || capacityFor(count) <= tables_[0].capacity()) {
+      return;
+    }
+    startRehash(capacityFor(count));
+    while (rehashing()) {
+      rehashSteps(tables_[0].groups());
+    }
+  }
+
+  /**
+   * @brief Migrate up to `groups` groups of the old table while rehashing.
+   *
+   * @return bool True if there's still work left.
+   */
+  bool rehashSteps(std::size_t groups) {
+    if (!rehashing() || pauseRehash_ > 0) {
+      return rehashing();
+    }
+    Table &from = tables_[0];
+    Table &to = tables_[1];
+    while (groups-- > 0 &&
+           static_cast<std::size_t>(rehashIdx_) < from.groups()) {
+      std::size_t base = rehashIdx_ * detail::GroupSize;
+      std::uint32_t full = detail::Group(from.ctrl + base).maskFull();
+      for (; full != 0; full &= full - 1) {
+        std::size_t index = base + std::countr_zero(full);
+        value_type &entry = from.slots[index];
+        std::size_t slot = insertSlot(to, hashOf(entry.first));
+        std::construct_at(&to.slots[slot], std::move(entry));
+        std::destroy_at(&entry);
+        // Keep probe chains of the old table intact for the lookups.
+        from.ctrl[index] = detail::CtrlDeleted;
+        --from.size;
+        ++from.deleted;
+      }
+      ++rehashIdx_;
+    }
+    if (static_cast<std::size_t>(rehashIdx_) >= from.groups()) {
+      release(from);
+      from = to;
+      to = Table{};
+      rehashIdx_ = -1;
+    }
+    return rehashing();
+  }
+
+  /**
+   * @brief Call `fn(entry)` for every entry. The callback may erase the entry
+   * it's given (or any other), rehashing is paused meanwhile so no entry is
+   * skipped or visited twice.
+   */
+  template <typename F> void forEach(F &&fn) {
+    ++pauseRehash_;
+    for (int t = 0; t < 2; ++t) {
+      Table &table = tables_[t];
+      for (std::size_t i = 0; i < table.capacity(); ++i) {
+        if (table.full(i)) {
+          fn(table.slots[i]);
+        }
+      }
+    }
+    --pauseRehash_;
+  }
+
+  template <typename F> void forEach(F &&fn) const {
+    for (const auto &entry : *this) {
+      fn(entry);
+    }
+  }
+
+  /**
+   * @brief Visit the entries of one cursor position and return the next
+   * cursor, 0 once the whole table was visited.
+   *
+   * The cursor enumerates home groups with their bits reversed (like redis'
+   * dictScan), so an entry present for the whole walk is returned at least
+   * once even if the table grows or shrinks between calls. Entries may be
+   * returned more than once.
+   *
+   * @param cursor 0 to start a new walk.
+   * @param fn Called with every visited entry, must not modify the table.
+   * @return std::size_t The cursor of the next call.
+   */
+  template <typename F> std::size_t scan(std::size_t cursor, F &&fn) {
+    if (empty()) {
+      return 0;
+    }
+    ++pauseRehash_;
+    if (!rehashing()) {
+      const Table &table = tables_[0];
+      scanHome(table, cursor & table.groupMask, fn);
+      cursor = nextCursor(cursor, table.groupMask);
+    } else {
+      const Table *small = &tables_[0];
+      const Table *large = &tables_[1];
+      if (small->groups() > large->groups()) {
+        std::swap(small, large);
+      }
+      std::size_t m0 = small->groupMask;
+      std::size_t m1 = large->groupMask;
+      scanHome(*small, cursor & m0, fn);
+      // Visit the groups of the larger table expanding the small one's group.
+      do {
+        scanHome(*large, cursor & m1, fn);
+        cursor = nextCursor(cursor, m1);
+      } while (cursor & (m0 ^ m1));
+    }
+    --pauseRehash_;
+    return cursor;
+  }
+
+private:
+  static constexpr std::size_t npos = static_cast<std::size_t>(-1);
+  static constexpr std::size_t MinGroups = 1;
+
+  static std::int8_t h2(std::size_t hash) { return hash & 0x7F; }
+  static std::size_t h1(std::size_t hash) { return hash >> 7; }
+
+  static std::size_t nextCursor(std::size_t cursor, std::size_t mask) {
+    cursor |= ~mask;
+    cursor = detail::reverseBits(cursor);
+    ++cursor;
+    return detail::reverseBits(cursor);
+  }
+
+  /**
+   * @brief Smallest capacity keeping `count` entries under the max load.
+   */
+  static std::size_t capacityFor(std::size_t count) {
+    std::size_t groups = MinGroups;
+    while (groups * detail::GroupSize * MaxLoadNum / MaxLoadDen <= count) {
+      groups <<= 1;
+    }
+    return groups * detail::GroupSize;
+  }
+
+  static void allocate(Table &table, std::size_t capacity) {
+    table.ctrl = static_cast<std::int8_t *>(
+        ::operator new(capacity, std::align_val_t(detail::GroupSize)));
+    std::memset(table.ctrl, detail::CtrlEmpty, capacity);
+    table.slots = static_cast<value_type *>(::operator new(
+        capacity * sizeof(value_type), std::align_val_t(alignof(value_type))));
+    table.groupMask = capacity / detail::GroupSize - 1;
+    table.size = 0;
+    table.deleted = 0;
+  }
+
+  static void release(Table &table) {
+    if (!table.ctrl) {
+      return;
+    }
+    for (std::size_t i = 0; table.size > 0 && i < table.capacity(); ++i) {
+      if (table.full(i)) {
+        std::destroy_at(&table.slots[i]);
+        --table.size;
+      }
+    }
+    ::operator delete(table.ctrl, std::align_val_t(detail::GroupSize));
+    ::operator delete(table.slots, std::align_val_t(alignof(value_type)));
+    table = Table{};
+  }
+
+  /**
+   * @brief Find the slot of a key by probing its groups, stops at the first
+   * group with an empty slot.
+   */
+  static std::size_t findIn(const Table &table, std::string_view key,
+                            std::size_t hash) {
+    return findIn(table, hash, [key](const value_type &entry) {
+      return entry.first == key;
+    });
+  }
+
+  /**
+   * @brief Find the slot of the first entry of a hash's probe sequence
+   * matching a predicate.
+   */
+  template <typename Pred>
+  static std::size_t findIn(const Table &table, std::size_t hash, Pred &&pred) {
+    if (table.size == 0) {
+      return npos;
+    }
+    std::size_t group = h1(hash) & table.groupMask;
+    for (std::size_t probe = 0; probe <= table.groupMask;) {
+      std::size_t base = group * detail::GroupSize;
+      detail::Group g(table.ctrl + base);
+      for (std::uint32_t match = g.match(h2(hash)); match != 0;
+           match &= match - 1) {
+        std::size_t index = base + std::countr_zero(match);
+        if (pred(table.slots[index])) {
+          return index;
+        }
+      }
+      if (g.maskEmpty() != 0) {
+        return npos;
+      }
+      ++probe;
+      group = (group + probe) & table.groupMask;
+    }
+    return npos;
+  }
+
+  /**
+   * @brief Claim the first free slot of the probe sequence for a key known not
+   * to be in the table. The slot storage is left for the caller to construct.
+   */
+  static std::size_t insertSlot(Table &table, std::size_t hash) {
+    std::size_t group = h1(hash) & table.groupMask;
+    for (std::size_t probe = 0; probe <= table.groupMask;) {
+      std::size_t base = group * detail::GroupSize;
+      std::uint32_t free = detail::Group(table.ctrl + base).maskFree();
+      if (free != 0) {
+        std::size_t index = base + std::countr_zero(free);
+        if (table.ctrl[index] == detail::CtrlDeleted) {
+          --table.deleted;
+        }
+        table.ctrl[index] = h2(hash);
+        ++table.size;
+        return index;
+      }
+      ++probe;
+      group = (group + probe) & table.groupMask;
+    }
+    throw std::length_error("HashTable has no free slot");
+  }
+
+  void eraseAt(Table &table, std::size_t index) {
+    std::destroy_at(&table.slots[index]);
+    std::size_t base = index & ~(detail::GroupSize - 1);
+    // A group with an empty slot was never full, so no probe chain crosses it
+    // and the slot can become empty again instead of a tombstone.
+    if (detail::Group(table.ctrl + base).maskEmpty() != 0) {
+      table.ctrl[index] = detail::CtrlEmpty;
+    } else {
+      table.ctrl[index] = detail::CtrlDeleted;
+      ++table.deleted;
+    }
+    --table.size;
+    if (pauseRehash_ == 0) {
+      rehashSteps(RehashGroupsPerOp);
+      shrinkIfNeeded();
+    }
+  }
+
+  void startRehash(std::size_t capacity) {
+    if (!tables_[0].ctrl) {
+      allocate(tables_[0], capacity);
+      return;
+    }
+    allocate(tables_[1], capacity);
+    rehashIdx_ = 0;
+  }
+
+  /**
+   * @brief Return the table new keys go to, starting a rehash when the main
+   * table is too full.
+   */
+  Table &growIfNeeded() {
+    if (rehashing()) {
+      Table &to = tables_[1];
+      if ((to.size + to.deleted + 1) * MaxLoadDen <=
+              to.capacity() * MaxLoadNum ||
+          pauseRehash_ > 0) {
+        return to;
+      }
+      // The new table filled up before the migration ended, finish it now.
+      while (rehashSteps(tables_[0].groups())) {
+      }
+    }
+    Table &table = tables_[0];
+    if (table.ctrl &&
+        (table.size + table.deleted + 1) * MaxLoadDen <=
+            table.capacity() * MaxLoadNum) {
+      return table;
+    }
+    // Double the size, unless the table is mostly tombstones which are cleaned
+    // by a rehash at the same size.
+    std::size_t capacity = table.capacity();
+    if (table.size * 2 * MaxLoadDen >= capacity * MaxLoadNum) {
+      capacity *= 2;
+    }
+    startRehash(std::max(capacity, capacityFor(table.size + 1)));
+    return rehashing() ? tables_[1] : tables_[0];
+  }
+
+  void shrinkIfNeeded() {
+    const Table &table = tables_[0];
+    if (rehashing() || table.groups() <= MinGroups ||
+        table.size * 8 >= table.capacity()) {
+      return;
+    }
+    std::size_t capacity = capacityFor(table.size * 2);
+    if (capacity < table.capacity()) {
+      startRehash(capacity);
+    }
+  }
+
+  /**
+   * @brief Visit the entries of a table whose home group is `home`, they are
+   * all on its probe sequence before the first group with an empty slot.
+   */
+  template <typename F>
+  void scanHome(const Table &table, std::size_t home, F &fn) {
+    if (table.size == 0) {
+      return;
+    }
+    std::size_t group = home;
+    for (std::size_t probe = 0; probe <= table.groupMask;) {
+      std::size_t base = group * detail::GroupSize;
+      detail::Group g(table.ctrl + base);
+      for (std::uint32_t full = g.maskFull(); full != 0; full &= full - 1) {
+        std::size_t index = base + std::countr_zero(full);
+        value_type &entry = table.slots[index];
+        if ((h1(hashOf(entry.first)) & table.groupMask) == home) {
+          fn(entry);
+        }
+      }
+      if (g.maskEmpty() != 0) {
+        return;
+      }
+      ++probe;
+      group = (group + probe) & table.groupMask;
+    }
+  }
+
+  Table tables_[2];
+  /**
+   * @brief Next group of tables_[0] to migrate, -1 when not rehashing.
+   */
+  std::ptrdiff_t rehashIdx_ = -1;
+  int pauseRehash_ = 0;
+};
+
+} // namespace Redis
+
+#endif
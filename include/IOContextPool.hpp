@@ -0,0 +1,75 @@
+#ifndef __REDIS_SERVER_IO_CONTEXT_POOL_HPP__
+#define __REDIS_SERVER_IO_CONTEXT_POOL_HPP__
+#include "Logging.hpp"
+#include <asio.hpp>
+#include <memory>
+#include <stdexcept>
+#include <thread>
+#include <vector>
+
+/**
+ * @brief A pool of event loops, each one is run by its own thread.
+ *
+ * Every connection is bound to the io_context that accepted it, so all the
+ * handlers of a connection run on the same thread and its state needs no
+ * locking.
+ */
+class IOContextPool {
+public:
+  /**
+   * @brief Construct a pool of `size` event loops.
+   *
+   * @param size Number of io_contexts (and threads), at least one.
+   */
+  explicit IOContextPool(std::size_t size) {
+    if (size == 0) {
+      throw std::invalid_argument("IOContextPool size must be positive");
+    }
+    for (std::size_t i = 0; i < size; ++i) {
+      auto context = std::make_unique<asio::io_context>(1);
+      workGuards_.push_back(asio::make_work_guard(*context));
+      contexts_.push_back(std::move(context));
+    }
+  }
+
+  /**
+   * @brief Number of event loops in the pool.
+   */
+  std::size_t size() const { return contexts_.size(); }
+
+  /**
+   * @brief Get the event loop at the given index.
+   */
+  asio::io_context &get(std::size_t index) { return *contexts_.at(index); }
+
+  /**
+   * @brief Run every event loop on its own thread and block until all of them
+   * return. The first loop runs on the calling thread.
+   */
+  void run() {
+    std::vector<std::thread> threads;
+    for (std::size_t i = 1; i < contexts_.size(); ++i) {
+      threads.emplace_back([this, i] { contexts_[i]->run(); });
+    }
+    contexts_[0]->run();
+    for (auto &thread : threads) {
+      thread.join();
+    }
+  }
+
+  /**
+   * @brief Stop all the event loops.
+   */
+  void stop() {
+    workGuards_.clear();
+    for (auto &context : contexts_) {
+      context->stop();
+    }
+  }
+
+private:
+  std::vector<std::unique_ptr<asio::io_context>> contexts_;
+  std::vector<asio::executor_work_guard<asio::io_context::executor_type>>
+      workGuards_;
+};
+#endif
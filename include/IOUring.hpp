@@ -0,0 +1,282 @@
+#ifndef __REDIS_SERVER_IO_URING_HPP__
+#define __REDIS_SERVER_IO_URING_HPP__
+#if defined(__linux__) && __has_include(<linux/io_uring.h>)
+#define REDIS_SERVER_IO_URING 1
+#include <algorithm>
+#include <atomic>
+#include <cerrno>
+#include <cstdint>
+#include <cstring>
+#include <linux/io_uring.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <system_error>
+#include <unistd.h>
+
+/**
+ * @brief A minimal io_uring instance driven through the raw system calls.
+ *
+ * Submission entries are queued with @sa getSqe and only handed to the kernel
+ * by @sa submitAndWait, so a whole event loop iteration costs a single system
+ * call. Not thread safe, owned by one event loop.
+ */
+class IOUring {
+public:
+  /**
+   * @brief Set up a ring.
+   *
+   * @param entries Size of the submission queue, the completion queue is
+   * twice as big.
+   * @throw std::system_error When the kernel doesn't support io_uring or
+   * forbids it.
+   */
+  explicit IOUring(unsigned entries) {
+    io_uring_params params{};
+    fd_ = static_cast<int>(syscall(__NR_io_uring_setup, entries, &params));
+    if (fd_ < 0) {
+      throw std::system_error(errno, std::system_category(), "io_uring_setup");
+    }
+    sqEntries_ = params.sq_entries;
+    sqRingSize_ = params.sq_off.array + params.sq_entries * sizeof(unsigned);
+    cqRingSize_ =
+        params.cq_off.cqes + params.cq_entries * sizeof(io_uring_cqe);
+    singleMmap_ = params.features & IORING_FEAT_SINGLE_MMAP;
+    if (singleMmap_) {
+      sqRingSize_ = cqRingSize_ = std::max(sqRingSize_, cqRingSize_);
+    }
+    sqRing_ = map(sqRingSize_, IORING_OFF_SQ_RING);
+    cqRing_ = singleMmap_ ? sqRing_ : map(cqRingSize_, IORING_OFF_CQ_RING);
+    sqes_ = static_cast<io_uring_sqe *>(
+        map(params.sq_entries * sizeof(io_uring_sqe), IORING_OFF_SQES));
+
+    char *sq = static_cast<char *>(sqRing_);
+    sqHead_ = reinterpret_cast<unsigned *>(sq + params.sq_off.head);
+    sqTail_ = reinterpret_cast<unsigned *>(sq + params.sq_off.tail);
+    sqMask_ = *reinterpret_cast<unsigned *>(sq + params.sq_off.ring_mask);
+    sqArray_ = reinterpret_cast<unsigned *>(sq + params.sq_off.array);
+    char *cq = static_cast<char *>(cqRing_);
+    cqHead_ = reinterpret_cast<unsigned *>(cq + params.cq_off.head);
+    cqTail_ = reinterpret_cast<unsigned *>(cq + params.cq_off.tail);
+    cqMask_ = *reinterpret_cast<unsigned *>(cq + params.cq_off.ring_mask);
+    cqes_ = reinterpret_cast<io_uring_cqe *>(cq + params.cq_off.cqes);
+    localTail_ = *sqTail_;
+  }
+
+  IOUring(const IOUring &) = delete;
+  IOUring &operator=(const IOUring &) = delete;
+
+  ~IOUring() {
+    if (sqes_) {
+      munmap(sqes_, sqEntries_ * sizeof(io_uring_sqe));
+    }
+    if (cqRing_ && !singleMmap_) {
+      munmap(cqRing_, cqRingSize_);
+    }
+    if (sqRing_) {
+      munmap(sqRing_, sqRingSize_);
+    }
+    if (fd_ >= 0) {
+      ::close(fd_);
+    }
+  }
+
+  int fd() const { return fd_; }
+
+  /**
+   * @brief A zeroed submission entry, queued until the next
+   * @sa submitAndWait. The queued entries are submitted first when the
+   * submission queue is full.
+   */
+  io_uring_sqe *getSqe() {
+    if (localTail_ - load(sqHead_) >= sqEntries_) {
+      submitAndWait(0);
+    }
+    unsigned index = localTail_ & sqMask_;
+    io_uring_sqe *sqe = &sqes_[index];
+    std::memset(sqe, 0, sizeof(*sqe));
+    sqArray_[index] = index;
+    ++localTail_;
+    return sqe;
+  }
+
+  /**
+   * @brief Submit the queued entries and wait for completions, with a single
+   * io_uring_enter.
+   *
+   * @param waitFor Completions to wait for, 0 to only submit.
+   * @return int Number of submitted entries, or -errno.
+   */
+  int submitAndWait(unsigned waitFor) {
+    std::atomic_ref<unsigned>(*sqTail_).store(localTail_,
+                                              std::memory_order_release);
+    unsigned toSubmit = localTail_ - load(sqHead_);
+    int result;
+    do {
+      result = static_cast<int>(
+          syscall(__NR_io_uring_enter, fd_, toSubmit, waitFor,
+                  waitFor > 0 ? IORING_ENTER_GETEVENTS : 0, nullptr, 0));
+    } while (result < 0 && errno == EINTR);
+    return result < 0 ? -errno : result;
+  }
+
+  /**
+   * @brief Call fn(cqe) for every available completion and mark them seen.
+   *
+   * @return unsigned Number of completions.
+   */
+  template <typename Fn> unsigned forEachCompletion(Fn &&fn) {
+    unsigned head = *cqHead_;
+    unsigned tail = load(cqTail_);
+    unsigned count = tail - head;
+    for (; head != tail; ++head) {
+      // Copied so fn may queue entries or recurse into the ring
+      io_uring_cqe cqe = cqes_[head & cqMask_];
+      std::atomic_ref<unsigned>(*cqHead_).store(head + 1,
+                                                std::memory_order_release);
+      fn(cqe);
+    }
+    return count;
+  }
+
+  /**
+   * @brief Register resources with the ring, see io_uring_register(2).
+   *
+   * @return int The result of the call, or -errno.
+   */
+  int registerOp(unsigned opcode, void *arg, unsigned args) {
+    int result =
+        static_cast<int>(syscall(__NR_io_uring_register, fd_, opcode, arg,
+                                 args));
+    return result < 0 ? -errno : result;
+  }
+
+private:
+  static unsigned load(unsigned *value) {
+    return std::atomic_ref<unsigned>(*value).load(std::memory_order_acquire);
+  }
+
+  void *map(std::size_t size, std::uint64_t offset) {
+    void *pointer = mmap(nullptr, size, PROT_READ | PROT_WRITE,
+                         MAP_SHARED | MAP_POPULATE, fd_, offset);
+    if (pointer == MAP_FAILED) {
+      throw std::system_error(errno, std::system_category(), "io_uring mmap");
+    }
+    return pointer;
+  }
+
+  int fd_ = -1;
+  unsigned sqEntries_ = 0;
+  std::size_t sqRingSize_ = 0;
+  std::size_t cqRingSize_ = 0;
+  bool singleMmap_ = false;
+  void *sqRing_ = nullptr;
+  void *cqRing_ = nullptr;
+  io_uring_sqe *sqes_ = nullptr;
+  unsigned *sqHead_ = nullptr;
+  unsigned *sqTail_ = nullptr;
+  unsigned sqMask_ = 0;
+  unsigned *sqArray_ = nullptr;
+  unsigned *cqHead_ = nullptr;
+  unsigned *cqTail_ = nullptr;
+  unsigned cqMask_ = 0;
+  io_uring_cqe *cqes_ = nullptr;
+  /**
+   * @brief Tail of the queued entries, published to the kernel on submit.
+   */
+  unsigned localTail_ = 0;
+};
+
+/**
+ * @brief A ring of provided buffers (Linux 5.19+): receives pick a free
+ * buffer when data arrives instead of pinning one per idle connection.
+ *
+ * Buffers given back with @sa recycle become visible to the kernel on
+ * @sa publish, once per event loop iteration.
+ */
+class BufferRing {
+public:
+  /**
+   * @brief Register a ring of `count` buffers of `size` bytes.
+   *
+   * @param count A power of 2, at most 32768.
+   * @throw std::system_error When the kernel doesn't support provided buffer
+   * rings.
+   */
+  BufferRing(IOUring &ring, std::uint16_t group, std::uint16_t count,
+             std::uint32_t size)
+      : group_(group), count_(count), size_(size) {
+    ringBytes_ = count * sizeof(io_uring_buf);
+    void *entries = mmap(nullptr, ringBytes_, PROT_READ | PROT_WRITE,
+                         MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (entries == MAP_FAILED) {
+      throw std::system_error(errno, std::system_category(), "mmap");
+    }
+    entries_ = static_cast<io_uring_buf *>(entries);
+    buffers_ = new char[std::size_t(count) * size];
+    io_uring_buf_reg reg{};
+    reg.ring_addr = reinterpret_cast<std::uint64_t>(entries_);
+    reg.ring_entries = count;
+    reg.bgid = group;
+    if (int error = ring.registerOp(IORING_REGISTER_PBUF_RING, &reg, 1);
+        error < 0) {
+      munmap(entries_, ringBytes_);
+      delete[] buffers_;
+      throw std::system_error(-error, std::system_category(),
+                              "IORING_REGISTER_PBUF_RING");
+    }
+    for (std::uint16_t bid = 0; bid < count; ++bid) {
+      recycle(bid);
+    }
+    publish();
+  }
+
+  BufferRing(const BufferRing &) = delete;
+  BufferRing &operator=(const BufferRing &) = delete;
+
+  ~BufferRing() {
+    munmap(entries_, ringBytes_);
+    delete[] buffers_;
+  }
+
+  std::uint16_t group() const { return group_; }
+
+  std::uint32_t bufferSize() const { return size_; }
+
+  const char *buffer(std::uint16_t bid) const {
+    return buffers_ + std::size_t(bid) * size_;
+  }
+
+  /**
+   * @brief Give a buffer back to the kernel, at the next @sa publish.
+   */
+  void recycle(std::uint16_t bid) {
+    io_uring_buf &entry = entries_[(tail_ + added_++) & (count_ - 1)];
+    entry.addr = reinterpret_cast<std::uint64_t>(buffer(bid));
+    entry.len = size_;
+    entry.bid = bid;
+  }
+
+  void publish() {
+    if (added_ == 0) {
+      return;
+    }
+    tail_ += added_;
+    added_ = 0;
+    // The ring's tail overlays the reserved field of its first entry
+    std::atomic_ref<std::uint16_t>(entries_[0].resv)
+        .store(tail_, std::memory_order_release);
+  }
+
+private:
+  std::uint16_t group_;
+  std::uint16_t count_;
+  std::uint32_t size_;
+  std::size_t ringBytes_;
+  io_uring_buf *entries_;
+  char *buffers_;
+  std::uint16_t tail_ = 0;
+  std::uint16_t added_ = 0;
+};
+
+#endif
+#endif
@@ -0,0 +1,166 @@
+#ifndef __REDIS_SERVER_OUTPUT_BUFFER_LIMIT_HPP__
+#define __REDIS_SERVER_OUTPUT_BUFFER_LIMIT_HPP__
+#include <algorithm>
+#include <array>
+#include <charconv>
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <optional>
+#include <string>
+#include <string_view>
+#include <utility>
+
+namespace Redis {
+
+/**
+ * @brief Classes of clients having their own output buffer limit.
+ */
+enum class ClientClass : std::uint8_t { NORMAL, REPLICA, PUBSUB };
+
+constexpr std::size_t ClientClasses = 3;
+
+inline std::string_view clientClassName(ClientClass clientClass) {
+  switch (clientClass) {
+  case ClientClass::REPLICA:
+    return "replica";
+  case ClientClass::PUBSUB:
+    return "pubsub";
+  default:
+    return "normal";
+  }
+}
+
+/**
+ * @brief Output buffer limit of a client class, like redis'
+ * client-output-buffer-limit: a client is disconnected as soon as its
+ * pending output reaches the hard limit, or once it stayed above the soft
+ * limit for softSeconds. A limit of 0 is disabled.
+ */
+struct OutputBufferLimit {
+  std::uint64_t hard = 0;
+  std::uint64_t soft = 0;
+  std::uint64_t softSeconds = 0;
+
+  /**
+   * @brief Is a client over the limit.
+   *
+   * @param bytes Pending output bytes of the client.
+   * @param softSince When the client went above the soft limit, set and reset
+   * by the call.
+   * @param now Current time.
+   */
+  bool exceeded(
+      std::uint64_t bytes,
+      std::optional<std::chrono::steady_clock::time_point> &softSince,
+      std::chrono::steady_clock::time_point now) const {
+    if (hard != 0 && bytes >= hard) {
+      return true;
+    }
+    if (soft == 0 || bytes < soft) {
+      softSince.reset();
+      return false;
+    }
+    if (!softSince) {
+      softSince = now;
+    }
+    return now - *softSince >= std::chrono::seconds(softSeconds);
+  }
+};
+
+using OutputBufferLimits = std::array<OutputBufferLimit, ClientClasses>;
+
+/**
+ * @brief Redis' default limits: none for normal clients, 256mb/64mb/60s for
+ * replicas and 32mb/8mb/60s for pubsub clients.
+ */
+inline OutputBufferLimits defaultOutputBufferLimits() {
+  constexpr std::uint64_t MB = 1024 * 1024;
+  return {OutputBufferLimit{0, 0, 0}, OutputBufferLimit{256 * MB, 64 * MB, 60},
+          OutputBufferLimit{32 * MB, 8 * MB, 60}};
+}
+
+/**
+ * @brief Parse a memory size with an optional k, kb, m, mb, g or gb unit
+ * (k = 1000, kb = 1024), like redis' config sizes.
+ */
+inline std::optional<std::uint64_t> parseMemorySize(std::string_view str) {
+  std::uint64_t value = 0;
+  auto [end, error] = std::from_chars(str.data(), str.data() + str.size(),
+                                      value);
+  if (error != std::errc() || end == str.data()) {
+    return std::nullopt;
+  }
+  std::string unit;
+  for (const char *c = end; c != str.data() + str.size(); ++c) {
+    unit += static_cast<char>(*c >= 'A' && *c <= 'Z' ? *c + 32 : *c);
+  }
+  constexpr std::pair<std::string_view, std::uint64_t> Units[] = {
+      {"", 1},         {"k", 1000},       {"kb", 1024},   {"m", 1000000},
+      {"mb", 1 << 20}, {"g", 1000000000}, {"gb", 1 << 30}};
+  for (const auto &[name, multiplier] : Units) {
+    if (unit == name) {
+      return value * multiplier;
+    }
+  }
+  return std::nullopt;
+}
+
+/**
+ * @brief Parse a client-output-buffer-limit config: groups of
+ * "<class> <hard> <soft> <soft seconds>" where the class is normal, replica
+ * (or slave) or pubsub. Classes missing from the config keep their limits.
+ *
+ * @param config E.g. "normal 0 0 0 replica 256mb 64mb 60".
+ * @param limits The limits the config updates.
+ * @return std::optional<OutputBufferLimits> std::nullopt for an invalid
+ * config.
+ */
+inline std::optional<OutputBufferLimits> parseOutputBufferLimits(
+    std::string_view config,
+    OutputBufferLimits limits = defaultOutputBufferLimits()) {
+  std::array<std::string_view, 4> group;
+  std::size_t fields = 0;
+  while (!config.empty()) {
+    std::size_t start = config.find_first_not_of(' ');
+    if (start == std::string_view::npos) {
+      break;
+    }
+    config.remove_prefix(start);
+    std::size_t end = std::min(config.find(' '), config.size());
+    group[fields++] = config.substr(0, end);
+    config.remove_prefix(end);
+    if (fields < group.size()) {
+      continue;
+    }
+    fields = 0;
+    std::size_t index;
+    if (group[0] == "normal") {
+      index = static_cast<std::size_t>(ClientClass::NORMAL);
+    } else if (group[0] == "replica" || group[0] == "slave") {
+      index = static_cast<std::size_t>(ClientClass::REPLICA);
+    } else if (group[0] == "pubsub") {
+      index = static_cast<std::size_t>(ClientClass::PUBSUB);
+    } else {
+      return std::nullopt;
+    }
+    auto hard = parseMemorySize(group[1]);
+    auto soft = parseMemorySize(group[2]);
+    std::uint64_t seconds = 0;
+    auto [ptr, error] = std::from_chars(
+        group[3].data(), group[3].data() + group[3].size(), seconds);
+    if (!hard || !soft || error != std::errc() ||
+        ptr != group[3].data() + group[3].size()) {
+      return std::nullopt;
+    }
+    limits[index] = {*hard, *soft, seconds};
+  }
+  if (fields != 0) {
+    return std::nullopt;
+  }
+  return limits;
+}
+
+} // namespace Redis
+
+#endif
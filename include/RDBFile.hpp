@@ -1,9 +1,13 @@
 #ifndef __REDIS_RDB_FILE_HPP__
 #define __REDIS_RDB_FILE_HPP__
 #include "Types.hpp"
+#include <cstdint>
 #include <fstream>
+#include <functional>
 #include <iostream>
+#include <optional>
 #include <string>
+#include <string_view>
 namespace Redis {
 
 /**
@@ -12,6 +16,12 @@ namespace Redis {
  *
  */
 enum OpCodes {
+  SLOTINFO = 0xF4,
+  FUNCTION2 = 0xF5,
+  FUNCTIONPREGA = 0xF6,
+  MODULEAUX = 0xF7,
+  IDLE = 0xF8,
+  FREQ = 0xF9,
   METADATA = 0xFA,
   EORDBF = 0xFF,
   SELECTDB = 0xFE,
@@ -21,6 +31,96 @@ enum OpCodes {
   AUX = 0xFA,
 };
 
+/**
+ * @brief Types of the values of the RDB files, the byte preceding a key.
+ * Only strings are loaded, the keys of the other types are skipped.
+ */
+enum class RDBType : std::uint8_t {
+  STRING = 0,
+  LIST = 1,
+  SET = 2,
+  ZSET = 3,
+  HASH = 4,
+  ZSET2 = 5,
+  MODULE = 6,
+  MODULE2 = 7,
+  HASHZIPMAP = 9,
+  LISTZIPLIST = 10,
+  SETINTSET = 11,
+  ZSETZIPLIST = 12,
+  HASHZIPLIST = 13,
+  LISTQUICKLIST = 14,
+  STREAMLISTPACKS = 15,
+  HASHLISTPACK = 16,
+  ZSETLISTPACK = 17,
+  LISTQUICKLIST2 = 18,
+  STREAMLISTPACKS2 = 19,
+  SETLISTPACK = 20,
+  STREAMLISTPACKS3 = 21,
+};
+
+/**
+ * @brief Newest RDB version the loader understands, redis 7.2's.
+ */
+constexpr int RDBVersion = 12;
+
+/**
+ * @brief Version of the files @sa RDBWriter writes. String keys, their
+ * expiry in milliseconds and the AUX fields need nothing newer, so any redis
+ * since 5.0 loads them.
+ */
+constexpr int RDBSaveVersion = 9;
+
+/**
+ * @brief Where @sa loadRDBFile puts the loaded records, split in partitions
+ * filled concurrently. The functions of a partition are never called
+ * concurrently.
+ */
+struct RDBTarget {
+  std::size_t partitions = 1;
+  /**
+   * @brief Partition of a key, below @sa partitions.
+   */
+  std::function<std::size_t(std::string_view key)> partitionOf;
+  /**
+   * @brief Make room for `count` records, from the RESIZEDB hint.
+   */
+  std::function<void(std::size_t partition, std::size_t count)> reserve;
+  std::function<void(std::size_t partition, std::string_view key,
+                     Record record)>
+      insert;
+};
+
+struct RDBLoadStats {
+  int version = 0;
+  std::size_t keys = 0;
+  /**
+   * @brief Keys of the other databases than 0 or of other types than
+   * strings.
+   */
+  std::size_t skipped = 0;
+};
+
+/**
+ * @brief Load the string keys of database 0 of a RDB file, of any version up
+ * to @sa RDBVersion.
+ *
+ * The file is mapped in memory and walked once to split it in chunks of
+ * records, which are decoded and inserted by `threads` threads while the walk
+ * goes on. The checksum of the file is verified in parallel too, unless it
+ * was saved without one.
+ *
+ * @param filePath Path to the rdb file.
+ * @param target The partitions receiving the records.
+ * @param threads Decoding threads, 0 for one per core.
+ * @return std::optional<RDBLoadStats> None if the file can't be opened, is
+ * corrupt or its checksum doesn't match, the partitions may hold part of the
+ * records then.
+ */
+std::optional<RDBLoadStats> loadRDBFile(const std::string &filePath,
+                                        const RDBTarget &target,
+                                        std::size_t threads = 0);
+
 /**
  * @brief Parse a RDB file and return the stored database.
  *
@@ -28,5 +128,157 @@ enum OpCodes {
  * @return std::optional<Database> None if error opening or parsing the file.
  */
 std::optional<Database> parseRDBFile(const std::string &filePath);
+
+/**
+ * @brief Loads a RDB stream as its bytes arrive, e.g. the snapshot a master
+ * sends to its replica: @sa feed inserts the complete records it's given and
+ * leaves a partial one for the next call. The records go to the target in
+ * the calling thread, one at a time.
+ */
+class RDBStreamLoader {
+public:
+  explicit RDBStreamLoader(RDBTarget target) : target_(std::move(target)) {}
+
+  /**
+   * @brief Load the next bytes of the stream.
+   *
+   * @return std::optional<std::size_t> The bytes consumed, the rest is the
+   * start of a partial record or follows the end of the stream. std::nullopt
+   * if the stream is corrupt or its checksum doesn't match.
+   */
+  std::optional<std::size_t> feed(std::string_view bytes);
+
+  /**
+   * @brief Was the whole stream loaded, up to its checksum.
+   */
+  bool finished() const { return stage_ == Stage::FINISHED; }
+
+  const RDBLoadStats &stats() const { return stats_; }
+
+private:
+  enum class Stage { HEADER, RECORDS, CHECKSUM, FINISHED };
+
+  RDBTarget target_;
+  Stage stage_ = Stage::HEADER;
+  std::uint64_t db_ = 0;
+  /**
+   * @brief The record whose expiry was read, waiting for its key.
+   */
+  Record record_;
+  std::string scratch_;
+  std::uint64_t crc_ = 0;
+  RDBLoadStats stats_;
+};
+
+/**
+ * @brief Serializes records in the RDB format, like redis' rdbSave: strings
+ * holding a 32 bits integer are stored as one, longer than 20 bytes they are
+ * LZF compressed when it saves space. The bytes go through a buffer to a
+ * sink and the CRC-64 is computed as they go.
+ */
+class RDBWriter {
+public:
+  /**
+   * @brief Receives the serialized bytes, returns false on a write error.
+   */
+  using Sink = std::function<bool(std::string_view bytes)>;
+
+  /**
+   * @param sink Where the bytes go.
+   * @param compress LZF compress the long strings.
+   */
+  explicit RDBWriter(Sink sink, bool compress = true);
+
+  /**
+   * @brief A sink writing to a file descriptor, retried when interrupted.
+   */
+  static Sink fileSink(int fd);
+
+  /**
+   * @brief Write the magic string and the AUX fields, first thing.
+   */
+  void header();
+
+  /**
+   * @brief Start a database, the sizes are hints for the loader.
+   */
+  void selectDb(std::uint64_t db, std::size_t keys, std::size_t expires);
+
+  /**
+   * @brief Write a string key, with its expiry if it has one.
+   */
+  void write(std::string_view key, const Record &record);
+
+  /**
+   * @brief Write the EOF opcode and the checksum and flush the buffer.
+   *
+   * @return bool False if the sink failed at any point.
+   */
+  bool finish();
+
+private:
+  void byte(std::uint8_t value);
+  void raw(std::string_view bytes);
+  void littleEndian(std::uint64_t value, std::size_t size);
+  void length(std::uint64_t value);
+  void string(std::string_view value);
+  /**
+   * @brief Write an integer in its 8, 16 or 32 bits encoding, false if it
+   * doesn't fit 32 bits.
+   */
+  bool integer(std::int64_t value);
+  void flush();
+
+  Sink sink_;
+  bool compress_;
+  std::string buffer_;
+  /**
+   * @brief Output of the LZF compression, reused between strings.
+   */
+  std::string compressed_;
+  std::uint64_t crc_ = 0;
+  bool failed_ = false;
+};
+
+/**
+ * @brief The temporary file @sa saveRDBFile writes from the process `pid`.
+ */
+std::string rdbTempFilePath(const std::string &filePath, long pid);
+
+/**
+ * @brief Save a RDB file atomically: the writer fills a temporary file of
+ * the same directory, which is synced then renamed over `filePath`, so the
+ * file is always either the previous snapshot or the complete new one.
+ *
+ * Nothing is logged, a forked child can call it.
+ *
+ * @param filePath Path of the rdb file.
+ * @param fill Writes the databases, between the header and the checksum.
+ * @param compress LZF compress the long strings.
+ * @return bool False if the file couldn't be written, it's left untouched
+ * then.
+ */
+bool saveRDBFile(const std::string &filePath,
+                 const std::function<void(RDBWriter &)> &fill,
+                 bool compress = true);
+/**
+ * @brief Length of the mark delimiting a snapshot streamed to the replicas.
+ */
+constexpr std::size_t RDBEofMarkSize = 40;
+
+/**
+ * @brief Stream a snapshot to a file descriptor the way a diskless master
+ * sends it to its replicas: its size isn't known beforehand, so it's framed
+ * as `$EOF:<mark>\r\n`, the RDB bytes, then the mark again.
+ *
+ * Nothing is logged, a forked child can call it.
+ *
+ * @param mark @sa RDBEofMarkSize random bytes.
+ * @param fill Writes the databases, between the header and the checksum.
+ * @return bool False if a write failed.
+ */
+bool writeRDBStream(int fd, std::string_view mark,
+                    const std::function<void(RDBWriter &)> &fill,
+                    bool compress = true);
 } // namespace Redis
-#endif
\ No newline at end of file
+#endif
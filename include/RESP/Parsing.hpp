@@ -1,10 +1,10 @@
 #ifndef __RESP_PARSING_HPP__
 #define __RESP_PARSING_HPP__
+#include <cstddef>
+#include <cstdint>
 #include <optional>
-#include <regex>
-#include <sstream>
-#include <stdexcept>
 #include <string>
+#include <string_view>
 #include <vector>
 namespace RESP {
 
@@ -30,41 +30,250 @@ enum DataType {
   PUSH = '>'
 };
 
-std::optional<std::string> parseBString(const std::string &command) {
-  std::regex rgx("[$][0-9]+\r\n(\\w+)\r\n");
-  std::smatch match;
-  if (std::regex_search(command, match, rgx)) {
-    return match.str(1);
+/**
+ * @brief Maximum number of elements accepted in a single command array.
+ */
+constexpr std::int64_t MaxArrayLength = 1024 * 1024;
+
+/**
+ * @brief Maximum size of a single bulk string argument (512MB like redis).
+ */
+constexpr std::int64_t MaxBulkLength = 512LL * 1024 * 1024;
+
+/**
+ * @brief State of a frame after trying to parse it from a buffer.
+ *
+ */
+enum class ParseStatus {
+  COMPLETE,   ///< A whole frame was parsed.
+  INCOMPLETE, ///< The buffer ends before the frame does, read more bytes.
+  INVALID     ///< The buffer doesn't hold a valid RESP frame.
+};
+
+/**
+ * @brief Result of parsing one frame from the start of a buffer.
+ *
+ */
+struct ParseResult {
+  ParseStatus status = ParseStatus::INCOMPLETE;
+  /**
+   * @brief Number of bytes the frame occupies in the buffer. Only meaningful
+   * when the status is COMPLETE.
+   */
+  std::size_t consumed = 0;
+  /**
+   * @brief When the buffer ends inside the payload of a bulk string, where the
+   * payload starts and its length, so the rest of it can be read at once.
+   * Otherwise bulkLength is 0.
+   */
+  std::size_t bulkOffset = 0;
+  std::size_t bulkLength = 0;
+};
+
+/**
+ * @brief A bulk string payload received outside of the frame buffer, e.g.
+ * straight into the buffer the value is stored in. The frame buffer holds
+ * the `$<len>\r\n` header directly followed by the `\r\n` ending the
+ * payload.
+ */
+struct ExternalBulk {
+  /**
+   * @brief Position in the frame buffer where the payload would start.
+   */
+  std::size_t offset = 0;
+  std::string_view payload;
+};
+
+/**
+ * @brief Parse a `\r\n` terminated integer starting at `pos`, on success `pos`
+ * points to the first byte after the `\r\n`.
+ *
+ * @param buffer Input bytes.
+ * @param pos Position of the first digit (or the minus sign).
+ * @param value The parsed integer.
+ * @return ParseStatus INCOMPLETE if the terminator wasn't received yet.
+ */
+inline ParseStatus parseLength(std::string_view buffer, std::size_t &pos,
+                               std::int64_t &value) {
+  std::size_t i = pos;
+  bool negative = false;
+  if (i < buffer.size() && buffer[i] == '-') {
+    negative = true;
+    ++i;
+  }
+  std::size_t digitsStart = i;
+  std::int64_t result = 0;
+  while (i < buffer.size() && buffer[i] >= '0' && buffer[i] <= '9') {
+    result = result * 10 + (buffer[i] - '0');
+    if (result > MaxBulkLength) {
+      return ParseStatus::INVALID;
+    }
+    ++i;
   }
-  return std::nullopt;
+  if (i == buffer.size()) {
+    return ParseStatus::INCOMPLETE;
+  }
+  if (i == digitsStart || buffer[i] != '\r') {
+    return ParseStatus::INVALID;
+  }
+  if (i + 1 == buffer.size()) {
+    return ParseStatus::INCOMPLETE;
+  }
+  if (buffer[i + 1] != '\n') {
+    return ParseStatus::INVALID;
+  }
+  value = negative ? -result : result;
+  pos = i + 2;
+  return ParseStatus::COMPLETE;
 }
 
-std::optional<std::vector<std::string>> parseArray(const std::string &command) {
-  if (command.empty() || command[0] != DataType::ARRAY) {
-    return std::nullopt;
+/**
+ * @brief Parse one command frame (an array of bulk strings) from the start of
+ * the buffer without copying it.
+ *
+ * The parser is driven by the length prefixes only, so bulk strings may hold
+ * any binary content including `\r\n`. It never reads past the end of the
+ * buffer; a truncated frame reports INCOMPLETE and can be parsed again once
+ * more bytes arrived.
+ *
+ * @param buffer Received bytes, may hold several frames or a partial one.
+ * @param args Filled with views into `buffer`, one per array element. They are
+ * valid as long as the buffer is.
+ * @param maxBulkLength Longer bulk strings are INVALID as soon as their header
+ * is received.
+ * @param external Payload of the bulk string at `external->offset`, if any.
+ * @return ParseResult The status and the number of bytes of the frame.
+ */
+inline ParseResult parseCommand(std::string_view buffer,
+                                std::vector<std::string_view> &args,
+                                std::int64_t maxBulkLength = MaxBulkLength,
+                                const ExternalBulk *external = nullptr) {
+  args.clear();
+  if (buffer.empty()) {
+    return {ParseStatus::INCOMPLETE, 0};
+  }
+  if (buffer[0] != DataType::ARRAY) {
+    return {ParseStatus::INVALID, 0};
+  }
+  std::size_t pos = 1;
+  std::int64_t count = 0;
+  ParseStatus status = parseLength(buffer, pos, count);
+  if (status != ParseStatus::COMPLETE) {
+    return {status, 0};
+  }
+  if (count > MaxArrayLength) {
+    return {ParseStatus::INVALID, 0};
   }
-  std::regex pattern(R"([^\r\n]+)");
-  auto words_begin =
-      std::sregex_iterator(command.begin(), command.end(), pattern);
-  auto words_end = std::sregex_iterator();
-  std::vector<std::string> words;
-  for (std::sregex_iterator i = words_begin; i != words_end; ++i) {
-    std::smatch match = *i;
-    std::string match_str = match.str();
-    if (match_str.empty())
+  if (count > 0) {
+    args.reserve(count);
+  }
+  for (std::int64_t i = 0; i < count; ++i) {
+    if (pos >= buffer.size()) {
+      args.clear();
+      return {ParseStatus::INCOMPLETE, 0};
+    }
+    if (buffer[pos] != DataType::B_STRING) {
+      args.clear();
+      return {ParseStatus::INVALID, 0};
+    }
+    ++pos;
+    std::int64_t length = 0;
+    status = parseLength(buffer, pos, length);
+    if (status == ParseStatus::COMPLETE &&
+        (length < 0 || length > maxBulkLength)) {
+      status = ParseStatus::INVALID;
+    }
+    if (status != ParseStatus::COMPLETE) {
+      args.clear();
+      return {status, 0};
+    }
+    if (external && pos == external->offset) {
+      if (external->payload.size() != static_cast<std::size_t>(length)) {
+        args.clear();
+        return {ParseStatus::INVALID, 0};
+      }
+      if (buffer.size() - pos < 2) {
+        args.clear();
+        return {ParseStatus::INCOMPLETE, 0};
+      }
+      if (buffer[pos] != '\r' || buffer[pos + 1] != '\n') {
+        args.clear();
+        return {ParseStatus::INVALID, 0};
+      }
+      args.push_back(external->payload);
+      pos += 2;
       continue;
-    if (match_str[0] == DataType::B_STRING && std::next(i, 1) != words_end) {
-      words.push_back(std::next(i, 1)->str());
     }
+    if (buffer.size() - pos < static_cast<std::size_t>(length) + 2) {
+      args.clear();
+      return {ParseStatus::INCOMPLETE, 0, pos,
+              static_cast<std::size_t>(length)};
+    }
+    if (buffer[pos + length] != '\r' || buffer[pos + length + 1] != '\n') {
+      args.clear();
+      return {ParseStatus::INVALID, 0};
+    }
+    args.push_back(buffer.substr(pos, length));
+    pos += length + 2;
+  }
+  return {ParseStatus::COMPLETE, pos};
+}
+
+/**
+ * @brief Parse a single bulk string.
+ *
+ * @param command The bulk string frame.
+ * @return std::optional<std::string> std::nullopt if it's not a complete bulk
+ * string.
+ */
+inline std::optional<std::string> parseBString(std::string_view command) {
+  if (command.empty() || command[0] != DataType::B_STRING) {
+    return std::nullopt;
+  }
+  std::size_t pos = 1;
+  std::int64_t length = 0;
+  if (parseLength(command, pos, length) != ParseStatus::COMPLETE ||
+      length < 0 || command.size() - pos < static_cast<std::size_t>(length)) {
+    return std::nullopt;
+  }
+  return std::string(command.substr(pos, length));
+}
+
+/**
+ * @brief Parse the first command array in the message and copy its elements.
+ *
+ * @param command The message holding the array.
+ * @return std::optional<std::vector<std::string>> std::nullopt if the message
+ * isn't a valid array, an empty list if the array isn't complete yet.
+ */
+inline std::optional<std::vector<std::string>>
+parseArray(std::string_view command) {
+  std::vector<std::string_view> args;
+  ParseResult result = parseCommand(command, args);
+  if (result.status == ParseStatus::INVALID ||
+      (command.empty() && result.status == ParseStatus::INCOMPLETE)) {
+    return std::nullopt;
   }
-  return words;
+  return std::vector<std::string>(args.begin(), args.end());
+}
+
+inline std::string toBString(std::string_view input) {
+  std::string out;
+  out.reserve(input.size() + 16);
+  out += "$";
+  out += std::to_string(input.size());
+  out += "\r\n";
+  out += input;
+  out += "\r\n";
+  return out;
 }
 
-std::string toBString(const std::string &input) {
-  return "$" + std::to_string(input.size()) + "\r\n" + input + "\r\n";
+inline std::string toInteger(std::int64_t value) {
+  return ":" + std::to_string(value) + "\r\n";
 }
 
-std::string toStringArray(const std::vector<std::string> &array) {
+template <typename StringT>
+std::string toStringArray(const std::vector<StringT> &array) {
   std::string out = "*" + std::to_string(array.size()) + "\r\n";
   for (const auto &str : array) {
     out += toBString(str);
@@ -72,5 +281,9 @@ std::string toStringArray(const std::vector<std::string> &array) {
   return out;
 }
 
+inline std::string toStringArray(const std::vector<std::string> &array) {
+  return toStringArray<std::string>(array);
+}
+
 } // namespace RESP
-#endif
\ No newline at end of file
+#endif
@@ -0,0 +1,197 @@
+#ifndef __REDIS_SERVER_RADIX_TREE_HPP__
+#define __REDIS_SERVER_RADIX_TREE_HPP__
+#include <algorithm>
+#include <memory>
+#include <string>
+#include <string_view>
+#include <vector>
+
+namespace Redis {
+
+/**
+ * @brief Ordered set of strings in a compressed prefix tree, every edge holds
+ * the longest run of characters shared by the strings below it.
+ *
+ * Used as an optional index of the keyspace: the keys starting with a prefix
+ * are visited without touching the others.
+ */
+class RadixTree {
+public:
+  /**
+   * @brief Add a string.
+   *
+   * @return bool False if it was present already.
+   */
+  bool insert(std::string_view str) {
+    Node *node = &root_;
+    while (true) {
+      if (str.empty()) {
+        if (node->terminal) {
+          return false;
+        }
+        node->terminal = true;
+        ++size_;
+        return true;
+      }
+      auto it = node->childFor(str[0]);
+      if (it == node->children.end() || (*it)->label[0] != str[0]) {
+        auto child = std::make_unique<Node>();
+        child->label = str;
+        child->terminal = true;
+        node->children.insert(it, std::move(child));
+        ++size_;
+        return true;
+      }
+      Node *child = it->get();
+      std::size_t common = commonPrefix(child->label, str);
+      if (common < child->label.size()) {
+        // Split the edge where the string leaves it.
+        auto split = std::make_unique<Node>();
+        split->label = child->label.substr(0, common);
+        child->label.erase(0, common);
+        split->children.push_back(std::move(*it));
+        *it = std::move(split);
+        child = it->get();
+      }
+      str.remove_prefix(common);
+      node = child;
+    }
+  }
+
+  /**
+   * @brief Remove a string, the nodes left with a single child are merged
+   * with it.
+   *
+   * @return bool False if it wasn't present.
+   */
+  bool erase(std::string_view str) {
+    // The path from the root, with the index of each node in its parent.
+    std::vector<std::pair<Node *, std::size_t>> path;
+    Node *node = &root_;
+    while (!str.empty()) {
+      auto it = node->childFor(str[0]);
+      if (it == node->children.end() || !str.starts_with((*it)->label)) {
+        return false;
+      }
+      path.emplace_back(node, it - node->children.begin());
+      str.remove_prefix((*it)->label.size());
+      node = it->get();
+    }
+    if (!node->terminal) {
+      return false;
+    }
+    node->terminal = false;
+    --size_;
+    if (path.empty()) {
+      return true;
+    }
+    auto [parent, index] = path.back();
+    if (node->children.empty()) {
+      parent->children.erase(parent->children.begin() + index);
+      node = parent;
+    }
+    // The node and possibly its parent may be left with a single child.
+    if (node != &root_ && !node->terminal && node->children.size() == 1) {
+      std::unique_ptr<Node> child = std::move(node->children.front());
+      node->label += child->label;
+      node->terminal = child->terminal;
+      node->children = std::move(child->children);
+    }
+    return true;
+  }
+
+  /**
+   * @brief Visit the strings starting with a prefix in lexicographic order.
+   *
+   * @param fn Called with every string, must not modify the tree.
+   */
+  template <typename F>
+  void forEachWithPrefix(std::string_view prefix, F &&fn) const {
+    const Node *node = &root_;
+    std::string path;
+    while (!prefix.empty()) {
+      auto it = node->childFor(prefix[0]);
+      if (it == node->children.end()) {
+        return;
+      }
+      const std::string &label = (*it)->label;
+      std::size_t common = commonPrefix(label, prefix);
+      if (common < std::min(label.size(), prefix.size())) {
+        return;
+      }
+      path += label;
+      prefix.remove_prefix(std::min(label.size(), prefix.size()));
+      node = it->get();
+    }
+    visit(*node, path, fn);
+  }
+
+  std::size_t size() const { return size_; }
+
+  void clear() {
+    root_ = Node();
+    size_ = 0;
+  }
+
+private:
+  struct Node {
+    using Children = std::vector<std::unique_ptr<Node>>;
+
+    std::string label;
+    bool terminal = false;
+    /**
+     * @brief Sorted by the first character of their label.
+     */
+    Children children;
+
+    /**
+     * @brief The child whose label starts with `ch`, or the position to
+     * insert it.
+     */
+    Children::iterator childFor(char ch) {
+      return std::lower_bound(children.begin(), children.end(), ch,
+                              [](const std::unique_ptr<Node> &child, char c) {
+                                return child->label[0] < c;
+                              });
+    }
+
+    /**
+     * @brief The child whose label starts with `ch`, or end().
+     */
+    Children::const_iterator childFor(char ch) const {
+      Children::const_iterator it = const_cast<Node *>(this)->childFor(ch);
+      if (it != children.end() && (*it)->label[0] != ch) {
+        return children.end();
+      }
+      return it;
+    }
+  };
+
+  static std::size_t commonPrefix(std::string_view a, std::string_view b) {
+    auto [ai, bi] = std::mismatch(a.begin(), a.end(), b.begin(), b.end());
+    return ai - a.begin();
+  }
+
+  /**
+   * @brief Visit the strings of a subtree, `path` holds the prefix of the
+   * node and is restored on return.
+   */
+  template <typename F>
+  static void visit(const Node &node, std::string &path, F &fn) {
+    if (node.terminal) {
+      fn(std::string_view(path));
+    }
+    for (const auto &child : node.children) {
+      path += child->label;
+      visit(*child, path, fn);
+      path.resize(path.size() - child->label.size());
+    }
+  }
+
+  Node root_;
+  std::size_t size_ = 0;
+};
+
+} // namespace Redis
+
+#endif
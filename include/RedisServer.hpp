@@ -1,25 +1,63 @@
 #ifndef REDIS_SERVER_HPP
 #define REDIS_SERVER_HPP
+#include "AppendOnlyFile.hpp"
+#include "ClientTable.hpp"
+#include "CommandTable.hpp"
 #include "Config.hpp"
+#include "RDBFile.hpp"
+#include "RESP/Parsing.hpp"
+#include "ReplicationBacklog.hpp"
+#include "ReplyPart.hpp"
+#include "Shard.hpp"
 #include "Types.hpp"
 #include <TCPClient.hpp>
+#include <array>
 #include <asio.hpp>
+#include <atomic>
 #include <chrono>
+#include <cstdint>
+#include <functional>
 #include <memory>
 #include <mutex>
 #include <optional>
+#include <span>
 #include <string>
+#include <string_view>
+#include <sys/types.h>
 #include <thread>
-#include <unordered_map>
 #include <vector>
-class TCPConnection;
+class Connection;
 
 namespace Redis {
 
 class Server : public std::enable_shared_from_this<Server> {
 public:
   using SharedPtr = std::shared_ptr<Redis::Server>;
-  using Reply = std::vector<std::string>;
+  /**
+   * @brief The parts of one or more replies, sent with a gathered write.
+   */
+  using Reply = std::vector<ReplyPart>;
+
+  /**
+   * @brief A bulk string payload read straight into its own buffer, see
+   * @sa RESP::ExternalBulk.
+   */
+  struct ExternalBulk {
+    /**
+     * @brief Position in the frame buffer where the payload would start.
+     */
+    std::size_t offset = 0;
+    SharedBuffer payload;
+  };
+
+  /**
+   * @brief How much of its pipeline a connection executes before yielding to
+   * the other connections of its event loop, @sa turnBudget.
+   */
+  struct TurnBudget {
+    std::size_t commands;
+    std::size_t bytes;
+  };
 
   /**
    * @brief Construct a new Redis Server object.
@@ -31,8 +69,14 @@ public:
    *
    * @param port The port number on which the server will listen. Defaults to
    * 6379.
+   * @param shards Number of keyspace shards each served by its own thread, 0
+   * keeps a single keyspace shared by all the I/O threads.
+   * @param config The initial config, it decides which files are loaded.
+   *
+   * @throws std::runtime_error If the append only file is enabled and can't be
+   * loaded or created.
    */
-  Server(int port = 6379);
+  Server(int port = 6379, std::size_t shards = 0, Config config = {});
 
   /**
    * @brief Construct a new Redis Server object as a replica.
@@ -46,19 +90,40 @@ public:
    * @param masterPort The port number of the master Redis server.
    * @param ioContext The asio::io_context object to be used for asynchronous
    * operations.
+   * @param shards Number of keyspace shards each served by its own thread, 0
+   * keeps a single keyspace shared by all the I/O threads.
+   * @param config The initial config, it decides which files are loaded.
    *
    * @throws std::runtime_error If the connection to the master server cannot be
    * established.
    */
   Server(int port, std::string masterIp, int masterPort,
-         asio::io_context &ioContext);
+         asio::io_context &ioContext, std::size_t shards = 0,
+         Config config = {});
+
+  /**
+   * @brief Stops the shard threads before the rest of the server goes away,
+   * a background save or rewrite in progress is killed.
+   */
+  virtual ~Server();
 
-  virtual ~Server() = default;
+  /**
+   * @brief Start the periodic background tasks (active expiry of the keys,
+   * the snapshots of the save config) on the given event loop. They run @sa
+   * Config::hz times per second.
+   *
+   * @param ioContext The event loop running the timer, it must outlive the
+   * server.
+   */
+  void startCron(asio::io_context &ioContext);
 
   /**
    * @brief Giving a message from redis client, parse it and return the expected
    * response.
    *
+   * Every complete command frame in the message is executed in order and the
+   * replies are concatenated, a trailing truncated frame is ignored.
+   *
    * @param message Received message from the redis client through the open
    * socket.
    * @param clientId The unique identifier of the client sending the command.
@@ -67,9 +132,35 @@ public:
    * @return std::optional<std::string> The response to the given message,
    * std::nullopt if the message parsing failed.
    */
-  std::optional<Reply> handleRequest(const std::string &message,
+  std::optional<Reply> handleRequest(std::string_view message,
                                      std::size_t clientId = -1);
 
+  /**
+   * @brief Execute every complete command frame at the start of the buffer and
+   * append their replies in order.
+   *
+   * Used by the connections to serve pipelined requests straight from their
+   * read buffer, bytes of a trailing partial frame are left unconsumed. The
+   * write commands are flushed to the append only file before it returns.
+   *
+   * @param buffer Bytes received from the client.
+   * @param replies Replies of the executed commands are appended to it.
+   * @param clientId The unique identifier of the client sending the commands.
+   * @param bulk A payload of the first frame read outside of the buffer, a SET
+   * of it stores its buffer without copying it.
+   * @param executed Incremented by the number of executed commands.
+   * @param budget Stop before the next frame once this many commands or bytes
+   * were executed, at least one command is. Unbounded when null.
+   * @return std::optional<std::size_t> Number of bytes consumed from the
+   * buffer, std::nullopt on a protocol error.
+   */
+  std::optional<std::size_t> handleBuffer(std::string_view buffer,
+                                          Reply &replies,
+                                          std::size_t clientId = -1,
+                                          const ExternalBulk *bulk = nullptr,
+                                          std::size_t *executed = nullptr,
+                                          const TurnBudget *budget = nullptr);
+
   /**
    * @brief Is this server a replica of another master redis server.
    *
@@ -82,38 +173,352 @@ public:
   /**
    * @brief Register a new client connection with the server.
    *
-   * This function adds a new client connection to the server's list of clients.
-   * It uses a weak pointer to avoid circular references and allow for automatic
-   * cleanup when the connection is closed.
+   * This function adds a new client connection to the server's table of
+   * clients. It uses a weak pointer to avoid circular references, the
+   * connection removes itself with @sa unregisterClient when it closes.
    *
-   * @param clientPtr A weak pointer to the TCPConnection object representing
+   * @param clientPtr A weak pointer to the Connection object representing
    * the client.
-   * @return std::size_t The index of the newly registered client in the
-   * server's client list.
+   * @return std::size_t The id of the client, see @sa ClientTable.
    */
-  std::size_t registerClient(std::weak_ptr<TCPConnection> clientPtr);
+  std::size_t registerClient(std::weak_ptr<Connection> clientPtr);
+
+  /**
+   * @brief Remove a closed client from the table of clients, its slot is
+   * reused by the next client.
+   *
+   * @param clientId The id returned by @sa registerClient.
+   */
+  void unregisterClient(std::size_t clientId);
+
+  /**
+   * @brief Output buffer limit of a class of clients, from the
+   * client-output-buffer-limit config. Safe to call from any thread.
+   */
+  OutputBufferLimit outputBufferLimit(ClientClass clientClass) const;
+
+  /**
+   * @brief Commands and bytes a client of the class executes per event loop
+   * turn, from the io-commands-per-turn and io-bytes-per-turn configs. The
+   * replication links get repl-turn-weight times more so a busy loop doesn't
+   * hold the replication stream back. Safe to call from any thread.
+   */
+  TurnBudget turnBudget(ClientClass clientClass) const;
 
 private:
   /**
    * @brief Initialize the server.
    *
    * This function performs the following tasks:
-   * 1. Initializes the command lookup table (cmdsLUT).
-   * 2. Loads the RDB file from the configured path.
-   * 3. If an RDB file is found and successfully parsed, it populates the
-   * server's database with the loaded data.
+   * 1. Creates the keyspace shards.
+   * 2. With appendonly enabled and an existing append only file, replays it.
+   * 3. Otherwise loads the RDB file from the configured path. If an RDB file
+   * is found, its records are decoded in parallel straight into their shards.
+   * A corrupt file leaves the keyspace empty.
+   * 4. With appendonly enabled, creates the append only file from the loaded
+   * keyspace if it's missing and opens it.
+   * 5. Starts the shard threads.
    *
    * The function is called in the constructor to set up the server's initial
    * state.
    */
 
-  void init();
+  void init(std::size_t shards);
+
+  /**
+   * @brief Execute the commands of an append only file, before the shard
+   * threads are started. A partial command at the end, left by a crash in the
+   * middle of a write, is truncated.
+   *
+   * @throws std::runtime_error If the file can't be read or isn't valid.
+   */
+  void loadAppendOnlyFile(const std::string &path);
+
+  /**
+   * @brief Get the shard owning the given key.
+   *
+   * @param key The record key.
+   * @return Shard& The shard, the key hash decides which one.
+   */
+  Shard &shardFor(std::string_view key);
+
+  /**
+   * @brief Index of the shard owning the given key in @sa shards_.
+   */
+  std::size_t shardIndex(std::string_view key) const;
+
+  /**
+   * @brief Create the keyspace shards, empty.
+   */
+  void createShards(std::size_t shards);
+
+  /**
+   * @brief Run a function on every shard and wait until all of them finished.
+   * Owned shards run it on their own threads in parallel, a shared keyspace
+   * runs it in place under the lock.
+   *
+   * @param fn Called with each shard.
+   */
+  void forEachShard(const std::function<void(Shard &)> &fn);
+
+  /**
+   * @brief Run a function on the shard owning a key and wait for it, on the
+   * shard's thread if it's owned. Must not be called from a shard thread.
+   *
+   * @param key The key selecting the shard.
+   * @param fn Called with the shard.
+   */
+  void runOnShard(Shard &shard, const std::function<void(Shard &)> &fn);
+
+  /**
+   * @brief Run a function on the shard owning a key, @sa runOnShard.
+   */
+  void runOnShard(std::string_view key,
+                  const std::function<void(Shard &)> &fn);
+
+  /**
+   * @brief Execute a batch of keyed commands on the shards owning their keys
+   * and append the replies in the batch order. Each shard gets one task
+   * holding all of its commands.
+   *
+   * @param batch Commands whose first argument is the key.
+   * @param replies Replies of the executed commands are appended to it.
+   * @param clientId The unique identifier of the client sending the commands.
+   */
+  void dispatchToShards(
+      const std::vector<std::vector<std::string_view>> &batch, Reply &replies,
+      std::size_t clientId);
+
+  /**
+   * @brief One tick of the background tasks, reschedules itself.
+   */
+  void cron();
+
+  /**
+   * @brief Delete expired keys on every shard within a time budget, owned
+   * shards do it on their own threads without being waited for.
+   *
+   * @param budget Time budget of every shard.
+   */
+  void activeExpireCycle(std::chrono::microseconds budget);
+
+  /**
+   * @brief Run a function while no other thread touches the keyspace: the
+   * shared shard is locked, owned shards are parked in a task until it
+   * returns. Must be called with @sa saveMutex_ held, two freezes could
+   * deadlock by parking the shards in a different order.
+   */
+  void freezeKeyspace(const std::function<void()> &fn);
+
+  /**
+   * @brief Changes of the keyspace since the server started, the sum of @sa
+   * Shard::changes.
+   */
+  std::uint64_t keyspaceChanges() const;
+
+  /**
+   * @brief Write the keys of every shard as database 0, the expired ones not
+   * deleted yet are left out. The keyspace must be frozen.
+   */
+  void writeKeyspace(RDBWriter &writer);
+
+  /**
+   * @brief Write the keys of every shard as SET commands, followed by a
+   * PEXPIREAT for the keys with an expiry. The keyspace must be frozen.
+   */
+  void writeKeyspace(CommandWriter &writer);
+
+  struct SnapshotConfig {
+    std::string path;
+    bool compress;
+  };
+
+  /**
+   * @brief The snapshot file and its compression, from the config.
+   */
+  SnapshotConfig snapshotConfig();
+
+  /**
+   * @brief The append only file, from the config.
+   */
+  std::string appendOnlyPath();
 
   /**
-   * @brief Initialize the cmdsLUT which holds redis command as a key
-   * and the corresponding parsing function as value.
+   * @brief What a forked child writes.
    */
-  void initCmdsLUT();
+  enum class ChildKind {
+    SNAPSHOT,
+    REWRITE,
+    /**
+     * @brief A snapshot streamed to the replicas through a pipe, @sa
+     * startReplicationSync.
+     */
+    REPLICATION,
+  };
+
+  /**
+   * @brief Fork a child writing the keyspace to a file, the keyspace is only
+   * frozen during the fork and the child's copy of the memory is kept
+   * consistent by copy-on-write. Called with @sa saveMutex_ held.
+   *
+   * @param kind What the child writes.
+   * @param path The file replaced by the child's temporary file.
+   * @param work Runs in the child, returns its success. The other threads
+   * are gone there: it must not log nor take a lock.
+   * @param atFork Runs in the parent while the keyspace is still frozen.
+   * @return std::optional<std::string> The error if the child couldn't be
+   * forked.
+   */
+  std::optional<std::string>
+  forkChild(ChildKind kind, const std::string &path,
+            const std::function<bool()> &work,
+            const std::function<void()> &atFork = {});
+
+  /**
+   * @brief Kill the child and remove its temporary file, called with @sa
+   * saveMutex_ held.
+   */
+  void killChild();
+
+  /**
+   * @brief Fork a child writing a snapshot of the keyspace, @sa forkChild.
+   * Called with @sa saveMutex_ held.
+   *
+   * @return std::optional<std::string> The error if the child couldn't be
+   * forked.
+   */
+  std::optional<std::string> startBackgroundSave();
+
+  /**
+   * @brief Fork a child rewriting the append only file from the keyspace,
+   * @sa forkChild. The commands applied meanwhile are kept in the rewrite
+   * buffer of @sa aof_ until the child exits. Called with @sa saveMutex_
+   * held.
+   *
+   * @return std::optional<std::string> The error if the child couldn't be
+   * forked.
+   */
+  std::optional<std::string> startAppendOnlyRewrite();
+
+  /**
+   * @brief Fork a child streaming a snapshot of the keyspace to the replicas
+   * waiting for one, @sa writeRDBStream. It writes to a pipe relayed to
+   * their connections by @sa relaySnapshot, nothing touches the disk. The
+   * commands applied after the fork are buffered for each of them until the
+   * snapshot is sent. Called with @sa saveMutex_ held.
+   *
+   * @return std::optional<std::string> The error if the child couldn't be
+   * forked.
+   */
+  std::optional<std::string> startReplicationSync();
+
+  /**
+   * @brief Start a full synchronization once a replica waited
+   * repl-diskless-sync-delay seconds for one and no child runs, from the
+   * cron and PSYNC.
+   */
+  void syncReplicas(int delaySeconds);
+
+  /**
+   * @brief Send the snapshot read from the child's pipe to the replicas of
+   * the synchronization, from its own thread. Every replica gets a window of
+   * the snapshot queued, the rest waits in the relay. The transfer goes at
+   * the pace of the fastest one, a replica whose output goes over its limit
+   * or which reads nothing for repl-timeout seconds is disconnected. Once
+   * the stream ends with its mark the replicas get their buffered commands
+   * and go online, else they are disconnected.
+   *
+   * @param fd Read end of the pipe, closed when done.
+   * @param mark The mark ending the stream.
+   */
+  void relaySnapshot(int fd, std::string mark);
+
+  /**
+   * @brief Handle the stream of the master from the reply to PSYNC on: after
+   * +FULLRESYNC the snapshot is loaded as its bytes arrive, replacing the
+   * keyspace, then the propagated commands are executed. After +CONTINUE
+   * they are executed at once, following the ones executed before the link
+   * was lost.
+   *
+   * @return std::optional<TCPClient::Turn> std::nullopt to stop replicating
+   * on an invalid stream.
+   */
+  std::optional<TCPClient::Turn> handleMasterStream(std::string_view stream);
+
+  /**
+   * @brief Insert the records of the master's snapshot loaded so far.
+   */
+  void insertSnapshotBatches();
+
+  /**
+   * @brief Called when the connection to the master is lost, reconnects
+   * after @sa MasterReconnectDelay. A replica which was executing the
+   * commands of the master asks for the ones it missed, else for a full
+   * synchronization.
+   */
+  void masterLinkLost();
+
+  /**
+   * @brief Try to connect to the master again, until it succeeds.
+   */
+  void reconnectMaster();
+
+  /**
+   * @brief Collect the background save or rewrite child if it exited, from
+   * the cron. A finished rewrite replaces the append only file.
+   */
+  void checkBackgroundSave();
+
+  /**
+   * @brief Start a background save when a save point of the save config is
+   * reached, from the cron. A failed save is retried after a delay.
+   *
+   * @param points The save points.
+   */
+  void autoSave(const std::vector<SavePoint> &points);
+
+  /**
+   * @brief Start a rewrite of the append only file when it grew enough since
+   * the last one, or when it was just enabled and doesn't exist yet. From the
+   * cron, a failed rewrite is retried after a delay.
+   *
+   * @param percentage Growth since the last rewrite, 0 to never rewrite on
+   * growth.
+   * @param minSize Smallest log rewritten on growth.
+   */
+  void autoRewriteAppendOnly(int percentage, std::uint64_t minSize);
+
+  /**
+   * @brief Enable or disable the append only file at runtime. Enabling it
+   * starts a rewrite creating it from the keyspace, disabling it stops a
+   * rewrite in progress.
+   */
+  void setAppendOnly(bool enabled);
+
+  /**
+   * @brief Function executing a command.
+   */
+  using Handler = Reply (Server::*)(const std::vector<std::string_view> &,
+                                    std::size_t);
+
+  /**
+   * @brief The command table, a member so that it can hold the private
+   * handlers. Defined at the top of RedisServer.cpp.
+   */
+  static const auto &commandTable();
+
+  /**
+   * @brief Find a command in the command table, the name is case
+   * insensitive.
+   *
+   * @return const Command<Handler>* nullptr for an unknown command.
+   */
+  static const Command<Handler> *findCommand(std::string_view name);
+
+  /**
+   * @brief Every command of the command table.
+   */
+  static std::span<const Command<Handler>> commands();
 
   /**
    * @brief Given list of command and arguments. parse it and return the
@@ -125,27 +530,40 @@ private:
    *                 operations that may differ based on the client's context.
    * @return std::optional<Reply> The response to this command.
    */
-  std::optional<Reply> handleCommands(const std::vector<std::string> &commands,
-                                      std::size_t clientId);
+  std::optional<Reply>
+  handleCommands(const std::vector<std::string_view> &commands,
+                 std::size_t clientId);
 
   /**
-   * @brief Get a stored value giving the key.
+   * @brief Get a stored value giving the key as a bulk string reply. Large
+   * values are referenced by the reply instead of copied: the parts are the
+   * "$len\r\n" header, the value's buffer and a shared "\r\n".
    *
    * @param key Key as string.
-   * @return std::optional<std::string> std::nullopt if the key doesn't exist or
-   * the value is expired.
+   * @return std::optional<Reply> std::nullopt if the key doesn't exist or the
+   * value is expired.
    */
-  std::optional<std::string> getValue(const std::string &key);
+  std::optional<Reply> getValue(std::string_view key);
 
   /**
    * @brief Create a new record in the database giving the key and value and an
    * optional expiry time.
    *
+   * The write is logged to the append only file while the shard is locked, so
+   * the log has the writes of a key in the order they were applied and a
+   * rewrite's snapshot has either the write or its log entry. The expiry is
+   * logged and propagated as a deadline with PEXPIREAT, a replay or a
+   * replica applying it late must not extend it. The
+   * keys evicted to make room are logged and propagated as DEL, and the
+   * write is propagated to the replicas under the same lock.
+   *
    * @param key The new record key.
    * @param value The new record value.
    * @param expiry Expiry time in miliseconds.
+   * @return bool False if the record wasn't created because the memory is
+   * over maxmemory and no key can be evicted.
    */
-  void setValue(const std::string &key, const std::string &value,
+  bool setValue(std::string_view key, std::string_view value,
                 std::optional<int> expiry = std::nullopt);
 
   /**
@@ -157,9 +575,22 @@ private:
    *                 operations that may differ based on the client's context.
    * @return std::string Server response to the command.
    */
-  Reply pingCommand(const std::vector<std::string> &commands,
+  Reply pingCommand(const std::vector<std::string_view> &commands,
                     std::size_t clientId);
 
+  /**
+   * @brief Parse a `COMMAND`, `COMMAND COUNT` or `COMMAND INFO` command from
+   * redis client, the replies describe the command table.
+   *
+   * @param commands The redis command and it's argument.
+   * @param clientId The unique identifier of the client sending the command.
+   *                 This is used to track client-specific state and for
+   *                 operations that may differ based on the client's context.
+   * @return Reply Server response to the command.
+   */
+  Reply commandCommand(const std::vector<std::string_view> &commands,
+                       std::size_t clientId);
+
   /**
    * @brief Parse a `ECHO` command from redis client.
    *
@@ -169,7 +600,7 @@ private:
    *                 operations that may differ based on the client's context.
    * @return Reply Server response to the command.
    */
-  Reply echoCommand(const std::vector<std::string> &commands,
+  Reply echoCommand(const std::vector<std::string_view> &commands,
                     std::size_t clientId);
 
   /**
@@ -181,7 +612,7 @@ private:
    *                 operations that may differ based on the client's context.
    * @return Reply Server response to the command.
    */
-  Reply getCommand(const std::vector<std::string> &commands,
+  Reply getCommand(const std::vector<std::string_view> &commands,
                    std::size_t clientId);
 
   /**
@@ -193,9 +624,76 @@ private:
    *                 operations that may differ based on the client's context.
    * @return Reply Server response to the command.
    */
-  Reply setCommand(const std::vector<std::string> &commands,
+  Reply setCommand(const std::vector<std::string_view> &commands,
+                   std::size_t clientId);
+
+  /**
+   * @brief Parse a `EXPIRE` command from redis client.
+   *
+   * Also serves `PEXPIRE`, the TTL is then in milliseconds, and `EXPIREAT`
+   * and `PEXPIREAT` taking a unix time. The append only file gets the
+   * deadline as a PEXPIREAT.
+   *
+   * @param commands The redis command and it's argument.
+   * @param clientId The unique identifier of the client sending the command.
+   *                 This is used to track client-specific state and for
+   *                 operations that may differ based on the client's context.
+   * @return Reply Server response to the command.
+   */
+  Reply expireCommand(const std::vector<std::string_view> &commands,
+                      std::size_t clientId);
+
+  /**
+   * @brief Parse a `TTL` command from redis client.
+   *
+   * Also serves `PTTL`, the TTL is then in milliseconds.
+   *
+   * @param commands The redis command and it's argument.
+   * @param clientId The unique identifier of the client sending the command.
+   *                 This is used to track client-specific state and for
+   *                 operations that may differ based on the client's context.
+   * @return Reply Server response to the command.
+   */
+  Reply ttlCommand(const std::vector<std::string_view> &commands,
+                   std::size_t clientId);
+
+  /**
+   * @brief Parse a `DEL key [key ...]` command from redis client, every key
+   * is deleted on its shard.
+   *
+   * @param commands The redis command and it's argument.
+   * @param clientId The unique identifier of the client sending the command.
+   *                 This is used to track client-specific state and for
+   *                 operations that may differ based on the client's context.
+   * @return Reply Server response to the command, the number of keys deleted.
+   */
+  Reply delCommand(const std::vector<std::string_view> &commands,
                    std::size_t clientId);
 
+  /**
+   * @brief Parse a `PERSIST` command from redis client.
+   *
+   * @param commands The redis command and it's argument.
+   * @param clientId The unique identifier of the client sending the command.
+   *                 This is used to track client-specific state and for
+   *                 operations that may differ based on the client's context.
+   * @return Reply Server response to the command.
+   */
+  Reply persistCommand(const std::vector<std::string_view> &commands,
+                       std::size_t clientId);
+
+  /**
+   * @brief Parse a `OBJECT ENCODING` command from redis client.
+   *
+   * @param commands The redis command and it's argument.
+   * @param clientId The unique identifier of the client sending the command.
+   *                 This is used to track client-specific state and for
+   *                 operations that may differ based on the client's context.
+   * @return Reply Server response to the command.
+   */
+  Reply objectCommand(const std::vector<std::string_view> &commands,
+                      std::size_t clientId);
+
   /**
    * @brief Parse a `CONFIG` command from redis client.
    *
@@ -205,7 +703,7 @@ private:
    *                 operations that may differ based on the client's context.
    * @return Reply Server response to the command.
    */
-  Reply configCommand(const std::vector<std::string> &commands,
+  Reply configCommand(const std::vector<std::string_view> &commands,
                       std::size_t clientId);
 
   /**
@@ -217,9 +715,40 @@ private:
    *                 operations that may differ based on the client's context.
    * @return Reply Server response to the command.
    */
-  Reply keysCommand(const std::vector<std::string> &commands,
+  Reply keysCommand(const std::vector<std::string_view> &commands,
+                    std::size_t clientId);
+
+  /**
+   * @brief Parse a `SCAN cursor [MATCH pattern] [COUNT count] [TYPE type]`
+   * command from redis client.
+   *
+   * The cursor holds the shard index and the shard's table cursor, the
+   * reverse binary order of @sa HashTable::scan keeps it valid while the
+   * tables grow or shrink between calls.
+   *
+   * @param commands The redis command and it's argument.
+   * @param clientId The unique identifier of the client sending the command.
+   *                 This is used to track client-specific state and for
+   *                 operations that may differ based on the client's context.
+   * @return Reply Server response to the command.
+   */
+  Reply scanCommand(const std::vector<std::string_view> &commands,
                     std::size_t clientId);
 
+  /**
+   * @brief Parse a `HSCAN`, `SSCAN` or `ZSCAN` command from redis client.
+   * Only strings are stored, so an existing key has the wrong type and a
+   * missing one is empty.
+   *
+   * @param commands The redis command and it's argument.
+   * @param clientId The unique identifier of the client sending the command.
+   *                 This is used to track client-specific state and for
+   *                 operations that may differ based on the client's context.
+   * @return Reply Server response to the command.
+   */
+  Reply collectionScanCommand(const std::vector<std::string_view> &commands,
+                              std::size_t clientId);
+
   /**
    * @brief Parse a `INFO` command from redis client.
    *
@@ -229,9 +758,75 @@ private:
    *                 operations that may differ based on the client's context.
    * @return Reply Server response to the command.
    */
-  Reply infoCommand(const std::vector<std::string> &commands,
+  Reply infoCommand(const std::vector<std::string_view> &commands,
                     std::size_t clientId);
 
+  /**
+   * @brief Parse a `SAVE` command from redis client: write a snapshot of the
+   * keyspace from this thread, every other client waits meanwhile.
+   *
+   * @param commands The redis command and it's argument.
+   * @param clientId The unique identifier of the client sending the command.
+   *                 This is used to track client-specific state and for
+   *                 operations that may differ based on the client's context.
+   * @return Reply Server response to the command.
+   */
+  Reply saveCommand(const std::vector<std::string_view> &commands,
+                    std::size_t clientId);
+
+  /**
+   * @brief Parse a `BGSAVE [SCHEDULE]` command from redis client: write a
+   * snapshot of the keyspace from a forked child, @sa startBackgroundSave.
+   *
+   * @param commands The redis command and it's argument.
+   * @param clientId The unique identifier of the client sending the command.
+   *                 This is used to track client-specific state and for
+   *                 operations that may differ based on the client's context.
+   * @return Reply Server response to the command.
+   */
+  Reply bgsaveCommand(const std::vector<std::string_view> &commands,
+                      std::size_t clientId);
+
+  /**
+   * @brief Parse a `LASTSAVE` command from redis client: the unix time of the
+   * last successful snapshot.
+   *
+   * @param commands The redis command and it's argument.
+   * @param clientId The unique identifier of the client sending the command.
+   *                 This is used to track client-specific state and for
+   *                 operations that may differ based on the client's context.
+   * @return Reply Server response to the command.
+   */
+  Reply lastsaveCommand(const std::vector<std::string_view> &commands,
+                        std::size_t clientId);
+
+  /**
+   * @brief Parse a `BGREWRITEAOF` command from redis client: rewrite the
+   * append only file from a forked child, @sa startAppendOnlyRewrite. It's
+   * scheduled after a background save in progress.
+   *
+   * @param commands The redis command and it's argument.
+   * @param clientId The unique identifier of the client sending the command.
+   *                 This is used to track client-specific state and for
+   *                 operations that may differ based on the client's context.
+   * @return Reply Server response to the command.
+   */
+  Reply bgrewriteaofCommand(const std::vector<std::string_view> &commands,
+                            std::size_t clientId);
+
+  /**
+   * @brief Parse a `CLIENT` command from redis client: ID, SETNAME, GETNAME,
+   * INFO, LIST and KILL.
+   *
+   * @param commands The redis command and it's argument.
+   * @param clientId The unique identifier of the client sending the command.
+   *                 This is used to track client-specific state and for
+   *                 operations that may differ based on the client's context.
+   * @return Reply Server response to the command.
+   */
+  Reply clientCommand(const std::vector<std::string_view> &commands,
+                      std::size_t clientId);
+
   /**
    * @brief Parse a `REPLCONF` command from redis client.
    *
@@ -241,11 +836,16 @@ private:
    *                 operations that may differ based on the client's context.
    * @return Reply Server response to the command.
    */
-  Reply replconfCommand(const std::vector<std::string> &commands,
+  Reply replconfCommand(const std::vector<std::string_view> &commands,
                         std::size_t clientId);
 
   /**
-   * @brief Parse a `PSYNC` command from redis client.
+   * @brief Parse a `PSYNC <replid> <offset>` command from redis client, the
+   * client becomes a replica. When the id is the one of this server and the
+   * stream from the offset is still in @sa backlog_ it's answered with
+   * +CONTINUE and the missing bytes. Else it's answered with +FULLRESYNC
+   * once the next snapshot streamed to the replicas is forked, @sa
+   * syncReplicas.
    *
    * @param commands The redis command and it's argument.
    * @param clientId The unique identifier of the client sending the command.
@@ -253,7 +853,7 @@ private:
    *                 operations that may differ based on the client's context.
    * @return Reply Server response to the command.
    */
-  Reply psyncCommand(const std::vector<std::string> &commands,
+  Reply psyncCommand(const std::vector<std::string_view> &commands,
                      std::size_t clientId);
 
   /**
@@ -269,24 +869,29 @@ private:
    * This function sends the given commands to all replica servers that are
    * currently connected to this Redis server. It's typically used after
    * executing a write operation to ensure that all replicas stay in sync with
-   * the master.
+   * the master. The commands are appended to @sa backlog_ too.
+   *
+   * Writes call it while they hold their shard's lock, the replicas get the
+   * writes of a key in the order they were applied and a fork's snapshot has
+   * either the write or its propagated command.
    *
    * @param commands A vector of strings representing the Redis command and its
    * arguments that should be propagated to the replicas.
    */
-  void propagateToReplicas(const std::vector<std::string> &commands);
+  void propagateToReplicas(const std::vector<std::string_view> &commands);
 
   /**
-   * @brief The main server database. Reading from the database should be thread
-   * safe. Inserting in the database should only be done through the function
-   * @sa setValue.
+   * @brief The keyspace split by key hash. With sharding disabled it holds a
+   * single shared shard. Every access must hold the shard's @sa Shard::lock.
+   * Inserting in the database should only be done through the function @sa
+   * setValue.
    */
-  Database data_;
+  std::vector<std::unique_ptr<Shard>> shards_;
 
   /**
-   * @brief Mutex to protect writing to the database.
+   * @brief Are the shards served by their own threads.
    */
-  std::mutex dataMutex_;
+  bool sharded_ = false;
 
   /**
    * @brief The server config.
@@ -295,13 +900,128 @@ private:
   Config config_;
 
   /**
-   * @brief Lookup table for redis command and the corresponding function to
-   * handle this command.
+   * @brief Protects @sa config_, CONFIG SET may run on any I/O thread while
+   * the cron reads it.
+   */
+  std::mutex configMutex_;
+
+  /**
+   * @brief Push the config used outside of @sa configMutex_ to the shards and
+   * the fields below, called with the mutex held.
+   */
+  void applyConfig();
+
+  /**
+   * @brief Copies of the maxmemory config read by every write.
+   */
+  std::atomic<std::uint64_t> maxmemory_ = 0;
+  std::atomic<std::size_t> maxmemorySamples_ = 5;
+
+  /**
+   * @brief Copy of @sa Config::protoMaxBulkLen read by every request.
+   */
+  std::atomic<std::int64_t> protoMaxBulkLen_ = RESP::MaxBulkLength;
+
+  /**
+   * @brief Copy of @sa Config::clientOutputBufferLimit per client class: the
+   * hard limit, the soft limit and the soft limit seconds.
+   */
+  std::array<std::array<std::atomic<std::uint64_t>, 3>, ClientClasses>
+      outputBufferLimits_{};
+
+  /**
+   * @brief Copies of the per turn budget configs, @sa turnBudget.
+   */
+  std::atomic<std::size_t> ioCommandsPerTurn_ = 128;
+  std::atomic<std::size_t> ioBytesPerTurn_ = 64 * 1024;
+  std::atomic<std::size_t> replTurnWeight_ = 4;
+
+  /**
+   * @brief Copy of @sa Config::replBacklogSize, @sa backlog_ is resized by
+   * the next propagation.
    */
-  std::unordered_map<
-      std::string,
-      std::function<Reply(const std::vector<std::string> &, std::size_t)>>
-      cmdsLUT;
+  std::atomic<std::size_t> replBacklogSize_ = 1024 * 1024;
+
+  /**
+   * @brief Timer of @sa cron, null until @sa startCron.
+   */
+  std::unique_ptr<asio::steady_timer> cronTimer_;
+
+  /**
+   * @brief Time spent in the active expiry.
+   */
+  std::atomic<std::uint64_t> statExpireCycleMicros_ = 0;
+
+  /**
+   * @brief Active expiry runs stopped by their time budget.
+   */
+  std::atomic<std::uint64_t> statExpireTimeCapReached_ = 0;
+
+  /**
+   * @brief Full synchronizations, and PSYNC requests accepted or refused
+   * with a partial one.
+   */
+  std::atomic<std::uint64_t> statSyncFull_ = 0;
+  std::atomic<std::uint64_t> statSyncPartialOk_ = 0;
+  std::atomic<std::uint64_t> statSyncPartialErr_ = 0;
+
+  /**
+   * @brief State of the snapshots, guarded by @sa saveMutex_.
+   */
+  struct SaveState {
+    /**
+     * @brief The child writing a background save or rewrite, -1 without one.
+     */
+    pid_t child = -1;
+    ChildKind childKind = ChildKind::SNAPSHOT;
+    /**
+     * @brief Read end of the pipe the child reports its copy-on-write memory
+     * on before it exits.
+     */
+    int childPipe = -1;
+    /**
+     * @brief The file the child replaces, and the one it writes.
+     */
+    std::string childPath;
+    std::string childTempPath;
+    std::chrono::steady_clock::time_point childStart;
+    /**
+     * @brief @sa keyspaceChanges when the child forked, and covered by the
+     * last successful snapshot.
+     */
+    std::uint64_t changesAtFork = 0;
+    std::uint64_t changesAtSave = 0;
+    /**
+     * @brief Unix times in seconds of the last successful snapshot and of
+     * the last background save started.
+     */
+    std::int64_t lastSave = 0;
+    std::int64_t lastBackgroundTry = 0;
+    bool lastBackgroundOk = true;
+    std::int64_t lastBackgroundSeconds = -1;
+    /**
+     * @brief Start another background save once this one exits, BGSAVE
+     * SCHEDULE.
+     */
+    bool scheduled = false;
+    std::uint64_t latestForkMicros = 0;
+    std::uint64_t lastCowBytes = 0;
+    /**
+     * @brief The same for the rewrites of the append only file, in unix
+     * seconds. BGREWRITEAOF during a background save schedules one.
+     */
+    std::int64_t lastRewriteTry = 0;
+    bool lastRewriteOk = true;
+    std::int64_t lastRewriteSeconds = -1;
+    bool rewriteScheduled = false;
+  };
+  SaveState save_;
+  std::mutex saveMutex_;
+
+  /**
+   * @brief The append only file, fed by the write commands.
+   */
+  AppendOnlyFile aof_;
 
   /**
    * @brief The port number on which this Redis server is listening.
@@ -328,10 +1048,11 @@ private:
 
   /**
    * @brief The current replication offset of this server.
-   * This represents how much of the master's replication stream has been
-   * processed.
+   * On a master it's the end of its stream, @sa ReplicationBacklog::offset.
+   * On a replica it represents how much of the master's replication stream
+   * has been processed.
    */
-  int masterReplOffset = 0;
+  std::atomic<std::uint64_t> masterReplOffset = 0;
 
   /**
    * @brief A TCP client used to connect to the master server when this server
@@ -340,24 +1061,121 @@ private:
   std::shared_ptr<TCPClient> replicaClient;
 
   /**
-   * @brief A vector of weak pointers to TCPConnection objects representing
-   * client connections to this server.
-   *
-   * This container stores weak pointers to avoid circular references. When a
-   * client disconnects, its corresponding weak pointer will automatically
-   * expire, allowing for proper cleanup.
+   * @brief The io context of @sa replicaClient and the timer of @sa
+   * reconnectMaster.
    */
-  std::vector<std::weak_ptr<TCPConnection>> clients;
+  asio::io_context *masterContext_ = nullptr;
+  std::unique_ptr<asio::steady_timer> reconnectTimer_;
 
   /**
-   * @brief A vector of weak pointers to TCPConnection objects representing
-   * replica servers connected to this server.
+   * @brief The client connections to this server, with their names.
    *
-   * This container is used when this server acts as a master, storing
-   * connections to its replicas. Weak pointers are used to prevent circular
-   * references and allow for automatic cleanup when a replica disconnects.
+   * The table stores weak pointers to avoid circular references, a
+   * connection removes itself when it closes.
+   */
+  ClientTable<Connection> clients_;
+
+  /**
+   * @brief A replica of this server and where its synchronization is.
+   */
+  struct ReplicaLink {
+    enum class State {
+      /**
+       * @brief Waiting for the next snapshot, which will hold the commands
+       * applied meanwhile. It gets its +FULLRESYNC reply, with the offset of
+       * the stream the snapshot matches, when the snapshot is forked.
+       */
+      WAIT_SNAPSHOT,
+      /**
+       * @brief Receiving the snapshot, the commands applied after its fork
+       * are buffered.
+       */
+      SEND_SNAPSHOT,
+      ONLINE,
+    };
+    std::weak_ptr<Connection> connection;
+    std::size_t clientId = 0;
+    State state = State::WAIT_SNAPSHOT;
+    std::chrono::steady_clock::time_point waitingSince;
+    /**
+     * @brief The commands propagated while it receives the snapshot, they
+     * count toward its output buffer limit.
+     */
+    std::string pending;
+    std::optional<std::chrono::steady_clock::time_point> softLimitSince;
+  };
+
+  /**
+   * @brief The replicas connected to this server, when it acts as a master.
+   * Weak pointers are used to prevent circular references, a closed replica
+   * is removed on the next synchronization.
+   */
+  std::vector<ReplicaLink> replicas;
+
+  /**
+   * @brief The latest bytes propagated to the replicas, guarded by @sa
+   * clientsMutex_. It's fed once the first replica registers.
+   */
+  ReplicationBacklog backlog_{1024 * 1024};
+
+  /**
+   * @brief The thread of @sa relaySnapshot, one synchronization runs at a
+   * time.
+   */
+  std::thread relayThread_;
+  std::atomic<bool> relaying_ = false;
+  /**
+   * @brief Set by the destructor, the relay stops waiting for the replicas.
+   */
+  std::atomic<bool> stopRelay_ = false;
+
+  /**
+   * @brief Where the stream of the master is, when this server is a replica.
+   */
+  struct MasterLink {
+    enum class Stage {
+      RESYNC_REPLY,
+      SNAPSHOT_HEADER,
+      SNAPSHOT,
+      /**
+       * @brief The mark ending a snapshot of unknown size.
+       */
+      SNAPSHOT_END,
+      COMMANDS,
+    };
+    std::atomic<Stage> stage = Stage::RESYNC_REPLY;
+    /**
+     * @brief The keyspace matches the stream of the master up to @sa
+     * masterReplOffset, a new link asks to continue from there. Unset while
+     * a snapshot is loaded.
+     */
+    bool synced = false;
+    /**
+     * @brief Empty when the size of the snapshot was sent instead.
+     */
+    std::string eofMark;
+    std::uint64_t remaining = 0;
+    std::unique_ptr<RDBStreamLoader> loader;
+    /**
+     * @brief Loaded records waiting to be inserted, per shard.
+     */
+    std::vector<std::vector<std::pair<std::string, Record>>> batches;
+    std::size_t batched = 0;
+  };
+  MasterLink master_;
+
+  /**
+   * @brief Mutex to protect the @sa clients_ and @sa replicas lists, they are
+   * updated from the I/O threads accepting the connections. Taken after
+   * @sa saveMutex_ when both are.
+   */
+  std::mutex clientsMutex_;
+
+  /**
+   * @brief Set once the first replica registers, lets the write commands skip
+   * @sa clientsMutex_ while there is nothing to propagate.
    */
-  std::vector<std::weak_ptr<TCPConnection>> replicas;
+  std::atomic<bool> hasReplicas_ = false;
 };
 } // namespace Redis
 
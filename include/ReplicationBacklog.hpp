@@ -0,0 +1,112 @@
+#ifndef __REDIS_SERVER_REPLICATION_BACKLOG_HPP__
+#define __REDIS_SERVER_REPLICATION_BACKLOG_HPP__
+#include <algorithm>
+#include <cstdint>
+#include <optional>
+#include <string>
+#include <string_view>
+
+namespace Redis {
+
+/**
+ * @brief The latest bytes of the replication stream, kept in a fixed size
+ * circular buffer so a replica reconnecting after a short disconnection gets
+ * only the bytes it missed instead of a full synchronization.
+ *
+ * Offsets count the bytes of the stream since the server started, @sa offset
+ * is the one following the last byte appended. The buffer is allocated by the
+ * first @sa append, a server without replicas doesn't pay for it.
+ */
+class ReplicationBacklog {
+public:
+  explicit ReplicationBacklog(std::size_t capacity) : capacity_(capacity) {}
+
+  /**
+   * @brief Maximum number of bytes kept.
+   */
+  std::size_t capacity() const { return capacity_; }
+
+  /**
+   * @brief Number of bytes kept, up to @sa capacity.
+   */
+  std::size_t size() const { return size_; }
+
+  /**
+   * @brief The offset of the stream after the last byte appended.
+   */
+  std::uint64_t offset() const { return offset_; }
+
+  /**
+   * @brief The offset of the oldest byte kept.
+   */
+  std::uint64_t firstOffset() const { return offset_ - size_; }
+
+  /**
+   * @brief Append bytes of the stream, overwriting the oldest ones once the
+   * buffer is full.
+   */
+  void append(std::string_view bytes) {
+    offset_ += bytes.size();
+    if (capacity_ == 0) {
+      return;
+    }
+    if (buffer_.size() != capacity_) {
+      buffer_.resize(capacity_);
+    }
+    // Only the last capacity bytes of a longer write are kept
+    if (bytes.size() > capacity_) {
+      bytes.remove_prefix(bytes.size() - capacity_);
+    }
+    std::size_t first = std::min(bytes.size(), capacity_ - head_);
+    std::copy_n(bytes.data(), first, buffer_.data() + head_);
+    std::copy_n(bytes.data() + first, bytes.size() - first, buffer_.data());
+    head_ = (head_ + bytes.size()) % capacity_;
+    size_ = std::min(size_ + bytes.size(), capacity_);
+  }
+
+  /**
+   * @brief The bytes of the stream from `from` to @sa offset.
+   *
+   * @return std::nullopt when some of them aren't kept anymore, or `from` is
+   * past the end of the stream.
+   */
+  std::optional<std::string> since(std::uint64_t from) const {
+    if (from < firstOffset() || from > offset_) {
+      return std::nullopt;
+    }
+    std::size_t length = offset_ - from;
+    if (length == 0) {
+      return std::string();
+    }
+    std::string bytes(length, '\0');
+    std::size_t start = (head_ + capacity_ - length) % capacity_;
+    std::size_t first = std::min(length, capacity_ - start);
+    std::copy_n(buffer_.data() + start, first, bytes.data());
+    std::copy_n(buffer_.data(), length - first, bytes.data() + first);
+    return bytes;
+  }
+
+  /**
+   * @brief Change the capacity, the bytes kept are dropped like redis does
+   * and the offset goes on.
+   */
+  void resize(std::size_t capacity) {
+    capacity_ = capacity;
+    buffer_ = std::string();
+    head_ = 0;
+    size_ = 0;
+  }
+
+private:
+  std::size_t capacity_;
+  std::string buffer_;
+  /**
+   * @brief Where the next byte is written.
+   */
+  std::size_t head_ = 0;
+  std::size_t size_ = 0;
+  std::uint64_t offset_ = 0;
+};
+} // namespace Redis
+
+#endif
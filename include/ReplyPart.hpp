@@ -0,0 +1,68 @@
+#ifndef __REDIS_SERVER_REPLY_PART_HPP__
+#define __REDIS_SERVER_REPLY_PART_HPP__
+#include "SharedBuffer.hpp"
+#include <ostream>
+#include <string>
+#include <string_view>
+#include <variant>
+
+namespace Redis {
+
+/**
+ * @brief A piece of a reply to be sent with a gathered write: bytes owned by
+ * the part, a @sa SharedBuffer kept alive by it (a value sent without
+ * copying it) or a literal with static storage.
+ */
+class ReplyPart {
+public:
+  ReplyPart(std::string str) : bytes_(std::move(str)) {}
+  ReplyPart(const char *str) : bytes_(std::string(str)) {}
+  ReplyPart(SharedBuffer buffer) : bytes_(std::move(buffer)) {}
+
+  /**
+   * @brief A part referencing bytes which outlive every reply, e.g. "\r\n".
+   */
+  static ReplyPart literal(std::string_view str) {
+    ReplyPart part(SharedBuffer{});
+    part.bytes_ = str;
+    return part;
+  }
+
+  std::string_view view() const {
+    switch (bytes_.index()) {
+    case 0:
+      return std::get<0>(bytes_);
+    case 1:
+      return std::get<1>(bytes_).view();
+    default:
+      return std::get<2>(bytes_);
+    }
+  }
+  operator std::string_view() const { return view(); }
+  const char *data() const { return view().data(); }
+  std::size_t size() const { return view().size(); }
+
+  std::string_view substr(std::size_t pos,
+                          std::size_t count = std::string_view::npos) const {
+    return view().substr(pos, count);
+  }
+  std::size_t find(std::string_view str, std::size_t pos = 0) const {
+    return view().find(str, pos);
+  }
+  bool starts_with(std::string_view str) const {
+    return view().starts_with(str);
+  }
+
+  bool operator==(std::string_view other) const { return view() == other; }
+
+  friend std::ostream &operator<<(std::ostream &os, const ReplyPart &part) {
+    return os << part.view();
+  }
+
+private:
+  std::variant<std::string, SharedBuffer, std::string_view> bytes_;
+};
+
+} // namespace Redis
+
+#endif
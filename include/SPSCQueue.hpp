@@ -0,0 +1,95 @@
+#ifndef __REDIS_SERVER_SPSC_QUEUE_HPP__
+#define __REDIS_SERVER_SPSC_QUEUE_HPP__
+#include <atomic>
+#include <cstddef>
+#include <new>
+#include <utility>
+#include <vector>
+
+namespace Redis {
+
+/**
+ * @brief Bounded lock-free single producer single consumer ring buffer.
+ *
+ * Exactly one thread may push and exactly one (other) thread may pop. The
+ * producer and consumer indices live on separate cache lines, each side also
+ * caches the other side's index so the shared line is only read when the
+ * queue looks full (or empty).
+ *
+ * @tparam T Element type, must be default constructible and movable.
+ */
+template <typename T> class SPSCQueue {
+public:
+  /**
+   * @brief Construct a queue holding at least `capacity` elements, the
+   * capacity is rounded up to a power of two.
+   */
+  explicit SPSCQueue(std::size_t capacity) {
+    std::size_t size = 1;
+    while (size < capacity) {
+      size <<= 1;
+    }
+    buffer_.resize(size);
+    mask_ = size - 1;
+  }
+
+  /**
+   * @brief Push an element, producer side only.
+   *
+   * @return false if the queue is full, the value isn't moved from then.
+   */
+  bool tryPush(T &&value) {
+    const std::size_t tail = tail_.load(std::memory_order_relaxed);
+    if (tail - headCache_ > mask_) {
+      headCache_ = head_.load(std::memory_order_acquire);
+      if (tail - headCache_ > mask_) {
+        return false;
+      }
+    }
+    buffer_[tail & mask_] = std::move(value);
+    tail_.store(tail + 1, std::memory_order_release);
+    return true;
+  }
+
+  /**
+   * @brief Pop the oldest element, consumer side only.
+   *
+   * @return false if the queue is empty.
+   */
+  bool tryPop(T &value) {
+    const std::size_t head = head_.load(std::memory_order_relaxed);
+    if (head == tailCache_) {
+      tailCache_ = tail_.load(std::memory_order_acquire);
+      if (head == tailCache_) {
+        return false;
+      }
+    }
+    value = std::move(buffer_[head & mask_]);
+    buffer_[head & mask_] = T{};
+    head_.store(head + 1, std::memory_order_release);
+    return true;
+  }
+
+  /**
+   * @brief Whether the queue holds no element, exact only from the consumer.
+   */
+  bool empty() const {
+    return head_.load(std::memory_order_acquire) ==
+           tail_.load(std::memory_order_acquire);
+  }
+
+private:
+  static constexpr std::size_t CacheLine = 64;
+
+  std::vector<T> buffer_;
+  std::size_t mask_ = 0;
+  // Consumer side
+  alignas(CacheLine) std::atomic<std::size_t> head_ = 0;
+  std::size_t tailCache_ = 0;
+  // Producer side
+  alignas(CacheLine) std::atomic<std::size_t> tail_ = 0;
+  std::size_t headCache_ = 0;
+};
+} // namespace Redis
+
+#endif
@@ -0,0 +1,60 @@
+#ifndef __REDIS_SERVER_SAVE_POINTS_HPP__
+#define __REDIS_SERVER_SAVE_POINTS_HPP__
+#include <algorithm>
+#include <charconv>
+#include <cstdint>
+#include <optional>
+#include <string_view>
+#include <vector>
+
+namespace Redis {
+
+/**
+ * @brief A snapshot is taken once at least `changes` changes of the keyspace
+ * happened and `seconds` passed since the last one, like redis' save config.
+ */
+struct SavePoint {
+  std::uint64_t seconds = 0;
+  std::uint64_t changes = 0;
+};
+
+/**
+ * @brief Parse a save config: pairs of "<seconds> <changes>".
+ *
+ * @param config E.g. "3600 1 300 100 60 10000", empty to disable the
+ * automatic snapshots.
+ * @return std::optional<std::vector<SavePoint>> std::nullopt for an invalid
+ * config.
+ */
+inline std::optional<std::vector<SavePoint>>
+parseSavePoints(std::string_view config) {
+  std::vector<SavePoint> points;
+  std::uint64_t numbers[2];
+  std::size_t fields = 0;
+  while (!config.empty()) {
+    std::size_t start = config.find_first_not_of(' ');
+    if (start == std::string_view::npos) {
+      break;
+    }
+    config.remove_prefix(start);
+    std::size_t end = std::min(config.find(' '), config.size());
+    auto [ptr, error] =
+        std::from_chars(config.data(), config.data() + end, numbers[fields]);
+    if (error != std::errc() || ptr != config.data() + end) {
+      return std::nullopt;
+    }
+    config.remove_prefix(end);
+    if (++fields == 2) {
+      points.push_back({numbers[0], numbers[1]});
+      fields = 0;
+    }
+  }
+  if (fields != 0) {
+    return std::nullopt;
+  }
+  return points;
+}
+
+} // namespace Redis
+
+#endif
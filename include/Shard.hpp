@@ -0,0 +1,327 @@
+#ifndef __REDIS_SERVER_SHARD_HPP__
+#define __REDIS_SERVER_SHARD_HPP__
+#include "Eviction.hpp"
+#include "RadixTree.hpp"
+#include "SPSCQueue.hpp"
+#include "Types.hpp"
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <random>
+#include <string>
+#include <string_view>
+#include <thread>
+#include <vector>
+
+namespace Redis {
+
+/**
+ * @brief A partition of the keyspace with its own @sa Database.
+ *
+ * A shard is used in one of two ways:
+ * - Shared: the server has a single shard which the I/O threads access
+ *   directly while holding its lock.
+ * - Owned: after @sa start the shard is served by its own thread. Other
+ *   threads never touch its data, they @sa submit tasks through lock-free
+ *   SPSC queues (one per producer thread) and the owner runs them in order.
+ */
+class Shard {
+public:
+  using Task = std::function<void()>;
+
+  /**
+   * @brief Number of producer threads getting their own SPSC queue at a time,
+   * threads beyond that share one queue guarded by a mutex.
+   */
+  static constexpr std::size_t MaxProducers = 64;
+
+  /**
+   * @brief Capacity of each producer queue. A producer waits for the tasks it
+   * submitted, so it rarely has more than one in flight per shard.
+   */
+  static constexpr std::size_t QueueCapacity = 16;
+
+  explicit Shard(std::size_t id);
+
+  /**
+   * @brief The queue index of the calling thread, taken on its first submit
+   * and freed when it exits. @sa MaxProducers when all of them are taken.
+   */
+  static std::size_t producerSlot();
+
+  /**
+   * @brief Stops the owner thread if it's running.
+   */
+  ~Shard();
+
+  Shard(const Shard &) = delete;
+  Shard &operator=(const Shard &) = delete;
+
+  /**
+   * @brief Start the owner thread, from now on the data is only accessed
+   * through @sa submit.
+   */
+  void start();
+
+  /**
+   * @brief Run the pending tasks and stop the owner thread.
+   */
+  void stop();
+
+  /**
+   * @brief Is the shard served by its own thread.
+   */
+  bool owned() const { return thread_.joinable(); }
+
+  /**
+   * @brief Queue a task to run on the owner thread. Tasks from the same
+   * producer thread run in submission order.
+   *
+   * @param task The task to run.
+   */
+  void submit(Task task);
+
+  /**
+   * @brief Lock the shard's data for the calling thread. This is a no-op for
+   * owned shards, only the owner thread touches their data.
+   */
+  std::unique_lock<std::mutex> lock() {
+    if (owned()) {
+      return std::unique_lock<std::mutex>(mutex_, std::defer_lock);
+    }
+    return std::unique_lock<std::mutex>(mutex_);
+  }
+
+  /**
+   * @brief The keyspace partition of this shard. Records must be written
+   * through @sa set so their expiry and key are indexed.
+   */
+  Database &data() { return data_; }
+
+  /**
+   * @brief Find a record, an expired one is deleted instead.
+   *
+   * The keyspace functions must be called with the shard's lock held or on
+   * the owner thread.
+   *
+   * @param key The record key.
+   * @param touch Update the access metadata used by the eviction.
+   * @return Record* The record, nullptr if the key doesn't exist.
+   */
+  Record *find(std::string_view key, bool touch = true);
+
+  /**
+   * @brief Insert or replace a record and index its expiry.
+   */
+  void set(std::string_view key, Record record);
+
+  /**
+   * @brief Delete a key.
+   *
+   * @return bool False if the key doesn't exist.
+   */
+  bool erase(std::string_view key);
+
+  /**
+   * @brief Set the expiry of an existing key, a time in the past deletes it.
+   *
+   * @param expiry Unix time in milliseconds.
+   * @return bool False if the key doesn't exist.
+   */
+  bool expire(std::string_view key, std::int64_t expiry);
+
+  /**
+   * @brief Remove the expiry of a key.
+   *
+   * @return bool False if the key doesn't exist or has no expiry.
+   */
+  bool persist(std::string_view key);
+
+  /**
+   * @brief Delete every key, e.g. before a replica loads the snapshot of its
+   * master.
+   */
+  void clear();
+
+  /**
+   * @brief The index of the keys having an expiry.
+   */
+  const ExpiryIndex &expiries() const { return expiries_; }
+
+  /**
+   * @brief Outcome of an @sa activeExpire run.
+   */
+  struct ExpireStats {
+    std::size_t expired = 0;
+    bool timedOut = false;
+  };
+
+  /**
+   * @brief Delete the keys whose expiry passed by walking the expiry index up
+   * to now. Keys left when the deadline is reached are deleted by the next
+   * run.
+   *
+   * @param deadline Time budget of this run.
+   * @return ExpireStats Deleted keys.
+   */
+  ExpireStats activeExpire(std::chrono::steady_clock::time_point deadline);
+
+  /**
+   * @brief Keys deleted because they expired, lazily or by @sa activeExpire.
+   * Safe to read from any thread.
+   */
+  std::uint64_t expiredKeys() const {
+    return expiredKeys_.load(std::memory_order_relaxed);
+  }
+
+  /**
+   * @brief Changes of the keyspace since the shard was created: sets,
+   * deletions, expiry updates and expired or evicted keys. The snapshots are
+   * scheduled from it. Safe to read from any thread.
+   */
+  std::uint64_t changes() const {
+    return changes_.load(std::memory_order_relaxed);
+  }
+
+  /**
+   * @brief Set the eviction policy, safe to call from any thread.
+   */
+  void setEvictionPolicy(EvictionPolicy policy) {
+    policy_.store(policy, std::memory_order_relaxed);
+  }
+
+  /**
+   * @brief Evict keys until the memory used is under the limit.
+   *
+   * Candidates are found by sampling keys from random positions of the table
+   * and the best of them are kept in an @sa EvictionPool.
+   *
+   * @param limit Memory limit in bytes.
+   * @param samples Keys sampled for every eviction.
+   * @param evicted If not null, the evicted keys are appended to it so their
+   * deletion can be propagated.
+   * @return bool False if the memory is still over the limit, nothing can be
+   * evicted with the policy.
+   */
+  bool evictIfNeeded(std::size_t limit, std::size_t samples,
+                     std::vector<std::string> *evicted = nullptr);
+
+  /**
+   * @brief Memory used by the records, see @sa entryBytes. Safe to read from
+   * any thread.
+   */
+  std::size_t usedMemory() const {
+    return usedMemory_.load(std::memory_order_relaxed);
+  }
+
+  /**
+   * @brief Keys deleted by @sa evictIfNeeded. Safe to read from any thread.
+   */
+  std::uint64_t evictedKeys() const {
+    return evictedKeys_.load(std::memory_order_relaxed);
+  }
+
+  /**
+   * @brief Memory accounted for a record: its slot in the table, the heap
+   * memory of the key and value and its expiry timer. The slack of the table
+   * isn't accounted for, evicting a key must lower the usage.
+   */
+  static std::size_t entryBytes(std::string_view key, const Record &record);
+
+  /**
+   * @brief Build or drop the prefix index of the keys, @sa prefixIndex.
+   */
+  void setPrefixIndex(bool enabled);
+
+  /**
+   * @brief The ordered index of the keys, null if disabled.
+   */
+  const RadixTree *prefixIndex() const { return prefixIndex_.get(); }
+
+  std::size_t id() const { return id_; }
+
+private:
+  /**
+   * @brief The owner thread loop, polls the producer queues and sleeps when
+   * all of them stayed empty for a while.
+   */
+  void run();
+
+  /**
+   * @brief Run every task currently queued.
+   *
+   * @return bool True if at least one task ran.
+   */
+  bool drain();
+
+  /**
+   * @brief Wake up the owner thread if it's sleeping.
+   */
+  void notify();
+
+  /**
+   * @brief Delete a record and its expiry timer.
+   */
+  void erase(Database::iterator it);
+
+  /**
+   * @brief Evict the best candidate of the pool after a new sampling.
+   *
+   * @return bool False if there was no candidate.
+   */
+  bool evictOne(std::size_t samples, std::vector<std::string> *evicted);
+
+  void addChanges(std::uint64_t changes) {
+    changes_.store(changes_.load(std::memory_order_relaxed) + changes,
+                   std::memory_order_relaxed);
+  }
+
+  void addMemory(std::ptrdiff_t bytes) {
+    usedMemory_.store(usedMemory_.load(std::memory_order_relaxed) + bytes,
+                      std::memory_order_relaxed);
+  }
+
+  std::size_t id_;
+  Database data_;
+  ExpiryIndex expiries_;
+  std::atomic<std::uint64_t> expiredKeys_ = 0;
+  /**
+   * @brief Only written by the owner thread (or under the lock).
+   */
+  std::atomic<std::size_t> usedMemory_ = 0;
+  /**
+   * @brief Only written by the owner thread (or under the lock).
+   */
+  std::atomic<std::uint64_t> changes_ = 0;
+  std::atomic<std::uint64_t> evictedKeys_ = 0;
+  std::atomic<EvictionPolicy> policy_ = EvictionPolicy::NOEVICTION;
+  EvictionPool pool_;
+  /**
+   * @brief Policy the pool's scores were computed with.
+   */
+  EvictionPolicy poolPolicy_ = EvictionPolicy::NOEVICTION;
+  std::minstd_rand rng_;
+  /**
+   * @brief Every key of data_ when enabled, maintained by the keyspace
+   * functions.
+   */
+  std::unique_ptr<RadixTree> prefixIndex_;
+  std::mutex mutex_;
+  std::vector<std::unique_ptr<SPSCQueue<Task>>> queues_;
+  /**
+   * @brief Queue shared by the producers without a slot of their own.
+   */
+  std::vector<Task> sharedQueue_;
+  std::mutex sharedQueueMutex_;
+  std::atomic<bool> hasShared_ = false;
+  std::atomic<bool> running_ = false;
+  std::atomic<bool> sleeping_ = false;
+  std::atomic<std::uint32_t> wakeups_ = 0;
+  std::thread thread_;
+};
+} // namespace Redis
+
+#endif
@@ -0,0 +1,104 @@
+#ifndef __REDIS_SERVER_SHARED_BUFFER_HPP__
+#define __REDIS_SERVER_SHARED_BUFFER_HPP__
+#include <atomic>
+#include <cstdint>
+#include <cstring>
+#include <new>
+#include <string_view>
+#include <utility>
+
+namespace Redis {
+
+/**
+ * @brief Immutable bytes with an atomic reference count, the count and the
+ * size are stored in front of the bytes in a single allocation.
+ *
+ * Copies share the bytes, so a value can be handed to a pending socket write
+ * without copying it and stays alive until the write completes even if the
+ * key is overwritten or deleted meanwhile, possibly on another thread.
+ */
+class SharedBuffer {
+public:
+  SharedBuffer() = default;
+  SharedBuffer(const SharedBuffer &other) : header_(other.header_) {
+    if (header_) {
+      header_->refs.fetch_add(1, std::memory_order_relaxed);
+    }
+  }
+  SharedBuffer(SharedBuffer &&other) noexcept
+      : header_(std::exchange(other.header_, nullptr)) {}
+  SharedBuffer &operator=(SharedBuffer other) noexcept {
+    std::swap(header_, other.header_);
+    return *this;
+  }
+  ~SharedBuffer() {
+    if (header_ && header_->refs.fetch_sub(1, std::memory_order_acq_rel) == 1) {
+      header_->~Header();
+      ::operator delete(header_);
+    }
+  }
+
+  /**
+   * @brief Allocate a buffer holding a copy of `bytes`.
+   */
+  static SharedBuffer copyOf(std::string_view bytes) {
+    SharedBuffer buffer = allocate(bytes.size());
+    std::memcpy(buffer.mutableData(), bytes.data(), bytes.size());
+    return buffer;
+  }
+
+  /**
+   * @brief Allocate an uninitialized buffer of `size` bytes, to be filled
+   * with @sa mutableData before it's shared.
+   */
+  static SharedBuffer allocate(std::size_t size) {
+    void *memory = ::operator new(sizeof(Header) + size);
+    SharedBuffer buffer;
+    buffer.header_ = new (memory) Header{{1}, size};
+    return buffer;
+  }
+
+  /**
+   * @brief Writable bytes, e.g. to read a payload straight into the buffer.
+   * Only while no other copy exists, the bytes are immutable once shared.
+   */
+  char *mutableData() {
+    return header_ ? reinterpret_cast<char *>(header_ + 1) : nullptr;
+  }
+
+  std::string_view view() const {
+    if (!header_) {
+      return {};
+    }
+    return std::string_view(reinterpret_cast<const char *>(header_ + 1),
+                            header_->size);
+  }
+  const char *data() const { return view().data(); }
+  std::size_t size() const { return header_ ? header_->size : 0; }
+
+  /**
+   * @brief Bytes allocated for the buffer.
+   */
+  std::size_t allocatedBytes() const {
+    return header_ ? sizeof(Header) + header_->size : 0;
+  }
+
+  /**
+   * @brief Number of copies sharing the bytes.
+   */
+  std::uint32_t useCount() const {
+    return header_ ? header_->refs.load(std::memory_order_relaxed) : 0;
+  }
+
+private:
+  struct Header {
+    std::atomic<std::uint32_t> refs;
+    std::size_t size;
+  };
+
+  Header *header_ = nullptr;
+};
+
+} // namespace Redis
+
+#endif
@@ -3,7 +3,11 @@
 #include "Logging.hpp"
 #include <asio.hpp>
 #include <asio/post.hpp>
+#include <cstring>
 #include <functional>
+#include <optional>
+#include <string_view>
+#include <vector>
 using asio::ip::tcp;
 
 /**
@@ -14,6 +18,24 @@ using asio::ip::tcp;
  */
 class TCPClient : public std::enable_shared_from_this<TCPClient> {
 public:
+  /**
+   * @brief What a stream handler did with the received bytes, @sa listen.
+   */
+  struct Turn {
+    /**
+     * @brief Bytes handled from the start of the received bytes.
+     */
+    std::size_t consumed;
+    /**
+     * @brief The handler stopped at its budget, it's called again with the
+     * rest once the other handlers of the io context had their turn.
+     */
+    bool exhausted;
+  };
+
+  using StreamHandler = std::function<std::optional<Turn>(std::string_view)>;
+  using CloseHandler = std::function<void(const std::error_code &)>;
+
   TCPClient(asio::io_context &io_context, std::string ip, int port)
       : ioContext_(io_context), socket_(ioContext_) {
     tcp::resolver resolver(ioContext_);
@@ -100,6 +122,24 @@ public:
                            });
   }
 
+  /**
+   * @brief Starts asynchronously handling the stream of bytes received from
+   * the server, e.g. the commands a master propagates to its replica.
+   *
+   * The handler is given every byte received and not consumed yet, the bytes
+   * of a partial message are kept for the next read. When it stops at its
+   * budget the rest is handed to it again from a posted handler, so a
+   * long burst doesn't hold the io context's other connections back.
+   *
+   * @param handler Returns the handled bytes, std::nullopt to stop listening.
+   * @param onClose Called once the connection is closed or fails.
+   */
+  void listen(StreamHandler handler, CloseHandler onClose = {}) {
+    streamHandler_ = std::move(handler);
+    closeHandler_ = std::move(onClose);
+    readStream();
+  }
+
   /**
    * @brief Sets the callback function for handling received messages.
    *
@@ -117,6 +157,46 @@ public:
   }
 
 private:
+  void readStream() {
+    if (streamBuffer_.size() - streamLength_ < StreamReadSize) {
+      streamBuffer_.resize(streamLength_ + StreamReadSize);
+    }
+    socket_.async_read_some(
+        asio::buffer(streamBuffer_.data() + streamLength_,
+                     streamBuffer_.size() - streamLength_),
+        [self = shared_from_this()](const std::error_code &error,
+                                    std::size_t bytes) {
+          if (error) {
+            LOG_ERROR("Receiving failed {}", error.message());
+            if (self->closeHandler_) {
+              self->closeHandler_(error);
+            }
+            return;
+          }
+          self->streamLength_ += bytes;
+          self->handleStream();
+        });
+  }
+
+  void handleStream() {
+    std::optional<Turn> turn = streamHandler_(
+        std::string_view(streamBuffer_.data(), streamLength_));
+    if (!turn) {
+      return;
+    }
+    std::memmove(streamBuffer_.data(), streamBuffer_.data() + turn->consumed,
+                 streamLength_ - turn->consumed);
+    streamLength_ -= turn->consumed;
+    if (turn->exhausted && streamLength_ > 0) {
+      asio::post(ioContext_,
+                 [self = shared_from_this()] { self->handleStream(); });
+      return;
+    }
+    readStream();
+  }
+
+  static constexpr std::size_t StreamReadSize = 16 * 1024;
+
   std::function<void(const std::string &)> callback;
   /**
    * @brief Reference to the Asio io_context used for asynchronous operations.
@@ -128,6 +208,10 @@ private:
    */
   tcp::socket socket_;
   asio::streambuf recvMsg_;
+  StreamHandler streamHandler_;
+  CloseHandler closeHandler_;
+  std::vector<char> streamBuffer_;
+  std::size_t streamLength_ = 0;
 };
 
 #endif
\ No newline at end of file
@@ -1,115 +1,411 @@
 #ifndef __TCP_CONNECTION_HPP__
 #define __TCP_CONNECTION_HPP__
+#include "Connection.hpp"
+#include "HandlerAllocator.hpp"
 #include "Logging.hpp"
 #include "RedisServer.hpp"
+#include <algorithm>
 #include <asio.hpp>
+#include <asio/awaitable.hpp>
+#include <asio/co_spawn.hpp>
+#include <asio/detached.hpp>
 #include <asio/post.hpp>
-#include <functional>
+#include <asio/redirect_error.hpp>
+#include <asio/use_awaitable.hpp>
+#include <atomic>
+#include <chrono>
+#include <cstring>
 #include <memory>
 #include <optional>
-#include <queue>
+#include <span>
 #include <string>
+#include <vector>
 using asio::ip::tcp;
-class TCPConnection : public std::enable_shared_from_this<TCPConnection> {
+
+/**
+ * @brief A client connection served by two coroutines on its event loop: one
+ * reads and executes the commands, the other writes their replies.
+ *
+ * The coroutines share the connection's state without locking since they run
+ * on the same thread, and their operations get their memory from a
+ * @sa HandlerMemory, so the steady state request loop doesn't allocate.
+ *
+ * @tparam Protocol The stream protocol of the socket, TCP or a Unix domain
+ * socket.
+ */
+template <typename Protocol>
+class SocketConnection
+    : public Connection,
+      public std::enable_shared_from_this<SocketConnection<Protocol>> {
 public:
-  using SharedPtr = std::shared_ptr<TCPConnection>;
-  TCPConnection(asio::io_context &io_context, Redis::Server::SharedPtr redisPtr)
-      : rServer(redisPtr), ioContext(io_context), socket_(ioContext) {}
+  using SharedPtr = std::shared_ptr<SocketConnection>;
+  using Socket = typename Protocol::socket;
+
+  /**
+   * @brief Initial size of the read buffer, it grows when a single command
+   * doesn't fit in it.
+   */
+  static constexpr std::size_t ReadBufferSize = 16 * 1024;
 
   /**
-   * @brief Create a new TCPConnection giving the asio context and
+   * @brief Bulk strings from this size are read with a single exact length
+   * read straight into the buffer the value is stored in, instead of growing
+   * the read buffer.
+   */
+  static constexpr std::size_t BigBulkSize = 32 * 1024;
+
+  SocketConnection(asio::io_context &io_context,
+                   Redis::Server::SharedPtr redisPtr)
+      : Connection(std::move(redisPtr)), ioContext(io_context),
+        socket_(ioContext), writeSignal_(ioContext), readSignal_(ioContext),
+        recvBuf_(ReadBufferSize) {
+    writeSignal_.expires_at(asio::steady_timer::time_point::max());
+    readSignal_.expires_at(asio::steady_timer::time_point::max());
+  }
+
+  /**
+   * @brief Create a new connection giving the asio context and
    * the Redis server.
    *
    * @param io_context asio context.
    * @param redisPtr Redis server.
-   * @return SharedPtr Ptr to the created TCPConnection.
+   * @return SharedPtr Ptr to the created connection.
    */
   static SharedPtr create(asio::io_context &io_context,
                           Redis::Server::SharedPtr redisPtr) {
-    auto ptr = std::make_shared<TCPConnection>(io_context, redisPtr);
-    ptr->setClientId(redisPtr->registerClient(ptr->weak_from_this()));
-    return ptr;
+    return std::make_shared<SocketConnection>(io_context, redisPtr);
   }
 
   /**
-   * @brief Get the TCP socket.
+   * @brief Get the socket.
    *
-   * @return tcp::socket& reference to the underlying tcp socket.
+   * @return Socket& reference to the underlying socket.
    */
-  tcp::socket &socket() { return socket_; }
+  Socket &socket() { return socket_; }
 
   /**
-   * @brief Start reading messages from the socket.
+   * @brief Register the connected client with the server and start the read
+   * and write coroutines, each of them keeps the connection alive.
    *
    */
   void start() {
-    asio::async_read_until(socket_, recvMsg_, "\r\n",
-                           std::bind(&TCPConnection::handle_new_message,
-                                     shared_from_this(),
-                                     std::placeholders::_1));
+    asio::error_code ignored;
+    addr_ = endpointName(socket_.remote_endpoint(ignored));
+    laddr_ = endpointName(socket_.local_endpoint(ignored));
+    setClientId(rServer->registerClient(this->weak_from_this()));
+    asio::co_spawn(
+        socket_.get_executor(),
+        [self = this->shared_from_this()] { return self->read_loop(); },
+        asio::detached);
+    asio::co_spawn(
+        socket_.get_executor(),
+        [self = this->shared_from_this()] { return self->write_loop(); },
+        asio::detached);
+  }
+
+  void send_message(const std::string &msg) override {
+    LOG_DEBUG("Sending {} bytes to client {}", msg.size(), clientId);
+    asio::post(socket_.get_executor(),
+               [self = this->shared_from_this(), msg]() {
+                 if (self->closed_) {
+                   return;
+                 }
+                 self->pendingReplies_.push_back(msg);
+                 self->outputBytes_ += msg.size();
+                 if (self->check_output_limit()) {
+                   self->writeSignal_.cancel();
+                 }
+               });
   }
-  void setClientId(std::size_t id) { clientId = id; }
 
-  void send_message(const std::string &msg) {
-    LOG_INFO("Sending message: {}", msg);
-    asio::async_write(socket_, asio::buffer(msg),
-                      [](const asio::error_code &ec, size_t) {});
+  void kill() override {
+    asio::post(socket_.get_executor(),
+               [self = this->shared_from_this()]() { self->close(); });
   }
 
 private:
-  std::size_t clientId = 0;
-  void handle_new_message(const std::error_code &error) {
-    std::string messageStr =
-        std::string((std::istreambuf_iterator<char>(&recvMsg_)),
-                    std::istreambuf_iterator<char>());
-    LOG_INFO("Received a new message {}", messageStr);
-    if (messageStr.empty()) {
-      asio::post(ioContext,
-                 std::bind(&TCPConnection::start, shared_from_this()));
-      return;
+  static std::string endpointName(const asio::ip::tcp::endpoint &endpoint) {
+    return endpoint.address().to_string() + ":" +
+           std::to_string(endpoint.port());
+  }
+
+  /**
+   * @brief The socket's path, with port 0 like redis. Clients' ends are
+   * unnamed, they get the server's path.
+   */
+  std::string endpointName(
+      const asio::local::stream_protocol::endpoint &endpoint) const {
+    std::string path = endpoint.path();
+    if (path.empty()) {
+      asio::error_code ignored;
+      path = socket_.local_endpoint(ignored).path();
     }
-    std::optional<Redis::Server::Reply> message =
-        rServer->handleRequest(messageStr, clientId); //"+PONG\r\n";
-    if (!message) {
-      LOG_DEBUG("no message to send. ");
-      asio::post(ioContext,
-                 std::bind(&TCPConnection::start, shared_from_this()));
+    return path + ":0";
+  }
+
+  /**
+   * @brief Completion token of the connection's operations: the coroutine
+   * resumes with the operation's error in `error`. With asio 1.22 or newer
+   * the operations are allocated from @sa handlerMemory_, older versions
+   * recycle them per thread.
+   */
+  auto token(asio::error_code &error) {
+#if defined(ASIO_VERSION) && ASIO_VERSION >= 102200
+    return asio::bind_allocator(
+        HandlerAllocator<void>(handlerMemory_),
+        asio::redirect_error(asio::use_awaitable, error));
+#else
+    return asio::redirect_error(asio::use_awaitable, error);
+#endif
+  }
+
+  /**
+   * @brief Close the socket once and remove the client from the server, the
+   * coroutines wake up and return.
+   */
+  void close() {
+    if (closed_) {
       return;
     }
-    LOG_INFO("Sending REPLY with {} messages ", message->size());
-    for (const auto &msg : *message) {
-      msgsQ_.push(msg);
+    closed_ = true;
+    pendingReplies_.clear();
+    outputBytes_ = inFlightBytes_;
+    asio::error_code ignored;
+    socket_.shutdown(asio::socket_base::shutdown_both, ignored);
+    socket_.close(ignored);
+    writeSignal_.cancel();
+    readSignal_.cancel();
+    rServer->unregisterClient(clientId);
+  }
+
+  /**
+   * @brief Read the requests and execute the complete commands of the read
+   * buffer, the bytes of a partial command are kept for the next read. Reads
+   * pause while the output is backed up.
+   *
+   * A long pipeline is executed one turn budget at a time, the connection
+   * goes to the back of the event loop's queue between two turns.
+   */
+  asio::awaitable<void> read_loop() {
+    asio::error_code error;
+    while (!closed_) {
+      if (outputBytes_ >= OutputPauseSize) {
+        LOG_DEBUG("Client {} output is backed up, pausing its reads",
+                  clientId);
+        co_await readSignal_.async_wait(token(error));
+        continue;
+      }
+      if (turnExhausted_) {
+        co_await asio::post(socket_.get_executor(), asio::use_awaitable);
+        if (closed_ || !execute()) {
+          co_return;
+        }
+        continue;
+      }
+      std::size_t bytes = 0;
+      if (std::size_t remaining = prepare_bulk(); remaining > 0) {
+        bytes = co_await asio::async_read(
+            socket_,
+            asio::buffer(bulk_.payload.mutableData() +
+                             bulk_.payload.size() - remaining,
+                         remaining),
+            token(error));
+        if (!error) {
+          // The frame completes with the bytes following the payload
+          netIn_ += bytes;
+          touch();
+          continue;
+        }
+      } else {
+        if (recvBuf_.size() - recvLen_ < ReadBufferSize / 2) {
+          recvBuf_.resize(recvBuf_.size() * 2);
+        }
+        bytes = co_await socket_.async_read_some(
+            asio::buffer(recvBuf_.data() + recvLen_,
+                         recvBuf_.size() - recvLen_),
+            token(error));
+        recvLen_ += bytes;
+      }
+      if (error) {
+        LOG_DEBUG("Client {} read failed {}", clientId, error.message());
+        close();
+        co_return;
+      }
+      netIn_ += bytes;
+      touch();
+      if (!execute()) {
+        co_return;
+      }
+    }
+  }
+
+  /**
+   * @brief Execute the complete commands of the read buffer, up to the turn
+   * budget of the client's class, and queue their replies for the writer.
+   *
+   * @return bool False if the connection stops reading.
+   */
+  bool execute() {
+    std::size_t queued = pendingReplies_.size();
+    std::size_t executed = 0;
+    Redis::Server::TurnBudget budget = rServer->turnBudget(clientClass_);
+    std::optional<std::size_t> consumed = rServer->handleBuffer(
+        std::string_view(recvBuf_.data(), recvLen_), pendingReplies_, clientId,
+        bulk_.offset != 0 ? &bulk_ : nullptr, &executed, &budget);
+    commands_ += executed;
+    for (std::size_t i = queued; i < pendingReplies_.size(); ++i) {
+      outputBytes_ += pendingReplies_[i].size();
+    }
+    if (!consumed) {
+      LOG_ERROR("Protocol error from client {}, closing the connection",
+                clientId);
+      pendingReplies_.push_back("-ERR Protocol error\r\n");
+      closeAfterWrite_ = true;
+      writeSignal_.cancel();
+      return false;
+    }
+    if (*consumed > 0) {
+      std::memmove(recvBuf_.data(), recvBuf_.data() + *consumed,
+                   recvLen_ - *consumed);
+      recvLen_ -= *consumed;
+      // The frame owning the external payload was the first one.
+      bulk_ = {};
     }
+    // The rest of the buffer may hold complete commands
+    turnExhausted_ = recvLen_ > 0 && (executed >= budget.commands ||
+                                      *consumed >= budget.bytes);
+    queryBuffer_ = recvLen_;
+    queryBufferFree_ = recvBuf_.size() - recvLen_;
+    if (!check_output_limit()) {
+      return false;
+    }
+    if (pendingReplies_.size() > queued) {
+      writeSignal_.cancel();
+    }
+    return true;
+  }
 
-    // send_new_msg(asio::error_code(0, std::generic_category()), 0);
-    asio::post(ioContext,
-               std::bind(&TCPConnection::send_new_msg, shared_from_this(),
-                         asio::error_code(0, std::generic_category()), 0));
+  /**
+   * @brief Disconnect the client if its output is over the limit of its
+   * class, @sa Redis::OutputBufferLimit.
+   *
+   * @return bool False if the client was disconnected.
+   */
+  bool check_output_limit() {
+    if (outputLimitExceeded()) {
+      close();
+      return false;
+    }
+    return true;
   }
 
-  void send_new_msg(const asio::error_code &ec, size_t) {
-    if (msgsQ_.empty() && !ec) {
-      start();
-    } else {
-      std::string messageAsString = msgsQ_.front();
-      msgsQ_.pop();
-      LOG_INFO("Sending message: {}", messageAsString);
-      asio::async_write(socket_, asio::buffer(messageAsString),
-                        std::bind(&TCPConnection::send_new_msg,
-                                  shared_from_this(), std::placeholders::_1,
-                                  std::placeholders::_2));
+  /**
+   * @brief When the partial frame ends inside a big bulk string, allocate its
+   * whole payload once so the rest of it is read with an exact length read.
+   * The frame's header stays in the read buffer and the bytes following the
+   * payload are read into it again.
+   *
+   * @return std::size_t Bytes of the payload still to read, 0 to read into
+   * the read buffer.
+   */
+  std::size_t prepare_bulk() {
+    if (bulk_.offset != 0 || recvLen_ == 0) {
+      return 0;
+    }
+    std::vector<std::string_view> args;
+    RESP::ParseResult result = RESP::parseCommand(
+        std::string_view(recvBuf_.data(), recvLen_), args);
+    if (result.status != RESP::ParseStatus::INCOMPLETE ||
+        result.bulkLength < BigBulkSize) {
+      return 0;
     }
+    std::size_t received =
+        std::min(recvLen_ - result.bulkOffset, result.bulkLength);
+    bulk_.offset = result.bulkOffset;
+    bulk_.payload = Redis::SharedBuffer::allocate(result.bulkLength);
+    std::memcpy(bulk_.payload.mutableData(), recvBuf_.data() + bulk_.offset,
+                received);
+    std::memmove(recvBuf_.data() + bulk_.offset,
+                 recvBuf_.data() + bulk_.offset + received,
+                 recvLen_ - bulk_.offset - received);
+    recvLen_ -= received;
+    return result.bulkLength - received;
   }
 
-  void handle_write(const asio::error_code &ec, size_t) {
-    if (!ec) {
-      start();
+  /**
+   * @brief Write all the pending replies with a single gathered write, replies
+   * queued while it's in flight go out with the next one. The in flight parts
+   * keep the values they reference alive until the write completes.
+   */
+  asio::awaitable<void> write_loop() {
+    asio::error_code error;
+    while (!closed_) {
+      if (pendingReplies_.empty()) {
+        if (closeAfterWrite_) {
+          close();
+          co_return;
+        }
+        // Woken up by cancel() when there is something to write
+        co_await writeSignal_.async_wait(token(error));
+        continue;
+      }
+      inFlightReplies_.swap(pendingReplies_);
+      writeBuffers_.clear();
+      inFlightBytes_ = 0;
+      for (const auto &reply : inFlightReplies_) {
+        writeBuffers_.push_back(asio::buffer(reply.data(), reply.size()));
+        inFlightBytes_ += reply.size();
+      }
+      LOG_DEBUG("Sending REPLY with {} messages ", inFlightReplies_.size());
+      // A span, as the operation copies its buffer sequence
+      std::size_t bytes = co_await asio::async_write(
+          socket_, std::span<const asio::const_buffer>(writeBuffers_),
+          token(error));
+      inFlightReplies_.clear();
+      outputBytes_ -= inFlightBytes_;
+      inFlightBytes_ = 0;
+      netOut_ += bytes;
+      if (error) {
+        LOG_DEBUG("Client {} write failed {}", clientId, error.message());
+        close();
+        co_return;
+      }
+      touch();
+      if (outputBytes_ < OutputPauseSize) {
+        readSignal_.cancel();
+      }
     }
   }
-  Redis::Server::SharedPtr rServer;
+
   asio::io_context &ioContext;
-  tcp::socket socket_;
-  asio::streambuf recvMsg_;
-  std::queue<std::string> msgsQ_;
+  Socket socket_;
+  /**
+   * @brief Timers which never expire, cancelling them wakes up the writer
+   * when replies are queued and the reader when the output drained.
+   */
+  asio::steady_timer writeSignal_;
+  asio::steady_timer readSignal_;
+  HandlerMemory handlerMemory_;
+  std::vector<char> recvBuf_;
+  std::size_t recvLen_ = 0;
+  /**
+   * @brief Payload of a big bulk string of the partial frame, read outside of
+   * the read buffer. Its offset is 0 without one.
+   */
+  Redis::Server::ExternalBulk bulk_;
+  /**
+   * @brief The last turn stopped at its budget, the rest of the read buffer is
+   * executed in the next turn before reading again.
+   */
+  bool turnExhausted_ = false;
+  Redis::Server::Reply pendingReplies_;
+  Redis::Server::Reply inFlightReplies_;
+  std::vector<asio::const_buffer> writeBuffers_;
+  bool closeAfterWrite_ = false;
+  std::size_t inFlightBytes_ = 0;
+  bool closed_ = false;
 };
-#endif
\ No newline at end of file
+
+using TCPConnection = SocketConnection<asio::ip::tcp>;
+using UnixConnection = SocketConnection<asio::local::stream_protocol>;
+#endif
@@ -4,20 +4,38 @@
 #include "RedisServer.hpp"
 #include "TCPConnection.hpp"
 #include <asio.hpp>
+#include <filesystem>
+#include <string>
+#include <system_error>
 
 using asio::ip::tcp;
-class TCPServer {
+
+/**
+ * @brief SO_REUSEPORT socket option, lets several acceptors listen on the same
+ * port and the kernel balances the incoming connections between them.
+ */
+using reuse_port =
+    asio::detail::socket_option::boolean<SOL_SOCKET, SO_REUSEPORT>;
+
+/**
+ * @brief Accepts the connections of a listening socket and serves each of
+ * them with a @sa SocketConnection of the same protocol.
+ *
+ * @tparam Protocol The stream protocol, TCP or a Unix domain socket.
+ */
+template <typename Protocol> class SocketServer {
 public:
   /**
-   * @brief Construct a new TCPServer.
+   * @brief Construct a server accepting on a listening acceptor.
    *
    * @param io asio io context.
-   * @param port Port number.
+   * @param acceptor The acceptor, bound and listening.
+   * @param redisServer The redis server handling the requests.
    */
-  explicit TCPServer(asio::io_context &io, int port,
-                     Redis::Server::SharedPtr redisServer)
-      : ioContext_(io), acceptor_(ioContext_, tcp::endpoint(tcp::v4(), port)),
-        redisPtr(redisServer) {}
+  SocketServer(asio::io_context &io, typename Protocol::acceptor acceptor,
+               Redis::Server::SharedPtr redisServer)
+      : ioContext_(io), acceptor_(std::move(acceptor)),
+        redisPtr(std::move(redisServer)) {}
 
   /**
    * @brief Start listening on the port and accept new connections.
@@ -25,8 +43,7 @@ public:
    */
   void start() {
     LOG_INFO("Waiting for client to connect");
-    TCPConnection::SharedPtr newClient =
-        TCPConnection::create(ioContext_, redisPtr);
+    auto newClient = SocketConnection<Protocol>::create(ioContext_, redisPtr);
     acceptor_.async_accept(newClient->socket(),
                            [this, newClient](std::error_code error) {
                              if (!error) {
@@ -39,7 +56,90 @@ public:
 
 private:
   asio::io_context &ioContext_;
-  tcp::acceptor acceptor_;
+  typename Protocol::acceptor acceptor_;
   Redis::Server::SharedPtr redisPtr;
 };
-#endif
\ No newline at end of file
+
+class TCPServer : public SocketServer<tcp> {
+public:
+  /**
+   * @brief Construct a new TCPServer.
+   *
+   * @param io asio io context.
+   * @param port Port number.
+   * @param redisServer The redis server handling the requests.
+   * @param reusePort Set SO_REUSEPORT on the acceptor, so one TCPServer can be
+   * created per event loop on the same port.
+   */
+  explicit TCPServer(asio::io_context &io, int port,
+                     Redis::Server::SharedPtr redisServer,
+                     bool reusePort = false)
+      : SocketServer(io, listen(io, port, reusePort), std::move(redisServer)) {
+  }
+
+private:
+  static tcp::acceptor listen(asio::io_context &io, int port,
+                              bool reusePort) {
+    tcp::acceptor acceptor(io);
+    tcp::endpoint endpoint(tcp::v4(), port);
+    acceptor.open(endpoint.protocol());
+    acceptor.set_option(tcp::acceptor::reuse_address(true));
+    if (reusePort) {
+      acceptor.set_option(reuse_port(true));
+    }
+    acceptor.bind(endpoint);
+    acceptor.listen();
+    return acceptor;
+  }
+};
+
+/**
+ * @brief Serves the clients sharing the host through a Unix domain socket,
+ * sparing them the loopback TCP stack.
+ */
+class UnixServer : public SocketServer<asio::local::stream_protocol> {
+public:
+  using Protocol = asio::local::stream_protocol;
+
+  /**
+   * @brief Construct a new UnixServer, replacing a stale socket file. The
+   * file is removed when the server is destroyed.
+   *
+   * @param io asio io context.
+   * @param path Path of the socket file.
+   * @param permissions Permissions of the socket file, like redis'
+   * unixsocketperm, e.g. 0700 to only let the server's user connect.
+   * @param redisServer The redis server handling the requests.
+   */
+  UnixServer(asio::io_context &io, const std::string &path,
+             std::filesystem::perms permissions,
+             Redis::Server::SharedPtr redisServer)
+      : SocketServer(io, listen(io, path, permissions),
+                     std::move(redisServer)),
+        path_(path) {}
+
+  UnixServer(const UnixServer &) = delete;
+  UnixServer &operator=(const UnixServer &) = delete;
+
+  ~UnixServer() {
+    std::error_code ignored;
+    std::filesystem::remove(path_, ignored);
+  }
+
+private:
+  static Protocol::acceptor listen(asio::io_context &io,
+                                   const std::string &path,
+                                   std::filesystem::perms permissions) {
+    std::error_code ignored;
+    if (std::filesystem::is_socket(path, ignored)) {
+      // Left by a previous run, binding would fail
+      std::filesystem::remove(path, ignored);
+    }
+    Protocol::acceptor acceptor(io, Protocol::endpoint(path));
+    std::filesystem::permissions(path, permissions);
+    return acceptor;
+  }
+
+  std::string path_;
+};
+#endif
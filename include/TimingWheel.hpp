@@ -0,0 +1,261 @@
+#ifndef __REDIS_SERVER_TIMING_WHEEL_HPP__
+#define __REDIS_SERVER_TIMING_WHEEL_HPP__
+#include <algorithm>
+#include <array>
+#include <cstdint>
+#include <type_traits>
+#include <utility>
+#include <vector>
+
+namespace Redis {
+
+/**
+ * @brief Hierarchical timing wheel with millisecond ticks.
+ *
+ * Level 0 has one bucket per millisecond for the next 64ms, every level above
+ * covers 64 times the range of the previous one with 64 times coarser buckets
+ * (6 levels reach ~2 years, later deadlines wait in the last level). When the
+ * time crosses the boundary of a coarse bucket its timers are moved down to
+ * the finer levels, so every timer is moved at most once per level. Spans of
+ * time without timers in the lower levels are skipped at once.
+ *
+ * Timers are nodes of a slab linked in their bucket, adding or cancelling one
+ * is O(1) and the memory is proportional to the number of live timers.
+ *
+ * @tparam T The payload of a timer.
+ */
+template <typename T> class TimingWheel {
+public:
+  using TimerId = std::uint32_t;
+  static constexpr TimerId NoTimer = static_cast<TimerId>(-1);
+
+  static constexpr int SlotBits = 6;
+  static constexpr std::size_t Slots = std::size_t(1) << SlotBits;
+  static constexpr int Levels = 6;
+
+  /**
+   * @brief Construct a wheel whose current time is `nowMs`.
+   */
+  explicit TimingWheel(std::int64_t nowMs = 0) : now_(nowMs) {
+    buckets_.fill(NoTimer);
+    occupied_.fill(0);
+  }
+
+  /**
+   * @brief Number of pending timers.
+   */
+  std::size_t size() const { return size_; }
+
+  /**
+   * @brief The time the wheel was advanced to.
+   */
+  std::int64_t now() const { return now_; }
+
+  /**
+   * @brief Add a timer, a deadline in the past fires on the next @sa advance.
+   *
+   * @param whenMs The deadline in milliseconds.
+   * @param value The payload given back when the timer fires.
+   * @return TimerId Handle to cancel the timer.
+   */
+  TimerId add(std::int64_t whenMs, T value) {
+    TimerId id;
+    if (freeList_ != NoTimer) {
+      id = freeList_;
+      freeList_ = nodes_[id].next;
+      nodes_[id].value = std::move(value);
+    } else {
+      id = static_cast<TimerId>(nodes_.size());
+      nodes_.push_back(Node{std::move(value)});
+    }
+    nodes_[id].when = whenMs;
+    link(id);
+    ++size_;
+    return id;
+  }
+
+  /**
+   * @brief Cancel a pending timer.
+   */
+  void cancel(TimerId id) {
+    unlink(id);
+    release(id);
+  }
+
+  /**
+   * @brief Deadline of a pending timer.
+   */
+  std::int64_t when(TimerId id) const { return nodes_[id].when; }
+
+  /**
+   * @brief Move the time forward to `nowMs` and fire the timers due until
+   * then, in deadline order at the millisecond granularity.
+   *
+   * @param nowMs The new time, going backwards is a no-op.
+   * @param limit Fire at most that many timers, the rest fire on the next
+   * call.
+   * @param fn Called with the payload of every fired timer, or with its
+   * TimerId and payload, it must not add or cancel timers.
+   * @return std::size_t The number of fired timers.
+   */
+  template <typename F>
+  std::size_t advance(std::int64_t nowMs, std::size_t limit, F &&fn) {
+    std::size_t fired = 0;
+    while (true) {
+      TimerId &head = buckets_[bucketOf(0, now_)];
+      while (head != NoTimer) {
+        if (fired == limit) {
+          return fired;
+        }
+        TimerId id = head;
+        unlink(id);
+        if constexpr (std::is_invocable_v<F &, TimerId, T &>) {
+          fn(id, nodes_[id].value);
+        } else {
+          fn(nodes_[id].value);
+        }
+        release(id);
+        ++fired;
+      }
+      if (now_ >= nowMs) {
+        return fired;
+      }
+      if (size_ == 0) {
+        now_ = nowMs;
+        return fired;
+      }
+      // Nothing fires before the next bucket boundary of the first level
+      // having timers, jump there.
+      std::int64_t next = now_ + 1;
+      for (int level = 0; level < Levels - 1 && occupied_[level] == 0;
+           ++level) {
+        int bits = (level + 1) * SlotBits;
+        next = ((now_ >> bits) + 1) << bits;
+      }
+      now_ = std::min(next, nowMs);
+      // Crossing a bucket boundary of a level moves its next bucket down.
+      for (int level = 1; level < Levels; ++level) {
+        if ((now_ & ((std::int64_t(1) << (level * SlotBits)) - 1)) != 0) {
+          break;
+        }
+        cascade(level);
+      }
+    }
+  }
+
+  /**
+   * @brief Bytes allocated by the wheel, not counting the memory owned by the
+   * payloads.
+   */
+  std::size_t allocatedBytes() const {
+    return sizeof(buckets_) + nodes_.capacity() * sizeof(Node);
+  }
+
+  /**
+   * @brief Bytes used by one timer, not counting its payload's memory.
+   */
+  static constexpr std::size_t timerBytes() { return sizeof(Node); }
+
+private:
+  static constexpr std::int64_t Mask = Slots - 1;
+
+  struct Node {
+    T value;
+    std::int64_t when = 0;
+    TimerId prev = NoTimer;
+    TimerId next = NoTimer;
+    /**
+     * @brief Bucket the node is linked in.
+     */
+    std::uint32_t bucket = 0;
+  };
+
+  static std::size_t bucketOf(int level, std::int64_t when) {
+    return level * Slots + ((when >> (level * SlotBits)) & Mask);
+  }
+
+  /**
+   * @brief Link a node in the bucket of its deadline relative to now_.
+   */
+  void link(TimerId id) {
+    std::int64_t when = nodes_[id].when;
+    std::int64_t delta = when - now_;
+    std::size_t bucket;
+    if (delta < std::int64_t(Slots)) {
+      bucket = bucketOf(0, std::max(when, now_));
+    } else {
+      int level = 1;
+      while (level < Levels - 1 &&
+             delta >= (std::int64_t(1) << ((level + 1) * SlotBits))) {
+        ++level;
+      }
+      std::int64_t maxDelta = (std::int64_t(1) << (Levels * SlotBits)) - 1;
+      if (delta > maxDelta) {
+        // Parked in the last level until it's in range.
+        when = now_ + maxDelta;
+      }
+      bucket = bucketOf(level, when);
+    }
+    Node &node = nodes_[id];
+    node.bucket = static_cast<std::uint32_t>(bucket);
+    node.prev = NoTimer;
+    node.next = buckets_[bucket];
+    if (buckets_[bucket] != NoTimer) {
+      nodes_[buckets_[bucket]].prev = id;
+    }
+    buckets_[bucket] = id;
+    occupied_[bucket / Slots] |= std::uint64_t(1) << (bucket % Slots);
+  }
+
+  void unlink(TimerId id) {
+    Node &node = nodes_[id];
+    if (node.prev != NoTimer) {
+      nodes_[node.prev].next = node.next;
+    } else {
+      buckets_[node.bucket] = node.next;
+      if (node.next == NoTimer) {
+        occupied_[node.bucket / Slots] &=
+            ~(std::uint64_t(1) << (node.bucket % Slots));
+      }
+    }
+    if (node.next != NoTimer) {
+      nodes_[node.next].prev = node.prev;
+    }
+  }
+
+  void release(TimerId id) {
+    nodes_[id].value = T{};
+    nodes_[id].next = freeList_;
+    freeList_ = id;
+    --size_;
+  }
+
+  /**
+   * @brief Move the timers of the current bucket of a level to lower levels.
+   */
+  void cascade(int level) {
+    std::size_t bucket = bucketOf(level, now_);
+    TimerId id = buckets_[bucket];
+    buckets_[bucket] = NoTimer;
+    occupied_[level] &= ~(std::uint64_t(1) << (bucket % Slots));
+    while (id != NoTimer) {
+      TimerId next = nodes_[id].next;
+      link(id);
+      id = next;
+    }
+  }
+
+  std::array<TimerId, Slots * Levels> buckets_;
+  /**
+   * @brief One bit per non empty bucket of every level.
+   */
+  std::array<std::uint64_t, Levels> occupied_;
+  std::vector<Node> nodes_;
+  TimerId freeList_ = NoTimer;
+  std::size_t size_ = 0;
+  std::int64_t now_;
+};
+
+} // namespace Redis
+
+#endif
@@ -1,27 +1,64 @@
 #ifndef __REDIS_SERVER_TYPES_HPP_
 #define __REDIS_SERVER_TYPES_HPP_
+#include "HashTable.hpp"
+#include "TimingWheel.hpp"
+#include "Value.hpp"
 #include <chrono>
-#include <optional>
+#include <cstdint>
+#include <limits>
 #include <string>
-#include <unordered_map>
 namespace Redis {
 /**
- * @brief Database record which contains the value as string,
- * and an Optional expiry date.
+ * @brief Index of the keys having an expiry. Every timer holds the hash of
+ * its key instead of a copy, the record it fires for is the entry of that
+ * hash whose @sa Record::timer it is.
+ *
+ */
+using ExpiryIndex = TimingWheel<std::size_t>;
+
+/**
+ * @brief Current unix time in milliseconds, the unit of the records expiry.
+ */
+inline std::int64_t unixTimeMs() {
+  return std::chrono::duration_cast<std::chrono::milliseconds>(
+             std::chrono::system_clock::now().time_since_epoch())
+      .count();
+}
+
+/**
+ * @brief Database record which contains the value, and an optional expiry
+ * date.
  *
  */
 struct Record {
-  std::string data;
-  std::optional<std::chrono::time_point<std::chrono::system_clock>> expiry;
+  /**
+   * @brief Expiry of the records that don't expire.
+   */
+  static constexpr std::int64_t NoExpiry =
+      std::numeric_limits<std::int64_t>::min();
+
+  Value data;
+  /**
+   * @brief Expiry as a unix time in milliseconds, or @sa NoExpiry.
+   */
+  std::int64_t expiry = NoExpiry;
+  /**
+   * @brief Timer of the expiry in the shard's @sa ExpiryIndex.
+   */
+  ExpiryIndex::TimerId timer = ExpiryIndex::NoTimer;
+  /**
+   * @brief LRU/LFU access metadata used by the eviction, @sa Access.
+   */
+  std::uint32_t access = 0;
+
+  bool hasExpiry() const { return expiry != NoExpiry; }
+
   /**
    * @brief Set the Expiry giving a period in milliseconds.
    *
    * @param milliseconds expiry period in milliseconds.
    */
-  void setExpiry(int milliseconds) {
-    expiry = std::chrono::system_clock::now() +
-             std::chrono::milliseconds(milliseconds);
-  }
+  void setExpiry(int milliseconds) { expiry = unixTimeMs() + milliseconds; }
 
   /**
    * @brief Set the Expiry giving a unix timestamp in milliseconds.
@@ -29,8 +66,7 @@ struct Record {
    * @param unixTsMilliSeconds miliseconds since epoch.
    */
   void setExpiry(unsigned long unixTsMilliSeconds) {
-    expiry = std::chrono::system_clock::time_point{
-        std::chrono::milliseconds{unixTsMilliSeconds}};
+    expiry = static_cast<std::int64_t>(unixTsMilliSeconds);
   }
 
   /**
@@ -39,27 +75,21 @@ struct Record {
    * @param unixTsSeconds seconds since epoch.
    */
   void setExpiry(unsigned int unixTsSeconds) {
-    expiry = std::chrono::system_clock::time_point{
-        std::chrono::seconds{unixTsSeconds}};
+    expiry = static_cast<std::int64_t>(unixTsSeconds) * 1000;
   }
 
   /**
    * @brief Return true if the record is already expired.
    */
-  bool expired() const {
-    if (expiry == std::nullopt) {
-      return false;
-    }
-    return *expiry <= std::chrono::system_clock::now();
-  }
+  bool expired() const { return hasExpiry() && expiry <= unixTimeMs(); }
 };
 
 /**
- * @brief Database is defined as an unordered_map with string keys
- * and @sa Record values.
+ * @brief Database is defined as an open addressing @sa HashTable with string
+ * keys and @sa Record values.
  *
  */
-using Database = std::unordered_map<std::string, Record>;
+using Database = HashTable<Record>;
 } // namespace Redis
 
 #endif
\ No newline at end of file
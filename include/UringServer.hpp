@@ -0,0 +1,630 @@
+#ifndef __REDIS_SERVER_URING_SERVER_HPP__
+#define __REDIS_SERVER_URING_SERVER_HPP__
+#include "IOUring.hpp"
+#ifdef REDIS_SERVER_IO_URING
+#include "Connection.hpp"
+#include "Logging.hpp"
+#include "RedisServer.hpp"
+#include <algorithm>
+#include <arpa/inet.h>
+#include <atomic>
+#include <climits>
+#include <cstdint>
+#include <cstring>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <netinet/in.h>
+#include <optional>
+#include <string>
+#include <string_view>
+#include <sys/eventfd.h>
+#include <sys/socket.h>
+#include <sys/uio.h>
+#include <system_error>
+#include <unistd.h>
+#include <unordered_map>
+#include <vector>
+
+class UringServer;
+
+/**
+ * @brief A client connection of the io_uring backend, @sa UringServer.
+ *
+ * Serves the same protocol as @sa TCPConnection: the complete commands of
+ * every receive are executed up to the turn budget and their replies go out
+ * with a single sendmsg, reads pause while the output is backed up. All its
+ * methods but @sa send_message and @sa kill run on the server's event loop.
+ */
+class UringConnection : public Connection,
+                        public std::enable_shared_from_this<UringConnection> {
+public:
+  using SharedPtr = std::shared_ptr<UringConnection>;
+
+  /**
+   * @brief Initial size of the read buffer, it grows when a single command
+   * doesn't fit in it.
+   */
+  static constexpr std::size_t ReadBufferSize = 16 * 1024;
+
+  UringConnection(UringServer &server, int fd, std::uint64_t key,
+                  Redis::Server::SharedPtr redisPtr)
+      : Connection(std::move(redisPtr)), server_(server), fd_(fd), key_(key),
+        recvBuf_(ReadBufferSize) {}
+
+  ~UringConnection() override { ::close(fd_); }
+
+  /**
+   * @brief Register the connected client with the server and start
+   * receiving.
+   */
+  void start();
+
+  void send_message(const std::string &msg) override;
+
+  void kill() override;
+
+private:
+  friend class UringServer;
+
+  static std::string socketName(int fd, bool peer) {
+    sockaddr_in address{};
+    socklen_t length = sizeof(address);
+    int result = peer ? getpeername(fd, (sockaddr *)&address, &length)
+                      : getsockname(fd, (sockaddr *)&address, &length);
+    char ip[INET_ADDRSTRLEN] = "";
+    if (result == 0) {
+      inet_ntop(AF_INET, &address.sin_addr, ip, sizeof(ip));
+    }
+    return std::string(ip) + ":" + std::to_string(ntohs(address.sin_port));
+  }
+
+  /**
+   * @brief Can the server forget the connection: it's closed and the kernel
+   * is done with its operations.
+   */
+  bool released() const { return closed_ && !recvPending_ && !sendPending_; }
+
+  void close();
+  void receive();
+  void handle_recv(int result, unsigned flags);
+  void serve();
+  void next_turn();
+  bool execute();
+  void flush_replies();
+  void send();
+  void handle_send(int result);
+
+  UringServer &server_;
+  int fd_;
+  /**
+   * @brief Key of the connection in the server, tags its operations.
+   */
+  std::uint64_t key_;
+  std::vector<char> recvBuf_;
+  std::size_t recvLen_ = 0;
+  Redis::Server::Reply pendingReplies_;
+  Redis::Server::Reply inFlightReplies_;
+  std::vector<iovec> iovecs_;
+  /**
+   * @brief First iovec of the in flight replies not completely sent yet.
+   */
+  std::size_t sentIovecs_ = 0;
+  msghdr message_{};
+  std::size_t inFlightBytes_ = 0;
+  bool recvPending_ = false;
+  bool sendPending_ = false;
+  bool readPaused_ = false;
+  /**
+   * @brief The last turn stopped at its budget, the rest of the read buffer is
+   * executed in a later loop iteration before receiving again.
+   */
+  bool turnExhausted_ = false;
+  bool closeAfterWrite_ = false;
+  bool closed_ = false;
+};
+
+/**
+ * @brief A TCP server running its own io_uring event loop, the alternative to
+ * @sa TCPServer and asio's reactor on Linux.
+ *
+ * Connections are accepted with a multishot accept, receives pick their
+ * buffer from a ring of provided buffers and every loop iteration submits all
+ * the queued operations and waits for completions with one system call. Other
+ * threads hand work to the loop with @sa post.
+ *
+ * Requires Linux 5.19 or newer, check @sa supported first and fall back to
+ * @sa TCPServer otherwise.
+ */
+class UringServer {
+public:
+  /**
+   * @brief Size of the submission queue.
+   */
+  static constexpr unsigned QueueDepth = 4096;
+
+  /**
+   * @brief Provided receive buffers, shared by all the connections of the
+   * loop.
+   */
+  static constexpr std::uint16_t Buffers = 512;
+  static constexpr std::uint32_t BufferSize = 16 * 1024;
+
+  /**
+   * @brief Construct a new UringServer listening on the port.
+   *
+   * @param port Port number.
+   * @param redisServer The redis server handling the requests.
+   * @param reusePort Set SO_REUSEPORT on the listening socket, so one
+   * UringServer can be created per thread on the same port.
+   * @throw std::system_error If the ring or the socket can't be set up.
+   */
+  UringServer(int port, Redis::Server::SharedPtr redisServer,
+              bool reusePort = false)
+      : ring_(QueueDepth), buffers_(ring_, 0, Buffers, BufferSize),
+        redisPtr(std::move(redisServer)) {
+    listenFd_ = socket(AF_INET, SOCK_STREAM | SOCK_CLOEXEC, 0);
+    wakeFd_ = eventfd(0, EFD_CLOEXEC);
+    int enable = 1;
+    setsockopt(listenFd_, SOL_SOCKET, SO_REUSEADDR, &enable, sizeof(enable));
+    if (reusePort) {
+      setsockopt(listenFd_, SOL_SOCKET, SO_REUSEPORT, &enable,
+                 sizeof(enable));
+    }
+    sockaddr_in address{};
+    address.sin_family = AF_INET;
+    address.sin_addr.s_addr = htonl(INADDR_ANY);
+    address.sin_port = htons(static_cast<std::uint16_t>(port));
+    if (listenFd_ < 0 || wakeFd_ < 0 ||
+        bind(listenFd_, (sockaddr *)&address, sizeof(address)) < 0 ||
+        listen(listenFd_, SOMAXCONN) < 0) {
+      int error = errno;
+      closeSockets();
+      throw std::system_error(error, std::system_category(), "listen");
+    }
+  }
+
+  UringServer(const UringServer &) = delete;
+  UringServer &operator=(const UringServer &) = delete;
+
+  ~UringServer() {
+    for (auto &[key, connection] : connections_) {
+      connection->close();
+    }
+    connections_.clear();
+    closeSockets();
+  }
+
+  /**
+   * @brief Can this kernel run the backend, io_uring may also be disabled or
+   * filtered by seccomp.
+   */
+  static bool supported() {
+    try {
+      IOUring ring(8);
+      BufferRing buffers(ring, 0, 1, 64);
+      return true;
+    } catch (const std::system_error &error) {
+      LOG_INFO("io_uring is not supported: {}", error.what());
+      return false;
+    }
+  }
+
+  /**
+   * @brief Accept connections and serve them on the calling thread until
+   * @sa stop.
+   */
+  void run() {
+    accept();
+    waitForTasks();
+    while (!stopped_) {
+      // Don't block while connections wait for their next turn
+      int result = ring_.submitAndWait(deferred_.empty() ? 1 : 0);
+      if (result < 0 && result != -EBUSY) {
+        LOG_ERROR("io_uring_enter failed {}", std::strerror(-result));
+        break;
+      }
+      ring_.forEachCompletion(
+          [this](const io_uring_cqe &cqe) { dispatch(cqe); });
+      std::vector<std::function<void()>> deferred;
+      deferred.swap(deferred_);
+      for (auto &task : deferred) {
+        task();
+      }
+      buffers_.publish();
+    }
+  }
+
+  /**
+   * @brief Stop the event loop, safe to call from any thread.
+   */
+  void stop() {
+    stopped_ = true;
+    wake();
+  }
+
+  /**
+   * @brief Run a task on the event loop, safe to call from any thread.
+   */
+  void post(std::function<void()> task) {
+    {
+      std::lock_guard<std::mutex> lock(tasksMutex_);
+      tasks_.push_back(std::move(task));
+    }
+    wake();
+  }
+
+private:
+  friend class UringConnection;
+
+  /**
+   * @brief Run a task on the event loop after the completions of this
+   * iteration, from the loop's thread.
+   */
+  void defer(std::function<void()> task) {
+    deferred_.push_back(std::move(task));
+  }
+
+  /**
+   * @brief Operations, in the low byte of the user data of their entries.
+   * The other bytes hold the key of their connection.
+   */
+  enum Operation : std::uint8_t { ACCEPT, WAKE, RECV, SEND };
+
+  static std::uint64_t userData(std::uint64_t key, Operation operation) {
+    return key << 8 | operation;
+  }
+
+  void closeSockets() {
+    if (listenFd_ >= 0) {
+      ::close(listenFd_);
+    }
+    if (wakeFd_ >= 0) {
+      ::close(wakeFd_);
+    }
+  }
+
+  void wake() {
+    std::uint64_t one = 1;
+    [[maybe_unused]] auto written = ::write(wakeFd_, &one, sizeof(one));
+  }
+
+  void accept() {
+    io_uring_sqe *sqe = ring_.getSqe();
+    sqe->opcode = IORING_OP_ACCEPT;
+    sqe->fd = listenFd_;
+    sqe->ioprio = IORING_ACCEPT_MULTISHOT;
+    sqe->accept_flags = SOCK_CLOEXEC;
+    sqe->user_data = userData(0, ACCEPT);
+  }
+
+  void waitForTasks() {
+    io_uring_sqe *sqe = ring_.getSqe();
+    sqe->opcode = IORING_OP_READ;
+    sqe->fd = wakeFd_;
+    sqe->addr = reinterpret_cast<std::uint64_t>(&wakeValue_);
+    sqe->len = sizeof(wakeValue_);
+    sqe->off = static_cast<std::uint64_t>(-1);
+    sqe->user_data = userData(0, WAKE);
+  }
+
+  void dispatch(const io_uring_cqe &cqe) {
+    auto operation = static_cast<Operation>(cqe.user_data & 0xFF);
+    std::uint64_t key = cqe.user_data >> 8;
+    if (operation == ACCEPT) {
+      if (cqe.res >= 0) {
+        LOG_INFO("A client connected successfully");
+        auto connection = std::make_shared<UringConnection>(
+            *this, cqe.res, nextKey_, redisPtr);
+        connections_.emplace(nextKey_++, connection);
+        connection->start();
+      } else {
+        LOG_ERROR("Accept failed {}", std::strerror(-cqe.res));
+      }
+      if (!(cqe.flags & IORING_CQE_F_MORE)) {
+        accept();
+      }
+      return;
+    }
+    if (operation == WAKE) {
+      std::vector<std::function<void()>> tasks;
+      {
+        std::lock_guard<std::mutex> lock(tasksMutex_);
+        tasks.swap(tasks_);
+      }
+      for (auto &task : tasks) {
+        task();
+      }
+      waitForTasks();
+      return;
+    }
+    auto it = connections_.find(key);
+    if (it == connections_.end()) {
+      return;
+    }
+    // Keeps the connection alive while it handles the completion
+    UringConnection::SharedPtr connection = it->second;
+    if (operation == RECV) {
+      connection->handle_recv(cqe.res, cqe.flags);
+    } else {
+      connection->handle_send(cqe.res);
+    }
+    release(*connection);
+  }
+
+  /**
+   * @brief Forget a closed connection once it has no operation left.
+   */
+  void release(UringConnection &connection) {
+    if (connection.released()) {
+      connections_.erase(connection.key_);
+    }
+  }
+
+  IOUring ring_;
+  BufferRing buffers_;
+  Redis::Server::SharedPtr redisPtr;
+  int listenFd_ = -1;
+  int wakeFd_ = -1;
+  std::uint64_t wakeValue_ = 0;
+  std::atomic<bool> stopped_ = false;
+  std::mutex tasksMutex_;
+  std::vector<std::function<void()>> tasks_;
+  std::vector<std::function<void()>> deferred_;
+  std::unordered_map<std::uint64_t, UringConnection::SharedPtr> connections_;
+  std::uint64_t nextKey_ = 1;
+};
+
+inline void UringConnection::start() {
+  addr_ = socketName(fd_, true);
+  laddr_ = socketName(fd_, false);
+  setClientId(rServer->registerClient(weak_from_this()));
+  receive();
+}
+
+inline void UringConnection::send_message(const std::string &msg) {
+  LOG_DEBUG("Sending {} bytes to client {}", msg.size(), clientId);
+  server_.post([self = shared_from_this(), msg]() {
+    if (self->closed_) {
+      return;
+    }
+    self->pendingReplies_.push_back(msg);
+    self->outputBytes_ += msg.size();
+    if (self->outputLimitExceeded()) {
+      self->close();
+      self->server_.release(*self);
+      return;
+    }
+    self->flush_replies();
+  });
+}
+
+inline void UringConnection::kill() {
+  server_.post([self = shared_from_this()]() {
+    self->close();
+    self->server_.release(*self);
+  });
+}
+
+/**
+ * @brief Close the socket once and remove the client from the server, the
+ * pending operations complete with an error before it's released.
+ */
+inline void UringConnection::close() {
+  if (closed_) {
+    return;
+  }
+  closed_ = true;
+  pendingReplies_.clear();
+  outputBytes_ = inFlightBytes_;
+  ::shutdown(fd_, SHUT_RDWR);
+  rServer->unregisterClient(clientId);
+}
+
+inline void UringConnection::receive() {
+  io_uring_sqe *sqe = server_.ring_.getSqe();
+  sqe->opcode = IORING_OP_RECV;
+  sqe->fd = fd_;
+  sqe->len = server_.buffers_.bufferSize();
+  sqe->flags = IOSQE_BUFFER_SELECT;
+  sqe->buf_group = server_.buffers_.group();
+  sqe->user_data = UringServer::userData(key_, UringServer::RECV);
+  recvPending_ = true;
+}
+
+/**
+ * @brief Copy the received bytes after the partial command of the read buffer
+ * and give the provided buffer back, then execute the complete commands.
+ */
+inline void UringConnection::handle_recv(int result, unsigned flags) {
+  recvPending_ = false;
+  if (flags & IORING_CQE_F_BUFFER) {
+    auto bid = static_cast<std::uint16_t>(flags >> IORING_CQE_BUFFER_SHIFT);
+    if (result > 0 && !closed_) {
+      if (recvBuf_.size() - recvLen_ < static_cast<std::size_t>(result)) {
+        recvBuf_.resize(std::max(recvBuf_.size() * 2, recvLen_ + result));
+      }
+      std::memcpy(recvBuf_.data() + recvLen_, server_.buffers_.buffer(bid),
+                  result);
+      recvLen_ += result;
+    }
+    server_.buffers_.recycle(bid);
+  }
+  if (closed_) {
+    return;
+  }
+  if (result == -ENOBUFS) {
+    // Every provided buffer is in use, they're given back by this iteration
+    receive();
+    return;
+  }
+  if (result <= 0) {
+    LOG_DEBUG("Client {} read failed {}", clientId, std::strerror(-result));
+    close();
+    return;
+  }
+  netIn_ += result;
+  touch();
+  serve();
+}
+
+/**
+ * @brief Execute a turn of the read buffer and send its replies.
+ */
+inline void UringConnection::serve() {
+  if (!execute()) {
+    return;
+  }
+  flush_replies();
+  next_turn();
+}
+
+/**
+ * @brief Receive more requests, or execute the rest of the read buffer once
+ * the other connections of the loop had their turn. Nothing while the output
+ * is backed up.
+ */
+inline void UringConnection::next_turn() {
+  if (outputBytes_ >= OutputPauseSize) {
+    LOG_DEBUG("Client {} output is backed up, pausing its reads", clientId);
+    readPaused_ = true;
+    return;
+  }
+  if (turnExhausted_) {
+    server_.defer([self = shared_from_this()]() {
+      if (self->closed_) {
+        return;
+      }
+      self->serve();
+      self->server_.release(*self);
+    });
+    return;
+  }
+  receive();
+}
+
+/**
+ * @brief Execute the complete commands of the read buffer, up to the turn
+ * budget of the client's class, and queue their replies.
+ *
+ * @return bool False if the connection stops reading.
+ */
+inline bool UringConnection::execute() {
+  std::size_t queued = pendingReplies_.size();
+  std::size_t executed = 0;
+  Redis::Server::TurnBudget budget = rServer->turnBudget(clientClass_);
+  std::optional<std::size_t> consumed = rServer->handleBuffer(
+      std::string_view(recvBuf_.data(), recvLen_), pendingReplies_, clientId,
+      nullptr, &executed, &budget);
+  commands_ += executed;
+  for (std::size_t i = queued; i < pendingReplies_.size(); ++i) {
+    outputBytes_ += pendingReplies_[i].size();
+  }
+  if (!consumed) {
+    LOG_ERROR("Protocol error from client {}, closing the connection",
+              clientId);
+    pendingReplies_.push_back("-ERR Protocol error\r\n");
+    closeAfterWrite_ = true;
+    flush_replies();
+    return false;
+  }
+  if (*consumed > 0) {
+    std::memmove(recvBuf_.data(), recvBuf_.data() + *consumed,
+                 recvLen_ - *consumed);
+    recvLen_ -= *consumed;
+  }
+  // The rest of the buffer may hold complete commands
+  turnExhausted_ = recvLen_ > 0 && (executed >= budget.commands ||
+                                    *consumed >= budget.bytes);
+  queryBuffer_ = recvLen_;
+  queryBufferFree_ = recvBuf_.size() - recvLen_;
+  if (outputLimitExceeded()) {
+    close();
+    return false;
+  }
+  return true;
+}
+
+/**
+ * @brief Send all the pending replies with a single sendmsg, replies queued
+ * while it's in flight go out with the next one. The in flight parts keep the
+ * values they reference alive until the send completes.
+ */
+inline void UringConnection::flush_replies() {
+  if (sendPending_ || closed_ || pendingReplies_.empty()) {
+    return;
+  }
+  inFlightReplies_.swap(pendingReplies_);
+  iovecs_.clear();
+  sentIovecs_ = 0;
+  inFlightBytes_ = 0;
+  for (const auto &reply : inFlightReplies_) {
+    iovecs_.push_back({const_cast<char *>(reply.data()), reply.size()});
+    inFlightBytes_ += reply.size();
+  }
+  LOG_DEBUG("Sending REPLY with {} messages ", inFlightReplies_.size());
+  send();
+}
+
+inline void UringConnection::send() {
+  message_.msg_iov = iovecs_.data() + sentIovecs_;
+  message_.msg_iovlen =
+      std::min<std::size_t>(iovecs_.size() - sentIovecs_, IOV_MAX);
+  io_uring_sqe *sqe = server_.ring_.getSqe();
+  sqe->opcode = IORING_OP_SENDMSG;
+  sqe->fd = fd_;
+  sqe->addr = reinterpret_cast<std::uint64_t>(&message_);
+  sqe->len = 1;
+  sqe->msg_flags = MSG_NOSIGNAL;
+  sqe->user_data = UringServer::userData(key_, UringServer::SEND);
+  sendPending_ = true;
+}
+
+/**
+ * @brief Send the rest of a partial send, or the replies queued meanwhile.
+ */
+inline void UringConnection::handle_send(int result) {
+  sendPending_ = false;
+  if (result < 0 || closed_) {
+    inFlightReplies_.clear();
+    outputBytes_ -= inFlightBytes_;
+    inFlightBytes_ = 0;
+    if (!closed_) {
+      LOG_DEBUG("Client {} write failed {}", clientId,
+                std::strerror(-result));
+      close();
+    }
+    return;
+  }
+  netOut_ += result;
+  for (std::size_t sent = result; sent > 0 && sentIovecs_ < iovecs_.size();) {
+    iovec &part = iovecs_[sentIovecs_];
+    std::size_t bytes = std::min(sent, part.iov_len);
+    part.iov_base = static_cast<char *>(part.iov_base) + bytes;
+    part.iov_len -= bytes;
+    sent -= bytes;
+    if (part.iov_len == 0) {
+      ++sentIovecs_;
+    }
+  }
+  if (sentIovecs_ < iovecs_.size()) {
+    send();
+    return;
+  }
+  inFlightReplies_.clear();
+  outputBytes_ -= inFlightBytes_;
+  inFlightBytes_ = 0;
+  touch();
+  if (closeAfterWrite_ && pendingReplies_.empty()) {
+    close();
+    return;
+  }
+  flush_replies();
+  if (readPaused_ && outputBytes_ < OutputPauseSize) {
+    readPaused_ = false;
+    next_turn();
+  }
+}
+
+#endif
+#endif
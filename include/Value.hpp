@@ -0,0 +1,218 @@
+#ifndef __REDIS_SERVER_VALUE_HPP__
+#define __REDIS_SERVER_VALUE_HPP__
+#include "SharedBuffer.hpp"
+#include <charconv>
+#include <cstdint>
+#include <cstring>
+#include <new>
+#include <string>
+#include <string_view>
+
+namespace Redis {
+
+/**
+ * @brief A string value in 16 bytes, stored with the most compact of three
+ * encodings (named like redis' OBJECT ENCODING):
+ * - INT: the string is the canonical form of an int64, e.g. a counter.
+ * - EMBSTR: up to 15 bytes stored inline.
+ * - RAW: longer strings, in an immutable @sa SharedBuffer shared by the
+ *   copies of the value.
+ *
+ * The last byte holds the encoding and the embedded length.
+ */
+class Value {
+public:
+  enum class Encoding : std::uint8_t { INT, EMBSTR, RAW };
+
+  static constexpr std::size_t EmbeddedSize = 15;
+
+  /**
+   * @brief Buffer big enough for any int64 formatted by @sa view.
+   */
+  using IntBuffer = char[20];
+
+  Value() { setTag(Encoding::EMBSTR, 0); }
+  explicit Value(std::string_view str) { assign(str); }
+  /**
+   * @brief Keep the buffer itself when the bytes need a RAW encoding instead
+   * of copying them, e.g. a payload read straight into it.
+   */
+  explicit Value(SharedBuffer buffer) {
+    std::int64_t integer = 0;
+    if (buffer.size() <= EmbeddedSize ||
+        parseInteger(buffer.view(), integer)) {
+      assign(buffer.view());
+    } else {
+      new (bytes_) SharedBuffer(std::move(buffer));
+      setTag(Encoding::RAW, 0);
+    }
+  }
+  Value(const Value &other) {
+    if (other.encoding() == Encoding::RAW) {
+      new (bytes_) SharedBuffer(other.rawBuffer());
+      bytes_[15] = other.bytes_[15];
+    } else {
+      std::memcpy(bytes_, other.bytes_, sizeof(bytes_));
+    }
+  }
+  // A SharedBuffer is a single pointer, it can be moved as bytes.
+  Value(Value &&other) noexcept {
+    std::memcpy(bytes_, other.bytes_, sizeof(bytes_));
+    other.setTag(Encoding::EMBSTR, 0);
+  }
+  Value &operator=(const Value &other) {
+    if (this != &other) {
+      Value copy(other);
+      *this = std::move(copy);
+    }
+    return *this;
+  }
+  Value &operator=(Value &&other) noexcept {
+    if (this != &other) {
+      release();
+      std::memcpy(bytes_, other.bytes_, sizeof(bytes_));
+      other.setTag(Encoding::EMBSTR, 0);
+    }
+    return *this;
+  }
+  Value &operator=(std::string_view str) {
+    // str may point into this value's own buffer
+    Value value(str);
+    return *this = std::move(value);
+  }
+  ~Value() { release(); }
+
+  Encoding encoding() const {
+    return static_cast<Encoding>(static_cast<std::uint8_t>(bytes_[15]) >> 4);
+  }
+
+  /**
+   * @brief Name of the encoding as reported by OBJECT ENCODING.
+   */
+  std::string_view encodingName() const {
+    switch (encoding()) {
+    case Encoding::INT:
+      return "int";
+    case Encoding::EMBSTR:
+      return "embstr";
+    default:
+      return "raw";
+    }
+  }
+
+  /**
+   * @brief The integer of an INT value.
+   */
+  std::int64_t integer() const {
+    std::int64_t value;
+    std::memcpy(&value, bytes_, sizeof(value));
+    return value;
+  }
+
+  /**
+   * @brief The string, an INT value is formatted in `buffer`.
+   *
+   * @return std::string_view Valid as long as the value and the buffer are.
+   */
+  std::string_view view(IntBuffer &buffer) const {
+    switch (encoding()) {
+    case Encoding::INT: {
+      auto result =
+          std::to_chars(buffer, buffer + sizeof(IntBuffer), integer());
+      return std::string_view(buffer, result.ptr - buffer);
+    }
+    case Encoding::EMBSTR:
+      return std::string_view(bytes_, bytes_[15] & 0x0F);
+    default:
+      return rawView();
+    }
+  }
+
+  std::string str() const {
+    IntBuffer buffer;
+    return std::string(view(buffer));
+  }
+
+  std::size_t size() const {
+    IntBuffer buffer;
+    return view(buffer).size();
+  }
+
+  /**
+   * @brief Bytes allocated on the heap by the value.
+   */
+  std::size_t allocatedBytes() const {
+    return encoding() == Encoding::RAW ? rawBuffer().allocatedBytes() : 0;
+  }
+
+  /**
+   * @brief The buffer of a RAW value, it stays valid after the value is
+   * changed or destroyed. Empty for the other encodings.
+   */
+  SharedBuffer buffer() const {
+    return encoding() == Encoding::RAW ? rawBuffer() : SharedBuffer();
+  }
+
+  bool operator==(std::string_view other) const {
+    IntBuffer buffer;
+    return view(buffer) == other;
+  }
+
+  /**
+   * @brief Parse the canonical form of an int64: no sign but '-', no leading
+   * zero, no "-0", so that formatting it back gives the same string.
+   */
+  static bool parseInteger(std::string_view str, std::int64_t &value) {
+    if (str.empty() || str.size() > sizeof(IntBuffer)) {
+      return false;
+    }
+    auto result = std::from_chars(str.data(), str.data() + str.size(), value);
+    if (result.ec != std::errc() || result.ptr != str.data() + str.size()) {
+      return false;
+    }
+    IntBuffer buffer;
+    auto formatted = std::to_chars(buffer, buffer + sizeof(buffer), value);
+    return std::string_view(buffer, formatted.ptr - buffer) == str;
+  }
+
+private:
+  void setTag(Encoding encoding, std::size_t embeddedSize) {
+    bytes_[15] = static_cast<char>((static_cast<std::uint8_t>(encoding) << 4) |
+                                   embeddedSize);
+  }
+
+  void assign(std::string_view str) {
+    std::int64_t integer = 0;
+    if (parseInteger(str, integer)) {
+      std::memcpy(bytes_, &integer, sizeof(integer));
+      setTag(Encoding::INT, 0);
+    } else if (str.size() <= EmbeddedSize) {
+      std::memcpy(bytes_, str.data(), str.size());
+      setTag(Encoding::EMBSTR, str.size());
+    } else {
+      new (bytes_) SharedBuffer(SharedBuffer::copyOf(str));
+      setTag(Encoding::RAW, 0);
+    }
+  }
+
+  const SharedBuffer &rawBuffer() const {
+    return *std::launder(reinterpret_cast<const SharedBuffer *>(bytes_));
+  }
+
+  std::string_view rawView() const { return rawBuffer().view(); }
+
+  void release() {
+    if (encoding() == Encoding::RAW) {
+      std::launder(reinterpret_cast<SharedBuffer *>(bytes_))->~SharedBuffer();
+      setTag(Encoding::EMBSTR, 0);
+    }
+  }
+
+  alignas(8) char bytes_[16];
+};
+
+static_assert(sizeof(Value) == 16);
+
+} // namespace Redis
+
+#endif
@@ -0,0 +1,331 @@
+#include "AppendOnlyFile.hpp"
+#include "Logging.hpp"
+#include <cerrno>
+#include <charconv>
+#include <chrono>
+#include <cstring>
+#include <fcntl.h>
+#include <filesystem>
+#include <sys/stat.h>
+#include <unistd.h>
+
+namespace Redis {
+
+namespace {
+/**
+ * @brief Bytes buffered by a @sa CommandWriter before they are written.
+ */
+constexpr std::size_t WriteBufferBytes = 64 << 10;
+
+/**
+ * @brief Write all the bytes, retried when interrupted.
+ *
+ * @return std::size_t The bytes written, less than the size on an error.
+ */
+std::size_t writeAll(int fd, std::string_view bytes) {
+  std::size_t done = 0;
+  while (done < bytes.size()) {
+    ssize_t written = ::write(fd, bytes.data() + done, bytes.size() - done);
+    if (written < 0) {
+      if (errno == EINTR) {
+        continue;
+      }
+      break;
+    }
+    done += written;
+  }
+  return done;
+}
+
+void appendHeader(std::string &out, char type, std::size_t value) {
+  char digits[24];
+  auto [end, error] = std::to_chars(digits, digits + sizeof(digits), value);
+  out += type;
+  out.append(digits, end);
+  out += "\r\n";
+}
+} // namespace
+
+void appendCommand(std::string &out,
+                   std::span<const std::string_view> command) {
+  appendHeader(out, '*', command.size());
+  for (std::string_view argument : command) {
+    appendHeader(out, '$', argument.size());
+    out += argument;
+    out += "\r\n";
+  }
+}
+
+AppendOnlyFile::~AppendOnlyFile() {
+  close();
+  {
+    std::lock_guard<std::mutex> lock(syncMutex_);
+    stopSync_ = true;
+  }
+  syncCondition_.notify_one();
+  if (syncThread_.joinable()) {
+    syncThread_.join();
+  }
+}
+
+bool AppendOnlyFile::open(const std::string &path) {
+  int fd = ::open(path.c_str(), O_WRONLY | O_APPEND | O_CREAT | O_CLOEXEC,
+                  0644);
+  if (fd < 0) {
+    return false;
+  }
+  struct stat status;
+  std::uint64_t size = ::fstat(fd, &status) == 0 ? status.st_size : 0;
+  std::lock_guard<std::mutex> writeLock(writeMutex_);
+  std::lock_guard<std::mutex> bufferLock(bufferMutex_);
+  if (fd_ >= 0) {
+    ::close(fd_);
+  }
+  fd_ = fd;
+  buffer_.clear();
+  writing_.clear();
+  appended_ = written_ = synced_ = 0;
+  size_ = baseSize_ = size;
+  lastWriteOk_ = true;
+  state_ = State::ON;
+  startSyncThread();
+  return true;
+}
+
+void AppendOnlyFile::waitForRewrite() {
+  std::lock_guard<std::mutex> lock(bufferMutex_);
+  if (state_ == State::OFF) {
+    state_ = State::WAIT_REWRITE;
+  }
+}
+
+void AppendOnlyFile::close() {
+  std::lock_guard<std::mutex> writeLock(writeMutex_);
+  if (fd_ >= 0) {
+    writeBuffer();
+    if (policy_ != FsyncPolicy::NO) {
+      ::fdatasync(fd_);
+    }
+    ::close(fd_);
+    fd_ = -1;
+  }
+  std::lock_guard<std::mutex> bufferLock(bufferMutex_);
+  state_ = State::OFF;
+  buffer_.clear();
+  writing_.clear();
+  rewriting_ = false;
+  rewriteBuffer_.clear();
+  appended_ = written_ = synced_ = 0;
+  size_ = baseSize_ = 0;
+}
+
+void AppendOnlyFile::append(std::span<const std::string_view> command) {
+  if (state_.load(std::memory_order_relaxed) == State::OFF) {
+    return;
+  }
+  std::lock_guard<std::mutex> lock(bufferMutex_);
+  if (rewriting_) {
+    appendCommand(rewriteBuffer_, command);
+  }
+  if (state_ == State::ON) {
+    std::size_t size = buffer_.size();
+    appendCommand(buffer_, command);
+    appended_.fetch_add(buffer_.size() - size, std::memory_order_release);
+  }
+}
+
+void AppendOnlyFile::flush() {
+  bool always = policy_.load(std::memory_order_relaxed) == FsyncPolicy::ALWAYS;
+  std::uint64_t target = appended_.load(std::memory_order_acquire);
+  if (written_.load(std::memory_order_acquire) >= target &&
+      (!always || synced_.load(std::memory_order_acquire) >= target)) {
+    return;
+  }
+  std::unique_lock<std::mutex> lock(writeMutex_, std::defer_lock);
+  if (always) {
+    lock.lock();
+  } else if (!lock.try_lock()) {
+    return;
+  }
+  if (fd_ < 0) {
+    return;
+  }
+  if (written_ < target) {
+    writeBuffer();
+  }
+  // Every command written so far is committed by this sync, the threads
+  // waiting for the lock find theirs done
+  if (always && synced_ < written_) {
+    if (::fdatasync(fd_) == 0) {
+      synced_.store(written_, std::memory_order_release);
+    } else {
+      LOG_ERROR("Can't fsync the append only file: {}", std::strerror(errno));
+    }
+  }
+}
+
+void AppendOnlyFile::writeBuffer() {
+  {
+    std::lock_guard<std::mutex> lock(bufferMutex_);
+    if (writing_.empty()) {
+      writing_.swap(buffer_);
+    } else {
+      writing_ += buffer_;
+      buffer_.clear();
+    }
+  }
+  if (writing_.empty()) {
+    return;
+  }
+  std::size_t done = writeAll(fd_, writing_);
+  written_.fetch_add(done, std::memory_order_release);
+  size_.fetch_add(done, std::memory_order_relaxed);
+  writing_.erase(0, done);
+  bool ok = writing_.empty();
+  if (!ok && lastWriteOk_) {
+    LOG_ERROR("Error writing to the append only file: {}",
+              std::strerror(errno));
+  }
+  lastWriteOk_ = ok;
+}
+
+void AppendOnlyFile::startSyncThread() {
+  if (!syncThread_.joinable()) {
+    syncThread_ = std::thread([this] { syncLoop(); });
+  }
+}
+
+void AppendOnlyFile::syncLoop() {
+  std::unique_lock<std::mutex> lock(syncMutex_);
+  while (!syncCondition_.wait_for(lock, std::chrono::seconds(1),
+                                  [this] { return stopSync_; })) {
+    if (policy_.load(std::memory_order_relaxed) == FsyncPolicy::EVERYSEC) {
+      lock.unlock();
+      syncWritten();
+      lock.lock();
+    }
+  }
+}
+
+void AppendOnlyFile::syncWritten() {
+  int fd = -1;
+  std::uint64_t target = 0;
+  {
+    std::lock_guard<std::mutex> lock(writeMutex_);
+    if (fd_ < 0 || synced_ >= written_) {
+      return;
+    }
+    // A duplicate stays valid if the log is replaced meanwhile, the writers
+    // aren't blocked by the sync
+    fd = ::dup(fd_);
+    target = written_;
+  }
+  if (fd < 0) {
+    return;
+  }
+  if (::fdatasync(fd) == 0) {
+    std::lock_guard<std::mutex> lock(writeMutex_);
+    if (synced_ < target) {
+      synced_ = target;
+    }
+  } else {
+    LOG_ERROR("Can't fsync the append only file: {}", std::strerror(errno));
+  }
+  ::close(fd);
+}
+
+void AppendOnlyFile::startRewrite() {
+  std::lock_guard<std::mutex> lock(bufferMutex_);
+  if (state_ == State::OFF) {
+    return;
+  }
+  rewriting_ = true;
+  rewriteBuffer_.clear();
+}
+
+bool AppendOnlyFile::finishRewrite(const std::string &tempPath,
+                                   const std::string &path) {
+  std::lock_guard<std::mutex> writeLock(writeMutex_);
+  std::lock_guard<std::mutex> bufferLock(bufferMutex_);
+  // Forked while the log was off, the file is only a snapshot
+  if (!rewriting_) {
+    return ::rename(tempPath.c_str(), path.c_str()) == 0;
+  }
+  int fd = ::open(tempPath.c_str(), O_WRONLY | O_APPEND | O_CLOEXEC);
+  if (fd < 0) {
+    return false;
+  }
+  if (writeAll(fd, rewriteBuffer_) != rewriteBuffer_.size() ||
+      ::fdatasync(fd) != 0 || ::rename(tempPath.c_str(), path.c_str()) != 0) {
+    ::close(fd);
+    return false;
+  }
+  struct stat status;
+  std::uint64_t size = ::fstat(fd, &status) == 0 ? status.st_size : 0;
+  if (fd_ >= 0) {
+    ::close(fd_);
+  }
+  fd_ = fd;
+  buffer_.clear();
+  writing_.clear();
+  rewriting_ = false;
+  rewriteBuffer_.clear();
+  rewriteBuffer_.shrink_to_fit();
+  written_ = synced_ = appended_.load();
+  size_ = baseSize_ = size;
+  lastWriteOk_ = true;
+  state_ = State::ON;
+  startSyncThread();
+  return true;
+}
+
+void AppendOnlyFile::abortRewrite() {
+  std::lock_guard<std::mutex> lock(bufferMutex_);
+  rewriting_ = false;
+  rewriteBuffer_.clear();
+  rewriteBuffer_.shrink_to_fit();
+}
+
+void CommandWriter::write(std::span<const std::string_view> command) {
+  appendCommand(buffer_, command);
+  if (buffer_.size() >= WriteBufferBytes) {
+    flush();
+  }
+}
+
+bool CommandWriter::finish() {
+  flush();
+  return !failed_;
+}
+
+void CommandWriter::flush() {
+  if (!failed_ && writeAll(fd_, buffer_) != buffer_.size()) {
+    failed_ = true;
+  }
+  buffer_.clear();
+}
+
+std::string appendOnlyTempPath(const std::string &filePath, long pid) {
+  return (std::filesystem::path(filePath).parent_path() /
+          ("temp-rewriteaof-bg-" + std::to_string(pid) + ".aof"))
+      .string();
+}
+
+bool writeAppendOnlyFile(const std::string &filePath,
+                         const std::function<void(CommandWriter &)> &fill) {
+  int fd = ::open(filePath.c_str(), O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC,
+                  0644);
+  if (fd < 0) {
+    return false;
+  }
+  CommandWriter writer(fd);
+  fill(writer);
+  bool written = writer.finish() && ::fsync(fd) == 0;
+  written = ::close(fd) == 0 && written;
+  if (!written) {
+    ::unlink(filePath.c_str());
+  }
+  return written;
+}
+
+} // namespace Redis
@@ -1,75 +1,1223 @@
 #include "RDBFile.hpp"
+#include "CRC64.hpp"
 #include "Logging.hpp"
-#include <array>
-#include <quill/std/Array.h>
-#include <unordered_map>
+#include <algorithm>
+#include <asio.hpp>
+#include <atomic>
+#include <cerrno>
+#include <charconv>
+#include <cstdio>
+#include <cstring>
+#include <fcntl.h>
+#include <filesystem>
+#include <limits>
+#include <mutex>
+#include <stdexcept>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <thread>
+#include <unistd.h>
 #include <vector>
 namespace Redis {
 
-void parseHeader(std::ifstream &fs) {
-  u_char bytes[9];
-  fs.read(reinterpret_cast<char *>(bytes), 9);
-}
-
-std::optional<Database> parseDatabase(std::ifstream &fs) {
-  u_char bytes[4];
-  u_char byte;
-  fs.read(reinterpret_cast<char *>(bytes), 4); // first 4 bytes
-  Database data;
-  std::optional<Record> record = Record{};
-  while (fs.read(reinterpret_cast<char *>(&byte), 1)) {
-    if (byte == 0x00) {
-      u_char length;
-      // Read the Key
-      fs.read(reinterpret_cast<char *>(&length), 1);
-      std::vector<u_char> key(static_cast<int>(length));
-      fs.read(reinterpret_cast<char *>(key.data()), static_cast<int>(length));
-      std::string keyStr(key.begin(), key.end());
-
-      // Read the value
-      fs.read(reinterpret_cast<char *>(&length), 1);
-      std::vector<u_char> value(static_cast<int>(length));
-      fs.read(reinterpret_cast<char *>(value.data()), static_cast<int>(length));
-      std::string valStr(value.begin(), value.end());
-      record->data = valStr;
-      data[keyStr] = *record;
+namespace {
+/**
+ * @brief Bytes of records decoded by a task.
+ */
+constexpr std::size_t ChunkBytes = 1 << 20;
+
+/**
+ * @brief Bytes of the file checksummed by a task.
+ */
+constexpr std::size_t ChecksumSegmentBytes = 64 << 20;
+
+/**
+ * @brief Records of a partition inserted per lock of the partition.
+ */
+constexpr std::size_t InsertBatch = 256;
+
+/**
+ * @brief Bytes buffered by a @sa RDBWriter before they go to its sink.
+ */
+constexpr std::size_t WriteBufferBytes = 64 << 10;
+
+/**
+ * @brief Strings up to this size are never compressed, the same as redis.
+ */
+constexpr std::size_t CompressMinSize = 20;
+
+/**
+ * @brief Most bytes a LZF back reference of 3 bytes expands to, no string
+ * decompresses to more than this many times its compressed size.
+ */
+constexpr std::uint64_t LZFMaxExpansion = 88;
+
+/**
+ * @brief Longest string loaded, the longest one a client can set.
+ */
+constexpr std::uint64_t MaxStringLength = 512ULL * 1024 * 1024;
+
+struct RDBError : std::runtime_error {
+  using std::runtime_error::runtime_error;
+};
+
+/**
+ * @brief The data ends in the middle of an encoding, a stream may still
+ * bring the rest.
+ */
+struct RDBTruncated : RDBError {
+  RDBTruncated() : RDBError("unexpected end of file") {}
+};
+
+/**
+ * @brief A whole file mapped read only.
+ */
+class MappedFile {
+public:
+  explicit MappedFile(const std::string &filePath) {
+    int fd = ::open(filePath.c_str(), O_RDONLY | O_CLOEXEC);
+    if (fd < 0) {
+      return;
+    }
+    struct stat status;
+    if (fstat(fd, &status) == 0 && status.st_size > 0) {
+      void *data = mmap(nullptr, status.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+      if (data != MAP_FAILED) {
+        data_ = static_cast<const char *>(data);
+        size_ = status.st_size;
+        // Read ahead of the walk, the decoding threads follow it closely
+        madvise(data, size_, MADV_WILLNEED);
+      }
+    }
+    ::close(fd);
+  }
+
+  MappedFile(const MappedFile &) = delete;
+  MappedFile &operator=(const MappedFile &) = delete;
+
+  ~MappedFile() {
+    if (data_) {
+      munmap(const_cast<char *>(data_), size_);
+    }
+  }
+
+  explicit operator bool() const { return data_ != nullptr; }
+
+  const char *data() const { return data_; }
+
+  std::size_t size() const { return size_; }
+
+private:
+  const char *data_ = nullptr;
+  std::size_t size_ = 0;
+};
+
+/**
+ * @brief Decompress a LZF compressed string, the compression of redis.
+ *
+ * @return bool False if the data is corrupt or doesn't decompress to exactly
+ * `size` bytes.
+ */
+bool lzfDecompress(const char *input, std::size_t inputSize, char *output,
+                   std::size_t size) {
+  const auto *in = reinterpret_cast<const unsigned char *>(input);
+  const unsigned char *inEnd = in + inputSize;
+  char *out = output;
+  char *outEnd = output + size;
+  while (in < inEnd) {
+    std::size_t control = *in++;
+    if (control < 32) {
+      // A literal run of control + 1 bytes
+      std::size_t length = control + 1;
+      if (length > static_cast<std::size_t>(inEnd - in) ||
+          length > static_cast<std::size_t>(outEnd - out)) {
+        return false;
+      }
+      std::memcpy(out, in, length);
+      in += length;
+      out += length;
+      continue;
+    }
+    // A back reference to the output
+    std::size_t length = control >> 5;
+    if (length == 7) {
+      if (in == inEnd) {
+        return false;
+      }
+      length += *in++;
+    }
+    if (in == inEnd) {
+      return false;
+    }
+    std::size_t distance = ((control & 0x1F) << 8) + *in++ + 1;
+    length += 2;
+    if (distance > static_cast<std::size_t>(out - output) ||
+        length > static_cast<std::size_t>(outEnd - out)) {
+      return false;
+    }
+    // The reference may overlap the bytes being written
+    for (const char *reference = out - distance; length > 0; --length) {
+      *out++ = *reference++;
+    }
+  }
+  return out == outEnd;
+}
+
+/**
+ * @brief Compress with LZF, liblzf's algorithm: a hash of the next 3 bytes
+ * finds the last position having them, a match up to 8KB back becomes a back
+ * reference and the other bytes go in literal runs of up to 32 bytes.
+ *
+ * @return std::size_t The compressed size, 0 if it doesn't fit `capacity`.
+ */
+std::size_t lzfCompress(const char *input, std::size_t size, char *output,
+                        std::size_t capacity) {
+  constexpr int HashBits = 14;
+  constexpr std::size_t MaxLiteral = 32;
+  constexpr std::size_t MaxOffset = 1 << 13;
+  constexpr std::size_t MaxReference = (1 << 8) + (1 << 3);
+  // Positions offset by a base growing with every call, so the entries of
+  // the previous calls are stale without clearing the table
+  thread_local std::vector<std::uint64_t> table(std::size_t(1) << HashBits);
+  thread_local std::uint64_t base = 0;
+  std::uint64_t start = base + 1;
+  base += size + 1;
+  if (capacity == 0) {
+    return 0;
+  }
+  const auto *in = reinterpret_cast<const unsigned char *>(input);
+  auto *out = reinterpret_cast<unsigned char *>(output);
+  auto hash = [in](std::size_t i) {
+    std::uint32_t bytes = in[i] << 16 | in[i + 1] << 8 | in[i + 2];
+    return (bytes * 2654435761u) >> (32 - HashBits);
+  };
+  // The header of the current literal run is out[o - literal - 1]
+  std::size_t o = 1;
+  std::size_t literal = 0;
+  std::size_t i = 0;
+  while (i < size) {
+    if (size - i >= 3) {
+      std::uint64_t &entry = table[hash(i)];
+      std::uint64_t previous = entry;
+      entry = start + i;
+      std::size_t reference = previous - start;
+      if (previous >= start && i - reference - 1 < MaxOffset &&
+          std::memcmp(in + reference, in + i, 3) == 0) {
+        std::size_t maxLength = std::min(size - i, MaxReference);
+        std::size_t length = 3;
+        while (length < maxLength && in[reference + length] == in[i + length]) {
+          ++length;
+        }
+        if (literal > 0) {
+          out[o - literal - 1] = literal - 1;
+        } else {
+          --o;
+        }
+        std::size_t offset = i - reference - 1;
+        std::size_t stored = length - 2;
+        if (o + (stored < 7 ? 2 : 3) > capacity) {
+          return 0;
+        }
+        if (stored < 7) {
+          out[o++] = (offset >> 8) + (stored << 5);
+        } else {
+          out[o++] = (offset >> 8) + (7 << 5);
+          out[o++] = stored - 7;
+        }
+        out[o++] = offset & 0xFF;
+        literal = 0;
+        ++o;
+        i += length;
+        continue;
+      }
+    }
+    if (o >= capacity) {
+      return 0;
+    }
+    out[o++] = in[i++];
+    if (++literal == MaxLiteral) {
+      out[o - literal - 1] = literal - 1;
+      literal = 0;
+      ++o;
+    }
+  }
+  if (literal > 0) {
+    out[o - literal - 1] = literal - 1;
+    return o;
+  }
+  return o - 1;
+}
+
+/**
+ * @brief Reads the encodings of the RDB format from a range of memory.
+ *
+ * @throw RDBError Past the end of the range or on corrupt data.
+ */
+class Reader {
+public:
+  /**
+   * @brief Formats of the specially encoded strings.
+   */
+  enum StringEncoding { INT8 = 0, INT16 = 1, INT32 = 2, LZF = 3 };
+
+  struct Length {
+    std::uint64_t value;
+    /**
+     * @brief The value is a @sa StringEncoding.
+     */
+    bool encoded;
+  };
+
+  Reader(const char *begin, const char *end) : position_(begin), end_(end) {}
+
+  const char *position() const { return position_; }
+
+  bool atEnd() const { return position_ == end_; }
+
+  const char *take(std::uint64_t size) {
+    if (size > static_cast<std::uint64_t>(end_ - position_)) {
+      throw RDBTruncated();
+    }
+    const char *bytes = position_;
+    position_ += size;
+    return bytes;
+  }
+
+  std::uint8_t byte() { return static_cast<std::uint8_t>(*take(1)); }
+
+  std::uint64_t littleEndian(std::size_t size) {
+    const auto *bytes = reinterpret_cast<const unsigned char *>(take(size));
+    std::uint64_t value = 0;
+    for (std::size_t i = size; i-- > 0;) {
+      value = value << 8 | bytes[i];
+    }
+    return value;
+  }
+
+  std::uint64_t bigEndian(std::size_t size) {
+    const auto *bytes = reinterpret_cast<const unsigned char *>(take(size));
+    std::uint64_t value = 0;
+    for (std::size_t i = 0; i < size; ++i) {
+      value = value << 8 | bytes[i];
+    }
+    return value;
+  }
+
+  /**
+   * @brief A length in 6, 14, 32 or 64 bits, or the format of a string.
+   */
+  Length length() {
+    std::uint8_t first = byte();
+    switch (first >> 6) {
+    case 0:
+      return {first & 0x3Fu, false};
+    case 1:
+      return {std::uint64_t(first & 0x3F) << 8 | byte(), false};
+    case 2:
+      if (first == 0x80) {
+        return {bigEndian(4), false};
+      }
+      if (first == 0x81) {
+        return {bigEndian(8), false};
+      }
+      throw RDBError("invalid length encoding");
+    default:
+      return {first & 0x3Fu, true};
+    }
+  }
+
+  std::uint64_t plainLength() {
+    Length result = length();
+    if (result.encoded) {
+      throw RDBError("unexpected string encoding");
+    }
+    return result.value;
+  }
+
+  void skipString() {
+    Length result = length();
+    if (!result.encoded) {
+      take(result.value);
+      return;
+    }
+    if (result.value == LZF) {
+      std::uint64_t compressed = plainLength();
+      plainLength();
+      take(compressed);
+      return;
+    }
+    integer(result.value);
+  }
+
+  /**
+   * @brief A string: in the range when it's stored as is, else decoded into
+   * `scratch`.
+   */
+  std::string_view string(std::string &scratch) {
+    Length result = length();
+    if (!result.encoded) {
+      return {take(result.value), result.value};
+    }
+    if (result.value == LZF) {
+      Compressed compressed = lzfString();
+      scratch.resize(compressed.size);
+      decompress(compressed, scratch.data());
+      return scratch;
+    }
+    char digits[20];
+    auto end = std::to_chars(digits, digits + sizeof(digits),
+                             integer(result.value))
+                   .ptr;
+    scratch.assign(digits, end);
+    return scratch;
+  }
+
+  /**
+   * @brief A string as a value, a long compressed one is decompressed
+   * straight into the value's buffer.
+   */
+  Value value() {
+    Length result = length();
+    if (!result.encoded) {
+      return Value(std::string_view(take(result.value), result.value));
+    }
+    if (result.value == LZF) {
+      Compressed compressed = lzfString();
+      SharedBuffer buffer = SharedBuffer::allocate(compressed.size);
+      decompress(compressed, buffer.mutableData());
+      return Value(std::move(buffer));
+    }
+    char digits[20];
+    auto end = std::to_chars(digits, digits + sizeof(digits),
+                             integer(result.value))
+                   .ptr;
+    return Value(std::string_view(digits, end - digits));
+  }
+
+  /**
+   * @brief Skip the value of a key, any type of @sa RDBType.
+   */
+  void skipValue(std::uint8_t type) {
+    switch (static_cast<RDBType>(type)) {
+    case RDBType::STRING:
+    case RDBType::HASHZIPMAP:
+    case RDBType::LISTZIPLIST:
+    case RDBType::SETINTSET:
+    case RDBType::ZSETZIPLIST:
+    case RDBType::HASHZIPLIST:
+    case RDBType::HASHLISTPACK:
+    case RDBType::ZSETLISTPACK:
+    case RDBType::SETLISTPACK:
+      // Serialized in a single string
+      skipString();
+      return;
+    case RDBType::LIST:
+    case RDBType::SET:
+    case RDBType::LISTQUICKLIST:
+      for (std::uint64_t n = plainLength(); n > 0; --n) {
+        skipString();
+      }
+      return;
+    case RDBType::HASH:
+      for (std::uint64_t n = plainLength(); n > 0; --n) {
+        skipString();
+        skipString();
+      }
+      return;
+    case RDBType::ZSET:
+      for (std::uint64_t n = plainLength(); n > 0; --n) {
+        skipString();
+        // A score as a string of at most 252 bytes, or nan and infinities
+        if (std::uint8_t size = byte(); size < 253) {
+          take(size);
+        }
+      }
+      return;
+    case RDBType::ZSET2:
+      for (std::uint64_t n = plainLength(); n > 0; --n) {
+        skipString();
+        take(8);
+      }
+      return;
+    case RDBType::LISTQUICKLIST2:
+      for (std::uint64_t n = plainLength(); n > 0; --n) {
+        plainLength();
+        skipString();
+      }
+      return;
+    case RDBType::MODULE2:
+      plainLength();
+      skipModuleValue();
+      return;
+    case RDBType::STREAMLISTPACKS:
+    case RDBType::STREAMLISTPACKS2:
+    case RDBType::STREAMLISTPACKS3:
+      skipStream(static_cast<RDBType>(type));
+      return;
+    default:
+      throw RDBError("unsupported value type " + std::to_string(type));
+    }
+  }
+
+  /**
+   * @brief Skip the self described data of a module, up to its EOF opcode.
+   */
+  void skipModuleValue() {
+    for (;;) {
+      switch (plainLength()) {
+      case 0: // EOF
+        return;
+      case 1: // signed integer
+      case 2: // unsigned integer
+        plainLength();
+        break;
+      case 3: // float
+        take(4);
+        break;
+      case 4: // double
+        take(8);
+        break;
+      case 5: // string
+        skipString();
+        break;
+      default:
+        throw RDBError("invalid module opcode");
+      }
+    }
+  }
+
+private:
+  struct Compressed {
+    const char *data;
+    std::uint64_t compressedSize;
+    std::uint64_t size;
+  };
+
+  Compressed lzfString() {
+    std::uint64_t compressedSize = plainLength();
+    std::uint64_t size = plainLength();
+    // Checked before the output is allocated, a corrupt length can't ask for
+    // more memory than the string could hold
+    if (size > MaxStringLength ||
+        size > (compressedSize + 2) * LZFMaxExpansion) {
+      throw RDBError("invalid LZF string length");
+    }
+    return {take(compressedSize), compressedSize, size};
+  }
+
+  static void decompress(const Compressed &compressed, char *output) {
+    if (!lzfDecompress(compressed.data, compressed.compressedSize, output,
+                       compressed.size)) {
+      throw RDBError("corrupt LZF string");
+    }
+  }
+
+  std::int64_t integer(std::uint64_t encoding) {
+    switch (encoding) {
+    case INT8:
+      return static_cast<std::int8_t>(byte());
+    case INT16:
+      return static_cast<std::int16_t>(littleEndian(2));
+    case INT32:
+      return static_cast<std::int32_t>(littleEndian(4));
+    default:
+      throw RDBError("invalid string encoding");
+    }
+  }
+
+  void skipStream(RDBType type) {
+    for (std::uint64_t n = plainLength(); n > 0; --n) {
+      skipString(); // master id
+      skipString(); // listpack
+    }
+    // Length and last id, then the first id, max deleted id and entries
+    // added of version 2
+    for (int n = type == RDBType::STREAMLISTPACKS ? 3 : 8; n > 0; --n) {
+      plainLength();
+    }
+    for (std::uint64_t groups = plainLength(); groups > 0; --groups) {
+      skipString();
+      plainLength();
+      plainLength();
+      if (type != RDBType::STREAMLISTPACKS) {
+        plainLength(); // entries read
+      }
+      for (std::uint64_t pending = plainLength(); pending > 0; --pending) {
+        take(16 + 8); // id and delivery time
+        plainLength();
+      }
+      for (std::uint64_t consumers = plainLength(); consumers > 0;
+           --consumers) {
+        skipString();
+        take(type == RDBType::STREAMLISTPACKS3 ? 16 : 8);
+        for (std::uint64_t pending = plainLength(); pending > 0; --pending) {
+          take(16);
+        }
+      }
+    }
+  }
+
+  const char *position_;
+  const char *end_;
+};
+
+/**
+ * @brief Loads a mapped RDB file into a @sa RDBTarget.
+ *
+ * The calling thread walks the file, only reading the lengths, and hands
+ * chunks of about @sa ChunkBytes of records to a thread pool decoding them,
+ * along with the checksum of the segments it walked past. Decoded records are
+ * batched per partition and inserted under the partition's lock.
+ */
+class Loader {
+public:
+  Loader(const MappedFile &file, const RDBTarget &target, std::size_t threads)
+      : file_(file), target_(target), pool_(threads),
+        locks_(target.partitions),
+        checksums_(file.size() / ChecksumSegmentBytes + 1) {}
+
+  std::optional<RDBLoadStats> load() {
+    try {
+      walk();
+    } catch (const RDBError &error) {
+      fail(error.what());
+    }
+    pool_.join();
+    if (failed_) {
+      LOG_ERROR("Failed to load the RDB file: {}", error_);
+      return std::nullopt;
+    }
+    if (verifyChecksum_) {
+      std::uint64_t checksum = 0;
+      for (std::size_t i = 0; i < checksumSizes_.size(); ++i) {
+        checksum =
+            CRC64::combine(checksum, checksums_[i], checksumSizes_[i]);
+      }
+      if (checksum != expectedChecksum_) {
+        LOG_ERROR("Wrong RDB checksum {:x}, expected {:x}", checksum,
+                  expectedChecksum_);
+        return std::nullopt;
+      }
+    }
+    stats_.keys = keys_;
+    stats_.skipped = skipped_;
+    return stats_;
+  }
+
+private:
+  struct Entry {
+    std::string key;
+    Record record;
+  };
+
+  void walk() {
+    Reader reader(file_.data(), file_.data() + file_.size());
+    const char *header = reader.take(9);
+    int version = 0;
+    auto [end, error] = std::from_chars(header + 5, header + 9, version);
+    if (std::string_view(header, 5) != "REDIS" || error != std::errc() ||
+        end != header + 9 || version < 1 || version > RDBVersion) {
+      throw RDBError("not a RDB file of a supported version");
+    }
+    stats_.version = version;
+    // The checksum usually ends the file, 0 when it was saved without one
+    verifyChecksum_ =
+        version >= 5 && file_.size() >= 17 &&
+        Reader(file_.data() + file_.size() - 8, file_.data() + file_.size())
+                .littleEndian(8) != 0;
+    std::uint64_t db = 0;
+    const char *chunk = reader.position();
+    while (!failed_) {
+      const char *record = reader.position();
+      std::uint8_t opcode = reader.byte();
+      switch (opcode) {
+      case OpCodes::EXPIRETIMEMS:
+        reader.take(8);
+        continue;
+      case OpCodes::EXPIRETIME:
+        reader.take(4);
+        continue;
+      case OpCodes::IDLE:
+        reader.plainLength();
+        continue;
+      case OpCodes::FREQ:
+        reader.byte();
+        continue;
+      default:
+        break;
+      }
+      if (opcode < OpCodes::SLOTINFO) {
+        // A key and its value
+        reader.skipString();
+        reader.skipValue(opcode);
+        if (db != 0) {
+          ++skipped_;
+          chunk = reader.position();
+        } else if (std::size_t(reader.position() - chunk) >= ChunkBytes) {
+          decode(chunk, reader.position());
+          chunk = reader.position();
+        }
+        checksumUpTo(reader.position(), false);
+        continue;
+      }
+      decode(chunk, record);
+      switch (opcode) {
+      case OpCodes::AUX:
+        reader.skipString();
+        reader.skipString();
+        break;
+      case OpCodes::SELECTDB:
+        db = reader.plainLength();
+        break;
+      case OpCodes::RESIZEDB: {
+        std::uint64_t size = reader.plainLength();
+        reader.plainLength(); // keys with an expiry
+        if (db == 0) {
+          reserve(size);
+        }
+        break;
+      }
+      case OpCodes::MODULEAUX:
+        // Module id, when opcode and when
+        reader.plainLength();
+        reader.plainLength();
+        reader.plainLength();
+        reader.skipModuleValue();
+        break;
+      case OpCodes::FUNCTION2:
+        reader.skipString();
+        break;
+      case OpCodes::SLOTINFO:
+        reader.plainLength();
+        reader.plainLength();
+        reader.plainLength();
+        break;
+      case OpCodes::EORDBF:
+        finish(reader);
+        return;
+      default:
+        throw RDBError("unsupported opcode " + std::to_string(opcode));
+      }
+      chunk = reader.position();
+    }
+  }
+
+  /**
+   * @brief Read the checksum following the EOF opcode and checksum the rest
+   * of the file before it.
+   */
+  void finish(Reader &reader) {
+    const char *end = reader.position();
+    if (stats_.version < 5) {
+      verifyChecksum_ = false;
+      return;
+    }
+    expectedChecksum_ = reader.littleEndian(8);
+    if (expectedChecksum_ == 0) {
+      verifyChecksum_ = false;
+      return;
+    }
+    // Bytes follow the checksum, it wasn't the one guessed
+    verifyChecksum_ = true;
+    checksumUpTo(end, true);
+  }
+
+  /**
+   * @brief Checksum the segments of the file before `end`, the last one may
+   * be shorter when `partial`.
+   */
+  void checksumUpTo(const char *end, bool partial) {
+    if (!verifyChecksum_) {
+      return;
+    }
+    std::size_t limit = end - file_.data();
+    while (checksummed_ < limit &&
+           (partial || limit - checksummed_ >= ChecksumSegmentBytes)) {
+      std::size_t begin = checksummed_;
+      std::size_t size = std::min(ChecksumSegmentBytes, limit - begin);
+      std::size_t index = checksumSizes_.size();
+      checksumSizes_.push_back(size);
+      asio::post(pool_, [this, begin, size, index] {
+        checksums_[index] = CRC64::update(0, file_.data() + begin, size);
+      });
+      checksummed_ += size;
+    }
+  }
+
+  void reserve(std::uint64_t size) {
+    if (!target_.reserve) {
+      return;
+    }
+    // The keys are spread evenly, give some slack to the fuller partitions
+    std::size_t perPartition = size / target_.partitions;
+    perPartition += perPartition / 8;
+    for (std::size_t partition = 0; partition < target_.partitions;
+         ++partition) {
+      std::lock_guard<std::mutex> lock(locks_[partition]);
+      target_.reserve(partition, perPartition);
+    }
+  }
+
+  void decode(const char *begin, const char *end) {
+    if (begin == end) {
+      return;
+    }
+    asio::post(pool_, [this, begin, end] {
+      if (failed_) {
+        return;
+      }
+      try {
+        decodeChunk(begin, end);
+      } catch (const std::exception &error) {
+        fail(error.what());
+      }
+    });
+  }
+
+  void decodeChunk(const char *begin, const char *end) {
+    Reader reader(begin, end);
+    std::vector<std::vector<Entry>> batches(target_.partitions);
+    std::string scratch;
+    Record record;
+    std::size_t keys = 0;
+    std::size_t skipped = 0;
+    while (!reader.atEnd()) {
+      std::uint8_t opcode = reader.byte();
+      switch (opcode) {
+      case OpCodes::EXPIRETIMEMS:
+        record.setExpiry(static_cast<unsigned long>(reader.littleEndian(8)));
+        continue;
+      case OpCodes::EXPIRETIME:
+        record.setExpiry(static_cast<unsigned int>(reader.littleEndian(4)));
+        continue;
+      case OpCodes::IDLE:
+        reader.plainLength();
+        continue;
+      case OpCodes::FREQ:
+        reader.byte();
+        continue;
+      default:
+        break;
+      }
+      if (static_cast<RDBType>(opcode) != RDBType::STRING) {
+        reader.skipString();
+        reader.skipValue(opcode);
+        record = Record{};
+        ++skipped;
+        continue;
+      }
+      std::string key(reader.string(scratch));
+      record.data = reader.value();
+      std::size_t partition =
+          target_.partitions == 1 ? 0 : target_.partitionOf(key);
+      std::vector<Entry> &batch = batches[partition];
+      batch.push_back({std::move(key), std::move(record)});
       record = Record{};
-    } else if (byte == OpCodes::EXPIRETIMEMS) {
-      u_char bytes[8];
-      fs.read(reinterpret_cast<char *>(bytes),
-              8); // expire timestamp unix epoch ms
-      unsigned long ts = *reinterpret_cast<unsigned long *>(bytes);
-      LOG_DEBUG("Expiry date {} ms ", ts);
-      record->setExpiry(ts);
-    } else if (byte == OpCodes::EXPIRETIME) {
-      u_char bytes[4];
-      fs.read(reinterpret_cast<char *>(bytes),
-              4); // expire timestamp unix epoch seconds
-      unsigned int ts = *reinterpret_cast<unsigned int *>(bytes);
-      LOG_DEBUG("Expiry date {} s ", ts);
-      record->setExpiry(ts);
-    } else if (byte == OpCodes::EORDBF) {
-      break;
-    }
-  }
-  return data;
+      ++keys;
+      if (batch.size() >= InsertBatch) {
+        insert(partition, batch);
+      }
+    }
+    for (std::size_t partition = 0; partition < batches.size(); ++partition) {
+      insert(partition, batches[partition]);
+    }
+    keys_ += keys;
+    skipped_ += skipped;
+  }
+
+  void insert(std::size_t partition, std::vector<Entry> &batch) {
+    if (batch.empty()) {
+      return;
+    }
+    std::lock_guard<std::mutex> lock(locks_[partition]);
+    for (Entry &entry : batch) {
+      target_.insert(partition, entry.key, std::move(entry.record));
+    }
+    batch.clear();
+  }
+
+  void fail(const std::string &error) {
+    std::lock_guard<std::mutex> lock(errorMutex_);
+    if (!failed_) {
+      error_ = error;
+    }
+    failed_ = true;
+  }
+
+  const MappedFile &file_;
+  const RDBTarget &target_;
+  asio::thread_pool pool_;
+  std::vector<std::mutex> locks_;
+  /**
+   * @brief Checksums of the segments, written by the pool.
+   */
+  std::vector<std::uint64_t> checksums_;
+  std::vector<std::size_t> checksumSizes_;
+  std::size_t checksummed_ = 0;
+  bool verifyChecksum_ = false;
+  std::uint64_t expectedChecksum_ = 0;
+  RDBLoadStats stats_;
+  std::atomic<std::size_t> keys_ = 0;
+  std::atomic<std::size_t> skipped_ = 0;
+  std::atomic<bool> failed_ = false;
+  std::mutex errorMutex_;
+  std::string error_;
+};
+} // namespace
+
+std::optional<RDBLoadStats> loadRDBFile(const std::string &filePath,
+                                        const RDBTarget &target,
+                                        std::size_t threads) {
+  MappedFile file(filePath);
+  if (!file) {
+    LOG_DEBUG("Can't open the RDB file {}", filePath);
+    return std::nullopt;
+  }
+  if (threads == 0) {
+    threads = std::max(1u, std::thread::hardware_concurrency());
+  }
+  // Small files don't need a thread per core
+  threads = std::min(threads, file.size() / ChunkBytes + 1);
+  return Loader(file, target, threads).load();
 }
 
-std::optional<Database> parseRDBFile(const std::string &filePath) {
-  std::ifstream fs(filePath, std::ios::binary);
-  if (!fs.is_open()) {
+std::optional<std::size_t> RDBStreamLoader::feed(std::string_view bytes) {
+  const char *position = bytes.data();
+  const char *end = bytes.data() + bytes.size();
+  try {
+    while (stage_ != Stage::FINISHED) {
+      // One header, opcode or checksum at a time, a partial one throws
+      // before anything changed
+      Reader reader(position, end);
+      Stage stage = stage_;
+      switch (stage_) {
+      case Stage::HEADER: {
+        const char *header = reader.take(9);
+        int version = 0;
+        auto [last, error] = std::from_chars(header + 5, header + 9, version);
+        if (std::string_view(header, 5) != "REDIS" || error != std::errc() ||
+            last != header + 9 || version < 1 || version > RDBVersion) {
+          throw RDBError("not a RDB stream of a supported version");
+        }
+        stats_.version = version;
+        stage_ = Stage::RECORDS;
+        break;
+      }
+      case Stage::RECORDS: {
+        std::uint8_t opcode = reader.byte();
+        switch (opcode) {
+        case OpCodes::EXPIRETIMEMS:
+          record_.setExpiry(
+              static_cast<unsigned long>(reader.littleEndian(8)));
+          break;
+        case OpCodes::EXPIRETIME:
+          record_.setExpiry(static_cast<unsigned int>(reader.littleEndian(4)));
+          break;
+        case OpCodes::IDLE:
+          reader.plainLength();
+          break;
+        case OpCodes::FREQ:
+          reader.byte();
+          break;
+        case OpCodes::AUX:
+          reader.skipString();
+          reader.skipString();
+          break;
+        case OpCodes::SELECTDB:
+          db_ = reader.plainLength();
+          break;
+        case OpCodes::RESIZEDB: {
+          std::uint64_t size = reader.plainLength();
+          reader.plainLength(); // keys with an expiry
+          if (db_ == 0 && target_.reserve) {
+            for (std::size_t partition = 0; partition < target_.partitions;
+                 ++partition) {
+              target_.reserve(partition, size / target_.partitions);
+            }
+          }
+          break;
+        }
+        case OpCodes::MODULEAUX:
+          reader.plainLength();
+          reader.plainLength();
+          reader.plainLength();
+          reader.skipModuleValue();
+          break;
+        case OpCodes::FUNCTION2:
+          reader.skipString();
+          break;
+        case OpCodes::SLOTINFO:
+          reader.plainLength();
+          reader.plainLength();
+          reader.plainLength();
+          break;
+        case OpCodes::EORDBF:
+          stage_ = stats_.version >= 5 ? Stage::CHECKSUM : Stage::FINISHED;
+          break;
+        default: {
+          if (opcode >= OpCodes::SLOTINFO) {
+            throw RDBError("unsupported opcode " + std::to_string(opcode));
+          }
+          if (db_ != 0 || static_cast<RDBType>(opcode) != RDBType::STRING) {
+            reader.skipString();
+            reader.skipValue(opcode);
+            record_ = Record{};
+            ++stats_.skipped;
+            break;
+          }
+          std::string key(reader.string(scratch_));
+          record_.data = reader.value();
+          std::size_t partition =
+              target_.partitions == 1 ? 0 : target_.partitionOf(key);
+          target_.insert(partition, key, std::move(record_));
+          record_ = Record{};
+          ++stats_.keys;
+          break;
+        }
+        }
+        break;
+      }
+      case Stage::CHECKSUM: {
+        std::uint64_t expected = reader.littleEndian(8);
+        if (expected != 0 && expected != crc_) {
+          throw RDBError("wrong checksum");
+        }
+        stage_ = Stage::FINISHED;
+        break;
+      }
+      case Stage::FINISHED:
+        break;
+      }
+      if (stage != Stage::CHECKSUM) {
+        crc_ = CRC64::update(crc_, position, reader.position() - position);
+      }
+      position = reader.position();
+    }
+  } catch (const RDBTruncated &) {
+    // The rest comes with the next bytes
+  } catch (const std::exception &error) {
+    LOG_ERROR("Failed to load the RDB stream: {}", error.what());
     return std::nullopt;
   }
-  parseHeader(fs);
-  u_char byte;
-  while (fs.read(reinterpret_cast<char *>(&byte), 1)) {
-    if (byte == OpCodes::METADATA) {
-      // TODO parse it
+  return position - bytes.data();
+}
+
+RDBWriter::RDBWriter(Sink sink, bool compress)
+    : sink_(std::move(sink)), compress_(compress) {
+  buffer_.reserve(WriteBufferBytes);
+}
+
+RDBWriter::Sink RDBWriter::fileSink(int fd) {
+  return [fd](std::string_view bytes) {
+    while (!bytes.empty()) {
+      ssize_t written = ::write(fd, bytes.data(), bytes.size());
+      if (written < 0) {
+        if (errno == EINTR) {
+          continue;
+        }
+        return false;
+      }
+      bytes.remove_prefix(written);
     }
-    if (byte == OpCodes::SELECTDB) {
-      return parseDatabase(fs);
+    return true;
+  };
+}
+
+void RDBWriter::header() {
+  char magic[16];
+  std::snprintf(magic, sizeof(magic), "REDIS%04d", RDBSaveVersion);
+  raw(magic);
+  byte(OpCodes::AUX);
+  string("redis-bits");
+  string(std::to_string(sizeof(void *) * 8));
+  byte(OpCodes::AUX);
+  string("ctime");
+  string(std::to_string(unixTimeMs() / 1000));
+}
+
+void RDBWriter::selectDb(std::uint64_t db, std::size_t keys,
+                         std::size_t expires) {
+  byte(OpCodes::SELECTDB);
+  length(db);
+  byte(OpCodes::RESIZEDB);
+  length(keys);
+  length(expires);
+}
+
+void RDBWriter::write(std::string_view key, const Record &record) {
+  if (record.hasExpiry()) {
+    byte(OpCodes::EXPIRETIMEMS);
+    littleEndian(record.expiry, 8);
+  }
+  byte(static_cast<std::uint8_t>(RDBType::STRING));
+  string(key);
+  if (record.data.encoding() == Value::Encoding::INT &&
+      integer(record.data.integer())) {
+    return;
+  }
+  Value::IntBuffer buffer;
+  string(record.data.view(buffer));
+}
+
+bool RDBWriter::finish() {
+  byte(OpCodes::EORDBF);
+  littleEndian(crc_, 8);
+  flush();
+  return !failed_;
+}
+
+void RDBWriter::byte(std::uint8_t value) {
+  char c = static_cast<char>(value);
+  raw({&c, 1});
+}
+
+void RDBWriter::raw(std::string_view bytes) {
+  crc_ = CRC64::update(crc_, bytes.data(), bytes.size());
+  if (buffer_.size() + bytes.size() > WriteBufferBytes) {
+    flush();
+    if (bytes.size() >= WriteBufferBytes) {
+      failed_ = failed_ || !sink_(bytes);
+      return;
+    }
+  }
+  buffer_ += bytes;
+}
+
+void RDBWriter::littleEndian(std::uint64_t value, std::size_t size) {
+  char bytes[8];
+  for (std::size_t i = 0; i < size; ++i) {
+    bytes[i] = static_cast<char>(value >> (8 * i));
+  }
+  raw({bytes, size});
+}
+
+void RDBWriter::length(std::uint64_t value) {
+  if (value < 64) {
+    byte(value);
+  } else if (value < 16384) {
+    byte(0x40 | value >> 8);
+    byte(value & 0xFF);
+  } else if (value <= 0xFFFFFFFF) {
+    byte(0x80);
+    for (int i = 3; i >= 0; --i) {
+      byte(static_cast<std::uint8_t>(value >> (8 * i)));
+    }
+  } else {
+    byte(0x81);
+    for (int i = 7; i >= 0; --i) {
+      byte(static_cast<std::uint8_t>(value >> (8 * i)));
+    }
+  }
+}
+
+void RDBWriter::string(std::string_view value) {
+  std::int64_t number = 0;
+  if (value.size() <= 11 && Value::parseInteger(value, number) &&
+      integer(number)) {
+    return;
+  }
+  if (compress_ && value.size() > CompressMinSize) {
+    // Only worth it when it saves at least 4 bytes, like redis
+    if (compressed_.size() < value.size()) {
+      compressed_.resize(value.size());
+    }
+    std::size_t size = lzfCompress(value.data(), value.size(),
+                                   compressed_.data(), value.size() - 4);
+    if (size > 0) {
+      byte(0xC0 | Reader::LZF);
+      length(size);
+      length(value.size());
+      raw({compressed_.data(), size});
+      return;
     }
   }
-  return std::nullopt;
+  length(value.size());
+  raw(value);
+}
+
+bool RDBWriter::integer(std::int64_t value) {
+  auto fits = [value](auto type) {
+    using Int = decltype(type);
+    return value >= std::numeric_limits<Int>::min() &&
+           value <= std::numeric_limits<Int>::max();
+  };
+  if (fits(std::int8_t{})) {
+    byte(0xC0 | Reader::INT8);
+    littleEndian(static_cast<std::uint64_t>(value), 1);
+  } else if (fits(std::int16_t{})) {
+    byte(0xC0 | Reader::INT16);
+    littleEndian(static_cast<std::uint64_t>(value), 2);
+  } else if (fits(std::int32_t{})) {
+    byte(0xC0 | Reader::INT32);
+    littleEndian(static_cast<std::uint64_t>(value), 4);
+  } else {
+    return false;
+  }
+  return true;
+}
+
+void RDBWriter::flush() {
+  if (!buffer_.empty() && !failed_) {
+    failed_ = !sink_(buffer_);
+  }
+  buffer_.clear();
+}
+
+std::string rdbTempFilePath(const std::string &filePath, long pid) {
+  return (std::filesystem::path(filePath).parent_path() /
+          ("temp-" + std::to_string(pid) + ".rdb"))
+      .string();
+}
+
+bool saveRDBFile(const std::string &filePath,
+                 const std::function<void(RDBWriter &)> &fill,
+                 bool compress) {
+  std::string tempPath = rdbTempFilePath(filePath, getpid());
+  int fd = ::open(tempPath.c_str(), O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC,
+                  0644);
+  if (fd < 0) {
+    return false;
+  }
+  RDBWriter writer(RDBWriter::fileSink(fd), compress);
+  writer.header();
+  fill(writer);
+  // Synced before the rename, a crash can't leave a truncated snapshot
+  bool saved = writer.finish() && ::fsync(fd) == 0;
+  saved = ::close(fd) == 0 && saved;
+  if (!saved || ::rename(tempPath.c_str(), filePath.c_str()) != 0) {
+    ::unlink(tempPath.c_str());
+    return false;
+  }
+  return true;
+}
+
+bool writeRDBStream(int fd, std::string_view mark,
+                    const std::function<void(RDBWriter &)> &fill,
+                    bool compress) {
+  RDBWriter::Sink sink = RDBWriter::fileSink(fd);
+  std::string preamble = "$EOF:" + std::string(mark) + "\r\n";
+  if (!sink(preamble)) {
+    return false;
+  }
+  RDBWriter writer(sink, compress);
+  writer.header();
+  fill(writer);
+  return writer.finish() && sink(mark);
+}
+
+std::optional<Database> parseRDBFile(const std::string &filePath) {
+  Database database;
+  RDBTarget target;
+  target.reserve = [&database](std::size_t, std::size_t count) {
+    database.reserve(count);
+  };
+  target.insert = [&database](std::size_t, std::string_view key,
+                              Record record) {
+    database[key] = std::move(record);
+  };
+  if (!loadRDBFile(filePath, target)) {
+    return std::nullopt;
+  }
+  return database;
 }
 } // namespace Redis
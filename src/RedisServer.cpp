@@ -1,57 +1,1208 @@
 #include "RedisServer.hpp"
+#include "Glob.hpp"
 #include "Helper.hpp"
 #include "Logging.hpp"
 #include "RDBFile.hpp"
 #include "RESP/RESP.hpp"
+#include <Connection.hpp>
 #include <TCPClient.hpp>
-#include <TCPConnection.hpp>
+#include <algorithm>
 #include <asio.hpp>
+#include <cerrno>
+#include <charconv>
+#include <csignal>
+#include <cstring>
+#include <fcntl.h>
 #include <filesystem>
-#include <regex>
+#include <fstream>
+#include <latch>
+#include <limits>
+#include <sys/wait.h>
 #include <thread>
+#include <unistd.h>
+#include <utility>
 namespace fs = std::filesystem;
 
 namespace Redis {
 
-Server::Server(int port) : port(port) { init(); }
+namespace {
+/**
+ * @brief Share of a cron tick the active expiry may use at the lowest effort,
+ * the same as redis.
+ */
+constexpr std::size_t ExpireCyclePercent = 25;
+
+/**
+ * @brief Groups of a rehashing table migrated by every cron tick, so idle
+ * tables finish their rehash too.
+ */
+constexpr std::size_t CronRehashGroups = 64;
+
+/**
+ * @brief Entries visited by a SCAN without COUNT, the same as redis.
+ */
+constexpr std::size_t DefaultScanCount = 10;
+
+/**
+ * @brief Seconds before a failed background save is retried by the save
+ * points, the same as redis.
+ */
+constexpr std::int64_t BackgroundSaveRetrySeconds = 5;
+
+/**
+ * @brief Bytes of the append only file read per turn of its replay.
+ */
+constexpr std::size_t AppendOnlyReadBytes = 1 << 20;
+
+/**
+ * @brief Bytes of the snapshot read from the child's pipe and sent to the
+ * replicas at a time.
+ */
+constexpr std::size_t ReplicationChunkBytes = 64 << 10;
+
+/**
+ * @brief Bytes of the snapshot queued for a replica before the relay waits
+ * for it to read them.
+ */
+constexpr std::size_t ReplicationSendWindow = 4 << 20;
+
+/**
+ * @brief Records of the master's snapshot a replica loads before inserting
+ * them in the shards.
+ */
+constexpr std::size_t SnapshotInsertBatch = 4096;
+
+/**
+ * @brief Time a replica waits before connecting again to its master.
+ */
+constexpr auto MasterReconnectDelay = std::chrono::milliseconds(500);
+
+/**
+ * @brief Smallest value sent without copying it, for smaller ones a copy is
+ * cheaper than the reference count and the extra write buffers.
+ */
+constexpr std::size_t ZeroCopyMinSize = 1024;
+
+/**
+ * @brief Payload read straight into its own buffer by the request this thread
+ * executes, a SET of exactly these bytes stores the buffer instead of a copy.
+ */
+thread_local const SharedBuffer *adoptablePayload = nullptr;
+
+/**
+ * @brief Makes a payload adoptable for the lifetime of the scope.
+ */
+class PayloadScope {
+public:
+  explicit PayloadScope(const SharedBuffer *payload)
+      : previous_(std::exchange(adoptablePayload, payload)) {}
+  ~PayloadScope() { adoptablePayload = previous_; }
+  PayloadScope(const PayloadScope &) = delete;
+  PayloadScope &operator=(const PayloadScope &) = delete;
+
+private:
+  const SharedBuffer *previous_;
+};
+
+/**
+ * @brief Reply of a scan: the next cursor and the elements.
+ */
+std::string scanReply(std::uint64_t cursor,
+                      const std::vector<std::string> &elements) {
+  return "*2\r\n" + RESP::toBString(std::to_string(cursor)) +
+         RESP::toStringArray(elements);
+}
+
+/**
+ * @brief COMMAND INFO reply of a command: name, arity, flags and key
+ * positions.
+ */
+template <typename Handler>
+std::string commandInfo(const Command<Handler> &command) {
+  std::vector<std::string> flags;
+  if (command.flags & CommandFlag::WRITE) {
+    flags.push_back("+write\r\n");
+  }
+  if (command.flags & CommandFlag::READONLY) {
+    flags.push_back("+readonly\r\n");
+  }
+  if (command.flags & CommandFlag::FAST) {
+    flags.push_back("+fast\r\n");
+  }
+  std::string info = "*6\r\n" + RESP::toBString(command.name) +
+                     RESP::toInteger(command.arity) + "*" +
+                     std::to_string(flags.size()) + "\r\n";
+  for (const auto &flag : flags) {
+    info += flag;
+  }
+  return info + RESP::toInteger(command.firstKey) +
+         RESP::toInteger(command.lastKey) + RESP::toInteger(command.keyStep);
+}
+/**
+ * @brief A client in the format of CLIENT LIST.
+ */
+std::string clientLine(std::size_t id, const Connection &client,
+                       const std::string &name) {
+  Connection::Stats stats = client.stats();
+  bool replica = client.clientClass() == ClientClass::REPLICA;
+  return "id=" + std::to_string(id) + " addr=" + stats.addr +
+         " laddr=" + stats.laddr + " name=" + name +
+         " age=" + std::to_string(stats.age.count()) +
+         " idle=" + std::to_string(stats.idle.count()) +
+         " flags=" + (replica ? "S" : "N") + " db=0" +
+         " qbuf=" + std::to_string(stats.queryBuffer) +
+         " qbuf-free=" + std::to_string(stats.queryBufferFree) +
+         " omem=" + std::to_string(stats.outputBytes) +
+         " tot-net-in=" + std::to_string(stats.netIn) +
+         " tot-net-out=" + std::to_string(stats.netOut) +
+         " tot-cmds=" + std::to_string(stats.commands) + "\n";
+}
+
+/**
+ * @brief Private dirty memory of the calling process, in a forked child the
+ * pages copied on write since the fork. 0 if unknown.
+ */
+std::uint64_t privateDirtyBytes() {
+  std::ifstream smaps("/proc/self/smaps_rollup");
+  std::string line;
+  while (std::getline(smaps, line)) {
+    if (line.starts_with("Private_Dirty:")) {
+      std::uint64_t kilobytes = 0;
+      std::size_t start = line.find_first_of("0123456789");
+      if (start != std::string::npos) {
+        std::from_chars(line.data() + start, line.data() + line.size(),
+                        kilobytes);
+      }
+      return kilobytes * 1024;
+    }
+  }
+  return 0;
+}
+
+/**
+ * @brief Can a client be named so, CLIENT LIST must stay parsable.
+ */
+bool validClientName(std::string_view name) {
+  return std::all_of(name.begin(), name.end(),
+                     [](char c) { return c >= '!' && c <= '~'; });
+}
+
+} // namespace
+
+const auto &Server::commandTable() {
+  using namespace CommandFlag;
+  using Cmd = Command<Handler>;
+  // name, arity, flags, first key, last key, key step, handler
+  static constexpr CommandTable table(std::array{
+      Cmd{"ping", -1, FAST, 0, 0, 0, &Server::pingCommand},
+      Cmd{"command", -1, 0, 0, 0, 0, &Server::commandCommand},
+      Cmd{"echo", 2, FAST, 0, 0, 0, &Server::echoCommand},
+      Cmd{"get", 2, READONLY | FAST, 1, 1, 1, &Server::getCommand},
+      Cmd{"set", -3, WRITE, 1, 1, 1, &Server::setCommand},
+      Cmd{"del", -2, WRITE, 1, -1, 1, &Server::delCommand},
+      Cmd{"config", -3, 0, 0, 0, 0, &Server::configCommand},
+      Cmd{"keys", 2, READONLY, 0, 0, 0, &Server::keysCommand},
+      Cmd{"scan", -2, READONLY, 0, 0, 0, &Server::scanCommand},
+      Cmd{"info", -1, 0, 0, 0, 0, &Server::infoCommand},
+      Cmd{"client", -2, 0, 0, 0, 0, &Server::clientCommand},
+      Cmd{"replconf", -1, 0, 0, 0, 0, &Server::replconfCommand},
+      Cmd{"psync", 3, 0, 0, 0, 0, &Server::psyncCommand},
+      Cmd{"expire", 3, WRITE | FAST, 1, 1, 1, &Server::expireCommand},
+      Cmd{"pexpire", 3, WRITE | FAST, 1, 1, 1, &Server::expireCommand},
+      Cmd{"expireat", 3, WRITE | FAST, 1, 1, 1, &Server::expireCommand},
+      Cmd{"pexpireat", 3, WRITE | FAST, 1, 1, 1, &Server::expireCommand},
+      Cmd{"ttl", 2, READONLY | FAST, 1, 1, 1, &Server::ttlCommand},
+      Cmd{"pttl", 2, READONLY | FAST, 1, 1, 1, &Server::ttlCommand},
+      Cmd{"persist", 2, WRITE | FAST, 1, 1, 1, &Server::persistCommand},
+      Cmd{"object", -2, READONLY, 2, 2, 1, &Server::objectCommand},
+      Cmd{"hscan", -3, READONLY, 1, 1, 1, &Server::collectionScanCommand},
+      Cmd{"sscan", -3, READONLY, 1, 1, 1, &Server::collectionScanCommand},
+      Cmd{"zscan", -3, READONLY, 1, 1, 1, &Server::collectionScanCommand},
+      Cmd{"save", 1, 0, 0, 0, 0, &Server::saveCommand},
+      Cmd{"bgsave", -1, 0, 0, 0, 0, &Server::bgsaveCommand},
+      Cmd{"lastsave", 1, FAST, 0, 0, 0, &Server::lastsaveCommand},
+      Cmd{"bgrewriteaof", 1, 0, 0, 0, 0, &Server::bgrewriteaofCommand},
+  });
+  return table;
+}
+
+Server::Server(int port, std::size_t shards, Config config)
+    : config_(std::move(config)), port(port), masterReplId(randomString(40)) {
+  init(shards);
+}
 
 Server::Server(int port, std::string masterIp, int masterPort,
-               asio::io_context &ioContext)
-    : port(port), masterIp(masterIp), masterPort(masterPort),
-      masterReplId(randomString(40)) {
-  init();
+               asio::io_context &ioContext, std::size_t shards, Config config)
+    : config_(std::move(config)), port(port), masterIp(masterIp),
+      masterPort(masterPort), masterReplId(randomString(40)) {
+  init(shards);
   if (isReplica() && !handShakeMaster(ioContext)) {
     throw std::runtime_error("Couldn't connect to the master server");
   }
 }
 
-std::size_t Server::registerClient(std::weak_ptr<TCPConnection> clientPtr) {
-  clients.push_back(clientPtr);
-  return clients.size() - 1;
+Server::~Server() {
+  // Owned shards may still run cron tasks using the server.
+  for (auto &shard : shards_) {
+    shard->stop();
+  }
+  stopRelay_ = true;
+  {
+    std::lock_guard<std::mutex> lock(saveMutex_);
+    if (save_.child > 0) {
+      killChild();
+    }
+  }
+  if (relayThread_.joinable()) {
+    relayThread_.join();
+  }
+}
+
+void Server::startCron(asio::io_context &ioContext) {
+  cronTimer_ = std::make_unique<asio::steady_timer>(ioContext);
+  cron();
+}
+
+void Server::cron() {
+  int hz = 0;
+  int effort = 0;
+  std::vector<SavePoint> savePoints;
+  int rewritePercentage = 0;
+  std::uint64_t rewriteMinSize = 0;
+  int syncDelay = 0;
+  {
+    std::lock_guard<std::mutex> lock(configMutex_);
+    hz = std::clamp(config_.hz, 1, 500);
+    effort = std::clamp(config_.activeExpireEffort, 1, 10) - 1;
+    savePoints = parseSavePoints(config_.save).value_or(savePoints);
+    rewritePercentage = config_.autoAofRewritePercentage;
+    rewriteMinSize = config_.autoAofRewriteMinSize;
+    syncDelay = config_.replDisklessSyncDelay;
+  }
+  auto period = std::chrono::microseconds(1000000 / hz);
+  // A higher effort gives more time to the active expiry, like redis.
+  activeExpireCycle(period * (ExpireCyclePercent + 2 * effort) / 100);
+  // Commands left by a flush finding another one writing, and failed writes
+  aof_.flush();
+  checkBackgroundSave();
+  syncReplicas(syncDelay);
+  autoRewriteAppendOnly(rewritePercentage, rewriteMinSize);
+  autoSave(savePoints);
+  cronTimer_->expires_after(period);
+  cronTimer_->async_wait([this](const asio::error_code &ec) {
+    if (!ec) {
+      cron();
+    }
+  });
+}
+
+void Server::activeExpireCycle(std::chrono::microseconds budget) {
+  for (auto &shard : shards_) {
+    Shard *shardPtr = shard.get();
+    shard->submit([this, shardPtr, budget] {
+      auto start = std::chrono::steady_clock::now();
+      auto stats = shardPtr->activeExpire(start + budget);
+      shardPtr->data().rehashSteps(CronRehashGroups);
+      statExpireTimeCapReached_ += stats.timedOut;
+      statExpireCycleMicros_ +=
+          std::chrono::duration_cast<std::chrono::microseconds>(
+              std::chrono::steady_clock::now() - start)
+              .count();
+      if (stats.expired > 0) {
+        LOG_DEBUG("Shard {} expired {} keys", shardPtr->id(), stats.expired);
+      }
+    });
+  }
+}
+
+void Server::freezeKeyspace(const std::function<void()> &fn) {
+  if (!sharded_) {
+    std::vector<std::unique_lock<std::mutex>> locks;
+    for (auto &shard : shards_) {
+      locks.push_back(shard->lock());
+    }
+    fn();
+    return;
+  }
+  std::latch parked(shards_.size());
+  std::latch released(1);
+  std::latch resumed(shards_.size());
+  for (auto &shard : shards_) {
+    shard->submit([&] {
+      parked.count_down();
+      released.wait();
+      resumed.count_down();
+    });
+  }
+  parked.wait();
+  fn();
+  released.count_down();
+  resumed.wait();
+}
+
+std::uint64_t Server::keyspaceChanges() const {
+  std::uint64_t changes = 0;
+  for (const auto &shard : shards_) {
+    changes += shard->changes();
+  }
+  return changes;
+}
+
+void Server::writeKeyspace(RDBWriter &writer) {
+  std::size_t keys = 0;
+  std::size_t expires = 0;
+  for (auto &shard : shards_) {
+    keys += shard->data().size();
+    expires += shard->expiries().size();
+  }
+  writer.selectDb(0, keys, expires);
+  std::int64_t now = unixTimeMs();
+  for (auto &shard : shards_) {
+    shard->data().forEach([&writer, now](const Database::value_type &entry) {
+      if (!entry.second.hasExpiry() || entry.second.expiry > now) {
+        writer.write(entry.first, entry.second);
+      }
+    });
+  }
+}
+
+void Server::writeKeyspace(CommandWriter &writer) {
+  std::int64_t now = unixTimeMs();
+  Value::IntBuffer intBuffer;
+  for (auto &shard : shards_) {
+    shard->data().forEach([&](const Database::value_type &entry) {
+      const Record &record = entry.second;
+      if (record.hasExpiry() && record.expiry <= now) {
+        return;
+      }
+      std::string_view set[] = {"SET", entry.first,
+                                record.data.view(intBuffer)};
+      writer.write(set);
+      if (record.hasExpiry()) {
+        std::string deadline = std::to_string(record.expiry);
+        std::string_view expire[] = {"PEXPIREAT", entry.first, deadline};
+        writer.write(expire);
+      }
+    });
+  }
+}
+
+Server::SnapshotConfig Server::snapshotConfig() {
+  std::lock_guard<std::mutex> lock(configMutex_);
+  return {(fs::path(config_.dir) / config_.dbfilename).string(),
+          config_.rdbcompression == "yes"};
+}
+
+std::string Server::appendOnlyPath() {
+  std::lock_guard<std::mutex> lock(configMutex_);
+  return (fs::path(config_.dir) / config_.appendfilename).string();
+}
+
+std::optional<std::string>
+Server::forkChild(ChildKind kind, const std::string &path,
+                  const std::function<bool()> &work,
+                  const std::function<void()> &atFork) {
+  int pipe[2];
+  if (::pipe2(pipe, O_CLOEXEC) != 0) {
+    return std::string(std::strerror(errno));
+  }
+  pid_t child = -1;
+  int forkError = 0;
+  std::uint64_t changes = 0;
+  auto start = std::chrono::steady_clock::now();
+  std::chrono::steady_clock::duration forkTime{};
+  // Only the fork waits for the shards, the child's copy of the keyspace
+  // can't change afterwards
+  freezeKeyspace([&] {
+    changes = keyspaceChanges();
+    auto forkStart = std::chrono::steady_clock::now();
+    child = ::fork();
+    if (child == 0) {
+      // The other threads are gone, the child must not take a lock they may
+      // have held: no logging and the shards aren't locked
+      ::close(pipe[0]);
+      bool written = work();
+      std::uint64_t cowBytes = privateDirtyBytes();
+      [[maybe_unused]] auto reported =
+          ::write(pipe[1], &cowBytes, sizeof(cowBytes));
+      ::_exit(written ? 0 : 1);
+    }
+    forkError = errno;
+    forkTime = std::chrono::steady_clock::now() - forkStart;
+    if (child > 0 && atFork) {
+      atFork();
+    }
+  });
+  ::close(pipe[1]);
+  if (child < 0) {
+    ::close(pipe[0]);
+    LOG_ERROR("Can't fork: {}", std::strerror(forkError));
+    return std::string(std::strerror(forkError));
+  }
+  save_.child = child;
+  save_.childKind = kind;
+  save_.childPipe = pipe[0];
+  save_.childPath = path;
+  switch (kind) {
+  case ChildKind::SNAPSHOT:
+    save_.childTempPath = rdbTempFilePath(path, child);
+    break;
+  case ChildKind::REWRITE:
+    save_.childTempPath = appendOnlyTempPath(path, child);
+    break;
+  case ChildKind::REPLICATION:
+    save_.childTempPath.clear();
+    break;
+  }
+  save_.childStart = start;
+  if (kind == ChildKind::SNAPSHOT) {
+    save_.changesAtFork = changes;
+  }
+  save_.latestForkMicros =
+      std::chrono::duration_cast<std::chrono::microseconds>(forkTime).count();
+  return std::nullopt;
+}
+
+void Server::killChild() {
+  ::kill(save_.child, SIGKILL);
+  ::waitpid(save_.child, nullptr, 0);
+  if (!save_.childTempPath.empty()) {
+    ::unlink(save_.childTempPath.c_str());
+  }
+  ::close(save_.childPipe);
+  if (save_.childKind == ChildKind::REWRITE) {
+    aof_.abortRewrite();
+  }
+  save_.child = -1;
+  save_.childPipe = -1;
+}
+
+std::optional<std::string> Server::startBackgroundSave() {
+  SnapshotConfig snapshot = snapshotConfig();
+  save_.lastBackgroundTry = unixTimeMs() / 1000;
+  auto error = forkChild(ChildKind::SNAPSHOT, snapshot.path, [&] {
+    return saveRDBFile(
+        snapshot.path, [this](RDBWriter &writer) { writeKeyspace(writer); },
+        snapshot.compress);
+  });
+  if (error) {
+    save_.lastBackgroundOk = false;
+    return error;
+  }
+  LOG_INFO("Background saving started by pid {}, forked in {} us",
+           save_.child, save_.latestForkMicros);
+  return std::nullopt;
+}
+
+std::optional<std::string> Server::startAppendOnlyRewrite() {
+  std::string path = appendOnlyPath();
+  save_.lastRewriteTry = unixTimeMs() / 1000;
+  auto error = forkChild(
+      ChildKind::REWRITE, path,
+      [&] {
+        return writeAppendOnlyFile(
+            appendOnlyTempPath(path, ::getpid()),
+            [this](CommandWriter &writer) { writeKeyspace(writer); });
+      },
+      [this] { aof_.startRewrite(); });
+  if (error) {
+    save_.lastRewriteOk = false;
+    return error;
+  }
+  LOG_INFO("Background append only file rewriting started by pid {}, forked "
+           "in {} us",
+           save_.child, save_.latestForkMicros);
+  return std::nullopt;
+}
+
+std::optional<std::string> Server::startReplicationSync() {
+  if (relayThread_.joinable()) {
+    relayThread_.join();
+  }
+  int stream[2];
+  if (::pipe2(stream, O_CLOEXEC) != 0) {
+    return std::string(std::strerror(errno));
+  }
+  bool compress = snapshotConfig().compress;
+  std::string mark = randomString(RDBEofMarkSize);
+  std::size_t syncing = 0;
+  auto error = forkChild(
+      ChildKind::REPLICATION, "",
+      [&] {
+        ::close(stream[0]);
+        return writeRDBStream(
+            stream[1], mark,
+            [this](RDBWriter &writer) { writeKeyspace(writer); }, compress);
+      },
+      [&] {
+        // The commands applied from now on aren't in the snapshot, it
+        // matches the stream up to its current offset
+        std::lock_guard<std::mutex> lock(clientsMutex_);
+        std::string reply = "+FULLRESYNC " + masterReplId + " " +
+                            std::to_string(masterReplOffset) + "\r\n";
+        for (auto &replica : replicas) {
+          auto connection = replica.connection.lock();
+          if (replica.state == ReplicaLink::State::WAIT_SNAPSHOT &&
+              connection) {
+            connection->send_message(reply);
+            replica.state = ReplicaLink::State::SEND_SNAPSHOT;
+            ++syncing;
+          }
+        }
+        statSyncFull_ += syncing;
+      });
+  ::close(stream[1]);
+  if (error) {
+    ::close(stream[0]);
+    return error;
+  }
+  relaying_ = true;
+  relayThread_ = std::thread(
+      [this, fd = stream[0], mark] { relaySnapshot(fd, mark); });
+  LOG_INFO("Full synchronization of {} replicas started by pid {}, forked in "
+           "{} us",
+           syncing, save_.child, save_.latestForkMicros);
+  return std::nullopt;
+}
+
+void Server::syncReplicas(int delaySeconds) {
+  if (!hasReplicas_.load(std::memory_order_acquire)) {
+    return;
+  }
+  std::lock_guard<std::mutex> lock(saveMutex_);
+  if (save_.child >= 0 || relaying_) {
+    return;
+  }
+  bool due = false;
+  {
+    std::lock_guard<std::mutex> clientsLock(clientsMutex_);
+    std::erase_if(replicas, [](const ReplicaLink &replica) {
+      return replica.connection.expired();
+    });
+    auto now = std::chrono::steady_clock::now();
+    for (const auto &replica : replicas) {
+      due = due || (replica.state == ReplicaLink::State::WAIT_SNAPSHOT &&
+                    now - replica.waitingSince >=
+                        std::chrono::seconds(delaySeconds));
+    }
+  }
+  if (due) {
+    if (auto error = startReplicationSync()) {
+      LOG_ERROR("Can't start the full synchronization of the replicas: {}",
+                *error);
+    }
+  }
+}
+
+void Server::relaySnapshot(int fd, std::string mark) {
+  using Clock = std::chrono::steady_clock;
+  struct Target {
+    std::shared_ptr<Connection> connection;
+    /**
+     * @brief The snapshot read while its window was full.
+     */
+    std::string queued;
+    Clock::time_point lastSent;
+    std::optional<Clock::time_point> softLimitSince;
+  };
+  std::vector<Target> targets;
+  {
+    std::lock_guard<std::mutex> lock(clientsMutex_);
+    for (const auto &replica : replicas) {
+      auto connection = replica.connection.lock();
+      if (connection &&
+          replica.state == ReplicaLink::State::SEND_SNAPSHOT) {
+        targets.push_back({std::move(connection), {}, Clock::now(), {}});
+      }
+    }
+  }
+  std::chrono::seconds timeout;
+  {
+    std::lock_guard<std::mutex> lock(configMutex_);
+    timeout = std::chrono::seconds(config_.replTimeout);
+  }
+  OutputBufferLimit limit = outputBufferLimit(ClientClass::REPLICA);
+  std::vector<std::shared_ptr<Connection>> dropped;
+  // Hands the queued snapshot to a replica once its window has room, a
+  // replica which stopped reading is disconnected instead of holding the
+  // others and the child back
+  auto drain = [&](Target &target, Clock::time_point now) {
+    if (target.queued.empty() ||
+        target.connection->outputBytes() < ReplicationSendWindow) {
+      if (!target.queued.empty()) {
+        target.connection->send_message(target.queued);
+        target.queued.clear();
+      }
+      target.lastSent = now;
+      return true;
+    }
+    std::size_t pending =
+        target.connection->outputBytes() + target.queued.size();
+    if (now - target.lastSent < timeout &&
+        !limit.exceeded(pending, target.softLimitSince, now)) {
+      return true;
+    }
+    LOG_ERROR("Replica with {} bytes of the snapshot pending is too slow, "
+              "disconnecting it",
+              pending);
+    target.connection->kill();
+    dropped.push_back(std::move(target.connection));
+    return false;
+  };
+  std::string chunk(ReplicationChunkBytes, '\0');
+  std::string tail;
+  std::uint64_t sent = 0;
+  bool end = false;
+  while (!stopRelay_.load(std::memory_order_relaxed)) {
+    std::erase_if(targets, [&, now = Clock::now()](Target &target) {
+      return !drain(target, now);
+    });
+    auto waiting = [](const Target &target) {
+      return !target.queued.empty();
+    };
+    if (targets.empty() ||
+        (end && std::none_of(targets.begin(), targets.end(), waiting))) {
+      break;
+    }
+    // The fastest replica sets the pace, the others queue behind it
+    if (end || std::all_of(targets.begin(), targets.end(), waiting)) {
+      std::this_thread::sleep_for(std::chrono::milliseconds(1));
+      continue;
+    }
+    ssize_t bytes = ::read(fd, chunk.data(), chunk.size());
+    if (bytes < 0 && errno == EINTR) {
+      continue;
+    }
+    if (bytes <= 0) {
+      end = true;
+      continue;
+    }
+    tail.append(chunk.data(), bytes);
+    if (tail.size() > mark.size()) {
+      tail.erase(0, tail.size() - mark.size());
+    }
+    for (auto &target : targets) {
+      target.queued.append(chunk.data(), bytes);
+    }
+    sent += bytes;
+  }
+  ::close(fd);
+  // The child writes the mark last, only once the whole snapshot is written
+  bool complete = end && tail == mark && !stopRelay_;
+  std::size_t online = 0;
+  {
+    std::lock_guard<std::mutex> lock(clientsMutex_);
+    for (auto &replica : replicas) {
+      auto connection = replica.connection.lock();
+      if (!connection ||
+          replica.state != ReplicaLink::State::SEND_SNAPSHOT) {
+        continue;
+      }
+      if (!complete || std::find(dropped.begin(), dropped.end(),
+                                 connection) != dropped.end()) {
+        connection->kill();
+        replica.connection.reset();
+        continue;
+      }
+      if (!replica.pending.empty()) {
+        connection->send_message(replica.pending);
+      }
+      replica.pending = std::string();
+      replica.state = ReplicaLink::State::ONLINE;
+      ++online;
+    }
+  }
+  if (complete) {
+    LOG_INFO("Snapshot of {} bytes sent to {} replicas, they are online",
+             sent, online);
+  } else {
+    LOG_ERROR("The snapshot for the replicas failed after {} bytes, "
+              "disconnecting them",
+              sent);
+  }
+  relaying_ = false;
+}
+
+void Server::checkBackgroundSave() {
+  std::lock_guard<std::mutex> lock(saveMutex_);
+  if (save_.child < 0) {
+    return;
+  }
+  int status = 0;
+  pid_t pid = ::waitpid(save_.child, &status, WNOHANG);
+  if (pid == 0) {
+    return;
+  }
+  bool written = pid == save_.child && WIFEXITED(status) &&
+                 WEXITSTATUS(status) == 0;
+  std::uint64_t cowBytes = 0;
+  if (::read(save_.childPipe, &cowBytes, sizeof(cowBytes)) ==
+      sizeof(cowBytes)) {
+    save_.lastCowBytes = cowBytes;
+  }
+  ::close(save_.childPipe);
+  std::int64_t seconds = std::chrono::duration_cast<std::chrono::seconds>(
+                             std::chrono::steady_clock::now() -
+                             save_.childStart)
+                             .count();
+  switch (save_.childKind) {
+  case ChildKind::SNAPSHOT:
+    save_.lastBackgroundOk = written;
+    save_.lastBackgroundSeconds = seconds;
+    if (written) {
+      save_.changesAtSave = save_.changesAtFork;
+      save_.lastSave = unixTimeMs() / 1000;
+      LOG_INFO("Background saving terminated with success, {} MB of memory "
+               "used by copy-on-write",
+               save_.lastCowBytes >> 20);
+    } else {
+      LOG_ERROR("Background saving of {} failed", save_.childPath);
+    }
+    break;
+  case ChildKind::REWRITE:
+    written = written &&
+              aof_.finishRewrite(save_.childTempPath, save_.childPath);
+    save_.lastRewriteOk = written;
+    save_.lastRewriteSeconds = seconds;
+    if (written) {
+      LOG_INFO("Background append only file rewriting terminated with "
+               "success, {} MB of memory used by copy-on-write",
+               save_.lastCowBytes >> 20);
+    } else {
+      LOG_ERROR("Background append only file rewriting of {} failed",
+                save_.childPath);
+      aof_.abortRewrite();
+    }
+    break;
+  case ChildKind::REPLICATION:
+    // The relay sees the end of the stream and finishes the synchronization
+    if (written) {
+      LOG_INFO("Snapshot for the replicas written, {} MB of memory used by "
+               "copy-on-write",
+               save_.lastCowBytes >> 20);
+    } else {
+      LOG_ERROR("Writing the snapshot for the replicas failed");
+    }
+    break;
+  }
+  if (!written && !save_.childTempPath.empty()) {
+    // A killed child couldn't remove its temporary file
+    ::unlink(save_.childTempPath.c_str());
+  }
+  save_.child = -1;
+  save_.childPipe = -1;
+  if (save_.rewriteScheduled) {
+    save_.rewriteScheduled = false;
+    startAppendOnlyRewrite();
+  } else if (save_.scheduled) {
+    save_.scheduled = false;
+    startBackgroundSave();
+  }
+}
+
+void Server::autoSave(const std::vector<SavePoint> &points) {
+  if (points.empty()) {
+    return;
+  }
+  std::lock_guard<std::mutex> lock(saveMutex_);
+  if (save_.child >= 0) {
+    return;
+  }
+  std::int64_t now = unixTimeMs() / 1000;
+  if (!save_.lastBackgroundOk &&
+      now - save_.lastBackgroundTry < BackgroundSaveRetrySeconds) {
+    return;
+  }
+  std::uint64_t changes = keyspaceChanges() - save_.changesAtSave;
+  for (const SavePoint &point : points) {
+    if (changes >= point.changes &&
+        now - save_.lastSave >= static_cast<std::int64_t>(point.seconds)) {
+      LOG_INFO("{} changes in {} seconds, saving", point.changes,
+               point.seconds);
+      startBackgroundSave();
+      return;
+    }
+  }
+}
+
+void Server::autoRewriteAppendOnly(int percentage, std::uint64_t minSize) {
+  std::lock_guard<std::mutex> lock(saveMutex_);
+  AppendOnlyFile::State state = aof_.state();
+  if (save_.child >= 0 || state == AppendOnlyFile::State::OFF) {
+    return;
+  }
+  if (!save_.lastRewriteOk &&
+      unixTimeMs() / 1000 - save_.lastRewriteTry <
+          BackgroundSaveRetrySeconds) {
+    return;
+  }
+  if (state == AppendOnlyFile::State::WAIT_REWRITE) {
+    startAppendOnlyRewrite();
+    return;
+  }
+  std::uint64_t size = aof_.size();
+  std::uint64_t base = std::max<std::uint64_t>(aof_.baseSize(), 1);
+  if (percentage == 0 || size < minSize || size <= base) {
+    return;
+  }
+  std::uint64_t growth = (size - base) * 100 / base;
+  if (growth >= static_cast<std::uint64_t>(percentage)) {
+    LOG_INFO("Starting the automatic rewriting of the append only file on "
+             "{}% growth",
+             growth);
+    startAppendOnlyRewrite();
+  }
+}
+
+void Server::setAppendOnly(bool enabled) {
+  std::lock_guard<std::mutex> lock(saveMutex_);
+  bool on = aof_.state() != AppendOnlyFile::State::OFF;
+  if (enabled == on) {
+    return;
+  }
+  if (!enabled) {
+    if (save_.child >= 0 && save_.childKind == ChildKind::REWRITE) {
+      LOG_INFO("Killing the append only file rewriting child {}",
+               save_.child);
+      killChild();
+    }
+    save_.rewriteScheduled = false;
+    aof_.close();
+    return;
+  }
+  // The log starts with a rewrite of the current keyspace, the writes
+  // applied meanwhile are kept for it
+  aof_.waitForRewrite();
+  if (save_.child >= 0) {
+    save_.rewriteScheduled = true;
+    return;
+  }
+  startAppendOnlyRewrite();
 }
 
-void Server::init() {
-  initCmdsLUT();
+std::size_t Server::registerClient(std::weak_ptr<Connection> clientPtr) {
+  std::lock_guard<std::mutex> lock(clientsMutex_);
+  return clients_.add(std::move(clientPtr));
+}
+
+void Server::unregisterClient(std::size_t clientId) {
+  std::lock_guard<std::mutex> lock(clientsMutex_);
+  clients_.remove(clientId);
+}
+
+void Server::createShards(std::size_t shards) {
+  shards_.clear();
+  for (std::size_t i = 0; i < shards; ++i) {
+    shards_.push_back(std::make_unique<Shard>(i));
+  }
+  std::lock_guard<std::mutex> lock(configMutex_);
+  applyConfig();
+}
+
+void Server::init(std::size_t shards) {
+  createShards(std::max<std::size_t>(shards, 1));
   fs::path rdbFilePath = fs::path(config_.dir) / fs::path(config_.dbfilename);
-  auto rdbDatabase = parseRDBFile(rdbFilePath);
-  if (rdbDatabase) {
-    LOG_INFO("Loaded RDB file from the path {} with {} records",
-             config_.dbfilename, rdbDatabase->size());
-    data_.insert(rdbDatabase->begin(), rdbDatabase->end());
+  bool appendOnly = config_.appendonly == "yes";
+  std::string aofPath = appendOnlyPath();
+  if (appendOnly && fs::exists(aofPath)) {
+    loadAppendOnlyFile(aofPath);
+  } else if (fs::exists(rdbFilePath)) {
+    // The shards aren't started yet, the loader serializes the accesses to
+    // each of them
+    RDBTarget target;
+    target.partitions = shards_.size();
+    target.partitionOf = [this](std::string_view key) {
+      return shardIndex(key);
+    };
+    target.reserve = [this](std::size_t shard, std::size_t count) {
+      shards_[shard]->data().reserve(count);
+    };
+    target.insert = [this](std::size_t shard, std::string_view key,
+                           Record record) {
+      shards_[shard]->set(key, std::move(record));
+    };
+    auto start = std::chrono::steady_clock::now();
+    auto stats = loadRDBFile(rdbFilePath, target);
+    if (stats) {
+      LOG_INFO("Loaded RDB file {} version {} with {} records in {} ms, "
+               "skipped {}",
+               rdbFilePath.string(), stats->version, stats->keys,
+               std::chrono::duration_cast<std::chrono::milliseconds>(
+                   std::chrono::steady_clock::now() - start)
+                   .count(),
+               stats->skipped);
+    } else {
+      LOG_ERROR("Failed to load the RDB file {}, starting empty",
+                rdbFilePath.string());
+      createShards(shards_.size());
+    }
+  }
+  // The loaded keys are saved already
+  save_.changesAtSave = keyspaceChanges();
+  save_.lastSave = unixTimeMs() / 1000;
+  if (appendOnly) {
+    // The log starts from the loaded snapshot
+    if (!fs::exists(aofPath)) {
+      std::string tempPath = appendOnlyTempPath(aofPath, ::getpid());
+      if (!writeAppendOnlyFile(tempPath,
+                               [this](CommandWriter &writer) {
+                                 writeKeyspace(writer);
+                               }) ||
+          ::rename(tempPath.c_str(), aofPath.c_str()) != 0) {
+        ::unlink(tempPath.c_str());
+        throw std::runtime_error("Can't create the append only file " +
+                                 aofPath + ": " + std::strerror(errno));
+      }
+    }
+    if (!aof_.open(aofPath)) {
+      throw std::runtime_error("Can't open the append only file " + aofPath +
+                               ": " + std::strerror(errno));
+    }
+  }
+  sharded_ = shards > 0;
+  if (sharded_) {
+    for (auto &shard : shards_) {
+      shard->start();
+    }
+    LOG_INFO("Keyspace split in {} shards", shards_.size());
+  }
+}
+
+void Server::loadAppendOnlyFile(const std::string &path) {
+  int fd = ::open(path.c_str(), O_RDONLY | O_CLOEXEC);
+  if (fd < 0) {
+    throw std::runtime_error("Can't open the append only file " + path +
+                             ": " + std::strerror(errno));
+  }
+  // The shards have no threads yet, the commands run in place like with a
+  // shared keyspace and through the same parser as the clients' ones
+  auto start = std::chrono::steady_clock::now();
+  std::string buffer;
+  std::size_t offset = 0;
+  std::size_t executed = 0;
+  Reply replies;
+  bool end = false;
+  while (!end) {
+    std::size_t size = buffer.size();
+    buffer.resize(size + AppendOnlyReadBytes);
+    ssize_t bytes = ::read(fd, buffer.data() + size, AppendOnlyReadBytes);
+    if (bytes < 0 && errno == EINTR) {
+      buffer.resize(size);
+      continue;
+    }
+    if (bytes < 0) {
+      int error = errno;
+      ::close(fd);
+      throw std::runtime_error("Can't read the append only file " + path +
+                               ": " + std::strerror(error));
+    }
+    buffer.resize(size + bytes);
+    end = bytes == 0;
+    std::optional<std::size_t> consumed =
+        handleBuffer(buffer, replies, -1, nullptr, &executed);
+    if (!consumed) {
+      ::close(fd);
+      throw std::runtime_error("Bad file format reading the append only file " +
+                               path + " at offset " + std::to_string(offset));
+    }
+    replies.clear();
+    offset += *consumed;
+    buffer.erase(0, *consumed);
+  }
+  ::close(fd);
+  if (!buffer.empty()) {
+    LOG_WARNING("The append only file {} ends with a partial command, "
+                "truncating it to {} bytes",
+                path, offset);
+    if (::truncate(path.c_str(), offset) != 0) {
+      throw std::runtime_error("Can't truncate the append only file " + path +
+                               ": " + std::strerror(errno));
+    }
+  }
+  LOG_INFO("Loaded the append only file {} with {} commands in {} ms", path,
+           executed,
+           std::chrono::duration_cast<std::chrono::milliseconds>(
+               std::chrono::steady_clock::now() - start)
+               .count());
+}
+
+void Server::applyConfig() {
+  auto policy = parseEvictionPolicy(config_.maxmemoryPolicy)
+                    .value_or(EvictionPolicy::NOEVICTION);
+  for (auto &shard : shards_) {
+    shard->setEvictionPolicy(policy);
+  }
+  maxmemory_ = config_.maxmemory;
+  maxmemorySamples_ = config_.maxmemorySamples;
+  protoMaxBulkLen_ = config_.protoMaxBulkLen;
+  auto limits = parseOutputBufferLimits(config_.clientOutputBufferLimit)
+                    .value_or(defaultOutputBufferLimits());
+  for (std::size_t i = 0; i < ClientClasses; ++i) {
+    outputBufferLimits_[i][0] = limits[i].hard;
+    outputBufferLimits_[i][1] = limits[i].soft;
+    outputBufferLimits_[i][2] = limits[i].softSeconds;
+  }
+  aof_.setPolicy(parseFsyncPolicy(config_.appendfsync)
+                     .value_or(FsyncPolicy::EVERYSEC));
+  ioCommandsPerTurn_ = config_.ioCommandsPerTurn;
+  ioBytesPerTurn_ = config_.ioBytesPerTurn;
+  replTurnWeight_ = config_.replTurnWeight;
+  replBacklogSize_ = config_.replBacklogSize;
+  bool prefixIndex = config_.keysPrefixIndex == "yes";
+  forEachShard([prefixIndex](Shard &shard) {
+    shard.setPrefixIndex(prefixIndex);
+  });
+}
+
+OutputBufferLimit Server::outputBufferLimit(ClientClass clientClass) const {
+  const auto &limit =
+      outputBufferLimits_[static_cast<std::size_t>(clientClass)];
+  return {limit[0], limit[1], limit[2]};
+}
+
+Server::TurnBudget Server::turnBudget(ClientClass clientClass) const {
+  std::size_t weight =
+      clientClass == ClientClass::REPLICA ? replTurnWeight_.load() : 1;
+  return {ioCommandsPerTurn_ * weight, ioBytesPerTurn_ * weight};
+}
+
+Shard &Server::shardFor(std::string_view key) {
+  return *shards_[shardIndex(key)];
+}
+
+std::size_t Server::shardIndex(std::string_view key) const {
+  if (shards_.size() == 1) {
+    return 0;
+  }
+  // The low bits of the hash pick the slot inside a shard's table, use the
+  // high ones to pick the shard.
+  std::size_t hash = StringHash{}(key) >> (sizeof(std::size_t) * 4);
+  return hash % shards_.size();
+}
+
+void Server::forEachShard(const std::function<void(Shard &)> &fn) {
+  if (!sharded_) {
+    for (auto &shard : shards_) {
+      auto lock = shard->lock();
+      fn(*shard);
+    }
+    return;
+  }
+  std::latch done(shards_.size());
+  for (auto &shard : shards_) {
+    Shard *shardPtr = shard.get();
+    shard->submit([&fn, &done, shardPtr] {
+      fn(*shardPtr);
+      done.count_down();
+    });
+  }
+  done.wait();
+}
+
+void Server::runOnShard(std::string_view key,
+                        const std::function<void(Shard &)> &fn) {
+  runOnShard(shardFor(key), fn);
+}
+
+void Server::runOnShard(Shard &shard,
+                        const std::function<void(Shard &)> &fn) {
+  if (!sharded_) {
+    auto lock = shard.lock();
+    fn(shard);
+    return;
   }
+  std::latch done(1);
+  shard.submit([&] {
+    fn(shard);
+    done.count_down();
+  });
+  done.wait();
 }
 
-void Server::propagateToReplicas(const std::vector<std::string> &commands) {
+void Server::dispatchToShards(
+    const std::vector<std::vector<std::string_view>> &batch, Reply &replies,
+    std::size_t clientId) {
+  if (batch.empty()) {
+    return;
+  }
+  std::vector<std::vector<std::size_t>> perShard(shards_.size());
+  for (std::size_t i = 0; i < batch.size(); ++i) {
+    perShard[shardFor(batch[i][1]).id()].push_back(i);
+  }
+  std::ptrdiff_t involved =
+      std::count_if(perShard.begin(), perShard.end(),
+                    [](const auto &commands) { return !commands.empty(); });
+  std::vector<std::optional<Reply>> results(batch.size());
+  std::latch done(involved);
+  const SharedBuffer *payload = adoptablePayload;
+  for (std::size_t shard = 0; shard < perShard.size(); ++shard) {
+    if (perShard[shard].empty()) {
+      continue;
+    }
+    shards_[shard]->submit(
+        [this, &batch, &results, &done, &commands = perShard[shard], clientId,
+         payload] {
+          PayloadScope scope(payload);
+          for (std::size_t i : commands) {
+            results[i] = handleCommands(batch[i], clientId);
+          }
+          done.count_down();
+        });
+  }
+  done.wait();
+  for (auto &result : results) {
+    if (result) {
+      replies.insert(replies.end(), std::make_move_iterator(result->begin()),
+                     std::make_move_iterator(result->end()));
+    }
+  }
+}
+
+void Server::propagateToReplicas(
+    const std::vector<std::string_view> &commands) {
+  if (!hasReplicas_.load(std::memory_order_acquire)) {
+    return;
+  }
   std::string command = RESP::toStringArray(commands);
-  for (const auto &replica : replicas) {
-    if (auto ptr = replica.lock(); ptr != nullptr) {
-      LOG_INFO("Sending a message to the replica ");
-      ptr->send_message(command);
+  std::lock_guard<std::mutex> lock(clientsMutex_);
+  if (std::size_t size = replBacklogSize_; backlog_.capacity() != size) {
+    backlog_.resize(size);
+  }
+  backlog_.append(command);
+  masterReplOffset = backlog_.offset();
+  for (auto &replica : replicas) {
+    switch (replica.state) {
+    case ReplicaLink::State::WAIT_SNAPSHOT:
+      // The snapshot it waits for isn't forked yet
+      break;
+    case ReplicaLink::State::SEND_SNAPSHOT:
+      if (auto ptr = replica.connection.lock(); ptr != nullptr) {
+        replica.pending += command;
+        std::size_t bytes = ptr->outputBytes() + replica.pending.size();
+        if (outputBufferLimit(ClientClass::REPLICA)
+                .exceeded(bytes, replica.softLimitSince,
+                          std::chrono::steady_clock::now())) {
+          LOG_ERROR("Replica {} output of {} bytes is over its limit during "
+                    "its synchronization, closing the connection",
+                    replica.clientId, bytes);
+          ptr->kill();
+          replica.connection.reset();
+          replica.pending = std::string();
+        }
+      }
+      break;
+    case ReplicaLink::State::ONLINE:
+      if (auto ptr = replica.connection.lock(); ptr != nullptr) {
+        LOG_DEBUG("Sending a message to the replica {}", replica.clientId);
+        ptr->send_message(command);
+      }
+      break;
     }
   }
 }
 
 bool Server::handShakeMaster(asio::io_context &ioContext) {
+  masterContext_ = &ioContext;
   replicaClient = TCPClient::create(ioContext, *masterIp, *masterPort);
   // ioThread = std::thread([&] { ioContext.run(); });
   LOG_INFO("Pinging the master server on {} {}", *masterIp, *masterPort);
@@ -80,248 +1231,1074 @@ bool Server::handShakeMaster(asio::io_context &ioContext) {
                  "+OK\r\n")) {
     return false;
   }
-  if (!readWrite(RESP::toStringArray({"REPLCONF", "capa", "psync2"}),
+  if (!readWrite(RESP::toStringArray(
+                     {"REPLCONF", "capa", "eof", "capa", "psync2"}),
                  "+OK\r\n")) {
     return false;
   }
-
-  readWrite(RESP::toStringArray({"PSYNC", "?", "-1"}), "");
-
-  std::string rdbFile;
-  auto error = replicaClient->read(rdbFile);
-  if (error) {
-    LOG_ERROR("Error getting rdb file from the master {}", error.message());
+  // Like redis, the offset asked for is the one of the next byte counted
+  // from 1
+  std::string psync =
+      master_.synced
+          ? RESP::toStringArray({"PSYNC", masterReplId,
+                                 std::to_string(masterReplOffset + 1)})
+          : RESP::toStringArray({"PSYNC", "?", "-1"});
+  if (auto error = replicaClient->send(psync)) {
+    LOG_ERROR("Error sending PSYNC to the master {}", error.message());
     return false;
   }
+  master_.stage = MasterLink::Stage::RESYNC_REPLY;
+  // The reply, the snapshot and the propagated commands come as one stream,
+  // the snapshot is loaded as it arrives
+  replicaClient->listen(
+      [this](std::string_view stream) { return handleMasterStream(stream); },
+      [this](const std::error_code &) { masterLinkLost(); });
+  return true;
+}
 
-  LOG_INFO("RDB file received from master, {}", rdbFile);
-  fs::path rdbFilePath = fs::temp_directory_path() / fs::path("replica.rdb");
-  // Open a new binary file to write the RDB content
-  std::ofstream outFile(rdbFilePath, std::ios::binary);
-  if (!outFile) {
-    LOG_ERROR("Failed to create {} file", rdbFilePath.string());
-    return false;
+void Server::masterLinkLost() {
+  LOG_WARNING("Lost the connection to the master, reconnecting in {} ms",
+              MasterReconnectDelay.count());
+  // A snapshot loaded in part is thrown away, the next link asks for a full
+  // synchronization
+  master_.loader.reset();
+  master_.batches.clear();
+  master_.batched = 0;
+  master_.stage = MasterLink::Stage::RESYNC_REPLY;
+  if (!reconnectTimer_) {
+    reconnectTimer_ = std::make_unique<asio::steady_timer>(*masterContext_);
   }
-  std::string rdbFileContent = rdbFile.substr(rdbFile.find("\r\n") + 2);
-  // Write the content of rdbFile to the new file
-  outFile.write(rdbFileContent.data(), rdbFileContent.size());
-  if (!outFile) {
-    LOG_ERROR("Failed to write RDB data to replica.rdb");
-    return false;
+  reconnectTimer_->expires_after(MasterReconnectDelay);
+  reconnectTimer_->async_wait([this](const asio::error_code &ec) {
+    if (!ec) {
+      reconnectMaster();
+    }
+  });
+}
+
+void Server::reconnectMaster() {
+  try {
+    if (handShakeMaster(*masterContext_)) {
+      return;
+    }
+  } catch (const std::exception &e) {
+    LOG_ERROR("Couldn't connect to the master {}", e.what());
   }
-  outFile.close();
-  LOG_INFO("RDB file successfully written to replica.rdb");
-
-  auto rdbDatabase = parseRDBFile(rdbFilePath);
-  if (rdbDatabase) {
-    LOG_INFO("Loaded Replica RDB file from the path {} with {} records",
-             config_.dbfilename, rdbDatabase->size());
-    data_.insert(rdbDatabase->begin(), rdbDatabase->end());
-  }
-  replicaClient->setCallback(
-      [this](const std::string &msg) { handleRequest(msg, 0); });
-  replicaClient->listen();
-  // asio::post(ioContext, [this]() { replicaClient->listen(); });
-  // replicaClient->listen();
-
-  // TODO check why the client is not getting the master messages
-  // replicaThread = std::thread([&] {
-  //   while (true) {
-  //     std::string msg;
-  //     replicaClient->read(msg);
-  //     LOG_INFO("Received message from master {}", msg);
-  //     handleRequest(msg, 0);
-  //     // asio::post()
-  //     // TODO optimize this part, use the iocontext to post a lambda
-  //     // which calls async_read_until in the client
-  //   }
-  // });
+  masterLinkLost();
+}
 
-  return true;
+std::optional<TCPClient::Turn>
+Server::handleMasterStream(std::string_view stream) {
+  std::size_t consumed = 0;
+  auto line = [&]() -> std::optional<std::string_view> {
+    std::size_t end = stream.find("\r\n", consumed);
+    if (end == std::string_view::npos) {
+      return std::nullopt;
+    }
+    std::string_view result = stream.substr(consumed, end - consumed);
+    consumed = end + 2;
+    return result;
+  };
+  for (;;) {
+    switch (master_.stage.load(std::memory_order_relaxed)) {
+    case MasterLink::Stage::RESYNC_REPLY: {
+      auto reply = line();
+      if (!reply) {
+        return TCPClient::Turn{consumed, false};
+      }
+      // +CONTINUE [<replid>], the missing commands follow
+      constexpr std::string_view Continue = "+CONTINUE";
+      if (reply->starts_with(Continue)) {
+        if (reply->size() > Continue.size() + 1) {
+          masterReplId = std::string(reply->substr(Continue.size() + 1));
+        }
+        LOG_INFO("Continuing the replication from offset {}",
+                 masterReplOffset.load());
+        master_.synced = true;
+        master_.stage = MasterLink::Stage::COMMANDS;
+        break;
+      }
+      // +FULLRESYNC <replid> <offset>
+      constexpr std::string_view FullResync = "+FULLRESYNC ";
+      std::size_t space = reply->find(' ', FullResync.size());
+      if (!reply->starts_with(FullResync) ||
+          space == std::string_view::npos) {
+        LOG_ERROR("Unexpected reply to PSYNC from the master {}", *reply);
+        return std::nullopt;
+      }
+      masterReplId = std::string(
+          reply->substr(FullResync.size(), space - FullResync.size()));
+      std::uint64_t offset = 0;
+      std::from_chars(reply->data() + space + 1,
+                      reply->data() + reply->size(), offset);
+      masterReplOffset = offset;
+      master_.synced = false;
+      master_.stage = MasterLink::Stage::SNAPSHOT_HEADER;
+      break;
+    }
+    case MasterLink::Stage::SNAPSHOT_HEADER: {
+      auto header = line();
+      if (!header) {
+        return TCPClient::Turn{consumed, false};
+      }
+      // $EOF:<mark> when streamed without a file, else $<size>
+      master_.eofMark.clear();
+      master_.remaining = 0;
+      if (header->starts_with("$EOF:") &&
+          header->size() == 5 + RDBEofMarkSize) {
+        master_.eofMark = std::string(header->substr(5));
+      } else if (header->empty() || (*header)[0] != '$' ||
+                 std::from_chars(header->data() + 1,
+                                 header->data() + header->size(),
+                                 master_.remaining)
+                         .ptr != header->data() + header->size()) {
+        LOG_ERROR("Invalid snapshot header from the master {}", *header);
+        return std::nullopt;
+      }
+      LOG_INFO("Loading the snapshot of the master {}",
+               master_.eofMark.empty()
+                   ? std::to_string(master_.remaining) + " bytes"
+                   : std::string("streamed"));
+      forEachShard([](Shard &shard) { shard.clear(); });
+      master_.batches.assign(shards_.size(), {});
+      RDBTarget target;
+      target.partitions = shards_.size();
+      target.partitionOf = [this](std::string_view key) {
+        return shardIndex(key);
+      };
+      target.insert = [this](std::size_t shard, std::string_view key,
+                             Record record) {
+        master_.batches[shard].emplace_back(std::string(key),
+                                            std::move(record));
+        ++master_.batched;
+      };
+      master_.loader = std::make_unique<RDBStreamLoader>(std::move(target));
+      master_.stage = MasterLink::Stage::SNAPSHOT;
+      break;
+    }
+    case MasterLink::Stage::SNAPSHOT: {
+      std::string_view bytes = stream.substr(consumed);
+      if (master_.eofMark.empty() && bytes.size() > master_.remaining) {
+        bytes = bytes.substr(0, master_.remaining);
+      }
+      std::optional<std::size_t> loaded = master_.loader->feed(bytes);
+      if (!loaded) {
+        LOG_ERROR("Invalid snapshot from the master, stop replicating");
+        return std::nullopt;
+      }
+      consumed += *loaded;
+      if (master_.eofMark.empty()) {
+        master_.remaining -= *loaded;
+      }
+      if (master_.batched >= SnapshotInsertBatch) {
+        insertSnapshotBatches();
+      }
+      if (!master_.loader->finished()) {
+        if (master_.eofMark.empty() && master_.remaining == 0) {
+          LOG_ERROR("The snapshot from the master is truncated");
+          return std::nullopt;
+        }
+        return TCPClient::Turn{consumed, false};
+      }
+      insertSnapshotBatches();
+      LOG_INFO("Loaded the snapshot of the master with {} records, skipped "
+               "{}",
+               master_.loader->stats().keys, master_.loader->stats().skipped);
+      master_.loader.reset();
+      master_.batches.clear();
+      if (master_.eofMark.empty() && master_.remaining != 0) {
+        LOG_ERROR("Bytes follow the snapshot from the master");
+        return std::nullopt;
+      }
+      master_.synced = master_.eofMark.empty();
+      master_.stage = master_.eofMark.empty()
+                          ? MasterLink::Stage::COMMANDS
+                          : MasterLink::Stage::SNAPSHOT_END;
+      break;
+    }
+    case MasterLink::Stage::SNAPSHOT_END: {
+      if (stream.size() - consumed < master_.eofMark.size()) {
+        return TCPClient::Turn{consumed, false};
+      }
+      if (stream.substr(consumed, master_.eofMark.size()) !=
+          master_.eofMark) {
+        LOG_ERROR("The snapshot from the master doesn't end with its mark");
+        return std::nullopt;
+      }
+      consumed += master_.eofMark.size();
+      master_.synced = true;
+      master_.stage = MasterLink::Stage::COMMANDS;
+      break;
+    }
+    case MasterLink::Stage::COMMANDS: {
+      // The propagated commands run as replica turns, a burst from the
+      // master yields to the clients of the io context between two of them
+      Reply ignored;
+      std::size_t executed = 0;
+      TurnBudget budget = turnBudget(ClientClass::REPLICA);
+      std::optional<std::size_t> handled =
+          handleBuffer(stream.substr(consumed), ignored, 0, nullptr,
+                       &executed, &budget);
+      if (!handled) {
+        LOG_ERROR("Invalid command from the master, stop replicating");
+        return std::nullopt;
+      }
+      masterReplOffset += *handled;
+      return TCPClient::Turn{consumed + *handled,
+                             executed >= budget.commands ||
+                                 *handled >= budget.bytes};
+    }
+    }
+  }
 }
 
-void Server::initCmdsLUT() {
-  cmdsLUT["ping"] = std::bind(&Server::pingCommand, this, std::placeholders::_1,
-                              std::placeholders::_2);
-  cmdsLUT["command"] = std::bind(&Server::pingCommand, this,
-                                 std::placeholders::_1, std::placeholders::_2);
-  cmdsLUT["echo"] = std::bind(&Server::echoCommand, this, std::placeholders::_1,
-                              std::placeholders::_2);
-  cmdsLUT["get"] = std::bind(&Server::getCommand, this, std::placeholders::_1,
-                             std::placeholders::_2);
-  cmdsLUT["set"] = std::bind(&Server::setCommand, this, std::placeholders::_1,
-                             std::placeholders::_2);
-  cmdsLUT["config"] = std::bind(&Server::configCommand, this,
-                                std::placeholders::_1, std::placeholders::_2);
-  cmdsLUT["keys"] = std::bind(&Server::keysCommand, this, std::placeholders::_1,
-                              std::placeholders::_2);
-  cmdsLUT["info"] = std::bind(&Server::infoCommand, this, std::placeholders::_1,
-                              std::placeholders::_2);
-  cmdsLUT["replconf"] = std::bind(&Server::replconfCommand, this,
-                                  std::placeholders::_1, std::placeholders::_2);
-  cmdsLUT["psync"] = std::bind(&Server::psyncCommand, this,
-                               std::placeholders::_1, std::placeholders::_2);
-  LOG_DEBUG("Init CMDS LUT with {} commands", cmdsLUT.size());
-}
-
-std::optional<std::string> Server::getValue(const std::string &key) {
-  if (data_.contains(key)) {
-    const Record &record = data_.at(key);
-    if (!data_.at(key).expired()) {
-      return data_.at(key).data;
-    } else {
-      data_.erase(key);
+void Server::insertSnapshotBatches() {
+  forEachShard([this](Shard &shard) {
+    for (auto &[key, record] : master_.batches[shard.id()]) {
+      shard.set(key, std::move(record));
     }
+    master_.batches[shard.id()].clear();
+  });
+  master_.batched = 0;
+}
+
+const Command<Server::Handler> *Server::findCommand(std::string_view name) {
+  return commandTable().find(name);
+}
+
+std::span<const Command<Server::Handler>> Server::commands() {
+  return commandTable().commands();
+}
+
+std::optional<Server::Reply> Server::getValue(std::string_view key) {
+  Shard &shard = shardFor(key);
+  auto lock = shard.lock();
+  Record *record = shard.find(key);
+  if (!record) {
+    return std::nullopt;
   }
-  return std::nullopt;
+  if (record->data.size() >= ZeroCopyMinSize) {
+    SharedBuffer buffer = record->data.buffer();
+    std::string header = "$" + std::to_string(buffer.size()) + "\r\n";
+    return Server::Reply{std::move(header), std::move(buffer),
+                         ReplyPart::literal("\r\n")};
+  }
+  Value::IntBuffer intBuffer;
+  return Server::Reply{RESP::toBString(record->data.view(intBuffer))};
 }
 
-void Server::setValue(const std::string &key, const std::string &value,
+bool Server::setValue(std::string_view key, std::string_view value,
                       std::optional<int> expiry) {
   Record newRecord;
-  newRecord.data = value;
+  const SharedBuffer *payload = adoptablePayload;
+  if (payload && payload->data() == value.data() &&
+      payload->size() == value.size()) {
+    newRecord.data = Value(*payload);
+  } else {
+    newRecord.data = value;
+  }
   if (expiry) {
     newRecord.setExpiry(*expiry);
   }
-  std::lock_guard<std::mutex> lock(dataMutex_);
-  data_[key] = newRecord;
+  Shard &shard = shardFor(key);
+  auto lock = shard.lock();
+  // Every shard gets an even part of the limit, the keys are spread evenly.
+  std::vector<std::string> evicted;
+  std::uint64_t maxmemory = maxmemory_;
+  bool fits = maxmemory == 0 ||
+              shard.evictIfNeeded(maxmemory / shards_.size(),
+                                  maxmemorySamples_, &evicted);
+  // The replicas and a replay of the log don't evict by themselves, they
+  // delete the same keys
+  for (const auto &evictedKey : evicted) {
+    std::string_view del[] = {"DEL", evictedKey};
+    aof_.append(del);
+    propagateToReplicas({"DEL", evictedKey});
+  }
+  if (!fits) {
+    return false;
+  }
+  std::int64_t deadline = newRecord.expiry;
+  shard.set(key, std::move(newRecord));
+  std::string_view set[] = {"SET", key, value};
+  aof_.append(set);
+  propagateToReplicas({"SET", key, value});
+  if (expiry) {
+    std::string deadlineStr = std::to_string(deadline);
+    std::string_view expire[] = {"PEXPIREAT", key, deadlineStr};
+    aof_.append(expire);
+    propagateToReplicas({"PEXPIREAT", key, deadlineStr});
+  }
+  return true;
 }
 
 std::optional<Server::Reply>
-Server::handleCommands(const std::vector<std::string> &commands,
+Server::handleCommands(const std::vector<std::string_view> &commands,
                        std::size_t clientId) {
-  std::string command = strTolower(commands[0]);
-  try {
-    return cmdsLUT.at(command)(commands, clientId);
-  } catch (const std::out_of_range &e) {
-    LOG_ERROR("Unrecognised command {}", command);
-    return std::nullopt;
+  const Command<Handler> *command = findCommand(commands[0]);
+  if (!command) {
+    LOG_ERROR("Unrecognised command {}", commands[0]);
+    std::string error = "-ERR unknown command '" + std::string(commands[0]) +
+                        "', with args beginning with: ";
+    for (std::size_t i = 1; i < commands.size(); ++i) {
+      error += "'" + std::string(commands[i]) + "' ";
+    }
+    return Server::Reply{error + "\r\n"};
   }
+  if (!command->checkArity(commands.size())) {
+    return Server::Reply{"-ERR wrong number of arguments for '" +
+                         std::string(command->name) + "' command\r\n"};
+  }
+  return (this->*command->handler)(commands, clientId);
 }
 
-Server::Reply Server::pingCommand(const std::vector<std::string> &commands,
-                                  std::size_t clientId) {
+Server::Reply
+Server::pingCommand(const std::vector<std::string_view> &commands,
+                    std::size_t clientId) {
   return Server::Reply{"+PONG\r\n"};
 }
 
-Server::Reply Server::echoCommand(const std::vector<std::string> &commands,
-                                  std::size_t clientId) {
-  return Server::Reply{"+" + commands[1] + "\r\n"};
+Server::Reply
+Server::commandCommand(const std::vector<std::string_view> &commands,
+                       std::size_t clientId) {
+  std::string subcommand =
+      commands.size() > 1 ? strTolower(std::string(commands[1])) : "";
+  std::string reply;
+  if (subcommand.empty()) {
+    reply = "*" + std::to_string(this->commands().size()) + "\r\n";
+    for (const auto &command : this->commands()) {
+      reply += commandInfo(command);
+    }
+  } else if (subcommand == "count") {
+    reply = RESP::toInteger(this->commands().size());
+  } else if (subcommand == "info") {
+    reply = "*" + std::to_string(commands.size() - 2) + "\r\n";
+    for (std::size_t i = 2; i < commands.size(); ++i) {
+      const Command<Handler> *command = findCommand(commands[i]);
+      reply += command ? commandInfo(*command) : "*-1\r\n";
+    }
+  } else if (subcommand == "docs") {
+    // Sent by redis-cli on connection, no documentation is available.
+    reply = "*0\r\n";
+  } else {
+    reply = "-ERR unknown subcommand '" + std::string(commands[1]) + "'.\r\n";
+  }
+  return Server::Reply{std::move(reply)};
+}
+
+Server::Reply
+Server::echoCommand(const std::vector<std::string_view> &commands,
+                    std::size_t clientId) {
+  return Server::Reply{"+" + std::string(commands[1]) + "\r\n"};
 }
 
-Server::Reply Server::getCommand(const std::vector<std::string> &commands,
-                                 std::size_t clientId) {
+Server::Reply
+Server::getCommand(const std::vector<std::string_view> &commands,
+                   std::size_t clientId) {
   LOG_DEBUG("Getting the value {}", commands[1]);
-  auto val = getValue(commands[1]);
-  if (val) {
-    return Server::Reply{RESP::toBString(*val)};
-  } else {
-    return Server::Reply{RESP::NullBString};
+  if (auto reply = getValue(commands[1])) {
+    return std::move(*reply);
   }
-  return Server::Reply{"+" + commands[1] + "\r\n"};
+  return Server::Reply{RESP::NullBString};
 }
 
-Server::Reply Server::setCommand(const std::vector<std::string> &commands,
-                                 std::size_t clientId) {
+Server::Reply
+Server::setCommand(const std::vector<std::string_view> &commands,
+                   std::size_t clientId) {
   if (commands.size() != 3 && commands.size() != 5) {
     return Server::Reply{RESP::NullBString};
   }
   std::optional<int> expiry;
   if (commands.size() == 5) {
-    try {
-      expiry = std::stoi(commands[4]);
+    int value = 0;
+    auto [ptr, ec] = std::from_chars(
+        commands[4].data(), commands[4].data() + commands[4].size(), value);
+    if (ec == std::errc()) {
+      expiry = value;
       LOG_INFO("Expiry time is {}ms", *expiry);
-    } catch (std::invalid_argument const &ex) {
-      LOG_ERROR("Expiry time is invalid {}", ex.what());
+    } else {
+      LOG_ERROR("Expiry time is invalid {}", commands[4]);
     }
   }
   LOG_DEBUG("Setting the key {} to {}", commands[1], commands[2]);
-  setValue(commands[1], commands[2], expiry);
-  propagateToReplicas(commands);
+  if (!setValue(commands[1], commands[2], expiry)) {
+    return Server::Reply{
+        "-OOM command not allowed when used memory > 'maxmemory'.\r\n"};
+  }
   return Server::Reply{"+OK\r\n"};
 }
 
-Server::Reply Server::configCommand(const std::vector<std::string> &commands,
-                                    std::size_t clientId) {
+Server::Reply
+Server::delCommand(const std::vector<std::string_view> &commands,
+                   std::size_t clientId) {
+  std::size_t deleted = 0;
+  for (std::size_t i = 1; i < commands.size(); ++i) {
+    runOnShard(commands[i], [&](Shard &shard) {
+      if (shard.erase(commands[i])) {
+        std::string_view del[] = {"DEL", commands[i]};
+        aof_.append(del);
+        propagateToReplicas({"DEL", commands[i]});
+        ++deleted;
+      }
+    });
+  }
+  return Server::Reply{RESP::toInteger(deleted)};
+}
+
+Server::Reply
+Server::expireCommand(const std::vector<std::string_view> &commands,
+                      std::size_t clientId) {
+  if (commands.size() != 3) {
+    return Server::Reply{RESP::NullBString};
+  }
+  std::string command = strTolower(std::string(commands[0]));
+  std::int64_t value = 0;
+  auto [ptr, ec] = std::from_chars(
+      commands[2].data(), commands[2].data() + commands[2].size(), value);
+  if (ec != std::errc() || ptr != commands[2].data() + commands[2].size()) {
+    return Server::Reply{"-ERR value is not an integer or out of range\r\n"};
+  }
+  // Deadlines must stay representable in milliseconds.
+  std::int64_t base = command.ends_with("at") ? 0 : unixTimeMs();
+  std::int64_t maxTtl = std::numeric_limits<std::int64_t>::max() - base;
+  std::int64_t unit = command.starts_with("pexpire") ? 1 : 1000;
+  if (value > maxTtl / unit || value < -maxTtl / unit) {
+    return Server::Reply{"-ERR invalid expire time in '" + command +
+                         "' command\r\n"};
+  }
+  std::int64_t deadline = base + value * unit;
+  Shard &shard = shardFor(commands[1]);
+  bool updated = false;
+  {
+    auto lock = shard.lock();
+    updated = shard.expire(commands[1], deadline);
+    if (updated) {
+      std::string deadlineStr = std::to_string(deadline);
+      std::string_view expire[] = {"PEXPIREAT", commands[1], deadlineStr};
+      aof_.append(expire);
+      propagateToReplicas({"PEXPIREAT", commands[1], deadlineStr});
+    }
+  }
+  return Server::Reply{RESP::toInteger(updated)};
+}
+
+Server::Reply
+Server::ttlCommand(const std::vector<std::string_view> &commands,
+                   std::size_t clientId) {
+  if (commands.size() != 2) {
+    return Server::Reply{RESP::NullBString};
+  }
+  Shard &shard = shardFor(commands[1]);
+  auto lock = shard.lock();
+  Record *record = shard.find(commands[1], false);
+  if (!record) {
+    return Server::Reply{RESP::toInteger(-2)};
+  }
+  if (!record->hasExpiry()) {
+    return Server::Reply{RESP::toInteger(-1)};
+  }
+  std::int64_t ttl = record->expiry - unixTimeMs();
+  if (strTolower(std::string(commands[0])) == "ttl") {
+    ttl = (ttl + 500) / 1000;
+  }
+  return Server::Reply{RESP::toInteger(ttl)};
+}
+
+Server::Reply
+Server::persistCommand(const std::vector<std::string_view> &commands,
+                       std::size_t clientId) {
+  if (commands.size() != 2) {
+    return Server::Reply{RESP::NullBString};
+  }
+  Shard &shard = shardFor(commands[1]);
+  bool persisted = false;
+  {
+    auto lock = shard.lock();
+    persisted = shard.persist(commands[1]);
+    if (persisted) {
+      aof_.append(commands);
+      propagateToReplicas(commands);
+    }
+  }
+  return Server::Reply{RESP::toInteger(persisted)};
+}
+
+Server::Reply
+Server::objectCommand(const std::vector<std::string_view> &commands,
+                      std::size_t clientId) {
+  if (commands.size() != 3 ||
+      strTolower(std::string(commands[1])) != "encoding") {
+    return Server::Reply{"-ERR unknown subcommand or wrong number of "
+                         "arguments for 'object' command\r\n"};
+  }
+  std::optional<std::string> encoding;
+  runOnShard(commands[2], [&](Shard &shard) {
+    if (Record *record = shard.find(commands[2], false)) {
+      encoding = record->data.encodingName();
+    }
+  });
+  if (!encoding) {
+    return Server::Reply{RESP::NullBString};
+  }
+  return Server::Reply{RESP::toBString(*encoding)};
+}
+
+Server::Reply
+Server::configCommand(const std::vector<std::string_view> &commands,
+                      std::size_t clientId) {
+  std::unique_lock<std::mutex> lock(configMutex_);
   if (commands[1] == "GET" || commands[1] == "get") {
-    auto value = config_.getField(commands[2]);
+    auto value = config_.getField(std::string(commands[2]));
     std::string valueStr = value.to_string();
-    return Server::Reply{RESP::toStringArray({commands[2], valueStr})};
+    return Server::Reply{
+        RESP::toStringArray({std::string(commands[2]), valueStr})};
+  }
+  if ((commands[1] == "SET" || commands[1] == "set") && commands.size() == 4) {
+    std::string field(commands[2]);
+    std::string value(commands[3]);
+    Config previous = config_;
+    if (!config_.setField(field, value) || !config_.valid()) {
+      config_ = previous;
+      return Server::Reply{"-ERR Invalid argument '" + value +
+                           "' for CONFIG SET '" + field + "'\r\n"};
+    }
+    applyConfig();
+    bool appendOnly = config_.appendonly == "yes";
+    lock.unlock();
+    // The saves take the config lock, not the other way around
+    if (field == "appendonly") {
+      setAppendOnly(appendOnly);
+    }
+    return Server::Reply{"+OK\r\n"};
   }
   return Server::Reply{RESP::NullBString};
 }
 
-Server::Reply Server::keysCommand(const std::vector<std::string> &commands,
-                                  std::size_t clientId) {
+Server::Reply
+Server::keysCommand(const std::vector<std::string_view> &commands,
+                    std::size_t clientId) {
   if (commands.size() != 2) {
     return Server::Reply{RESP::NullBString};
   }
-  std::string pattern = commands[1];
-  if (size_t loc = pattern.find('*'); loc != std::string::npos) {
-    pattern.insert(loc, ".");
-  }
-  LOG_DEBUG("Searching using the pattern {}", pattern);
-  const std::regex regex(pattern);
-  std::vector<std::string> matchedKeys;
-  for (const auto &record : data_) {
-    if (std::regex_match(record.first, regex)) {
-      matchedKeys.push_back(record.first);
+  std::string_view pattern = commands[1];
+  std::string_view prefix = globPrefix(pattern);
+  // Every shard collects its own matches, then they are merged
+  std::vector<std::vector<std::string>> shardKeys(shards_.size());
+  forEachShard([&](Shard &shard) {
+    auto &keys = shardKeys[shard.id()];
+    const RadixTree *index = shard.prefixIndex();
+    if (index && !prefix.empty()) {
+      // Only the keys under the pattern's literal prefix can match.
+      index->forEachWithPrefix(prefix, [&](std::string_view key) {
+        auto it = shard.data().find(key);
+        // Expired records stay until the cron or an access deletes them
+        if (it != shard.data().end() && !it->second.expired() &&
+            globMatch(pattern, key)) {
+          keys.emplace_back(key);
+        }
+      });
+      return;
     }
+    for (const auto &record : shard.data()) {
+      if (!record.second.expired() && globMatch(pattern, record.first)) {
+        keys.push_back(record.first);
+      }
+    }
+  });
+  std::vector<std::string> matchedKeys;
+  for (auto &keys : shardKeys) {
+    matchedKeys.insert(matchedKeys.end(), std::make_move_iterator(keys.begin()),
+                       std::make_move_iterator(keys.end()));
   }
   LOG_DEBUG("Matched KEYS {}", matchedKeys);
   return Server::Reply{RESP::toStringArray(matchedKeys)};
 }
 
-Server::Reply Server::infoCommand(const std::vector<std::string> &commands,
-                                  std::size_t clientId) {
+Server::Reply
+Server::scanCommand(const std::vector<std::string_view> &commands,
+                    std::size_t clientId) {
+  if (commands.size() < 2 || commands.size() % 2 != 0) {
+    return Server::Reply{"-ERR syntax error\r\n"};
+  }
+  std::uint64_t cursor = 0;
+  auto [ptr, ec] = std::from_chars(
+      commands[1].data(), commands[1].data() + commands[1].size(), cursor);
+  if (ec != std::errc() || ptr != commands[1].data() + commands[1].size()) {
+    return Server::Reply{"-ERR invalid cursor\r\n"};
+  }
+  std::optional<std::string_view> pattern;
+  std::size_t count = DefaultScanCount;
+  std::optional<std::string> type;
+  for (std::size_t i = 2; i < commands.size(); i += 2) {
+    std::string option = strTolower(std::string(commands[i]));
+    std::string_view arg = commands[i + 1];
+    if (option == "match") {
+      pattern = arg;
+    } else if (option == "count") {
+      auto [countPtr, countEc] =
+          std::from_chars(arg.data(), arg.data() + arg.size(), count);
+      if (countEc != std::errc() || countPtr != arg.data() + arg.size() ||
+          count == 0) {
+        return Server::Reply{"-ERR syntax error\r\n"};
+      }
+    } else if (option == "type") {
+      type = strTolower(std::string(arg));
+    } else {
+      return Server::Reply{"-ERR syntax error\r\n"};
+    }
+  }
+  // The low part of the cursor is the shard, the high part its table cursor.
+  std::size_t shards = shards_.size();
+  std::size_t shardIndex = cursor % shards;
+  std::size_t tableCursor = cursor / shards;
+  std::size_t visited = 0;
+  std::vector<std::string> keys;
+  while (visited < count) {
+    runOnShard(*shards_[shardIndex], [&](Shard &shard) {
+      do {
+        tableCursor = shard.data().scan(
+            tableCursor, [&](const Database::value_type &entry) {
+              ++visited;
+              // Only strings are stored.
+              if (entry.second.expired() || (type && *type != "string") ||
+                  (pattern && !globMatch(*pattern, entry.first))) {
+                return;
+              }
+              keys.push_back(entry.first);
+            });
+      } while (tableCursor != 0 && visited < count);
+    });
+    if (tableCursor == 0 && ++shardIndex == shards) {
+      return Server::Reply{scanReply(0, keys)};
+    }
+  }
+  return Server::Reply{scanReply(tableCursor * shards + shardIndex, keys)};
+}
+
+Server::Reply
+Server::collectionScanCommand(const std::vector<std::string_view> &commands,
+                              std::size_t clientId) {
+  if (commands.size() < 3) {
+    return Server::Reply{RESP::NullBString};
+  }
+  Shard &shard = shardFor(commands[1]);
+  auto lock = shard.lock();
+  if (shard.find(commands[1], false)) {
+    return Server::Reply{"-WRONGTYPE Operation against a key holding the "
+                         "wrong kind of value\r\n"};
+  }
+  return Server::Reply{scanReply(0, {})};
+}
+
+Server::Reply
+Server::infoCommand(const std::vector<std::string_view> &commands,
+                    std::size_t clientId) {
+  // Without a section every section is returned
+  std::string section =
+      commands.size() == 2 ? strTolower(std::string(commands[1])) : "";
   std::vector<std::string> info;
-  if (isReplica()) {
-    info.push_back("role:slave");
-  } else {
-    info.push_back("role:master");
+  if (section.empty() || section == "replication") {
+    if (isReplica()) {
+      info.push_back("role:slave");
+      bool synced = master_.stage.load(std::memory_order_relaxed) ==
+                    MasterLink::Stage::COMMANDS;
+      info.push_back(std::string("master_link_status:") +
+                     (synced ? "up" : "down"));
+      info.push_back("master_sync_in_progress:" +
+                     std::to_string(synced ? 0 : 1));
+    } else {
+      info.push_back("role:master");
+    }
+    std::lock_guard<std::mutex> lock(clientsMutex_);
+    std::vector<std::string> states;
+    for (const auto &replica : replicas) {
+      if (replica.connection.expired()) {
+        continue;
+      }
+      const char *state = replica.state == ReplicaLink::State::ONLINE
+                              ? "online"
+                          : replica.state == ReplicaLink::State::SEND_SNAPSHOT
+                              ? "send_bulk"
+                              : "wait_bgsave";
+      states.push_back("slave" + std::to_string(states.size()) +
+                       ":id=" + std::to_string(replica.clientId) +
+                       ",state=" + state);
+    }
+    info.push_back("connected_slaves:" + std::to_string(states.size()));
+    info.insert(info.end(), states.begin(), states.end());
+    info.push_back("master_replid:" + masterReplId);
+    info.push_back("master_repl_offset:" + std::to_string(masterReplOffset));
+    // Offsets of the bytes counted from 1, like redis
+    info.push_back("repl_backlog_active:" +
+                   std::to_string(hasReplicas_.load()));
+    info.push_back("repl_backlog_size:" +
+                   std::to_string(backlog_.capacity()));
+    info.push_back("repl_backlog_first_byte_offset:" +
+                   std::to_string(backlog_.firstOffset() + 1));
+    info.push_back("repl_backlog_histlen:" + std::to_string(backlog_.size()));
+  }
+  if (section.empty() || section == "clients") {
+    std::lock_guard<std::mutex> lock(clientsMutex_);
+    std::vector<std::string> outputs;
+    clients_.forEach([&](std::size_t id, const auto &client, const auto &) {
+      outputs.push_back("client" + std::to_string(outputs.size()) +
+                        ":id=" + std::to_string(id) + ",class=" +
+                        std::string(clientClassName(client->clientClass())) +
+                        ",omem=" + std::to_string(client->outputBytes()));
+    });
+    info.push_back("connected_clients:" + std::to_string(outputs.size()));
+    info.insert(info.end(), outputs.begin(), outputs.end());
+  }
+  if (section.empty() || section == "memory") {
+    std::size_t usedMemory = 0;
+    for (const auto &shard : shards_) {
+      usedMemory += shard->usedMemory();
+    }
+    info.push_back("used_memory:" + std::to_string(usedMemory));
+    info.push_back("maxmemory:" + std::to_string(maxmemory_));
+    std::lock_guard<std::mutex> lock(configMutex_);
+    info.push_back("maxmemory_policy:" + config_.maxmemoryPolicy);
+  }
+  if (section.empty() || section == "persistence") {
+    std::lock_guard<std::mutex> lock(saveMutex_);
+    std::int64_t childSeconds =
+        save_.child >= 0
+            ? std::chrono::duration_cast<std::chrono::seconds>(
+                  std::chrono::steady_clock::now() - save_.childStart)
+                  .count()
+            : -1;
+    bool inProgress =
+        save_.child >= 0 && save_.childKind == ChildKind::SNAPSHOT;
+    bool rewriting = save_.child >= 0 && save_.childKind == ChildKind::REWRITE;
+    info.push_back("rdb_changes_since_last_save:" +
+                   std::to_string(keyspaceChanges() - save_.changesAtSave));
+    info.push_back("rdb_bgsave_in_progress:" +
+                   std::to_string(inProgress ? 1 : 0));
+    info.push_back("rdb_last_save_time:" + std::to_string(save_.lastSave));
+    info.push_back(std::string("rdb_last_bgsave_status:") +
+                   (save_.lastBackgroundOk ? "ok" : "err"));
+    info.push_back("rdb_last_bgsave_time_sec:" +
+                   std::to_string(save_.lastBackgroundSeconds));
+    info.push_back("rdb_current_bgsave_time_sec:" +
+                   std::to_string(inProgress ? childSeconds : -1));
+    info.push_back("rdb_last_cow_size:" + std::to_string(save_.lastCowBytes));
+    info.push_back(std::string("aof_enabled:") +
+                   (aof_.state() != AppendOnlyFile::State::OFF ? "1" : "0"));
+    info.push_back("aof_rewrite_in_progress:" +
+                   std::to_string(rewriting ? 1 : 0));
+    info.push_back("aof_rewrite_scheduled:" +
+                   std::to_string(save_.rewriteScheduled ? 1 : 0));
+    info.push_back("aof_last_rewrite_time_sec:" +
+                   std::to_string(save_.lastRewriteSeconds));
+    info.push_back("aof_current_rewrite_time_sec:" +
+                   std::to_string(rewriting ? childSeconds : -1));
+    info.push_back(std::string("aof_last_bgrewrite_status:") +
+                   (save_.lastRewriteOk ? "ok" : "err"));
+    info.push_back(std::string("aof_last_write_status:") +
+                   (aof_.lastWriteOk() ? "ok" : "err"));
+    info.push_back("aof_current_size:" + std::to_string(aof_.size()));
+    info.push_back("aof_base_size:" + std::to_string(aof_.baseSize()));
+  }
+  if (section.empty() || section == "stats") {
+    std::uint64_t expiredKeys = 0;
+    std::uint64_t evictedKeys = 0;
+    for (const auto &shard : shards_) {
+      expiredKeys += shard->expiredKeys();
+      evictedKeys += shard->evictedKeys();
+    }
+    info.push_back("expired_keys:" + std::to_string(expiredKeys));
+    info.push_back("evicted_keys:" + std::to_string(evictedKeys));
+    info.push_back("expired_time_cap_reached_count:" +
+                   std::to_string(statExpireTimeCapReached_));
+    info.push_back("expire_cycle_cpu_milliseconds:" +
+                   std::to_string(statExpireCycleMicros_ / 1000));
+    info.push_back("sync_full:" + std::to_string(statSyncFull_));
+    info.push_back("sync_partial_ok:" + std::to_string(statSyncPartialOk_));
+    info.push_back("sync_partial_err:" + std::to_string(statSyncPartialErr_));
+    std::lock_guard<std::mutex> lock(saveMutex_);
+    info.push_back("latest_fork_usec:" +
+                   std::to_string(save_.latestForkMicros));
   }
-  info.push_back("master_replid:" + masterReplId);
-  info.push_back("master_repl_offset:" + std::to_string(masterReplOffset));
   info.push_back("");
-  std::string infoBString = RESP::toStringArray(info);
+  return Server::Reply{RESP::toStringArray(info)};
+}
+
+Server::Reply
+Server::saveCommand(const std::vector<std::string_view> &commands,
+                    std::size_t clientId) {
+  std::lock_guard<std::mutex> lock(saveMutex_);
+  if (save_.child >= 0) {
+    return Server::Reply{"-ERR Background save already in progress\r\n"};
+  }
+  SnapshotConfig snapshot = snapshotConfig();
+  bool saved = false;
+  std::uint64_t changes = 0;
+  freezeKeyspace([&] {
+    changes = keyspaceChanges();
+    saved = saveRDBFile(
+        snapshot.path, [this](RDBWriter &writer) { writeKeyspace(writer); },
+        snapshot.compress);
+  });
+  if (!saved) {
+    LOG_ERROR("Failed to save the RDB file {}: {}", snapshot.path,
+              std::strerror(errno));
+    return Server::Reply{"-ERR Failed to save the RDB file\r\n"};
+  }
+  save_.changesAtSave = changes;
+  save_.lastSave = unixTimeMs() / 1000;
+  LOG_INFO("DB saved on disk");
+  return Server::Reply{"+OK\r\n"};
+}
+
+Server::Reply
+Server::bgsaveCommand(const std::vector<std::string_view> &commands,
+                      std::size_t clientId) {
+  bool schedule = commands.size() == 2 &&
+                  strTolower(std::string(commands[1])) == "schedule";
+  if (commands.size() > 2 || (commands.size() == 2 && !schedule)) {
+    return Server::Reply{"-ERR syntax error\r\n"};
+  }
+  std::lock_guard<std::mutex> lock(saveMutex_);
+  if (save_.child >= 0) {
+    if (schedule) {
+      save_.scheduled = true;
+      return Server::Reply{"+Background saving scheduled\r\n"};
+    }
+    if (save_.childKind == ChildKind::REWRITE) {
+      return Server::Reply{"-ERR Background append only file rewriting in "
+                           "progress, use BGSAVE SCHEDULE\r\n"};
+    }
+    if (save_.childKind == ChildKind::REPLICATION) {
+      return Server::Reply{"-ERR Full synchronization of the replicas in "
+                           "progress, use BGSAVE SCHEDULE\r\n"};
+    }
+    return Server::Reply{"-ERR Background save already in progress\r\n"};
+  }
+  if (auto error = startBackgroundSave()) {
+    return Server::Reply{"-ERR Background save failed: " + *error + "\r\n"};
+  }
+  return Server::Reply{"+Background saving started\r\n"};
+}
 
-  if (commands.size() == 2 && commands[1] == "replication") {
-    // Return replication info only
-    return Server::Reply{infoBString};
+Server::Reply
+Server::lastsaveCommand(const std::vector<std::string_view> &commands,
+                        std::size_t clientId) {
+  std::lock_guard<std::mutex> lock(saveMutex_);
+  return Server::Reply{RESP::toInteger(save_.lastSave)};
+}
+
+Server::Reply
+Server::bgrewriteaofCommand(const std::vector<std::string_view> &commands,
+                            std::size_t clientId) {
+  std::lock_guard<std::mutex> lock(saveMutex_);
+  if (save_.child >= 0) {
+    if (save_.childKind == ChildKind::REWRITE) {
+      return Server::Reply{"-ERR Background append only file rewriting "
+                           "already in progress\r\n"};
+    }
+    save_.rewriteScheduled = true;
+    return Server::Reply{
+        "+Background append only file rewriting scheduled\r\n"};
   }
+  if (auto error = startAppendOnlyRewrite()) {
+    return Server::Reply{"-ERR Background append only file rewriting "
+                         "failed: " +
+                         *error + "\r\n"};
+  }
+  return Server::Reply{"+Background append only file rewriting started\r\n"};
+}
 
-  return Server::Reply{
-      infoBString}; // return all available options, more stuff in the future.
+Server::Reply
+Server::clientCommand(const std::vector<std::string_view> &commands,
+                      std::size_t clientId) {
+  std::string subcommand = strTolower(std::string(commands[1]));
+  std::lock_guard<std::mutex> lock(clientsMutex_);
+  if (subcommand == "id" && commands.size() == 2) {
+    return Server::Reply{RESP::toInteger(clientId)};
+  }
+  if (subcommand == "setname" && commands.size() == 3) {
+    if (!validClientName(commands[2])) {
+      return Server::Reply{"-ERR Client names cannot contain spaces, newlines "
+                           "or special characters.\r\n"};
+    }
+    if (std::string *name = clients_.name(clientId)) {
+      *name = commands[2];
+    }
+    return Server::Reply{"+OK\r\n"};
+  }
+  if (subcommand == "getname" && commands.size() == 2) {
+    std::string *name = clients_.name(clientId);
+    if (!name || name->empty()) {
+      return Server::Reply{RESP::NullBString};
+    }
+    return Server::Reply{RESP::toBString(*name)};
+  }
+  if (subcommand == "info" && commands.size() == 2) {
+    std::string line;
+    if (auto client = clients_.find(clientId)) {
+      line = clientLine(clientId, *client, *clients_.name(clientId));
+    }
+    return Server::Reply{RESP::toBString(line)};
+  }
+  if (subcommand == "list" && commands.size() == 2) {
+    std::string list;
+    clients_.forEach(
+        [&](std::size_t id, const auto &client, const std::string &name) {
+          list += clientLine(id, *client, name);
+        });
+    return Server::Reply{RESP::toBString(list)};
+  }
+  if (subcommand == "kill" && commands.size() == 3) {
+    // The old form: CLIENT KILL addr:port
+    bool killed = false;
+    clients_.forEach([&](std::size_t, const auto &client, const auto &) {
+      if (!killed && client->stats().addr == commands[2]) {
+        client->kill();
+        killed = true;
+      }
+    });
+    return Server::Reply{killed ? "+OK\r\n" : "-ERR No such client\r\n"};
+  }
+  if (subcommand == "kill" && commands.size() % 2 == 0) {
+    // Filters: ID, ADDR, LADDR, TYPE and SKIPME, all of them must match
+    std::optional<std::size_t> id;
+    std::optional<std::string_view> addr, laddr;
+    std::optional<ClientClass> type;
+    bool skipMe = true;
+    for (std::size_t i = 2; i < commands.size(); i += 2) {
+      std::string filter = strTolower(std::string(commands[i]));
+      std::string_view value = commands[i + 1];
+      if (filter == "id") {
+        std::size_t parsed = 0;
+        auto [ptr, error] =
+            std::from_chars(value.data(), value.data() + value.size(), parsed);
+        if (error != std::errc() || ptr != value.data() + value.size()) {
+          return Server::Reply{"-ERR client-id should be greater than 0\r\n"};
+        }
+        id = parsed;
+      } else if (filter == "addr") {
+        addr = value;
+      } else if (filter == "laddr") {
+        laddr = value;
+      } else if (filter == "type") {
+        std::string name = strTolower(std::string(value));
+        if (name == "normal") {
+          type = ClientClass::NORMAL;
+        } else if (name == "replica" || name == "slave") {
+          type = ClientClass::REPLICA;
+        } else if (name == "pubsub") {
+          type = ClientClass::PUBSUB;
+        } else {
+          return Server::Reply{"-ERR Unknown client type '" +
+                               std::string(value) + "'\r\n"};
+        }
+      } else if (filter == "skipme") {
+        std::string yesNo = strTolower(std::string(value));
+        if (yesNo != "yes" && yesNo != "no") {
+          return Server::Reply{"-ERR syntax error\r\n"};
+        }
+        skipMe = yesNo == "yes";
+      } else {
+        return Server::Reply{"-ERR syntax error\r\n"};
+      }
+    }
+    std::size_t killed = 0;
+    clients_.forEach([&](std::size_t clientIdx, const auto &client,
+                         const auto &) {
+      Connection::Stats stats = client->stats();
+      if ((id && clientIdx != *id) || (addr && stats.addr != *addr) ||
+          (laddr && stats.laddr != *laddr) ||
+          (type && client->clientClass() != *type) ||
+          (skipMe && clientIdx == clientId)) {
+        return;
+      }
+      client->kill();
+      ++killed;
+    });
+    return Server::Reply{RESP::toInteger(killed)};
+  }
+  return Server::Reply{"-ERR unknown subcommand or wrong number of "
+                       "arguments for 'client' command\r\n"};
 }
 
-Server::Reply Server::replconfCommand(const std::vector<std::string> &commands,
-                                      std::size_t clientId) {
-  if (commands.size() != 3) {
+Server::Reply
+Server::replconfCommand(const std::vector<std::string_view> &commands,
+                        std::size_t clientId) {
+  // Option and value pairs, e.g. capa eof capa psync2
+  if (commands.size() < 3 || commands.size() % 2 == 0) {
     return Server::Reply{RESP::NullBString};
   }
   return Server::Reply{"+OK\r\n"};
 }
 
-Server::Reply Server::psyncCommand(const std::vector<std::string> &commands,
-                                   std::size_t clientId) {
+Server::Reply
+Server::psyncCommand(const std::vector<std::string_view> &commands,
+                     std::size_t clientId) {
   if (commands.size() != 3) {
     return Server::Reply{RESP::NullBString};
   }
-  Server::Reply reply;
-  reply.push_back("+FULLRESYNC " + masterReplId + " " +
-                  std::to_string(masterReplOffset) + "\r\n");
-  reply.push_back("$0\r\n");
+  // Like redis, the offset is the one of the next byte counted from 1
+  std::uint64_t offset = 0;
+  auto [ptr, error] = std::from_chars(
+      commands[2].data(), commands[2].data() + commands[2].size(), offset);
+  bool resume = commands[1] == masterReplId && error == std::errc() &&
+                ptr == commands[2].data() + commands[2].size() && offset > 0;
   LOG_INFO("Marking client {} as a replica", clientId);
-  if (clientId > 0 && clientId < clients.size()) {
-    replicas.push_back(clients[clientId]);
-  } else {
-    LOG_ERROR("Replica is requesting SYNC but no client id is registered.");
+  {
+    std::lock_guard<std::mutex> lock(clientsMutex_);
+    std::erase_if(replicas, [](const ReplicaLink &replica) {
+      return replica.connection.expired();
+    });
+    std::optional<std::string> missing;
+    if (resume) {
+      missing = backlog_.since(offset - 1);
+    }
+    if (missing) {
+      // The missing commands follow this reply, then the propagated ones
+      ++statSyncPartialOk_;
+      LOG_INFO("Partial resynchronization of client {} with {} bytes",
+               clientId, missing->size());
+      Server::Reply reply{"+CONTINUE\r\n"};
+      if (!missing->empty()) {
+        reply.push_back(std::move(*missing));
+      }
+      if (auto client = clients_.find(clientId)) {
+        client->setClientClass(ClientClass::REPLICA);
+        replicas.push_back({client, clientId, ReplicaLink::State::ONLINE,
+                            std::chrono::steady_clock::now(), {}});
+        hasReplicas_.store(true, std::memory_order_release);
+      }
+      return reply;
+    }
+    if (commands[1] != "?") {
+      ++statSyncPartialErr_;
+    }
+    auto client = clients_.find(clientId);
+    if (!client) {
+      LOG_ERROR("Replica is requesting SYNC but no client id is registered.");
+      return Server::Reply{"+FULLRESYNC " + masterReplId + " " +
+                           std::to_string(masterReplOffset) + "\r\n"};
+    }
+    client->setClientClass(ClientClass::REPLICA);
+    replicas.push_back({client, clientId,
+                        ReplicaLink::State::WAIT_SNAPSHOT,
+                        std::chrono::steady_clock::now(), {}});
+    hasReplicas_.store(true, std::memory_order_release);
   }
-
-  return reply;
+  int delay = 0;
+  {
+    std::lock_guard<std::mutex> lock(configMutex_);
+    delay = config_.replDisklessSyncDelay;
+  }
+  // Else the cron starts it, the replicas arriving meanwhile share it. The
+  // +FULLRESYNC reply is sent once it's forked
+  if (delay == 0) {
+    syncReplicas(0);
+  }
+  return Server::Reply{};
 }
 
-std::optional<Server::Reply> Server::handleRequest(const std::string &message,
+std::optional<Server::Reply> Server::handleRequest(std::string_view message,
                                                    std::size_t clientId) {
   if (message.empty()) {
     LOG_DEBUG("Received an empty message");
@@ -331,12 +2308,79 @@ std::optional<Server::Reply> Server::handleRequest(const std::string &message,
     LOG_DEBUG("Received a non array command {}", message);
     return Server::Reply{"\r\n"};
   }
-  std::optional<std::vector<std::string>> commands = RESP::parseArray(message);
-  if (!commands) {
-    LOG_DEBUG("Received a non array command {}", message);
+  Server::Reply reply;
+  if (!handleBuffer(message, reply, clientId)) {
+    LOG_DEBUG("Received an invalid command {}", message);
     return std::nullopt;
   }
-  return handleCommands(*commands, clientId);
+  return reply;
+}
+
+std::optional<std::size_t> Server::handleBuffer(std::string_view buffer,
+                                                Reply &replies,
+                                                std::size_t clientId,
+                                                const ExternalBulk *bulk,
+                                                std::size_t *executed,
+                                                const TurnBudget *budget) {
+  RESP::ExternalBulk external;
+  if (bulk) {
+    external = {bulk->offset, bulk->payload.view()};
+  }
+  PayloadScope scope(bulk ? &bulk->payload : nullptr);
+  std::int64_t maxBulkLength = protoMaxBulkLen_;
+  std::vector<std::string_view> commands;
+  // In sharded mode consecutive keyed commands are batched and forwarded to
+  // their shards together, any other command first waits for the batch so the
+  // replies keep the request order.
+  std::vector<std::vector<std::string_view>> shardBatch;
+  std::size_t consumed = 0;
+  std::size_t turnCommands = 0;
+  while (consumed < buffer.size()) {
+    if (budget && turnCommands > 0 &&
+        (turnCommands >= budget->commands || consumed >= budget->bytes)) {
+      break;
+    }
+    // The external payload belongs to the first frame.
+    RESP::ParseResult result =
+        RESP::parseCommand(buffer.substr(consumed), commands, maxBulkLength,
+                           bulk && consumed == 0 ? &external : nullptr);
+    if (result.status == RESP::ParseStatus::INVALID) {
+      return std::nullopt;
+    }
+    if (result.status == RESP::ParseStatus::INCOMPLETE) {
+      break;
+    }
+    consumed += result.consumed;
+    if (commands.empty()) {
+      continue;
+    }
+    ++turnCommands;
+    if (executed) {
+      ++*executed;
+    }
+    // Commands whose only key is their first argument run on the key's
+    // shard.
+    const Command<Handler> *command = findCommand(commands[0]);
+    if (sharded_ && command && command->firstKey == 1 &&
+        command->lastKey == 1 &&
+        command->checkArity(commands.size())) {
+      shardBatch.push_back(commands);
+      continue;
+    }
+    dispatchToShards(shardBatch, replies, clientId);
+    shardBatch.clear();
+    std::optional<Server::Reply> commandReply =
+        handleCommands(commands, clientId);
+    if (commandReply) {
+      replies.insert(replies.end(),
+                     std::make_move_iterator(commandReply->begin()),
+                     std::make_move_iterator(commandReply->end()));
+    }
+  }
+  dispatchToShards(shardBatch, replies, clientId);
+  // Once per turn, with the always policy the replies wait for the sync
+  aof_.flush();
+  return consumed;
 }
 
-} // namespace Redis
\ No newline at end of file
+} // namespace Redis
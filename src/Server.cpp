@@ -1,12 +1,17 @@
+#include "IOContextPool.hpp"
 #include "Logging.hpp"
 #include "TCPServer.hpp"
+#include "UringServer.hpp"
 #include <arpa/inet.h>
 #include <asio.hpp>
+#include <charconv>
 #include <cstdint>
 #include <cstdlib>
 #include <cstring>
 #include <cxxopts.hpp>
+#include <filesystem>
 #include <iostream>
+#include <memory>
 #include <netdb.h>
 #include <string>
 #include <string_view>
@@ -27,8 +32,14 @@ int main(int argc, char **argv) {
                            "A c++ implementation for Redis server");
   // clang-format off
   options.add_options()("d,debug", "Enable debugging")
-  ("p,port", "Port number", cxxopts::value<int>()->default_value("6379"))
+  ("p,port", "Port number, 0 to only listen on the Unix socket", cxxopts::value<int>()->default_value("6379"))
+  ("unixsocket", "Path of a Unix domain socket to listen on", cxxopts::value<std::string>())
+  ("unixsocketperm", "Octal permissions of the Unix socket", cxxopts::value<std::string>()->default_value("700"))
   ("r,replicaof", "Replica of the master server", cxxopts::value<std::string>())
+  ("t,io-threads", "Number of I/O threads (event loops)", cxxopts::value<int>()->default_value("1"))
+  ("s,shards", "Keyspace shards with their own threads, 0 to disable", cxxopts::value<int>()->default_value("0"))
+  ("io-backend", "Network backend, asio or io_uring", cxxopts::value<std::string>()->default_value("asio"))
+  ("c,config", "A config field set before the files are loaded, as name=value, e.g. appendonly=yes. May be repeated", cxxopts::value<std::vector<std::string>>())
   ("h,help", "Print usage");
   // clang-format on
 
@@ -39,6 +50,62 @@ int main(int argc, char **argv) {
   }
   bool debug = result["debug"].as<bool>();
   int port = result["port"].as<int>();
+  int ioThreads = result["io-threads"].as<int>();
+  if (ioThreads < 1) {
+    LOG_ERROR("io-threads should be a positive number");
+    exit(EXIT_FAILURE);
+  }
+  int shards = result["shards"].as<int>();
+  if (shards < 0) {
+    LOG_ERROR("shards should not be negative");
+    exit(EXIT_FAILURE);
+  }
+  std::optional<std::string> unixSocket;
+  if (result.count("unixsocket")) {
+    unixSocket = result["unixsocket"].as<std::string>();
+  }
+  if (port == 0 && !unixSocket) {
+    LOG_ERROR("port 0 requires a unixsocket to listen on");
+    exit(EXIT_FAILURE);
+  }
+  std::string permissions = result["unixsocketperm"].as<std::string>();
+  unsigned unixSocketPerm = 0;
+  auto [end, permError] =
+      std::from_chars(permissions.data(),
+                      permissions.data() + permissions.size(), unixSocketPerm,
+                      8);
+  if (permError != std::errc() ||
+      end != permissions.data() + permissions.size() ||
+      unixSocketPerm > 0777) {
+    LOG_ERROR("unixsocketperm should be octal permissions like 700");
+    exit(EXIT_FAILURE);
+  }
+  std::string ioBackend = result["io-backend"].as<std::string>();
+  if (ioBackend != "asio" && ioBackend != "io_uring") {
+    LOG_ERROR("io-backend should be asio or io_uring");
+    exit(EXIT_FAILURE);
+  }
+  Redis::Config config;
+  if (result.count("config")) {
+    for (const auto &field : result["config"].as<std::vector<std::string>>()) {
+      std::size_t equal = field.find('=');
+      if (equal == std::string::npos ||
+          !config.setField(field.substr(0, equal), field.substr(equal + 1)) ||
+          !config.valid()) {
+        LOG_ERROR("Invalid config {}", field);
+        exit(EXIT_FAILURE);
+      }
+    }
+  }
+  bool uring = false;
+  if (ioBackend == "io_uring") {
+#ifdef REDIS_SERVER_IO_URING
+    uring = UringServer::supported();
+#endif
+    if (!uring) {
+      LOG_INFO("io_uring is not available, falling back to asio");
+    }
+  }
   std::optional<std::string> masterIp;
   std::optional<int> masterPort;
   if (result.count("replicaof")) {
@@ -57,21 +124,59 @@ int main(int argc, char **argv) {
   if (debug)
     global_logger_a->set_log_level(quill::LogLevel::TraceL3);
 
-  // Creating the server
-  asio::io_context io_context;
+  // Creating the server, with io_uring a single asio loop is left for the
+  // cron and the replication.
+  IOContextPool ioContextPool(uring ? 1 : ioThreads);
   try {
     Redis::Server::SharedPtr redisServer;
     if (masterIp.has_value()) {
-      redisServer = std::make_shared<Redis::Server>(port, *masterIp,
-                                                    *masterPort, io_context);
+      redisServer = std::make_shared<Redis::Server>(
+          port, *masterIp, *masterPort, ioContextPool.get(0), shards, config);
     } else {
-      redisServer = std::make_shared<Redis::Server>(port);
+      redisServer = std::make_shared<Redis::Server>(port, shards, config);
     }
 
-    LOG_INFO("Starting the server on port {}", port);
-    TCPServer server(io_context, port, redisServer);
-    server.start();
-    io_context.run();
+    redisServer->startCron(ioContextPool.get(0));
+
+    // The Unix socket serves the co-located clients on the first loop
+    std::unique_ptr<UnixServer> unixServer;
+    if (unixSocket) {
+      LOG_INFO("Listening on the Unix socket {}", *unixSocket);
+      unixServer = std::make_unique<UnixServer>(
+          ioContextPool.get(0), *unixSocket,
+          static_cast<std::filesystem::perms>(unixSocketPerm), redisServer);
+      unixServer->start();
+    }
+
+    LOG_INFO("Starting the server on port {} with {} {} I/O threads", port,
+             ioThreads, uring ? "io_uring" : "asio");
+#ifdef REDIS_SERVER_IO_URING
+    if (uring) {
+      std::vector<std::unique_ptr<UringServer>> servers;
+      std::vector<std::thread> threads;
+      for (int i = 0; i < ioThreads && port != 0; ++i) {
+        servers.push_back(std::make_unique<UringServer>(port, redisServer,
+                                                        ioThreads > 1));
+      }
+      for (auto &server : servers) {
+        threads.emplace_back([&server] { server->run(); });
+      }
+      ioContextPool.run();
+      for (auto &thread : threads) {
+        thread.join();
+      }
+      return 0;
+    }
+#endif
+    // One acceptor per event loop, the kernel spreads the connections between
+    // them and each connection stays on the loop that accepted it.
+    std::vector<std::unique_ptr<TCPServer>> servers;
+    for (std::size_t i = 0; i < ioContextPool.size() && port != 0; ++i) {
+      servers.push_back(std::make_unique<TCPServer>(
+          ioContextPool.get(i), port, redisServer, ioThreads > 1));
+      servers.back()->start();
+    }
+    ioContextPool.run();
   } catch (std::exception &e) {
     LOG_ERROR("Error {}", e.what());
   }
@@ -0,0 +1,420 @@
+#include "Shard.hpp"
+#include "Logging.hpp"
+
+namespace Redis {
+
+namespace {
+/**
+ * @brief Polling rounds with empty queues before the owner thread sleeps.
+ */
+constexpr int SpinsBeforeSleep = 256;
+
+/**
+ * @brief Keys deleted by @sa Shard::activeExpire between two checks of the
+ * deadline.
+ */
+constexpr std::size_t ExpireBatch = 64;
+
+/**
+ * @brief Longest string kept inline by std::string, longer ones allocate.
+ */
+constexpr std::size_t InlineStringSize = 15;
+
+/**
+ * @brief Home groups of the table visited at most by one sampling, bounds the
+ * work when few keys match the policy (volatile-ttl).
+ */
+constexpr std::size_t MaxSampleGroupsPerKey = 16;
+
+std::size_t stringBytes(std::string_view str) {
+  return str.size() > InlineStringSize ? str.size() + 1 : 0;
+}
+
+/**
+ * @brief The producer slots shared by the shards, the slots of the exited
+ * threads are reused so short-lived threads don't use them up.
+ */
+class ProducerSlots {
+public:
+  /**
+   * @brief A free slot, or @sa Shard::MaxProducers when all are taken.
+   */
+  std::size_t acquire() {
+    std::lock_guard<std::mutex> lock(mutex_);
+    if (!free_.empty()) {
+      std::size_t slot = free_.back();
+      free_.pop_back();
+      return slot;
+    }
+    return next_ < Shard::MaxProducers ? next_++ : Shard::MaxProducers;
+  }
+
+  void release(std::size_t slot) {
+    if (slot < Shard::MaxProducers) {
+      std::lock_guard<std::mutex> lock(mutex_);
+      free_.push_back(slot);
+    }
+  }
+
+private:
+  std::mutex mutex_;
+  std::vector<std::size_t> free_;
+  std::size_t next_ = 0;
+};
+
+ProducerSlots &producerSlots() {
+  static ProducerSlots slots;
+  return slots;
+}
+} // namespace
+
+Shard::Shard(std::size_t id) : id_(id), expiries_(unixTimeMs()) {}
+
+Shard::~Shard() { stop(); }
+
+std::size_t Shard::producerSlot() {
+  // The mutex of the slots orders the pushes of a slot's previous thread
+  // before the ones of the next, each queue keeps a single producer at a time
+  struct Slot {
+    std::size_t index = producerSlots().acquire();
+    ~Slot() { producerSlots().release(index); }
+  };
+  thread_local Slot slot;
+  return slot.index;
+}
+
+void Shard::start() {
+  if (owned()) {
+    return;
+  }
+  queues_.clear();
+  for (std::size_t i = 0; i < MaxProducers; ++i) {
+    queues_.push_back(std::make_unique<SPSCQueue<Task>>(QueueCapacity));
+  }
+  running_ = true;
+  thread_ = std::thread([this] { run(); });
+  LOG_INFO("Shard {} started", id_);
+}
+
+void Shard::stop() {
+  if (!owned()) {
+    return;
+  }
+  running_ = false;
+  notify();
+  thread_.join();
+}
+
+void Shard::submit(Task task) {
+  if (!owned()) {
+    // Not served by a thread, run in place under the lock.
+    auto lock = this->lock();
+    task();
+    return;
+  }
+  std::size_t slot = producerSlot();
+  if (slot < queues_.size()) {
+    while (!queues_[slot]->tryPush(std::move(task))) {
+      std::this_thread::yield();
+    }
+  } else {
+    std::lock_guard<std::mutex> lock(sharedQueueMutex_);
+    sharedQueue_.push_back(std::move(task));
+    hasShared_.store(true, std::memory_order_release);
+  }
+  notify();
+}
+
+void Shard::notify() {
+  // Pairs with the fence in run(), either the owner sees the new task before
+  // sleeping or this thread sees it sleeping and wakes it up.
+  std::atomic_thread_fence(std::memory_order_seq_cst);
+  if (sleeping_.load(std::memory_order_relaxed)) {
+    wakeups_.fetch_add(1, std::memory_order_relaxed);
+    wakeups_.notify_one();
+  }
+}
+
+bool Shard::drain() {
+  bool ranTask = false;
+  Task task;
+  for (auto &queue : queues_) {
+    while (queue->tryPop(task)) {
+      task();
+      ranTask = true;
+    }
+  }
+  if (hasShared_.load(std::memory_order_acquire)) {
+    std::vector<Task> tasks;
+    {
+      std::lock_guard<std::mutex> lock(sharedQueueMutex_);
+      tasks.swap(sharedQueue_);
+      hasShared_.store(false, std::memory_order_relaxed);
+    }
+    for (auto &sharedTask : tasks) {
+      sharedTask();
+      ranTask = true;
+    }
+  }
+  return ranTask;
+}
+
+std::size_t Shard::entryBytes(std::string_view key, const Record &record) {
+  // The slot and its control byte.
+  std::size_t bytes = sizeof(Database::value_type) + 1 + stringBytes(key) +
+                      record.data.allocatedBytes();
+  if (record.hasExpiry()) {
+    bytes += ExpiryIndex::timerBytes();
+  }
+  return bytes;
+}
+
+Record *Shard::find(std::string_view key, bool touch) {
+  auto it = data_.find(key);
+  if (it == data_.end()) {
+    return nullptr;
+  }
+  if (it->second.expired()) {
+    erase(it);
+    expiredKeys_.fetch_add(1, std::memory_order_relaxed);
+    return nullptr;
+  }
+  if (touch) {
+    it->second.access = Access::touch(
+        it->second.access, policy_.load(std::memory_order_relaxed), rng_);
+  }
+  return &it->second;
+}
+
+void Shard::set(std::string_view key, Record record) {
+  auto [it, inserted] = data_.try_emplace(key);
+  if (inserted && prefixIndex_) {
+    prefixIndex_->insert(key);
+  }
+  if (!inserted) {
+    addMemory(-static_cast<std::ptrdiff_t>(entryBytes(key, it->second)));
+    if (it->second.timer != ExpiryIndex::NoTimer) {
+      expiries_.cancel(it->second.timer);
+    }
+  }
+  record.timer = ExpiryIndex::NoTimer;
+  if (record.hasExpiry()) {
+    record.timer = expiries_.add(record.expiry, Database::hashOf(key));
+  }
+  record.access = Access::init(policy_.load(std::memory_order_relaxed));
+  it->second = std::move(record);
+  addMemory(entryBytes(key, it->second));
+  addChanges(1);
+}
+
+void Shard::erase(Database::iterator it) {
+  addMemory(-static_cast<std::ptrdiff_t>(entryBytes(it->first, it->second)));
+  if (it->second.timer != ExpiryIndex::NoTimer) {
+    expiries_.cancel(it->second.timer);
+  }
+  if (prefixIndex_) {
+    prefixIndex_->erase(it->first);
+  }
+  data_.erase(it);
+  addChanges(1);
+}
+
+bool Shard::erase(std::string_view key) {
+  auto it = data_.find(key);
+  if (it == data_.end()) {
+    return false;
+  }
+  erase(it);
+  return true;
+}
+
+bool Shard::expire(std::string_view key, std::int64_t expiry) {
+  Record *record = find(key);
+  if (!record) {
+    return false;
+  }
+  if (expiry <= unixTimeMs()) {
+    erase(key);
+    return true;
+  }
+  addMemory(-static_cast<std::ptrdiff_t>(entryBytes(key, *record)));
+  if (record->timer != ExpiryIndex::NoTimer) {
+    expiries_.cancel(record->timer);
+  }
+  record->expiry = expiry;
+  record->timer = expiries_.add(expiry, Database::hashOf(key));
+  addMemory(entryBytes(key, *record));
+  addChanges(1);
+  return true;
+}
+
+bool Shard::persist(std::string_view key) {
+  Record *record = find(key);
+  if (!record || !record->hasExpiry()) {
+    return false;
+  }
+  addMemory(-static_cast<std::ptrdiff_t>(entryBytes(key, *record)));
+  expiries_.cancel(record->timer);
+  record->expiry = Record::NoExpiry;
+  record->timer = ExpiryIndex::NoTimer;
+  addMemory(entryBytes(key, *record));
+  addChanges(1);
+  return true;
+}
+
+Shard::ExpireStats
+Shard::activeExpire(std::chrono::steady_clock::time_point deadline) {
+  ExpireStats stats;
+  std::int64_t now = unixTimeMs();
+  while (true) {
+    std::size_t fired = expiries_.advance(
+        now, ExpireBatch, [this](ExpiryIndex::TimerId id, std::size_t hash) {
+          // The timer is gone already, only the record is left to delete.
+          auto it = data_.findIf(hash, [id](const Database::value_type &entry) {
+            return entry.second.timer == id;
+          });
+          if (it != data_.end()) {
+            addMemory(-static_cast<std::ptrdiff_t>(
+                entryBytes(it->first, it->second)));
+            if (prefixIndex_) {
+              prefixIndex_->erase(it->first);
+            }
+            data_.erase(it);
+          }
+        });
+    stats.expired += fired;
+    if (fired < ExpireBatch) {
+      break;
+    }
+    if (std::chrono::steady_clock::now() >= deadline) {
+      stats.timedOut = true;
+      break;
+    }
+  }
+  expiredKeys_.fetch_add(stats.expired, std::memory_order_relaxed);
+  addChanges(stats.expired);
+  return stats;
+}
+
+void Shard::clear() {
+  addChanges(data_.size());
+  data_.clear();
+  expiries_ = ExpiryIndex(unixTimeMs());
+  pool_.clear();
+  if (prefixIndex_) {
+    prefixIndex_->clear();
+  }
+  usedMemory_.store(0, std::memory_order_relaxed);
+}
+
+void Shard::setPrefixIndex(bool enabled) {
+  if (!enabled) {
+    prefixIndex_.reset();
+    return;
+  }
+  if (prefixIndex_) {
+    return;
+  }
+  prefixIndex_ = std::make_unique<RadixTree>();
+  data_.forEach([this](const Database::value_type &entry) {
+    prefixIndex_->insert(entry.first);
+  });
+}
+
+bool Shard::evictIfNeeded(std::size_t limit, std::size_t samples,
+                          std::vector<std::string> *evicted) {
+  while (usedMemory() > limit) {
+    if (policy_.load(std::memory_order_relaxed) ==
+            EvictionPolicy::NOEVICTION ||
+        !evictOne(samples, evicted)) {
+      return false;
+    }
+  }
+  return true;
+}
+
+bool Shard::evictOne(std::size_t samples,
+                     std::vector<std::string> *evicted) {
+  EvictionPolicy policy = policy_.load(std::memory_order_relaxed);
+  if (policy != poolPolicy_) {
+    pool_.clear();
+    poolPolicy_ = policy;
+  }
+  std::uint32_t now = Access::lruClock();
+  std::size_t sampled = 0;
+  auto sample = [&](const Database::value_type &entry) {
+    const Record &record = entry.second;
+    std::uint64_t score;
+    switch (policy) {
+    case EvictionPolicy::ALLKEYS_LRU:
+      // Idle time, wraps around like the clock.
+      score = static_cast<std::uint32_t>(now - record.access);
+      break;
+    case EvictionPolicy::ALLKEYS_LFU:
+      score = 255 - Access::lfuDecayed(record.access);
+      break;
+    case EvictionPolicy::VOLATILE_TTL:
+      if (!record.hasExpiry()) {
+        return;
+      }
+      score = std::numeric_limits<std::uint64_t>::max() -
+              static_cast<std::uint64_t>(record.expiry);
+      break;
+    default:
+      return;
+    }
+    ++sampled;
+    pool_.insert(entry.first, score);
+  };
+  // Scan whole home groups from random positions until enough keys matched.
+  std::size_t cursor = rng_();
+  for (std::size_t groups = 0;
+       sampled < samples && groups < samples * MaxSampleGroupsPerKey &&
+       !data_.empty();
+       ++groups) {
+    cursor = data_.scan(cursor, sample);
+    if (cursor == 0) {
+      cursor = rng_();
+    }
+  }
+  while (auto key = pool_.pop()) {
+    auto it = data_.find(*key);
+    // The candidate may be gone or changed since it was sampled.
+    if (it == data_.end() ||
+        (policy == EvictionPolicy::VOLATILE_TTL && !it->second.hasExpiry())) {
+      continue;
+    }
+    erase(it);
+    evictedKeys_.fetch_add(1, std::memory_order_relaxed);
+    if (evicted) {
+      evicted->push_back(std::move(*key));
+    }
+    return true;
+  }
+  return false;
+}
+
+void Shard::run() {
+  int idleRounds = 0;
+  while (running_.load(std::memory_order_relaxed)) {
+    if (drain()) {
+      idleRounds = 0;
+      continue;
+    }
+    if (++idleRounds < SpinsBeforeSleep) {
+      std::this_thread::yield();
+      continue;
+    }
+    std::uint32_t wakeups = wakeups_.load(std::memory_order_relaxed);
+    sleeping_.store(true, std::memory_order_relaxed);
+    std::atomic_thread_fence(std::memory_order_seq_cst);
+    if (!drain() && running_.load(std::memory_order_relaxed)) {
+      wakeups_.wait(wakeups, std::memory_order_relaxed);
+    }
+    sleeping_.store(false, std::memory_order_relaxed);
+    idleRounds = 0;
+  }
+  drain();
+}
+
+} // namespace Redis
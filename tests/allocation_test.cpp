@@ -0,0 +1,82 @@
+#include "RedisServer.hpp"
+#include <TCPServer.hpp>
+#include <asio.hpp>
+#include <atomic>
+#include <cstddef>
+#include <cstdlib>
+#include <gtest/gtest.h>
+#include <new>
+#include <string>
+#include <thread>
+
+namespace {
+std::atomic<std::size_t> allocations = 0;
+
+// Out of line so the compiler doesn't pair the replaced operators with
+// malloc/free and warn about -Wmismatched-new-delete
+[[gnu::noinline]] void *allocate(std::size_t size) {
+  return std::malloc(size == 0 ? 1 : size);
+}
+
+[[gnu::noinline]] void deallocate(void *pointer) { std::free(pointer); }
+} // namespace
+
+void *operator new(std::size_t size) {
+  ++allocations;
+  if (void *pointer = allocate(size)) {
+    return pointer;
+  }
+  throw std::bad_alloc();
+}
+
+void operator delete(void *pointer) noexcept { deallocate(pointer); }
+
+void operator delete(void *pointer, std::size_t) noexcept {
+  deallocate(pointer);
+}
+
+TEST(ALLOCATION, REQUEST_LOOP) {
+  const std::string ping = "*1\r\n$4\r\nPING\r\n";
+  Redis::Server::SharedPtr redisServer = std::make_shared<Redis::Server>();
+
+  // Allocations of executing the command itself, which the I/O loop doesn't
+  // add to.
+  Redis::Server::Reply replies;
+  redisServer->handleBuffer(ping, replies);
+  replies.clear();
+  std::size_t before = allocations;
+  redisServer->handleBuffer(ping, replies);
+  std::size_t perCommand = allocations - before;
+
+  asio::io_context io_context;
+  TCPServer server(io_context, 12352, redisServer);
+  server.start();
+  std::thread t([&] { io_context.run(); });
+
+  asio::io_context clientContext;
+  tcp::socket socket(clientContext);
+  tcp::resolver resolver(clientContext);
+  asio::connect(socket, resolver.resolve("localhost", "12352"));
+
+  std::string reply(7, '\0');
+  auto roundTrip = [&] {
+    asio::write(socket, asio::buffer(ping));
+    asio::read(socket, asio::buffer(reply));
+  };
+  // Warm up the buffers and the recycled operation memory
+  for (int i = 0; i < 100; ++i) {
+    roundTrip();
+  }
+
+  constexpr std::size_t RoundTrips = 1000;
+  before = allocations;
+  for (std::size_t i = 0; i < RoundTrips; ++i) {
+    roundTrip();
+  }
+  std::size_t loopAllocations = allocations - before;
+  EXPECT_EQ(reply, "+PONG\r\n");
+  EXPECT_LE(loopAllocations, RoundTrips * perCommand);
+
+  io_context.stop();
+  t.join();
+}
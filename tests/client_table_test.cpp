@@ -0,0 +1,54 @@
+#include "ClientTable.hpp"
+#include <gtest/gtest.h>
+#include <memory>
+#include <string>
+#include <vector>
+
+using Table = Redis::ClientTable<int>;
+
+TEST(CLIENT_TABLE, ReuseSlots) {
+  Table table;
+  auto a = std::make_shared<int>(1);
+  auto b = std::make_shared<int>(2);
+  Table::Id idA = table.add(a);
+  Table::Id idB = table.add(b);
+  EXPECT_NE(idA, Table::NoClient);
+  EXPECT_NE(idA, idB);
+  EXPECT_EQ(*table.find(idA), 1);
+  EXPECT_EQ(table.size(), 2);
+
+  *table.name(idA) = "first";
+  EXPECT_TRUE(table.remove(idA));
+  EXPECT_FALSE(table.remove(idA));
+  EXPECT_EQ(table.find(idA), nullptr);
+  EXPECT_EQ(table.name(idA), nullptr);
+
+  // The free slot is reused under a new id, without the old name
+  auto c = std::make_shared<int>(3);
+  Table::Id idC = table.add(c);
+  EXPECT_NE(idC, idA);
+  EXPECT_EQ(table.slots(), 2);
+  EXPECT_EQ(table.find(idA), nullptr);
+  EXPECT_EQ(*table.find(idC), 3);
+  EXPECT_EQ(*table.name(idC), "");
+  EXPECT_EQ(table.find(Table::NoClient), nullptr);
+}
+
+TEST(CLIENT_TABLE, ForEach) {
+  Table table;
+  std::vector<std::shared_ptr<int>> clients;
+  std::vector<Table::Id> ids;
+  for (int i = 0; i < 4; ++i) {
+    clients.push_back(std::make_shared<int>(i));
+    ids.push_back(table.add(clients.back()));
+  }
+  table.remove(ids[1]);
+  // A client gone without being removed isn't listed
+  clients[2].reset();
+  std::vector<int> seen;
+  table.forEach([&](Table::Id id, const auto &client, const std::string &) {
+    EXPECT_EQ(table.find(id), client);
+    seen.push_back(*client);
+  });
+  EXPECT_EQ(seen, std::vector<int>({0, 3}));
+}
@@ -0,0 +1,35 @@
+#include "CommandTable.hpp"
+#include <array>
+#include <gtest/gtest.h>
+
+namespace {
+int one() { return 1; }
+int two() { return 2; }
+
+using Command = Redis::Command<int (*)()>;
+constexpr Redis::CommandTable table(std::array{
+    Command{"get", 2, Redis::CommandFlag::READONLY, 1, 1, 1, &one},
+    Command{"set", -3, Redis::CommandFlag::WRITE, 1, 1, 1, &two},
+    Command{"getset", 3, Redis::CommandFlag::WRITE, 1, 1, 1, &two},
+});
+} // namespace
+
+TEST(COMMAND_TABLE, Find) {
+  static_assert(table.find("get") != nullptr);
+  ASSERT_NE(table.find("GeT"), nullptr);
+  EXPECT_EQ(table.find("GET")->handler(), 1);
+  EXPECT_EQ(table.find("set")->handler(), 2);
+  EXPECT_EQ(table.find("getset")->name, "getset");
+  EXPECT_EQ(table.find("ge"), nullptr);
+  EXPECT_EQ(table.find("gets"), nullptr);
+  EXPECT_EQ(table.find(""), nullptr);
+  EXPECT_EQ(table.commands().size(), 3);
+}
+
+TEST(COMMAND_TABLE, Arity) {
+  EXPECT_TRUE(table.find("get")->checkArity(2));
+  EXPECT_FALSE(table.find("get")->checkArity(3));
+  EXPECT_FALSE(table.find("set")->checkArity(2));
+  EXPECT_TRUE(table.find("set")->checkArity(3));
+  EXPECT_TRUE(table.find("set")->checkArity(5));
+}
@@ -0,0 +1,43 @@
+#include "Eviction.hpp"
+#include <gtest/gtest.h>
+#include <random>
+#include <string>
+
+TEST(EVICTION, ParsePolicy) {
+  EXPECT_EQ(Redis::parseEvictionPolicy("allkeys-lru"),
+            Redis::EvictionPolicy::ALLKEYS_LRU);
+  EXPECT_EQ(Redis::parseEvictionPolicy("volatile-ttl"),
+            Redis::EvictionPolicy::VOLATILE_TTL);
+  EXPECT_FALSE(Redis::parseEvictionPolicy("allkeys-random").has_value());
+}
+
+TEST(EVICTION, PoolKeepsBest) {
+  Redis::EvictionPool pool;
+  for (int i = 0; i < 100; ++i) {
+    pool.insert("key" + std::to_string(i), i);
+  }
+  // A known key isn't added twice
+  pool.insert("key99", 1000);
+  EXPECT_EQ(pool.size(), Redis::EvictionPool::Size);
+  for (int i = 99; i >= 100 - int(Redis::EvictionPool::Size); --i) {
+    EXPECT_EQ(pool.pop(), "key" + std::to_string(i));
+  }
+  EXPECT_FALSE(pool.pop().has_value());
+}
+
+TEST(EVICTION, LfuCounter) {
+  using namespace Redis;
+  std::minstd_rand rng;
+  std::uint32_t access = Access::init(EvictionPolicy::ALLKEYS_LFU);
+  EXPECT_EQ(Access::lfuDecayed(access), Access::LfuInitValue);
+  std::uint32_t hot = access;
+  for (int i = 0; i < 1000; ++i) {
+    hot = Access::touch(hot, EvictionPolicy::ALLKEYS_LFU, rng);
+  }
+  // The counter grows logarithmically
+  EXPECT_GT(Access::lfuDecayed(hot), Access::LfuInitValue + 5);
+  EXPECT_LT(Access::lfuDecayed(hot), 255);
+  // It decays by one per idle period
+  std::uint32_t idle = ((Access::lfuMinutes() - 3) & 0xFFFFFF) << 8 | 10;
+  EXPECT_EQ(Access::lfuDecayed(idle), 10 - 3 / Access::LfuDecayMinutes);
+}
@@ -0,0 +1,75 @@
+#include "Glob.hpp"
+#include "RadixTree.hpp"
+#include <gtest/gtest.h>
+#include <string>
+#include <vector>
+
+using Redis::globMatch;
+
+TEST(GLOB, Wildcards) {
+  EXPECT_TRUE(globMatch("*", ""));
+  EXPECT_TRUE(globMatch("*", "anything"));
+  EXPECT_TRUE(globMatch("h?llo", "hello"));
+  EXPECT_FALSE(globMatch("h?llo", "hllo"));
+  EXPECT_TRUE(globMatch("h*llo", "hllo"));
+  EXPECT_TRUE(globMatch("h*llo", "heeeello"));
+  EXPECT_TRUE(globMatch("*:*:name", "user:1:name"));
+  EXPECT_FALSE(globMatch("*:*:name", "user:1:names"));
+  EXPECT_TRUE(globMatch("a*b*c*d", "aXbYbZcWcd"));
+  EXPECT_FALSE(globMatch("a*b*c*d", "aXbYbZcWc"));
+  EXPECT_FALSE(globMatch(std::string(30, '*') + "b", std::string(1000, 'a')));
+}
+
+TEST(GLOB, Classes) {
+  EXPECT_TRUE(globMatch("h[ae]llo", "hello"));
+  EXPECT_TRUE(globMatch("h[ae]llo", "hallo"));
+  EXPECT_FALSE(globMatch("h[ae]llo", "hillo"));
+  EXPECT_TRUE(globMatch("h[^e]llo", "hallo"));
+  EXPECT_FALSE(globMatch("h[^e]llo", "hello"));
+  EXPECT_TRUE(globMatch("h[a-b]llo", "hbllo"));
+  EXPECT_TRUE(globMatch("h[b-a]llo", "hallo"));
+  EXPECT_FALSE(globMatch("h[a-b]llo", "hcllo"));
+  EXPECT_TRUE(globMatch("key[0-9]", "key7"));
+  // Escaped special characters are literals
+  EXPECT_TRUE(globMatch("a\\*b", "a*b"));
+  EXPECT_FALSE(globMatch("a\\*b", "axb"));
+  EXPECT_TRUE(globMatch("[\\]]", "]"));
+  EXPECT_EQ(Redis::globPrefix("user:1*:name"), "user:1");
+  EXPECT_EQ(Redis::globPrefix("*"), "");
+}
+
+TEST(RADIX_TREE, PrefixWalk) {
+  Redis::RadixTree tree;
+  std::vector<std::string> keys = {"user:1",   "user:10", "user:2", "user",
+                                   "session:1", "us",     "user:100"};
+  for (const auto &key : keys) {
+    EXPECT_TRUE(tree.insert(key));
+  }
+  EXPECT_FALSE(tree.insert("user:1"));
+  EXPECT_EQ(tree.size(), keys.size());
+  auto withPrefix = [&](std::string_view prefix) {
+    std::vector<std::string> found;
+    tree.forEachWithPrefix(
+        prefix, [&](std::string_view key) { found.emplace_back(key); });
+    return found;
+  };
+  EXPECT_EQ(withPrefix("user:1"),
+            (std::vector<std::string>{"user:1", "user:10", "user:100"}));
+  EXPECT_EQ(withPrefix("use"), (std::vector<std::string>{"user", "user:1",
+                                                         "user:10", "user:100",
+                                                         "user:2"}));
+  EXPECT_TRUE(withPrefix("user:3").empty());
+  EXPECT_EQ(withPrefix("").size(), keys.size());
+
+  EXPECT_TRUE(tree.erase("user:10"));
+  EXPECT_FALSE(tree.erase("user:10"));
+  EXPECT_FALSE(tree.erase("user:"));
+  EXPECT_TRUE(tree.erase("user"));
+  EXPECT_EQ(withPrefix("user:1"),
+            (std::vector<std::string>{"user:1", "user:100"}));
+  for (const auto &key : keys) {
+    tree.erase(key);
+  }
+  EXPECT_EQ(tree.size(), 0);
+  EXPECT_TRUE(withPrefix("").empty());
+}
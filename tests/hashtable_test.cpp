@@ -0,0 +1,152 @@
+#include "HashTable.hpp"
+#include <gtest/gtest.h>
+#include <set>
+#include <string>
+#include <vector>
+
+using Table = Redis::HashTable<int>;
+
+TEST(HASH_TABLE, InsertFindErase) {
+  Table table;
+  EXPECT_TRUE(table.empty());
+  EXPECT_EQ(table.find("missing"), table.end());
+  EXPECT_TRUE(table.insert_or_assign("foo", 1).second);
+  EXPECT_FALSE(table.insert_or_assign("foo", 2).second);
+  table["bar"] = 3;
+  EXPECT_EQ(table.size(), 2);
+  EXPECT_EQ(table.at("foo"), 2);
+  EXPECT_EQ(table.find(std::string_view("bar"))->second, 3);
+  EXPECT_THROW(table.at("missing"), std::out_of_range);
+  EXPECT_EQ(table.erase("foo"), 1);
+  EXPECT_EQ(table.erase("foo"), 0);
+  EXPECT_FALSE(table.contains("foo"));
+  EXPECT_TRUE(table.contains("bar"));
+  EXPECT_EQ(table.size(), 1);
+}
+
+TEST(HASH_TABLE, GrowsIncrementally) {
+  Table table;
+  constexpr int Keys = 100000;
+  bool sawRehash = false;
+  for (int i = 0; i < Keys; ++i) {
+    table["key:" + std::to_string(i)] = i;
+    sawRehash |= table.rehashing();
+    // Keys are found while they are spread over both tables.
+    if (table.rehashing()) {
+      ASSERT_EQ(table.at("key:0"), 0);
+      ASSERT_EQ(table.at("key:" + std::to_string(i)), i);
+    }
+  }
+  EXPECT_TRUE(sawRehash);
+  EXPECT_EQ(table.size(), Keys);
+  while (table.rehashSteps(16)) {
+  }
+  EXPECT_FALSE(table.rehashing());
+  for (int i = 0; i < Keys; ++i) {
+    ASSERT_EQ(table.at("key:" + std::to_string(i)), i);
+  }
+  int count = 0;
+  for (const auto &[key, value] : table) {
+    EXPECT_EQ(key, "key:" + std::to_string(value));
+    ++count;
+  }
+  EXPECT_EQ(count, Keys);
+}
+
+TEST(HASH_TABLE, FindIfByHash) {
+  Table table;
+  for (int i = 0; i < 1000; ++i) {
+    table["key:" + std::to_string(i)] = i;
+  }
+  // The entries are found by their hash alone, wherever the rehash put them
+  for (int i = 0; i < 1000; i += 7) {
+    std::string key = "key:" + std::to_string(i);
+    auto it = table.findIf(Table::hashOf(key), [i](const auto &entry) {
+      return entry.second == i;
+    });
+    ASSERT_NE(it, table.end());
+    EXPECT_EQ(it->first, key);
+  }
+  auto none = table.findIf(Table::hashOf("key:1"),
+                           [](const auto &entry) { return entry.second == 2; });
+  EXPECT_EQ(none, table.end());
+}
+
+TEST(HASH_TABLE, EraseAndReuse) {
+  Table table;
+  // Churn keys so the table is full of tombstones and shrinks back.
+  for (int round = 0; round < 20; ++round) {
+    for (int i = 0; i < 1000; ++i) {
+      table[std::to_string(round) + ":" + std::to_string(i)] = i;
+    }
+    for (int i = 0; i < 1000; ++i) {
+      ASSERT_EQ(table.erase(std::to_string(round) + ":" + std::to_string(i)),
+                1);
+    }
+  }
+  EXPECT_TRUE(table.empty());
+  EXPECT_EQ(table.begin(), table.end());
+  while (table.rehashSteps(16)) {
+  }
+  EXPECT_LE(table.capacity(), 64);
+}
+
+TEST(HASH_TABLE, ForEachErase) {
+  Table table;
+  for (int i = 0; i < 5000; ++i) {
+    table[std::to_string(i)] = i;
+  }
+  int visited = 0;
+  table.forEach([&](Table::value_type &entry) {
+    ++visited;
+    if (entry.second % 2 == 0) {
+      table.erase(entry.first);
+    }
+  });
+  EXPECT_EQ(visited, 5000);
+  EXPECT_EQ(table.size(), 2500);
+  for (int i = 0; i < 5000; ++i) {
+    ASSERT_EQ(table.contains(std::to_string(i)), i % 2 == 1);
+  }
+}
+
+TEST(HASH_TABLE, ScanAcrossResizes) {
+  Table table;
+  for (int i = 0; i < 2000; ++i) {
+    table[std::to_string(i)] = i;
+  }
+  std::set<std::string> seen;
+  std::size_t cursor = 0;
+  int calls = 0;
+  do {
+    cursor = table.scan(cursor, [&](const Table::value_type &entry) {
+      seen.insert(entry.first);
+    });
+    // Grow the table in the middle of the walk, then shrink it.
+    if (++calls == 10) {
+      for (int i = 2000; i < 20000; ++i) {
+        table[std::to_string(i)] = i;
+      }
+    } else if (calls == 200) {
+      for (int i = 2000; i < 20000; ++i) {
+        table.erase(std::to_string(i));
+      }
+    }
+  } while (cursor != 0);
+  for (int i = 0; i < 2000; ++i) {
+    ASSERT_TRUE(seen.contains(std::to_string(i))) << i;
+  }
+}
+
+TEST(HASH_TABLE, CopyAndMove) {
+  Table table;
+  for (int i = 0; i < 100; ++i) {
+    table[std::to_string(i)] = i;
+  }
+  Table copy = table;
+  Table moved = std::move(table);
+  EXPECT_EQ(copy.size(), 100);
+  EXPECT_EQ(moved.size(), 100);
+  EXPECT_EQ(copy.at("42"), 42);
+  EXPECT_EQ(moved.at("42"), 42);
+}
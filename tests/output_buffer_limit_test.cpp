@@ -0,0 +1,45 @@
+#include "OutputBufferLimit.hpp"
+#include <chrono>
+#include <gtest/gtest.h>
+#include <optional>
+
+using namespace Redis;
+
+TEST(OUTPUT_BUFFER_LIMIT, Parse) {
+  EXPECT_EQ(parseMemorySize("64mb"), 64 * 1024 * 1024);
+  EXPECT_EQ(parseMemorySize("2K"), 2000);
+  EXPECT_EQ(parseMemorySize("100"), 100);
+  EXPECT_FALSE(parseMemorySize("mb").has_value());
+  EXPECT_FALSE(parseMemorySize("10xb").has_value());
+
+  auto limits = parseOutputBufferLimits("normal 1mb 512kb 10 slave 0 0 0");
+  ASSERT_TRUE(limits.has_value());
+  const auto &normal = (*limits)[static_cast<int>(ClientClass::NORMAL)];
+  EXPECT_EQ(normal.hard, 1024 * 1024);
+  EXPECT_EQ(normal.soft, 512 * 1024);
+  EXPECT_EQ(normal.softSeconds, 10);
+  EXPECT_EQ((*limits)[static_cast<int>(ClientClass::REPLICA)].hard, 0);
+  // Missing classes keep their defaults
+  EXPECT_EQ((*limits)[static_cast<int>(ClientClass::PUBSUB)].hard,
+            32 * 1024 * 1024);
+  EXPECT_FALSE(parseOutputBufferLimits("normal 1mb 0").has_value());
+  EXPECT_FALSE(parseOutputBufferLimits("admin 0 0 0").has_value());
+  EXPECT_FALSE(parseOutputBufferLimits("normal 0 0 soon").has_value());
+}
+
+TEST(OUTPUT_BUFFER_LIMIT, Exceeded) {
+  using namespace std::chrono_literals;
+  OutputBufferLimit limit{1000, 100, 10};
+  std::optional<std::chrono::steady_clock::time_point> since;
+  auto now = std::chrono::steady_clock::now();
+  EXPECT_FALSE(limit.exceeded(50, since, now));
+  EXPECT_TRUE(limit.exceeded(1000, since, now));
+  // Above the soft limit for too long
+  EXPECT_FALSE(limit.exceeded(500, since, now));
+  EXPECT_FALSE(limit.exceeded(500, since, now + 9s));
+  EXPECT_TRUE(limit.exceeded(500, since, now + 10s));
+  // Going below the soft limit resets its timer
+  EXPECT_FALSE(limit.exceeded(50, since, now + 11s));
+  EXPECT_FALSE(limit.exceeded(500, since, now + 12s));
+  EXPECT_FALSE(OutputBufferLimit{}.exceeded(1 << 30, since, now));
+}
@@ -1,6 +1,8 @@
 #include <RESP/Parsing.hpp>
 #include <gtest/gtest.h>
 #include <optional>
+#include <string_view>
+#include <vector>
 // Demonstrate some basic assertions.
 TEST(RESP_PARSING, BasicParsing) {
   auto val = RESP::parseArray("");
@@ -41,4 +43,107 @@ TEST(RESP_PARSING, Array) {
 TEST(RESP_PARSING, toBString) {
   std::string val = RESP::toBString("bar");
   EXPECT_EQ(val, "$3\r\nbar\r\n");
-}
\ No newline at end of file
+}
+TEST(RESP_PARSING, CommandFrame) {
+  std::vector<std::string_view> args;
+  std::string_view frame = "*2\r\n$4\r\nECHO\r\n$3\r\nhey\r\n";
+  auto result = RESP::parseCommand(frame, args);
+  ASSERT_EQ(result.status, RESP::ParseStatus::COMPLETE);
+  EXPECT_EQ(result.consumed, frame.size());
+  ASSERT_EQ(args.size(), 2);
+  EXPECT_EQ(args[0], "ECHO");
+  EXPECT_EQ(args[1], "hey");
+  // The arguments point into the input buffer
+  EXPECT_EQ(args[1].data(), frame.data() + frame.size() - 5);
+}
+
+TEST(RESP_PARSING, PartialFrames) {
+  std::vector<std::string_view> args;
+  std::string_view frame = "*2\r\n$4\r\nECHO\r\n$3\r\nhey\r\n";
+  for (std::size_t len = 0; len < frame.size(); ++len) {
+    auto result = RESP::parseCommand(frame.substr(0, len), args);
+    EXPECT_EQ(result.status, RESP::ParseStatus::INCOMPLETE) << len;
+    EXPECT_TRUE(args.empty());
+  }
+}
+
+TEST(RESP_PARSING, MultipleFrames) {
+  std::vector<std::string_view> args;
+  std::string_view buffer =
+      "*1\r\n$4\r\nPING\r\n*2\r\n$3\r\nGET\r\n$3\r\nfoo\r\n*1\r\n$4";
+  auto result = RESP::parseCommand(buffer, args);
+  ASSERT_EQ(result.status, RESP::ParseStatus::COMPLETE);
+  EXPECT_EQ(result.consumed, 14);
+  EXPECT_EQ(args, std::vector<std::string_view>({"PING"}));
+
+  buffer.remove_prefix(result.consumed);
+  result = RESP::parseCommand(buffer, args);
+  ASSERT_EQ(result.status, RESP::ParseStatus::COMPLETE);
+  EXPECT_EQ(args, std::vector<std::string_view>({"GET", "foo"}));
+
+  buffer.remove_prefix(result.consumed);
+  result = RESP::parseCommand(buffer, args);
+  EXPECT_EQ(result.status, RESP::ParseStatus::INCOMPLETE);
+}
+
+TEST(RESP_PARSING, BinarySafe) {
+  std::vector<std::string_view> args;
+  std::string_view frame("*2\r\n$3\r\nSET\r\n$5\r\na\r\n\0b\r\n", 26);
+  auto result = RESP::parseCommand(frame, args);
+  ASSERT_EQ(result.status, RESP::ParseStatus::COMPLETE);
+  ASSERT_EQ(args.size(), 2);
+  EXPECT_EQ(args[1], std::string_view("a\r\n\0b", 5));
+}
+
+TEST(RESP_PARSING, InvalidFrames) {
+  std::vector<std::string_view> args;
+  EXPECT_EQ(RESP::parseCommand("+OK\r\n", args).status,
+            RESP::ParseStatus::INVALID);
+  EXPECT_EQ(RESP::parseCommand("*x\r\n", args).status,
+            RESP::ParseStatus::INVALID);
+  EXPECT_EQ(RESP::parseCommand("*1\r\n:1\r\n", args).status,
+            RESP::ParseStatus::INVALID);
+  EXPECT_EQ(RESP::parseCommand("*1\r\n$2\r\nabc\r\n", args).status,
+            RESP::ParseStatus::INVALID);
+  EXPECT_EQ(RESP::parseCommand("*1\r\n$-1\r\n", args).status,
+            RESP::ParseStatus::INVALID);
+}
+
+TEST(RESP_PARSING, BulkLength) {
+  std::vector<std::string_view> args;
+  // The payload position is known as soon as its header arrived
+  std::string_view frame = "*3\r\n$3\r\nSET\r\n$1\r\nk\r\n$100\r\nabc";
+  auto result = RESP::parseCommand(frame, args);
+  ASSERT_EQ(result.status, RESP::ParseStatus::INCOMPLETE);
+  EXPECT_EQ(result.bulkOffset, frame.size() - 3);
+  EXPECT_EQ(result.bulkLength, 100);
+  // Longer payloads are rejected before they are received
+  EXPECT_EQ(RESP::parseCommand(frame, args, 99).status,
+            RESP::ParseStatus::INVALID);
+  EXPECT_EQ(RESP::parseCommand("*1\r\n$99999999999\r\n", args).status,
+            RESP::ParseStatus::INVALID);
+}
+
+TEST(RESP_PARSING, ExternalBulk) {
+  std::vector<std::string_view> args;
+  std::string payload = "a payload read elsewhere";
+  std::string frame = "*3\r\n$3\r\nSET\r\n$24\r\n";
+  RESP::ExternalBulk external{frame.size(), payload};
+  // The arguments following it are parsed from the frame
+  frame += "\r\n$2\r\nPX";
+  EXPECT_EQ(RESP::parseCommand(frame, args, RESP::MaxBulkLength, &external)
+                .status,
+            RESP::ParseStatus::INCOMPLETE);
+  frame = "*2\r\n$3\r\nSET\r\n$24\r\n\r\n*1";
+  auto result =
+      RESP::parseCommand(frame, args, RESP::MaxBulkLength, &external);
+  ASSERT_EQ(result.status, RESP::ParseStatus::COMPLETE);
+  EXPECT_EQ(result.consumed, frame.size() - 2);
+  ASSERT_EQ(args.size(), 2);
+  EXPECT_EQ(args[1].data(), payload.data());
+  // The payload must match its header
+  external.payload = "short";
+  EXPECT_EQ(RESP::parseCommand(frame, args, RESP::MaxBulkLength, &external)
+                .status,
+            RESP::ParseStatus::INVALID);
+}
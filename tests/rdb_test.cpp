@@ -1,5 +1,86 @@
+#include "CRC64.hpp"
 #include "RDBFile.hpp"
+#include "SavePoints.hpp"
+#include <fcntl.h>
+#include <filesystem>
+#include <fstream>
 #include <gtest/gtest.h>
+#include <random>
+#include <unistd.h>
+
+namespace {
+/**
+ * @brief Writes RDB files byte by byte, with the encodings under test.
+ */
+class RDBBuilder {
+public:
+  explicit RDBBuilder(int version = 9) {
+    std::string digits = std::to_string(version);
+    bytes_ = "REDIS" + std::string(4 - digits.size(), '0') + digits;
+  }
+
+  RDBBuilder &byte(std::uint8_t value) {
+    bytes_ += static_cast<char>(value);
+    return *this;
+  }
+
+  RDBBuilder &raw(std::string_view bytes) {
+    bytes_ += bytes;
+    return *this;
+  }
+
+  RDBBuilder &littleEndian(std::uint64_t value, int size) {
+    for (int i = 0; i < size; ++i) {
+      byte(static_cast<std::uint8_t>(value >> (8 * i)));
+    }
+    return *this;
+  }
+
+  RDBBuilder &length(std::uint64_t value) {
+    if (value < 64) {
+      return byte(value);
+    }
+    if (value < 16384) {
+      return byte(0x40 | value >> 8).byte(value & 0xFF);
+    }
+    byte(0x80);
+    for (int i = 3; i >= 0; --i) {
+      byte(static_cast<std::uint8_t>(value >> (8 * i)));
+    }
+    return *this;
+  }
+
+  RDBBuilder &string(std::string_view value) {
+    return length(value.size()).raw(value);
+  }
+
+  RDBBuilder &set(std::string_view key, std::string_view value) {
+    return byte(0).string(key).string(value);
+  }
+
+  std::string finish(bool checksum = true) {
+    byte(Redis::OpCodes::EORDBF);
+    std::uint64_t crc =
+        checksum ? Redis::CRC64::update(0, bytes_.data(), bytes_.size()) : 0;
+    littleEndian(crc, 8);
+    return bytes_;
+  }
+
+private:
+  std::string bytes_;
+};
+
+std::string save(const std::string &name, const std::string &bytes) {
+  std::string path = (std::filesystem::temp_directory_path() / name).string();
+  std::ofstream(path, std::ios::binary) << bytes;
+  return path;
+}
+
+std::string valueOf(const Redis::Database &database, std::string_view key) {
+  auto it = database.find(key);
+  return it == database.end() ? "<missing>" : it->second.data.str();
+}
+} // namespace
 
 TEST(RDB_FILE, BasicRead) {
   auto databse = Redis::parseRDBFile(RDB_FILE_PATH);
@@ -18,3 +99,371 @@ TEST(RDB_FILE, ReadFileWithExp) {
   ASSERT_TRUE(databse->at("hema").expired());
   ASSERT_FALSE(databse->at("foo").expired());
 }
+
+TEST(RDB_FILE, CRC64) {
+  EXPECT_EQ(Redis::CRC64::update(0, "123456789", 9), 0xe9c6d914c4b8d9caULL);
+  std::string data(1000, 'x');
+  for (std::size_t i = 0; i < data.size(); ++i) {
+    data[i] = static_cast<char>(i * 31);
+  }
+  std::uint64_t whole = Redis::CRC64::update(0, data.data(), data.size());
+  std::uint64_t first = Redis::CRC64::update(0, data.data(), 333);
+  std::uint64_t second = Redis::CRC64::update(0, data.data() + 333, 667);
+  EXPECT_EQ(Redis::CRC64::combine(first, second, 667), whole);
+  EXPECT_EQ(Redis::CRC64::update(first, data.data() + 333, 667), whole);
+}
+
+TEST(RDB_FILE, Encodings) {
+  std::string big(20000, 'b');
+  RDBBuilder builder;
+  builder.byte(Redis::OpCodes::AUX).string("redis-ver").string("7.2.0");
+  builder.byte(Redis::OpCodes::AUX).string("redis-bits").byte(0xC0).byte(64);
+  builder.byte(Redis::OpCodes::SELECTDB).length(0);
+  builder.byte(Redis::OpCodes::RESIZEDB).length(9).length(1);
+  builder.set("small", "value");
+  // 14 and 32 bit lengths
+  builder.set(std::string(100, 'k'), std::string(300, 'v'));
+  builder.set("big", big);
+  // Integers in 8, 16 and 32 bits
+  builder.byte(0).string("int8").byte(0xC0).byte(0xFB);
+  builder.byte(0).string("int16").byte(0xC1).littleEndian(-1234 & 0xFFFF, 2);
+  builder.byte(0).string("int32").byte(0xC2).littleEndian(123456789, 4);
+  // "a" then a back reference repeating it 9 times
+  builder.byte(0).string("lzf").byte(0xC3).length(5).length(10).raw(
+      std::string("\x00" "a\xE0\x00\x00", 5));
+  // LZF compressed key
+  builder.byte(0).byte(0xC3).length(5).length(10).raw(
+      std::string("\x00" "b\xE0\x00\x00", 5));
+  builder.string("lzf key");
+  builder.byte(Redis::OpCodes::EXPIRETIMEMS).littleEndian(4102444800000, 8);
+  builder.byte(Redis::OpCodes::IDLE).length(10);
+  builder.set("expiring", "soon");
+  std::string path = save("rdb_encodings.rdb", builder.finish());
+
+  auto database = Redis::parseRDBFile(path);
+  ASSERT_TRUE(database.has_value());
+  EXPECT_EQ(database->size(), 9);
+  EXPECT_EQ(valueOf(*database, "small"), "value");
+  EXPECT_EQ(valueOf(*database, std::string(100, 'k')), std::string(300, 'v'));
+  EXPECT_EQ(valueOf(*database, "big"), big);
+  EXPECT_EQ(valueOf(*database, "int8"), "-5");
+  EXPECT_EQ(valueOf(*database, "int16"), "-1234");
+  EXPECT_EQ(valueOf(*database, "int32"), "123456789");
+  EXPECT_EQ(valueOf(*database, "lzf"), "aaaaaaaaaa");
+  EXPECT_EQ(valueOf(*database, "bbbbbbbbbb"), "lzf key");
+  ASSERT_NE(database->find("expiring"), database->end());
+  EXPECT_EQ(database->at("expiring").expiry, 4102444800000);
+  std::filesystem::remove(path);
+}
+
+TEST(RDB_FILE, SkippedKeys) {
+  RDBBuilder builder(12);
+  builder.byte(Redis::OpCodes::SELECTDB).length(0);
+  builder.set("kept", "1");
+  // A list, a sorted set, a listpack hash and a quicklist
+  builder.byte(1).string("list").length(2).string("a").string("b");
+  builder.byte(3).string("zset").length(2);
+  builder.string("a").byte(253).string("b").string("2");
+  builder.byte(16).string("hash").string("listpack bytes");
+  builder.byte(18).string("quicklist").length(1).length(2).string("node");
+  builder.byte(Redis::OpCodes::FUNCTION2).string("#!lua name=lib");
+  // Only database 0 is loaded
+  builder.byte(Redis::OpCodes::SELECTDB).length(1);
+  builder.byte(Redis::OpCodes::RESIZEDB).length(1).length(0);
+  builder.set("other db", "1");
+  std::string path = save("rdb_skipped.rdb", builder.finish());
+
+  std::size_t loaded = 0;
+  Redis::RDBTarget target;
+  target.insert = [&](std::size_t, std::string_view key, Redis::Record) {
+    EXPECT_EQ(key, "kept");
+    ++loaded;
+  };
+  auto stats = Redis::loadRDBFile(path, target);
+  ASSERT_TRUE(stats.has_value());
+  EXPECT_EQ(stats->version, 12);
+  EXPECT_EQ(stats->keys, 1);
+  EXPECT_EQ(stats->skipped, 5);
+  EXPECT_EQ(loaded, 1);
+  std::filesystem::remove(path);
+}
+
+TEST(RDB_FILE, Checksum) {
+  RDBBuilder builder;
+  builder.byte(Redis::OpCodes::SELECTDB).length(0).set("key", "value");
+  std::string bytes = builder.finish();
+  std::string path = save("rdb_checksum.rdb", bytes);
+  EXPECT_TRUE(Redis::parseRDBFile(path).has_value());
+
+  // A flipped byte of the value
+  bytes[bytes.find("value")] = 'V';
+  save("rdb_checksum.rdb", bytes);
+  EXPECT_FALSE(Redis::parseRDBFile(path).has_value());
+
+  // Saved without a checksum
+  RDBBuilder unchecked;
+  unchecked.byte(Redis::OpCodes::SELECTDB).length(0).set("key", "value");
+  save("rdb_checksum.rdb", unchecked.finish(false));
+  EXPECT_TRUE(Redis::parseRDBFile(path).has_value());
+
+  // Truncated
+  save("rdb_checksum.rdb", bytes.substr(0, bytes.size() - 12));
+  EXPECT_FALSE(Redis::parseRDBFile(path).has_value());
+  std::filesystem::remove(path);
+}
+
+TEST(RDB_FILE, CorruptLZFLength) {
+  // A LZF string claiming a length no compressed string can reach
+  RDBBuilder huge;
+  huge.byte(Redis::OpCodes::SELECTDB).length(0);
+  huge.byte(0).string("key").byte(0xC3).length(5).byte(0x81);
+  huge.littleEndian(0x7f7f7f7f7f7f7f7f, 8);
+  huge.raw(std::string("\x00" "a\xE0\x00\x00", 5));
+  RDBBuilder ratio;
+  ratio.byte(Redis::OpCodes::SELECTDB).length(0);
+  ratio.byte(0).string("key").byte(0xC3).length(5).length(100000);
+  ratio.raw(std::string("\x00" "a\xE0\x00\x00", 5));
+  for (RDBBuilder *builder : {&huge, &ratio}) {
+    std::string bytes = builder->finish();
+    std::string path = save("rdb_corrupt_lzf.rdb", bytes);
+    Redis::RDBTarget target;
+    target.insert = [](std::size_t, std::string_view, Redis::Record) {};
+    EXPECT_FALSE(Redis::loadRDBFile(path, target).has_value());
+    std::filesystem::remove(path);
+    Redis::RDBStreamLoader loader(target);
+    EXPECT_FALSE(loader.feed(bytes).has_value());
+  }
+}
+
+TEST(RDB_FILE, ParallelPartitions) {
+  // Spans several decoding chunks
+  constexpr std::size_t keys = 50000;
+  constexpr std::size_t partitions = 4;
+  RDBBuilder builder;
+  builder.byte(Redis::OpCodes::SELECTDB).length(0);
+  builder.byte(Redis::OpCodes::RESIZEDB).length(keys).length(0);
+  for (std::size_t i = 0; i < keys; ++i) {
+    builder.set("key:" + std::to_string(i),
+                std::string(50, 'a' + i % 26) + std::to_string(i));
+  }
+  std::string path = save("rdb_parallel.rdb", builder.finish());
+
+  std::vector<Redis::Database> tables(partitions);
+  std::vector<std::size_t> reserved(partitions);
+  Redis::RDBTarget target;
+  target.partitions = partitions;
+  target.partitionOf = [](std::string_view key) {
+    return std::hash<std::string_view>{}(key) % partitions;
+  };
+  target.reserve = [&](std::size_t partition, std::size_t count) {
+    reserved[partition] = count;
+  };
+  target.insert = [&](std::size_t partition, std::string_view key,
+                      Redis::Record record) {
+    EXPECT_EQ(partition, std::hash<std::string_view>{}(key) % partitions);
+    tables[partition][key] = std::move(record);
+  };
+  auto stats = Redis::loadRDBFile(path, target, 4);
+  ASSERT_TRUE(stats.has_value());
+  EXPECT_EQ(stats->keys, keys);
+  std::size_t total = 0;
+  for (std::size_t partition = 0; partition < partitions; ++partition) {
+    EXPECT_GE(reserved[partition], keys / partitions);
+    total += tables[partition].size();
+  }
+  EXPECT_EQ(total, keys);
+  for (std::size_t i = 0; i < keys; i += 997) {
+    std::string key = "key:" + std::to_string(i);
+    EXPECT_EQ(valueOf(tables[target.partitionOf(key)], key),
+              std::string(50, 'a' + i % 26) + std::to_string(i));
+  }
+  std::filesystem::remove(path);
+}
+
+TEST(RDB_FILE, SaveRoundTrip) {
+  std::minstd_rand rng(7);
+  Redis::Database database;
+  auto add = [&](std::string key, std::string value,
+                 std::int64_t expiry = Redis::Record::NoExpiry) {
+    Redis::Record record;
+    record.data = value;
+    record.expiry = expiry;
+    database[key] = std::move(record);
+  };
+  // Integers of every width, and too long for 32 bits
+  for (std::string value : {"0", "-7", "300", "-40000", "2147483647",
+                            "-2147483648", "2147483648", "-9000000000000"}) {
+    add("int:" + value, value);
+  }
+  add("12345", "integer key");
+  add("small", "value");
+  add("expiring", "value", 4102444800000);
+  // Compressible and incompressible strings around the buffer size
+  for (std::size_t size : {21, 100, 1000, 70000, 300000}) {
+    std::string repeated;
+    std::string random;
+    while (repeated.size() < size) {
+      repeated += "pattern " + std::to_string(repeated.size() % 97) + " ";
+    }
+    repeated.resize(size);
+    for (std::size_t i = 0; i < size; ++i) {
+      random += static_cast<char>(rng());
+    }
+    add("repeated:" + std::to_string(size), repeated);
+    add("random:" + std::to_string(size), random);
+  }
+  // Runs matching up to the longest back reference
+  for (std::size_t i = 0; i < 50; ++i) {
+    std::string value;
+    while (value.size() < 2000) {
+      value += std::string(rng() % 300 + 1, 'a' + rng() % 3);
+    }
+    add("runs:" + std::to_string(i), value);
+  }
+  auto fill = [&database](Redis::RDBWriter &writer) {
+    writer.selectDb(0, database.size(), 1);
+    database.forEach([&writer](const Redis::Database::value_type &entry) {
+      writer.write(entry.first, entry.second);
+    });
+  };
+
+  std::string path =
+      (std::filesystem::temp_directory_path() / "rdb_save.rdb").string();
+  std::vector<std::uintmax_t> sizes;
+  for (bool compress : {true, false}) {
+    ASSERT_TRUE(Redis::saveRDBFile(path, fill, compress));
+    EXPECT_FALSE(std::filesystem::exists(
+        Redis::rdbTempFilePath(path, getpid())));
+    auto loaded = Redis::parseRDBFile(path);
+    ASSERT_TRUE(loaded.has_value());
+    ASSERT_EQ(loaded->size(), database.size());
+    database.forEach([&](const Redis::Database::value_type &entry) {
+      EXPECT_EQ(valueOf(*loaded, entry.first), entry.second.data.str())
+          << entry.first;
+      EXPECT_EQ(loaded->at(entry.first).expiry, entry.second.expiry);
+    });
+    sizes.push_back(std::filesystem::file_size(path));
+  }
+  // Most of the 370KB of repeated strings and runs are compressed away
+  EXPECT_LT(sizes[0] + 300000, sizes[1]);
+  std::filesystem::remove(path);
+
+  // An unwritable directory leaves nothing behind
+  EXPECT_FALSE(Redis::saveRDBFile("/nonexistent/dump.rdb", fill));
+}
+
+TEST(RDB_FILE, StreamLoad) {
+  std::minstd_rand rng(11);
+  Redis::Database database;
+  for (std::size_t i = 0; i < 2000; ++i) {
+    Redis::Record record;
+    std::string value(rng() % 3 == 0 ? rng() % 5000 : rng() % 30, 'v');
+    for (char &c : value) {
+      c = static_cast<char>('a' + rng() % 4);
+    }
+    record.data = i % 10 == 0 ? std::to_string(i) : value;
+    if (i % 7 == 0) {
+      record.expiry = 4102444800000 + i;
+    }
+    database["key:" + std::to_string(i)] = std::move(record);
+  }
+  auto fill = [&database](Redis::RDBWriter &writer) {
+    writer.selectDb(0, database.size(), 0);
+    database.forEach([&writer](const Redis::Database::value_type &entry) {
+      writer.write(entry.first, entry.second);
+    });
+  };
+  std::string path =
+      (std::filesystem::temp_directory_path() / "rdb_stream").string();
+  int fd = ::open(path.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0644);
+  ASSERT_GE(fd, 0);
+  std::string mark(Redis::RDBEofMarkSize, 'm');
+  ASSERT_TRUE(Redis::writeRDBStream(fd, mark, fill));
+  ::close(fd);
+  std::ifstream file(path, std::ios::binary);
+  std::string stream((std::istreambuf_iterator<char>(file)),
+                     std::istreambuf_iterator<char>());
+  std::filesystem::remove(path);
+  std::string preamble = "$EOF:" + mark + "\r\n";
+  ASSERT_EQ(stream.substr(0, preamble.size()), preamble);
+  ASSERT_EQ(stream.substr(stream.size() - mark.size()), mark);
+  std::string rdb = stream.substr(
+      preamble.size(), stream.size() - preamble.size() - mark.size());
+
+  // Fed as it would arrive from a socket, the partial records are kept
+  auto load = [&](const std::string &bytes, Redis::Database &loaded) {
+    Redis::RDBTarget target;
+    target.insert = [&loaded](std::size_t, std::string_view key,
+                              Redis::Record record) {
+      loaded[key] = std::move(record);
+    };
+    Redis::RDBStreamLoader loader(target);
+    std::string buffer;
+    std::size_t offset = 0;
+    while (offset < bytes.size() && !loader.finished()) {
+      std::size_t size = std::min<std::size_t>(rng() % 3000 + 1,
+                                               bytes.size() - offset);
+      buffer.append(bytes, offset, size);
+      offset += size;
+      auto consumed = loader.feed(buffer);
+      if (!consumed) {
+        return false;
+      }
+      buffer.erase(0, *consumed);
+    }
+    return loader.finished() && buffer.empty() &&
+           loader.stats().keys == database.size();
+  };
+  Redis::Database loaded;
+  ASSERT_TRUE(load(rdb, loaded));
+  ASSERT_EQ(loaded.size(), database.size());
+  database.forEach([&](const Redis::Database::value_type &entry) {
+    EXPECT_EQ(valueOf(loaded, entry.first), entry.second.data.str())
+        << entry.first;
+    EXPECT_EQ(loaded.at(entry.first).expiry, entry.second.expiry);
+  });
+
+  // A corrupted byte fails the checksum
+  std::string corrupted = rdb;
+  corrupted[corrupted.size() / 2] ^= 1;
+  Redis::Database ignored;
+  EXPECT_FALSE(load(corrupted, ignored));
+
+  // The keys of the other types and databases are skipped
+  std::string other = RDBBuilder()
+                          .set("kept", "1")
+                          .byte(2)
+                          .string("set")
+                          .length(1)
+                          .string("member")
+                          .byte(Redis::OpCodes::SELECTDB)
+                          .length(1)
+                          .set("db1", "2")
+                          .finish();
+  Redis::Database skipped;
+  Redis::RDBTarget target;
+  target.insert = [&skipped](std::size_t, std::string_view key,
+                             Redis::Record record) {
+    skipped[key] = std::move(record);
+  };
+  Redis::RDBStreamLoader loader(target);
+  EXPECT_EQ(loader.feed(other), other.size());
+  EXPECT_TRUE(loader.finished());
+  EXPECT_EQ(loader.stats().keys, 1);
+  EXPECT_EQ(loader.stats().skipped, 2);
+  EXPECT_EQ(valueOf(skipped, "kept"), "1");
+}
+
+TEST(SAVE_POINTS, Parse) {
+  auto points = Redis::parseSavePoints("3600 1 300 100  60 10000");
+  ASSERT_TRUE(points.has_value());
+  ASSERT_EQ(points->size(), 3);
+  EXPECT_EQ(points->at(1).seconds, 300);
+  EXPECT_EQ(points->at(1).changes, 100);
+  EXPECT_EQ(points->at(2).changes, 10000);
+  ASSERT_TRUE(Redis::parseSavePoints("").has_value());
+  EXPECT_TRUE(Redis::parseSavePoints("")->empty());
+  EXPECT_FALSE(Redis::parseSavePoints("3600").has_value());
+  EXPECT_FALSE(Redis::parseSavePoints("3600 one").has_value());
+  EXPECT_FALSE(Redis::parseSavePoints("-1 1").has_value());
+}
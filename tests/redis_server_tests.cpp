@@ -1,8 +1,33 @@
+#include "RDBFile.hpp"
 #include "RESP/Constants.hpp"
+#include "RESP/Parsing.hpp"
 #include "RedisServer.hpp"
+#include <cstring>
+#include <filesystem>
+#include <fstream>
 #include <gtest/gtest.h>
+#include <set>
+#include <thread>
 using Reply = Redis::Server::Reply;
 
+namespace {
+/**
+ * @brief Send a command to the server and return its whole reply.
+ */
+std::string request(Redis::Server &server,
+                    const std::vector<std::string> &command) {
+  auto replies = server.handleRequest(RESP::toStringArray(command));
+  EXPECT_TRUE(replies.has_value());
+  std::string reply;
+  if (replies) {
+    for (const auto &part : *replies) {
+      reply += part.view();
+    }
+  }
+  return reply;
+}
+} // namespace
+
 TEST(REDIS_SERVER, PING) {
   Redis::Server server;
   auto res = server.handleRequest("*1\r\n$4\r\nping\r\n");
@@ -26,24 +51,24 @@ TEST(REDIS_SERVER, SETGET) {
 
   // Create a key foo and set value to bar
   auto res =
-      server.handleRequest("*3\r\n$4\r\nset\r\n$3\r\nfoo\r\n$3\r\nbar\r\n");
+      server.handleRequest("*3\r\n$3\r\nset\r\n$3\r\nfoo\r\n$3\r\nbar\r\n");
   ASSERT_TRUE(res.has_value());
   EXPECT_EQ(*res, Reply({"+OK\r\n"}));
 
   // get the value of the key foo
-  res = server.handleRequest("*2\r\n$4\r\nget\r\n$3\r\nfoo\r\n");
+  res = server.handleRequest("*2\r\n$3\r\nget\r\n$3\r\nfoo\r\n");
   ASSERT_TRUE(res.has_value());
   EXPECT_EQ(*res, Reply({"$3\r\nbar\r\n"}));
 
   // Get a non existing key
-  res = server.handleRequest("*2\r\n$4\r\nget\r\n$3\r\nbaz\r\n");
+  res = server.handleRequest("*2\r\n$3\r\nget\r\n$3\r\nbaz\r\n");
   ASSERT_TRUE(res.has_value());
   EXPECT_EQ(*res, Reply{RESP::NullBString});
 }
 
 TEST(REDIS_SERVER, INFO) {
   Redis::Server server;
-  auto res = server.handleRequest("*2\r\n$4\r\nINFO\r\n$11\r\replication\r\n");
+  auto res = server.handleRequest("*2\r\n$4\r\nINFO\r\n$11\r\nreplication\r\n");
   ASSERT_TRUE(res.has_value());
   EXPECT_NE(res->at(0).find("$11\r\nrole:master\r\n"), std::string::npos);
 
@@ -65,7 +90,7 @@ TEST(REDIS_SERVER, INFO) {
 TEST(REDIS_SERVER, PSYNC) {
   Redis::Server server;
   auto res =
-      server.handleRequest("*3\r\n$4\r\npsync\r\n$1\r\n1\r\n$1\r\n2\r\n");
+      server.handleRequest("*3\r\n$5\r\npsync\r\n$1\r\n1\r\n$1\r\n2\r\n");
   ASSERT_TRUE(res.has_value());
   EXPECT_NE(res->at(0).find("+FULLRESYNC"), std::string::npos);
 }
@@ -73,7 +98,671 @@ TEST(REDIS_SERVER, PSYNC) {
 TEST(REDIS_SERVER, REPLCONF) {
   Redis::Server server;
   auto res =
-      server.handleRequest("*3\r\n$4\r\nreplconf\r\n$1\r\n1\r\n$1\r\n2\r\n");
+      server.handleRequest("*3\r\n$8\r\nreplconf\r\n$1\r\n1\r\n$1\r\n2\r\n");
+  ASSERT_TRUE(res.has_value());
+  EXPECT_EQ(*res, Reply({"+OK\r\n"}));
+}
+
+TEST(REDIS_SERVER, PIPELINE) {
+  Redis::Server server;
+  auto res =
+      server.handleRequest("*3\r\n$3\r\nset\r\n$3\r\nfoo\r\n$3\r\nbar\r\n"
+                           "*2\r\n$3\r\nget\r\n$3\r\nfoo\r\n"
+                           "*1\r\n$4\r\nping\r\n");
+  ASSERT_TRUE(res.has_value());
+  EXPECT_EQ(*res, Reply({"+OK\r\n", "$3\r\nbar\r\n", "+PONG\r\n"}));
+
+  // A truncated trailing frame is left for the next read
+  res = server.handleRequest(
+      "*1\r\n$4\r\nping\r\n*2\r\n$3\r\nget\r\n$3\r\nf");
+  ASSERT_TRUE(res.has_value());
+  EXPECT_EQ(*res, Reply({"+PONG\r\n"}));
+}
+
+TEST(REDIS_SERVER, BINARY_SAFE_VALUES) {
+  Redis::Server server;
+  auto res = server.handleRequest(std::string_view(
+      "*3\r\n$3\r\nset\r\n$3\r\nbin\r\n$4\r\na\r\n\0\r\n", 32));
+  ASSERT_TRUE(res.has_value());
+  EXPECT_EQ(*res, Reply({"+OK\r\n"}));
+
+  res = server.handleRequest("*2\r\n$3\r\nget\r\n$3\r\nbin\r\n");
+  ASSERT_TRUE(res.has_value());
+  EXPECT_EQ(*res, Reply({std::string("$4\r\na\r\n\0\r\n", 10)}));
+}
+
+TEST(REDIS_SERVER, SHARDED) {
+  Redis::Server server(6379, 4);
+  std::string request;
+  for (int i = 0; i < 100; ++i) {
+    std::string key = "key" + std::to_string(i);
+    request += RESP::toStringArray({"SET", key, "value" + std::to_string(i)});
+  }
+  // KEYS in the middle of the pipeline sees all the writes before it
+  request += RESP::toStringArray({"KEYS", "*"});
+  for (int i = 0; i < 100; ++i) {
+    request += RESP::toStringArray({"GET", "key" + std::to_string(i)});
+  }
+  auto res = server.handleRequest(request);
+  ASSERT_TRUE(res.has_value());
+  ASSERT_EQ(res->size(), 201);
+  for (int i = 0; i < 100; ++i) {
+    EXPECT_EQ(res->at(i), "+OK\r\n");
+    EXPECT_EQ(res->at(101 + i), RESP::toBString("value" + std::to_string(i)));
+  }
+  EXPECT_EQ(res->at(100).substr(0, 6), "*100\r\n");
+}
+
+TEST(REDIS_SERVER, DEL) {
+  for (std::size_t shards : {0, 4}) {
+    Redis::Server server(6379, shards);
+    for (int i = 0; i < 10; ++i) {
+      request(server, {"SET", "key" + std::to_string(i), "value"});
+    }
+    EXPECT_EQ(request(server, {"DEL", "key0"}), ":1\r\n");
+    EXPECT_EQ(request(server, {"DEL", "key0"}), ":0\r\n");
+    // The keys may live on different shards
+    EXPECT_EQ(
+        request(server, {"DEL", "key1", "key2", "missing", "key3", "key1"}),
+        ":3\r\n");
+    EXPECT_EQ(request(server, {"GET", "key2"}), RESP::NullBString);
+    EXPECT_EQ(request(server, {"GET", "key4"}), RESP::toBString("value"));
+    EXPECT_EQ(request(server, {"DEL"}),
+              "-ERR wrong number of arguments for 'del' command\r\n");
+  }
+}
+
+TEST(REDIS_SERVER, CONFIG_SET) {
+  Redis::Server server;
+  auto res = server.handleRequest(
+      RESP::toStringArray({"CONFIG", "SET", "hz", "100"}));
+  ASSERT_TRUE(res.has_value());
+  EXPECT_EQ(*res, Reply({"+OK\r\n"}));
+  res = server.handleRequest(RESP::toStringArray({"CONFIG", "GET", "hz"}));
+  ASSERT_TRUE(res.has_value());
+  EXPECT_EQ(*res, Reply({RESP::toStringArray({"hz", "100"})}));
+
+  res = server.handleRequest(
+      RESP::toStringArray({"CONFIG", "SET", "hz", "fast"}));
+  ASSERT_TRUE(res.has_value());
+  EXPECT_EQ(res->at(0).substr(0, 4), "-ERR");
+}
+
+TEST(REDIS_SERVER, ACTIVE_EXPIRE) {
+  asio::io_context ioContext;
+  Redis::Server server;
+  server.startCron(ioContext);
+  std::string request;
+  for (int i = 0; i < 100; ++i) {
+    std::string key = "key" + std::to_string(i);
+    request += RESP::toStringArray({"SET", key, "value", "PX", "1"});
+  }
+  request += RESP::toStringArray({"SET", "persistent", "value"});
+  ASSERT_TRUE(server.handleRequest(request).has_value());
+
+  // The keys are never read again, the cron deletes them
+  ioContext.run_for(std::chrono::milliseconds(500));
+  auto res = server.handleRequest(RESP::toStringArray({"KEYS", "*"}));
+  ASSERT_TRUE(res.has_value());
+  EXPECT_EQ(*res, Reply({RESP::toStringArray({"persistent"})}));
+  res = server.handleRequest(RESP::toStringArray({"INFO", "stats"}));
+  ASSERT_TRUE(res.has_value());
+  EXPECT_NE(res->at(0).find("expired_keys:100\r\n"), std::string::npos);
+}
+
+TEST(REDIS_SERVER, EXPIRE_TTL) {
+  Redis::Server server;
+  EXPECT_EQ(request(server, {"TTL", "key"}), ":-2\r\n");
+  EXPECT_EQ(request(server, {"EXPIRE", "key", "10"}), ":0\r\n");
+  request(server, {"SET", "key", "value"});
+  EXPECT_EQ(request(server, {"TTL", "key"}), ":-1\r\n");
+  EXPECT_EQ(request(server, {"EXPIRE", "key", "10"}), ":1\r\n");
+  EXPECT_EQ(request(server, {"TTL", "key"}), ":10\r\n");
+  EXPECT_EQ(request(server, {"PEXPIRE", "key", "5000"}), ":1\r\n");
+  std::string pttl(request(server, {"PTTL", "key"}));
+  EXPECT_TRUE(pttl == ":5000\r\n" || pttl == ":4999\r\n") << pttl;
+  EXPECT_EQ(request(server, {"PERSIST", "key"}), ":1\r\n");
+  EXPECT_EQ(request(server, {"PERSIST", "key"}), ":0\r\n");
+  EXPECT_EQ(request(server, {"TTL", "key"}), ":-1\r\n");
+  EXPECT_EQ(request(server, {"EXPIRE", "key", "soon"}).substr(0, 4), "-ERR");
+  EXPECT_EQ(
+      request(server, {"EXPIRE", "key", "9223372036854775807"}).substr(0, 4),
+      "-ERR");
+  // A negative TTL deletes the key
+  EXPECT_EQ(request(server, {"EXPIRE", "key", "-1"}), ":1\r\n");
+  EXPECT_EQ(request(server, {"GET", "key"}), RESP::NullBString);
+}
+
+TEST(REDIS_SERVER, OBJECT_ENCODING) {
+  Redis::Server server(6379, 2);
+  request(server, {"SET", "counter", "1234"});
+  request(server, {"SET", "short", "value"});
+  request(server, {"SET", "long", std::string(64, 'x')});
+  EXPECT_EQ(request(server, {"OBJECT", "ENCODING", "counter"}),
+            "$3\r\nint\r\n");
+  EXPECT_EQ(request(server, {"OBJECT", "ENCODING", "short"}),
+            "$6\r\nembstr\r\n");
+  EXPECT_EQ(request(server, {"OBJECT", "ENCODING", "long"}), "$3\r\nraw\r\n");
+  EXPECT_EQ(request(server, {"OBJECT", "ENCODING", "missing"}),
+            RESP::NullBString);
+  EXPECT_EQ(request(server, {"GET", "counter"}), "$4\r\n1234\r\n");
+  EXPECT_EQ(request(server, {"GET", "long"}),
+            RESP::toBString(std::string(64, 'x')));
+}
+
+TEST(REDIS_SERVER, MAXMEMORY) {
+  Redis::Server server;
+  auto res = server.handleRequest(
+      RESP::toStringArray({"CONFIG", "SET", "maxmemory-policy", "lru"}));
   ASSERT_TRUE(res.has_value());
+  EXPECT_EQ(res->at(0).substr(0, 4), "-ERR");
+  res = server.handleRequest(
+      RESP::toStringArray({"CONFIG", "GET", "maxmemory-policy"}));
+  ASSERT_TRUE(res.has_value());
+  EXPECT_EQ(*res,
+            Reply({RESP::toStringArray({"maxmemory-policy", "noeviction"})}));
+
+  // Without eviction writes fail once the limit is reached
+  res = server.handleRequest(
+      RESP::toStringArray({"CONFIG", "SET", "maxmemory", "1"}));
+  EXPECT_EQ(*res, Reply({"+OK\r\n"}));
+  res = server.handleRequest(RESP::toStringArray({"SET", "key1", "value"}));
+  EXPECT_EQ(*res, Reply({"+OK\r\n"}));
+  res = server.handleRequest(RESP::toStringArray({"SET", "key2", "value"}));
+  ASSERT_TRUE(res.has_value());
+  EXPECT_EQ(res->at(0).substr(0, 4), "-OOM");
+
+  // With eviction the old key makes room for the new one
+  res = server.handleRequest(RESP::toStringArray(
+      {"CONFIG", "SET", "maxmemory-policy", "allkeys-lru"}));
   EXPECT_EQ(*res, Reply({"+OK\r\n"}));
+  res = server.handleRequest(RESP::toStringArray({"SET", "key2", "value"}));
+  EXPECT_EQ(*res, Reply({"+OK\r\n"}));
+  res = server.handleRequest(RESP::toStringArray({"GET", "key1"}));
+  EXPECT_EQ(*res, Reply({RESP::NullBString}));
+  res = server.handleRequest(RESP::toStringArray({"INFO", "stats"}));
+  ASSERT_TRUE(res.has_value());
+  EXPECT_NE(res->at(0).find("evicted_keys:1"), std::string::npos);
+}
+
+TEST(REDIS_SERVER, SCAN) {
+  Redis::Server server(6379, 2);
+  // Split a reply in its cursor and its keys
+  auto scan = [&](const std::vector<std::string> &command) {
+    std::string reply(request(server, command));
+    std::string_view rest(reply);
+    rest.remove_prefix(std::string_view("*2\r\n").size());
+    std::string cursor = RESP::parseBString(rest).value_or("");
+    rest.remove_prefix(rest.find("\r\n") + 2 + cursor.size() + 2);
+    auto keys = RESP::parseArray(rest).value_or(std::vector<std::string>{});
+    return std::make_pair(cursor, keys);
+  };
+  std::set<std::string> expected;
+  for (int i = 0; i < 200; ++i) {
+    std::string key = "key" + std::to_string(i);
+    request(server, {"SET", key, "value"});
+    expected.insert(key);
+  }
+  std::set<std::string> seen;
+  std::string cursor = "0";
+  int calls = 0;
+  do {
+    auto [next, keys] = scan({"SCAN", cursor, "COUNT", "20"});
+    seen.insert(keys.begin(), keys.end());
+    cursor = next;
+    ++calls;
+  } while (cursor != "0" && calls < 1000);
+  EXPECT_EQ(seen, expected);
+  // The walk is incremental
+  EXPECT_GT(calls, 5);
+
+  auto [next, keys] = scan({"SCAN", "0", "MATCH", "key1*", "COUNT", "1000"});
+  EXPECT_EQ(next, "0");
+  EXPECT_EQ(keys.size(), 111);
+  std::tie(next, keys) = scan({"SCAN", "0", "TYPE", "hash", "COUNT", "1000"});
+  EXPECT_TRUE(keys.empty());
+
+  EXPECT_EQ(request(server, {"SCAN", "abc"}), "-ERR invalid cursor\r\n");
+  EXPECT_EQ(request(server, {"SCAN", "0", "COUNT", "0"}),
+            "-ERR syntax error\r\n");
+  EXPECT_EQ(request(server, {"HSCAN", "key1", "0"}).substr(0, 10),
+            "-WRONGTYPE");
+  EXPECT_EQ(request(server, {"SSCAN", "missing", "0"}),
+            "*2\r\n$1\r\n0\r\n*0\r\n");
+}
+
+TEST(REDIS_SERVER, KEYS_PREFIX_INDEX) {
+  Redis::Server server(6379, 2);
+  auto keys = [&](const std::string &pattern) {
+    auto found = RESP::parseArray(request(server, {"KEYS", pattern}));
+    std::set<std::string> result;
+    if (found) {
+      result.insert(found->begin(), found->end());
+    }
+    return result;
+  };
+  request(server, {"SET", "user:1:name", "a"});
+  request(server, {"SET", "user:2:name", "b"});
+  EXPECT_EQ(request(server, {"CONFIG", "SET", "keys-prefix-index", "yes"}),
+            "+OK\r\n");
+  request(server, {"SET", "user:10:name", "c"});
+  request(server, {"SET", "user:1:age", "1"});
+  EXPECT_EQ(keys("user:1*:name"),
+            (std::set<std::string>{"user:1:name", "user:10:name"}));
+  EXPECT_EQ(keys("user:?:*").size(), 3);
+  EXPECT_EQ(keys("*:name").size(), 3);
+  // Without a cron the expired record stays, neither path lists it
+  request(server, {"SET", "user:3:name", "d", "PX", "1"});
+  std::this_thread::sleep_for(std::chrono::milliseconds(10));
+  EXPECT_EQ(keys("user:?:*").size(), 3);
+  EXPECT_EQ(keys("*:name").size(), 3);
+  EXPECT_EQ(request(server, {"CONFIG", "SET", "keys-prefix-index", "maybe"})
+                .substr(0, 4),
+            "-ERR");
+}
+
+TEST(REDIS_SERVER, COMMAND_TABLE) {
+  Redis::Server server;
+  EXPECT_EQ(request(server, {"SeT", "key", "value"}), "+OK\r\n");
+  EXPECT_EQ(request(server, {"FOO", "bar"}),
+            "-ERR unknown command 'FOO', with args beginning with: 'bar' \r\n");
+  EXPECT_EQ(request(server, {"GET"}),
+            "-ERR wrong number of arguments for 'get' command\r\n");
+  EXPECT_EQ(request(server, {"GET", "a", "b"}).substr(0, 30),
+            "-ERR wrong number of arguments");
+  EXPECT_EQ(request(server, {"COMMAND", "INFO", "get", "nosuch"}),
+            "*2\r\n*6\r\n$3\r\nget\r\n:2\r\n*2\r\n+readonly\r\n+fast\r\n"
+            ":1\r\n:1\r\n:1\r\n*-1\r\n");
+  // COMMAND lists as many commands as COMMAND COUNT
+  std::string count(request(server, {"COMMAND", "COUNT"}));
+  EXPECT_TRUE(request(server, {"COMMAND"}).starts_with("*" + count.substr(1)));
+}
+
+TEST(REDIS_SERVER, ZERO_COPY_GET) {
+  Redis::Server server;
+  std::string value(100000, 'x');
+  server.handleRequest(RESP::toStringArray({"SET", "big", value}));
+  auto res = server.handleRequest(RESP::toStringArray({"GET", "big"}));
+  ASSERT_TRUE(res.has_value());
+  // Header, value and "\r\n" without copying the value
+  ASSERT_EQ(res->size(), 3);
+  EXPECT_EQ(res->at(0), "$100000\r\n");
+  EXPECT_EQ(res->at(2), "\r\n");
+  const char *data = res->at(1).data();
+  // The pending reply keeps the value alive after it's overwritten
+  server.handleRequest(RESP::toStringArray({"SET", "big", "small"}));
+  EXPECT_EQ(res->at(1).data(), data);
+  EXPECT_EQ(res->at(1), value);
+  res = server.handleRequest(RESP::toStringArray({"GET", "big"}));
+  EXPECT_EQ(*res, Reply({"$5\r\nsmall\r\n"}));
+}
+
+TEST(REDIS_SERVER, EXTERNAL_BULK) {
+  Redis::Server server;
+  // A payload read outside of the frame is stored without copying it
+  std::string frame = RESP::toStringArray({"SET", "big"}) + "$2000\r\n";
+  frame[1] = '3';
+  Redis::Server::ExternalBulk bulk{frame.size(),
+                                   Redis::SharedBuffer::allocate(2000)};
+  std::memset(bulk.payload.mutableData(), 'x', 2000);
+  frame += "\r\n";
+  Reply replies;
+  EXPECT_EQ(server.handleBuffer(frame, replies, -1, &bulk), frame.size());
+  EXPECT_EQ(replies, Reply({"+OK\r\n"}));
+  auto res = server.handleRequest(RESP::toStringArray({"GET", "big"}));
+  ASSERT_TRUE(res.has_value());
+  ASSERT_EQ(res->size(), 3);
+  EXPECT_EQ(res->at(1).data(), bulk.payload.data());
+
+  // Longer bulk strings are a protocol error once their header is received
+  auto ok = server.handleRequest(
+      RESP::toStringArray({"CONFIG", "SET", "proto-max-bulk-len", "2000"}));
+  EXPECT_EQ(*ok, Reply({"+OK\r\n"}));
+  replies.clear();
+  EXPECT_FALSE(server.handleBuffer("*3\r\n$3\r\nSET\r\n$1\r\nk\r\n$2001\r\n",
+                                   replies));
+  EXPECT_TRUE(server.handleBuffer(frame, replies, -1, &bulk));
+}
+
+TEST(REDIS_SERVER, TURN_BUDGET) {
+  Redis::Server server;
+  EXPECT_EQ(request(server, {"CONFIG", "SET", "io-commands-per-turn", "2"}),
+            "+OK\r\n");
+  EXPECT_NE(request(server, {"CONFIG", "SET", "io-commands-per-turn", "0"}),
+            "+OK\r\n");
+  Redis::Server::TurnBudget budget =
+      server.turnBudget(Redis::ClientClass::NORMAL);
+  EXPECT_EQ(budget.commands, 2);
+  EXPECT_EQ(server.turnBudget(Redis::ClientClass::REPLICA).commands, 8);
+
+  // The turn stops before the third command, the rest is left unconsumed
+  std::string ping = "*1\r\n$4\r\nPING\r\n";
+  std::string pipeline = ping + ping + ping + ping + ping;
+  Reply replies;
+  std::size_t executed = 0;
+  EXPECT_EQ(server.handleBuffer(pipeline, replies, -1, nullptr, &executed,
+                                &budget),
+            2 * ping.size());
+  EXPECT_EQ(executed, 2);
+  EXPECT_EQ(replies, Reply({"+PONG\r\n", "+PONG\r\n"}));
+
+  // A single command runs even when it's bigger than the byte budget
+  EXPECT_EQ(request(server, {"CONFIG", "SET", "io-bytes-per-turn", "1"}),
+            "+OK\r\n");
+  budget = server.turnBudget(Redis::ClientClass::NORMAL);
+  replies.clear();
+  EXPECT_EQ(server.handleBuffer(pipeline, replies, -1, nullptr, nullptr,
+                                &budget),
+            ping.size());
+  EXPECT_EQ(replies, Reply({"+PONG\r\n"}));
+
+  // Unbounded without a budget
+  replies.clear();
+  EXPECT_EQ(server.handleBuffer(pipeline, replies), pipeline.size());
+  EXPECT_EQ(replies.size(), 5);
+}
+
+namespace {
+/**
+ * @brief Run the cron until no background save or rewrite is in progress.
+ */
+void waitBackgroundSave(Redis::Server &server, asio::io_context &ioContext) {
+  for (int i = 0; i < 500; ++i) {
+    ioContext.run_for(std::chrono::milliseconds(10));
+    auto res = server.handleRequest(
+        RESP::toStringArray({"INFO", "persistence"}));
+    std::string info(res->at(0).view());
+    if (info.find("rdb_bgsave_in_progress:0") != std::string::npos &&
+        info.find("aof_rewrite_in_progress:0") != std::string::npos) {
+      return;
+    }
+  }
+  FAIL() << "The background save didn't finish";
+}
+} // namespace
+
+TEST(REDIS_SERVER, SAVE_BGSAVE) {
+  std::filesystem::path dir =
+      std::filesystem::temp_directory_path() / "redis_server_save";
+  std::filesystem::create_directories(dir);
+  std::string path = (dir / "dump.rdb").string();
+  for (std::size_t shards : {0, 4}) {
+    std::filesystem::remove(path);
+    asio::io_context ioContext;
+    Redis::Server server(6379, shards);
+    ASSERT_EQ(request(server, {"CONFIG", "SET", "dir", dir.string()}),
+              "+OK\r\n");
+    ASSERT_EQ(request(server, {"CONFIG", "SET", "save", ""}), "+OK\r\n");
+    server.startCron(ioContext);
+    for (int i = 0; i < 100; ++i) {
+      request(server, {"SET", "key" + std::to_string(i), std::string(i, 'v')});
+    }
+    request(server, {"SET", "expiring", "1", "PX", "100000"});
+
+    // SAVE writes the file in place
+    EXPECT_NE(request(server, {"INFO", "persistence"})
+                  .find("rdb_changes_since_last_save:101\r\n"),
+              std::string::npos);
+    EXPECT_EQ(request(server, {"SAVE"}), "+OK\r\n");
+    auto saved = Redis::parseRDBFile(path);
+    ASSERT_TRUE(saved.has_value());
+    EXPECT_EQ(saved->size(), 101);
+    EXPECT_EQ(saved->at("key42").data.str(), std::string(42, 'v'));
+    EXPECT_TRUE(saved->at("expiring").hasExpiry());
+    EXPECT_NE(request(server, {"INFO", "persistence"})
+                  .find("rdb_changes_since_last_save:0\r\n"),
+              std::string::npos);
+    EXPECT_GT(std::stoll(request(server, {"LASTSAVE"}).substr(1)), 0);
+
+    // BGSAVE snapshots the keyspace at the fork, later writes aren't in it
+    request(server, {"SET", "before", "1"});
+    EXPECT_EQ(request(server, {"BGSAVE"}), "+Background saving started\r\n");
+    request(server, {"SET", "after", "1"});
+    EXPECT_EQ(request(server, {"BGSAVE"}),
+              "-ERR Background save already in progress\r\n");
+    EXPECT_EQ(request(server, {"SAVE"}),
+              "-ERR Background save already in progress\r\n");
+    EXPECT_EQ(request(server, {"BGSAVE", "NOW"}), "-ERR syntax error\r\n");
+    waitBackgroundSave(server, ioContext);
+    saved = Redis::parseRDBFile(path);
+    ASSERT_TRUE(saved.has_value());
+    EXPECT_NE(saved->find("before"), saved->end());
+    EXPECT_EQ(saved->find("after"), saved->end());
+    std::string info = request(server, {"INFO"});
+    EXPECT_NE(info.find("rdb_last_bgsave_status:ok\r\n"), std::string::npos);
+    EXPECT_NE(info.find("rdb_changes_since_last_save:1\r\n"),
+              std::string::npos);
+    EXPECT_NE(info.find("latest_fork_usec:"), std::string::npos);
+    EXPECT_NE(info.find("rdb_last_cow_size:"), std::string::npos);
+
+    // A scheduled save starts once the running one exits
+    EXPECT_EQ(request(server, {"BGSAVE"}), "+Background saving started\r\n");
+    EXPECT_EQ(request(server, {"BGSAVE", "SCHEDULE"}),
+              "+Background saving scheduled\r\n");
+    waitBackgroundSave(server, ioContext);
+    waitBackgroundSave(server, ioContext);
+    saved = Redis::parseRDBFile(path);
+    ASSERT_TRUE(saved.has_value());
+    EXPECT_NE(saved->find("after"), saved->end());
+
+    // A directory that doesn't exist fails the save
+    ASSERT_EQ(request(server, {"CONFIG", "SET", "dir", "/nonexistent"}),
+              "+OK\r\n");
+    EXPECT_EQ(request(server, {"BGSAVE"}), "+Background saving started\r\n");
+    waitBackgroundSave(server, ioContext);
+    EXPECT_NE(request(server, {"INFO", "persistence"})
+                  .find("rdb_last_bgsave_status:err\r\n"),
+              std::string::npos);
+    EXPECT_EQ(request(server, {"SAVE"}),
+              "-ERR Failed to save the RDB file\r\n");
+  }
+  std::filesystem::remove_all(dir);
+}
+
+TEST(REDIS_SERVER, SAVE_POINTS) {
+  std::filesystem::path dir =
+      std::filesystem::temp_directory_path() / "redis_server_save_points";
+  std::filesystem::create_directories(dir);
+  asio::io_context ioContext;
+  Redis::Server server;
+  ASSERT_EQ(request(server, {"CONFIG", "SET", "dir", dir.string()}), "+OK\r\n");
+  EXPECT_NE(request(server, {"CONFIG", "SET", "save", "60"}), "+OK\r\n");
+  ASSERT_EQ(request(server, {"CONFIG", "SET", "save", "3600 1 0 3"}),
+            "+OK\r\n");
+  server.startCron(ioContext);
+
+  // Under 3 changes, and the hour didn't pass
+  request(server, {"SET", "a", "1"});
+  request(server, {"SET", "b", "2"});
+  ioContext.run_for(std::chrono::milliseconds(300));
+  EXPECT_FALSE(std::filesystem::exists(dir / "dump.rdb"));
+
+  request(server, {"SET", "c", "3"});
+  for (int i = 0; i < 500 && !std::filesystem::exists(dir / "dump.rdb");
+       ++i) {
+    ioContext.run_for(std::chrono::milliseconds(10));
+  }
+  waitBackgroundSave(server, ioContext);
+  auto saved = Redis::parseRDBFile((dir / "dump.rdb").string());
+  ASSERT_TRUE(saved.has_value());
+  EXPECT_EQ(saved->size(), 3);
+  std::filesystem::remove_all(dir);
+}
+
+namespace {
+std::string readFile(const std::filesystem::path &path) {
+  std::ifstream file(path, std::ios::binary);
+  return std::string(std::istreambuf_iterator<char>(file), {});
+}
+} // namespace
+
+TEST(REDIS_SERVER, APPEND_ONLY_FILE) {
+  std::filesystem::path dir =
+      std::filesystem::temp_directory_path() / "redis_server_aof";
+  std::filesystem::path path = dir / "appendonly.aof";
+  Redis::Config config;
+  config.dir = dir.string();
+  config.appendonly = "yes";
+  config.appendfsync = "always";
+  config.save = "";
+  for (std::size_t shards : {0, 4}) {
+    std::filesystem::remove_all(dir);
+    std::filesystem::create_directories(dir);
+    {
+      Redis::Server server(6379, shards, config);
+      ASSERT_TRUE(std::filesystem::exists(path));
+      request(server, {"SET", "a", "1"});
+      request(server, {"SET", "b", "2", "PX", "100000"});
+      request(server, {"EXPIRE", "a", "1000"});
+      request(server, {"SET", "c", "3"});
+      request(server, {"PEXPIREAT", "c", "1"});
+      request(server, {"SET", "d", "4"});
+      EXPECT_EQ(request(server, {"EXPIRE", "missing", "10"}), ":0\r\n");
+      // Synced before the replies with always
+      std::string log = readFile(path);
+      EXPECT_NE(log.find("$1\r\na\r\n$1\r\n1\r\n"), std::string::npos);
+      EXPECT_NE(log.find("PEXPIREAT"), std::string::npos);
+      EXPECT_EQ(log.find("EXPIRE\r\n"), std::string::npos);
+      EXPECT_EQ(log.find("missing"), std::string::npos);
+      EXPECT_NE(request(server, {"INFO", "persistence"})
+                    .find("aof_enabled:1\r\n"),
+                std::string::npos);
+    }
+    // A crash in the middle of a write leaves a partial command
+    std::uintmax_t size = std::filesystem::file_size(path);
+    std::ofstream(path, std::ios::app) << "*3\r\n$3\r\nSET\r\n$1\r\ne";
+    {
+      Redis::Server server(6379, shards, config);
+      EXPECT_EQ(std::filesystem::file_size(path), size);
+      EXPECT_EQ(request(server, {"GET", "a"}), "$1\r\n1\r\n");
+      EXPECT_EQ(request(server, {"GET", "b"}), "$1\r\n2\r\n");
+      EXPECT_EQ(request(server, {"GET", "c"}), RESP::NullBString);
+      EXPECT_EQ(request(server, {"GET", "e"}), RESP::NullBString);
+      std::int64_t ttl = std::stoll(request(server, {"TTL", "a"}).substr(1));
+      EXPECT_GT(ttl, 990);
+      EXPECT_LE(ttl, 1000);
+      ttl = std::stoll(request(server, {"PTTL", "b"}).substr(1));
+      EXPECT_GT(ttl, 90000);
+      EXPECT_LE(ttl, 100000);
+      EXPECT_EQ(request(server, {"TTL", "d"}), ":-1\r\n");
+    }
+    // An invalid command refuses to start
+    std::ofstream(path, std::ios::app) << "*1\r\n$x\r\n\r\n";
+    EXPECT_THROW(Redis::Server(6379, shards, config), std::runtime_error);
+  }
+  std::filesystem::remove_all(dir);
+}
+
+TEST(REDIS_SERVER, APPEND_ONLY_FILE_EVICTION) {
+  std::filesystem::path dir =
+      std::filesystem::temp_directory_path() / "redis_server_aof_eviction";
+  std::filesystem::remove_all(dir);
+  std::filesystem::create_directories(dir);
+  Redis::Config config;
+  config.dir = dir.string();
+  config.appendonly = "yes";
+  config.save = "";
+  config.maxmemory = 1;
+  config.maxmemoryPolicy = "allkeys-lru";
+  {
+    Redis::Server server(6379, 0, config);
+    server.handleRequest(RESP::toStringArray({"SET", "key1", "value"}));
+    server.handleRequest(RESP::toStringArray({"SET", "key2", "value"}));
+  }
+  // The replay deletes the evicted key, even without a limit
+  config.maxmemory = 0;
+  Redis::Server server(6379, 0, config);
+  auto res = server.handleRequest(RESP::toStringArray({"GET", "key1"}));
+  EXPECT_EQ(*res, Reply({RESP::NullBString}));
+  res = server.handleRequest(RESP::toStringArray({"GET", "key2"}));
+  EXPECT_EQ(*res, Reply({RESP::toBString("value")}));
+  std::filesystem::remove_all(dir);
+}
+
+TEST(REDIS_SERVER, BGREWRITEAOF) {
+  std::filesystem::path dir =
+      std::filesystem::temp_directory_path() / "redis_server_bgrewriteaof";
+  std::filesystem::path path = dir / "appendonly.aof";
+  Redis::Config config;
+  config.dir = dir.string();
+  config.save = "";
+  for (std::size_t shards : {0, 4}) {
+    std::filesystem::remove_all(dir);
+    std::filesystem::create_directories(dir);
+    {
+      asio::io_context ioContext;
+      Redis::Server server(6379, shards, config);
+      server.startCron(ioContext);
+      request(server, {"SET", "before", "1"});
+
+      // Enabled at runtime, a rewrite creates the log from the keyspace
+      ASSERT_EQ(request(server, {"CONFIG", "SET", "appendonly", "yes"}),
+                "+OK\r\n");
+      request(server, {"SET", "during", "1"});
+      waitBackgroundSave(server, ioContext);
+      for (int i = 0; i < 500 && !std::filesystem::exists(path); ++i) {
+        ioContext.run_for(std::chrono::milliseconds(10));
+      }
+      waitBackgroundSave(server, ioContext);
+      request(server, {"SET", "after", "1"});
+      ioContext.run_for(std::chrono::milliseconds(50));
+      std::string log = readFile(path);
+      EXPECT_NE(log.find("before"), std::string::npos);
+      EXPECT_NE(log.find("during"), std::string::npos);
+      EXPECT_NE(log.find("after"), std::string::npos);
+
+      // The rewrite compacts the overwrites, the writes during it are kept
+      for (int i = 0; i < 1000; ++i) {
+        request(server, {"SET", "counter", std::to_string(i)});
+      }
+      request(server, {"SET", "expiring", "1", "PX", "1000000"});
+      std::uintmax_t size = std::filesystem::file_size(path);
+      EXPECT_EQ(request(server, {"BGREWRITEAOF"}),
+                "+Background append only file rewriting started\r\n");
+      request(server, {"SET", "counter", "last"});
+      EXPECT_EQ(request(server, {"BGREWRITEAOF"}),
+                "-ERR Background append only file rewriting already in "
+                "progress\r\n");
+      EXPECT_EQ(request(server, {"BGSAVE"}).substr(0, 4), "-ERR");
+      waitBackgroundSave(server, ioContext);
+      request(server, {"SET", "final", "1"});
+      EXPECT_LT(std::filesystem::file_size(path), size / 10);
+      std::string info = request(server, {"INFO", "persistence"});
+      EXPECT_NE(info.find("aof_last_bgrewrite_status:ok\r\n"),
+                std::string::npos);
+      EXPECT_NE(info.find("aof_base_size:"), std::string::npos);
+
+      // Scheduled behind a background save
+      ASSERT_EQ(request(server, {"CONFIG", "SET", "dbfilename", "dump.rdb"}),
+                "+OK\r\n");
+      EXPECT_EQ(request(server, {"BGSAVE"}), "+Background saving started\r\n");
+      EXPECT_EQ(request(server, {"BGREWRITEAOF"}),
+                "+Background append only file rewriting scheduled\r\n");
+      waitBackgroundSave(server, ioContext);
+      waitBackgroundSave(server, ioContext);
+      EXPECT_NE(request(server, {"INFO", "persistence"})
+                    .find("aof_rewrite_scheduled:0\r\n"),
+                std::string::npos);
+    }
+    config.appendonly = "yes";
+    {
+      Redis::Server server(6379, shards, config);
+      EXPECT_EQ(request(server, {"GET", "counter"}), "$4\r\nlast\r\n");
+      EXPECT_EQ(request(server, {"GET", "final"}), "$1\r\n1\r\n");
+      EXPECT_EQ(request(server, {"GET", "before"}), "$1\r\n1\r\n");
+      EXPECT_GT(std::stoll(request(server, {"TTL", "expiring"}).substr(1)),
+                990);
+
+      // Disabled, the writes aren't logged anymore
+      ASSERT_EQ(request(server, {"CONFIG", "SET", "appendonly", "no"}),
+                "+OK\r\n");
+      request(server, {"SET", "unlogged", "1"});
+      EXPECT_EQ(readFile(path).find("unlogged"), std::string::npos);
+      EXPECT_NE(request(server, {"INFO", "persistence"})
+                    .find("aof_enabled:0\r\n"),
+                std::string::npos);
+    }
+    config.appendonly = "no";
+  }
+  std::filesystem::remove_all(dir);
 }
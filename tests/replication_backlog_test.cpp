@@ -0,0 +1,57 @@
+#include "ReplicationBacklog.hpp"
+#include <gtest/gtest.h>
+#include <string>
+
+TEST(REPLICATION_BACKLOG, Since) {
+  Redis::ReplicationBacklog backlog(8);
+  EXPECT_EQ(backlog.since(0), "");
+  EXPECT_EQ(backlog.since(1), std::nullopt);
+  backlog.append("abc");
+  EXPECT_EQ(backlog.offset(), 3);
+  EXPECT_EQ(backlog.firstOffset(), 0);
+  EXPECT_EQ(backlog.since(0), "abc");
+  EXPECT_EQ(backlog.since(2), "c");
+  EXPECT_EQ(backlog.since(3), "");
+  EXPECT_EQ(backlog.since(4), std::nullopt);
+}
+
+TEST(REPLICATION_BACKLOG, WrapsAround) {
+  Redis::ReplicationBacklog backlog(8);
+  std::string stream = "abcdefghij";
+  backlog.append("abcdef");
+  backlog.append("ghij");
+  // The oldest bytes are overwritten
+  EXPECT_EQ(backlog.size(), 8);
+  EXPECT_EQ(backlog.firstOffset(), 2);
+  EXPECT_EQ(backlog.since(1), std::nullopt);
+  EXPECT_EQ(backlog.since(2), "cdefghij");
+  EXPECT_EQ(backlog.since(7), "hij");
+  // A write longer than the buffer keeps its end
+  stream += "0123456789";
+  backlog.append("0123456789");
+  EXPECT_EQ(backlog.offset(), 20);
+  EXPECT_EQ(backlog.since(12), "23456789");
+  for (int i = 0; i < 100; ++i) {
+    std::string bytes(i % 5, static_cast<char>('a' + i % 26));
+    stream += bytes;
+    backlog.append(bytes);
+    ASSERT_EQ(backlog.offset(), stream.size());
+    for (std::uint64_t from = backlog.firstOffset();
+         from <= backlog.offset(); ++from) {
+      ASSERT_EQ(backlog.since(from), stream.substr(from)) << i;
+    }
+  }
+}
+
+TEST(REPLICATION_BACKLOG, Resize) {
+  Redis::ReplicationBacklog backlog(8);
+  backlog.append("abcdef");
+  backlog.resize(4);
+  // The history is dropped, the offset goes on
+  EXPECT_EQ(backlog.offset(), 6);
+  EXPECT_EQ(backlog.since(5), std::nullopt);
+  EXPECT_EQ(backlog.since(6), "");
+  backlog.append("ghijkl");
+  EXPECT_EQ(backlog.since(8), "ijkl");
+  EXPECT_EQ(backlog.since(7), std::nullopt);
+}
@@ -0,0 +1,223 @@
+#include "SPSCQueue.hpp"
+#include "Shard.hpp"
+#include <atomic>
+#include <gtest/gtest.h>
+#include <latch>
+#include <thread>
+#include <vector>
+
+TEST(SPSC_QUEUE, PushPop) {
+  Redis::SPSCQueue<int> queue(3);
+  int value = 0;
+  EXPECT_TRUE(queue.empty());
+  EXPECT_FALSE(queue.tryPop(value));
+  // Capacity is rounded up to 4
+  for (int i = 0; i < 4; ++i) {
+    EXPECT_TRUE(queue.tryPush(int(i)));
+  }
+  EXPECT_FALSE(queue.tryPush(4));
+  for (int i = 0; i < 4; ++i) {
+    ASSERT_TRUE(queue.tryPop(value));
+    EXPECT_EQ(value, i);
+  }
+  EXPECT_TRUE(queue.empty());
+}
+
+TEST(SPSC_QUEUE, ProducerConsumer) {
+  Redis::SPSCQueue<int> queue(64);
+  constexpr int count = 100000;
+  std::thread producer([&] {
+    for (int i = 0; i < count; ++i) {
+      while (!queue.tryPush(int(i))) {
+        std::this_thread::yield();
+      }
+    }
+  });
+  int expected = 0;
+  int value = 0;
+  while (expected < count) {
+    if (queue.tryPop(value)) {
+      ASSERT_EQ(value, expected);
+      ++expected;
+    } else {
+      std::this_thread::yield();
+    }
+  }
+  producer.join();
+}
+
+TEST(SHARD, SharedRunsInPlace) {
+  Redis::Shard shard(0);
+  EXPECT_FALSE(shard.owned());
+  bool ran = false;
+  shard.submit([&] { ran = true; });
+  EXPECT_TRUE(ran);
+}
+
+TEST(SHARD, ProducerSlotsAreReused) {
+  // More threads than slots, one at a time, all get a queue of their own
+  for (std::size_t i = 0; i < 2 * Redis::Shard::MaxProducers; ++i) {
+    std::size_t slot = Redis::Shard::MaxProducers;
+    std::thread([&slot] { slot = Redis::Shard::producerSlot(); }).join();
+    EXPECT_LT(slot, Redis::Shard::MaxProducers);
+  }
+}
+
+TEST(SHARD, OwnedRunsOnItsThread) {
+  Redis::Shard shard(0);
+  shard.start();
+  ASSERT_TRUE(shard.owned());
+  constexpr int producers = 4;
+  constexpr int tasks = 1000;
+  std::atomic<int> ran = 0;
+  std::latch done(producers * tasks);
+  std::vector<std::thread> threads;
+  std::thread::id ownerId;
+  shard.submit([&] { ownerId = std::this_thread::get_id(); });
+  for (int p = 0; p < producers; ++p) {
+    threads.emplace_back([&] {
+      for (int i = 0; i < tasks; ++i) {
+        shard.submit([&shard, &ran, &done, i] {
+          // Only the owner thread touches the data
+          shard.data()["key"].data = std::to_string(i);
+          ++ran;
+          done.count_down();
+        });
+      }
+    });
+  }
+  done.wait();
+  EXPECT_EQ(ran, producers * tasks);
+  for (auto &thread : threads) {
+    thread.join();
+  }
+  std::thread::id lastId;
+  std::latch last(1);
+  shard.submit([&] {
+    lastId = std::this_thread::get_id();
+    last.count_down();
+  });
+  last.wait();
+  EXPECT_EQ(lastId, ownerId);
+  EXPECT_NE(lastId, std::this_thread::get_id());
+  shard.stop();
+  EXPECT_FALSE(shard.owned());
+}
+
+TEST(SHARD, ActiveExpire) {
+  Redis::Shard shard(0);
+  for (int i = 0; i < 1000; ++i) {
+    Redis::Record record;
+    record.data = "value";
+    // Half the keys are already expired, a quarter never expire
+    if (i % 4 != 3) {
+      record.setExpiry(i % 2 == 0 ? -1 : 60000);
+    }
+    shard.set(std::to_string(i), record);
+  }
+  EXPECT_EQ(shard.expiries().size(), 750);
+  auto deadline = std::chrono::steady_clock::now() + std::chrono::seconds(10);
+  auto stats = shard.activeExpire(deadline);
+  EXPECT_FALSE(stats.timedOut);
+  EXPECT_EQ(stats.expired, 500);
+  EXPECT_EQ(shard.expiredKeys(), 500);
+  EXPECT_EQ(shard.data().size(), 500);
+  EXPECT_EQ(shard.expiries().size(), 250);
+  for (int i = 1; i < 1000; i += 2) {
+    EXPECT_TRUE(shard.data().contains(std::to_string(i)));
+  }
+}
+
+TEST(SHARD, ExpiryIndex) {
+  Redis::Shard shard(0);
+  Redis::Record record;
+  record.data = "value";
+  record.setExpiry(60000);
+  shard.set("key", record);
+  EXPECT_EQ(shard.expiries().size(), 1);
+  // Overwriting, persisting and deleting drop the timer
+  shard.set("key", record);
+  EXPECT_EQ(shard.expiries().size(), 1);
+  EXPECT_TRUE(shard.persist("key"));
+  EXPECT_FALSE(shard.persist("key"));
+  EXPECT_EQ(shard.expiries().size(), 0);
+  EXPECT_TRUE(shard.expire("key", Redis::unixTimeMs() + 10000));
+  EXPECT_EQ(shard.expiries().size(), 1);
+  EXPECT_TRUE(shard.erase("key"));
+  EXPECT_EQ(shard.expiries().size(), 0);
+  EXPECT_FALSE(shard.expire("key", Redis::unixTimeMs()));
+  // An expiry in the past deletes the key
+  shard.set("key", record);
+  EXPECT_TRUE(shard.expire("key", Redis::unixTimeMs() - 1000));
+  EXPECT_EQ(shard.find("key"), nullptr);
+  EXPECT_EQ(shard.expiries().size(), 0);
+}
+
+TEST(SHARD, MemoryAccounting) {
+  Redis::Shard shard(0);
+  Redis::Record record;
+  record.data = "a value longer than the embedded size";
+  shard.set("key", record);
+  std::size_t used = shard.usedMemory();
+  EXPECT_EQ(used, Redis::Shard::entryBytes("key", record));
+  EXPECT_TRUE(shard.expire("key", Redis::unixTimeMs() + 10000));
+  EXPECT_GT(shard.usedMemory(), used);
+  EXPECT_TRUE(shard.persist("key"));
+  EXPECT_EQ(shard.usedMemory(), used);
+  record.data = "1";
+  shard.set("key", record);
+  EXPECT_LT(shard.usedMemory(), used);
+  EXPECT_TRUE(shard.erase("key"));
+  EXPECT_EQ(shard.usedMemory(), 0);
+
+  // Clearing drops the keys, their expiries and their memory
+  shard.set("key", record);
+  record.expiry = Redis::unixTimeMs() + 10000;
+  shard.set("expiring", record);
+  shard.clear();
+  EXPECT_EQ(shard.data().size(), 0);
+  EXPECT_EQ(shard.expiries().size(), 0);
+  EXPECT_EQ(shard.usedMemory(), 0);
+  EXPECT_EQ(shard.find("key"), nullptr);
+}
+
+TEST(SHARD, EvictLru) {
+  Redis::Shard shard(0);
+  shard.setEvictionPolicy(Redis::EvictionPolicy::ALLKEYS_LRU);
+  Redis::Record record;
+  record.data = "value";
+  for (int i = 0; i < 100; ++i) {
+    shard.set("key" + std::to_string(i), record);
+  }
+  std::this_thread::sleep_for(std::chrono::milliseconds(5));
+  ASSERT_NE(shard.find("key0"), nullptr);
+  std::size_t limit = shard.usedMemory() / 2;
+  EXPECT_TRUE(shard.evictIfNeeded(limit, 5));
+  EXPECT_LE(shard.usedMemory(), limit);
+  EXPECT_EQ(shard.evictedKeys(), 50);
+  // The recently used key is the last candidate
+  EXPECT_NE(shard.find("key0"), nullptr);
+
+  shard.setEvictionPolicy(Redis::EvictionPolicy::NOEVICTION);
+  EXPECT_FALSE(shard.evictIfNeeded(0, 5));
+  EXPECT_EQ(shard.data().size(), 50);
+}
+
+TEST(SHARD, EvictVolatileTtl) {
+  Redis::Shard shard(0);
+  shard.setEvictionPolicy(Redis::EvictionPolicy::VOLATILE_TTL);
+  Redis::Record record;
+  record.data = "value";
+  shard.set("persistent", record);
+  record.setExpiry(60000);
+  shard.set("later", record);
+  record.setExpiry(1000);
+  shard.set("sooner", record);
+  std::size_t limit = shard.usedMemory() - 1;
+  EXPECT_TRUE(shard.evictIfNeeded(limit, 5));
+  EXPECT_EQ(shard.find("sooner"), nullptr);
+  EXPECT_NE(shard.find("later"), nullptr);
+  // Keys without expiry are never evicted
+  EXPECT_FALSE(shard.evictIfNeeded(0, 5));
+  EXPECT_NE(shard.find("persistent"), nullptr);
+}
@@ -1,10 +1,17 @@
+#include "IOContextPool.hpp"
 #include "RESP/Constants.hpp"
+#include "RESP/Parsing.hpp"
 #include "RedisServer.hpp"
 #include <TCPClient.hpp>
 #include <TCPServer.hpp>
+#include <algorithm>
+#include <atomic>
 #include <chrono>
+#include <filesystem>
 #include <gtest/gtest.h>
+#include <random>
 #include <thread>
+#include <vector>
 using namespace std::chrono_literals;
 TEST(TCP_CLIENT, PING) {
   Redis::Server::SharedPtr redisServer = std::make_shared<Redis::Server>();
@@ -27,3 +34,750 @@ TEST(TCP_CLIENT, PING) {
   io_context.stop();
   t.join();
 }
+
+TEST(TCP_CONNECTION, PIPELINE) {
+  Redis::Server::SharedPtr redisServer = std::make_shared<Redis::Server>();
+  asio::io_context io_context;
+  TCPServer server(io_context, 12346, redisServer);
+  server.start();
+  std::thread t([&] { io_context.run(); });
+
+  asio::io_context clientContext;
+  tcp::socket socket(clientContext);
+  tcp::resolver resolver(clientContext);
+  asio::connect(socket, resolver.resolve("localhost", "12346"));
+
+  // 100 commands in a single write, the last one split across two writes
+  constexpr int commands = 100;
+  std::string batch;
+  for (int i = 0; i < commands; ++i) {
+    batch += "*1\r\n$4\r\nPING\r\n";
+  }
+  batch += "*2\r\n$4\r\nECHO\r\n$3\r\nh";
+  asio::write(socket, asio::buffer(batch));
+  std::this_thread::sleep_for(50ms);
+  asio::write(socket, asio::buffer(std::string("ey\r\n")));
+
+  std::string expected;
+  for (int i = 0; i < commands; ++i) {
+    expected += "+PONG\r\n";
+  }
+  expected += "+hey\r\n";
+  std::string received(expected.size(), '\0');
+  asio::error_code error;
+  asio::read(socket, asio::buffer(received), error);
+  ASSERT_FALSE(error);
+  EXPECT_EQ(received, expected);
+
+  io_context.stop();
+  t.join();
+}
+
+TEST(TCP_CONNECTION, LARGE_VALUE) {
+  Redis::Server::SharedPtr redisServer = std::make_shared<Redis::Server>();
+  asio::io_context io_context;
+  TCPServer server(io_context, 12348, redisServer);
+  server.start();
+  std::thread t([&] { io_context.run(); });
+
+  asio::io_context clientContext;
+  tcp::socket socket(clientContext);
+  tcp::resolver resolver(clientContext);
+  asio::connect(socket, resolver.resolve("localhost", "12348"));
+
+  // Sent from the stored buffer with a gathered write
+  std::string value(1024 * 1024, 'v');
+  std::string request = RESP::toStringArray({"SET", "big", value}) +
+                        RESP::toStringArray({"GET", "big"});
+  asio::write(socket, asio::buffer(request));
+  std::string expected = "+OK\r\n" + RESP::toBString(value);
+  std::string received(expected.size(), '\0');
+  asio::error_code error;
+  asio::read(socket, asio::buffer(received), error);
+  ASSERT_FALSE(error);
+  EXPECT_EQ(received, expected);
+
+  io_context.stop();
+  t.join();
+}
+
+TEST(TCP_CONNECTION, BULK_READ) {
+  Redis::Server::SharedPtr redisServer = std::make_shared<Redis::Server>();
+  asio::io_context io_context;
+  TCPServer server(io_context, 12349, redisServer);
+  server.start();
+  std::thread t([&] { io_context.run(); });
+
+  asio::io_context clientContext;
+  tcp::socket socket(clientContext);
+  tcp::resolver resolver(clientContext);
+  asio::connect(socket, resolver.resolve("localhost", "12349"));
+
+  // The payload arrives in pieces, followed by more arguments and commands
+  std::string value(2 * 1024 * 1024, 'v');
+  std::string request =
+      RESP::toStringArray({"SET", "big", value, "PX", "60000"}) +
+      RESP::toStringArray({"GET", "big"});
+  std::size_t pieces[] = {20, 100000, request.size() - 100020};
+  std::size_t sent = 0;
+  for (std::size_t piece : pieces) {
+    asio::write(socket, asio::buffer(request.data() + sent, piece));
+    sent += piece;
+    std::this_thread::sleep_for(10ms);
+  }
+  std::string expected = "+OK\r\n" + RESP::toBString(value);
+  std::string received(expected.size(), '\0');
+  asio::error_code error;
+  asio::read(socket, asio::buffer(received), error);
+  ASSERT_FALSE(error);
+  EXPECT_EQ(received, expected);
+
+  io_context.stop();
+  t.join();
+}
+
+TEST(TCP_CONNECTION, OUTPUT_BUFFER_LIMIT) {
+  Redis::Server::SharedPtr redisServer = std::make_shared<Redis::Server>();
+  asio::io_context io_context;
+  TCPServer server(io_context, 12350, redisServer);
+  server.start();
+  std::thread t([&] { io_context.run(); });
+
+  asio::io_context clientContext;
+  tcp::resolver resolver(clientContext);
+  auto connect = [&] {
+    tcp::socket socket(clientContext);
+    asio::connect(socket, resolver.resolve("localhost", "12350"));
+    return socket;
+  };
+  std::string value(100 * 1024, 'v');
+  redisServer->handleRequest(RESP::toStringArray({"SET", "big", value}));
+  std::string gets;
+  for (int i = 0; i < 50; ++i) {
+    gets += RESP::toStringArray({"GET", "big"});
+  }
+  std::string expected;
+  for (int i = 0; i < 50; ++i) {
+    expected += RESP::toBString(value);
+  }
+
+  // A slow reader gets everything, the reads pause meanwhile
+  tcp::socket slow = connect();
+  asio::write(slow, asio::buffer(gets));
+  std::this_thread::sleep_for(50ms);
+  auto reply =
+      redisServer->handleRequest(RESP::toStringArray({"INFO", "clients"}));
+  std::string info(reply->at(0));
+  EXPECT_NE(info.find("connected_clients:1"), std::string::npos) << info;
+  EXPECT_NE(info.find("class=normal,omem="), std::string::npos) << info;
+  std::string received(expected.size(), '\0');
+  asio::error_code error;
+  asio::read(slow, asio::buffer(received), error);
+  ASSERT_FALSE(error);
+  EXPECT_EQ(received, expected);
+
+  // Over the hard limit the client is disconnected
+  redisServer->handleRequest(RESP::toStringArray(
+      {"CONFIG", "SET", "client-output-buffer-limit", "normal 1mb 0 0"}));
+  tcp::socket greedy = connect();
+  asio::write(greedy, asio::buffer(gets));
+  std::size_t total = 0;
+  while (!error && total <= expected.size()) {
+    total += greedy.read_some(asio::buffer(received), error);
+  }
+  EXPECT_TRUE(error);
+  EXPECT_LT(total, expected.size());
+
+  io_context.stop();
+  t.join();
+}
+
+TEST(TCP_CONNECTION, CLIENT_COMMANDS) {
+  Redis::Server::SharedPtr redisServer = std::make_shared<Redis::Server>();
+  asio::io_context io_context;
+  TCPServer server(io_context, 12351, redisServer);
+  server.start();
+  std::thread t([&] { io_context.run(); });
+
+  asio::io_context clientContext;
+  tcp::resolver resolver(clientContext);
+  auto connect = [&] {
+    tcp::socket socket(clientContext);
+    asio::connect(socket, resolver.resolve("localhost", "12351"));
+    return socket;
+  };
+  auto request = [](tcp::socket &socket,
+                    std::vector<std::string> args) -> std::string {
+    asio::write(socket, asio::buffer(RESP::toStringArray(args)));
+    std::string reply(4096, '\0');
+    reply.resize(socket.read_some(asio::buffer(reply)));
+    return reply;
+  };
+  tcp::socket first = connect();
+  tcp::socket second = connect();
+  EXPECT_EQ(request(first, {"CLIENT", "SETNAME", "first"}), "+OK\r\n");
+  EXPECT_EQ(request(first, {"CLIENT", "GETNAME"}), "$5\r\nfirst\r\n");
+  EXPECT_EQ(request(second, {"CLIENT", "GETNAME"}), "$-1\r\n");
+  EXPECT_TRUE(request(first, {"CLIENT", "SETNAME", "a b"}).starts_with("-ERR"));
+
+  std::string list = request(first, {"CLIENT", "LIST"});
+  EXPECT_NE(list.find(" name=first "), std::string::npos) << list;
+  // One line per client and the two of the bulk string
+  EXPECT_EQ(std::count(list.begin(), list.end(), '\n'), 4) << list;
+  std::string info = request(first, {"CLIENT", "INFO"});
+  EXPECT_NE(info.find(" name=first "), std::string::npos) << info;
+  EXPECT_NE(info.find(" tot-cmds="), std::string::npos) << info;
+
+  std::string id = request(second, {"CLIENT", "ID"});
+  ASSERT_TRUE(id.starts_with(":"));
+  id = id.substr(1, id.size() - 3);
+  EXPECT_EQ(request(first, {"CLIENT", "KILL", "ID", id}), ":1\r\n");
+  char byte;
+  asio::error_code error;
+  second.read_some(asio::buffer(&byte, 1), error);
+  EXPECT_EQ(error, asio::error::eof);
+  // The killed client's slot is free again
+  EXPECT_EQ(request(first, {"CLIENT", "KILL", "ID", id}), ":0\r\n");
+  list = request(first, {"CLIENT", "LIST"});
+  EXPECT_EQ(std::count(list.begin(), list.end(), '\n'), 3) << list;
+  EXPECT_EQ(request(first, {"CLIENT", "KILL", "1.2.3.4:5"}),
+            "-ERR No such client\r\n");
+
+  io_context.stop();
+  t.join();
+}
+
+TEST(TCP_SERVER, IO_THREADS) {
+  Redis::Server::SharedPtr redisServer = std::make_shared<Redis::Server>();
+  IOContextPool pool(4);
+  std::vector<std::unique_ptr<TCPServer>> servers;
+  for (std::size_t i = 0; i < pool.size(); ++i) {
+    servers.push_back(
+        std::make_unique<TCPServer>(pool.get(i), 12347, redisServer, true));
+    servers.back()->start();
+  }
+  std::thread t([&] { pool.run(); });
+
+  // Concurrent clients writing and reading their own keys
+  constexpr int clients = 8;
+  constexpr int requests = 200;
+  std::vector<std::thread> workers;
+  std::atomic<int> failures = 0;
+  for (int c = 0; c < clients; ++c) {
+    workers.emplace_back([&, c] {
+      asio::io_context clientContext;
+      tcp::socket socket(clientContext);
+      tcp::resolver resolver(clientContext);
+      asio::connect(socket, resolver.resolve("localhost", "12347"));
+      for (int i = 0; i < requests; ++i) {
+        std::string key = "key:" + std::to_string(c) + ":" + std::to_string(i);
+        std::string request = RESP::toStringArray({"SET", key, key}) +
+                              RESP::toStringArray({"GET", key});
+        asio::write(socket, asio::buffer(request));
+        std::string expected = "+OK\r\n" + RESP::toBString(key);
+        std::string received(expected.size(), '\0');
+        asio::read(socket, asio::buffer(received));
+        if (received != expected) {
+          ++failures;
+        }
+      }
+    });
+  }
+  for (auto &worker : workers) {
+    worker.join();
+  }
+  EXPECT_EQ(failures, 0);
+
+  pool.stop();
+  t.join();
+}
+
+TEST(TCP_CONNECTION, TURN_BUDGET) {
+  Redis::Server::SharedPtr redisServer = std::make_shared<Redis::Server>();
+  redisServer->handleRequest(
+      RESP::toStringArray({"CONFIG", "SET", "io-commands-per-turn", "3"}));
+  asio::io_context io_context;
+  TCPServer server(io_context, 12356, redisServer);
+  server.start();
+  std::thread t([&] { io_context.run(); });
+
+  // Two pipelines sharing the event loop, executed 3 commands per turn
+  constexpr int clients = 2;
+  constexpr int commands = 100;
+  asio::io_context clientContext;
+  std::vector<tcp::socket> sockets;
+  tcp::resolver resolver(clientContext);
+  for (int c = 0; c < clients; ++c) {
+    sockets.emplace_back(clientContext);
+    asio::connect(sockets.back(), resolver.resolve("localhost", "12356"));
+  }
+  for (int c = 0; c < clients; ++c) {
+    std::string batch;
+    for (int i = 0; i < commands; ++i) {
+      batch += RESP::toStringArray({"ECHO", std::to_string(i)});
+    }
+    batch += "*2\r\n$4\r\nECHO\r\n$3\r\nh";
+    asio::write(sockets[c], asio::buffer(batch));
+  }
+  std::this_thread::sleep_for(50ms);
+  std::string expected;
+  for (int i = 0; i < commands; ++i) {
+    expected += "+" + std::to_string(i) + "\r\n";
+  }
+  expected += "+hey\r\n";
+  for (auto &socket : sockets) {
+    asio::write(socket, asio::buffer(std::string("ey\r\n")));
+    std::string received(expected.size(), '\0');
+    asio::error_code error;
+    asio::read(socket, asio::buffer(received), error);
+    ASSERT_FALSE(error);
+    EXPECT_EQ(received, expected);
+  }
+
+  io_context.stop();
+  t.join();
+}
+
+TEST(UNIX_SERVER, PING) {
+  namespace fs = std::filesystem;
+  Redis::Server::SharedPtr redisServer = std::make_shared<Redis::Server>();
+  std::string path = (fs::temp_directory_path() / "redis_server_test.sock");
+  asio::io_context io_context;
+  auto server = std::make_unique<UnixServer>(io_context, path,
+                                             fs::perms::owner_all, redisServer);
+  server->start();
+  std::thread t([&] { io_context.run(); });
+  EXPECT_TRUE(fs::is_socket(path));
+  EXPECT_EQ(fs::status(path).permissions(), fs::perms::owner_all);
+
+  asio::io_context clientContext;
+  asio::local::stream_protocol::socket socket(clientContext);
+  socket.connect(asio::local::stream_protocol::endpoint(path));
+  std::string request = "*1\r\n$4\r\nPING\r\n" +
+                        RESP::toStringArray({"CLIENT", "INFO"});
+  asio::write(socket, asio::buffer(request));
+  std::string pong(7, '\0');
+  asio::read(socket, asio::buffer(pong));
+  EXPECT_EQ(pong, "+PONG\r\n");
+  std::string info(4096, '\0');
+  info.resize(socket.read_some(asio::buffer(info)));
+  EXPECT_NE(info.find(" addr=" + path + ":0 "), std::string::npos) << info;
+
+  io_context.stop();
+  t.join();
+  // The socket file goes with the server
+  server.reset();
+  EXPECT_FALSE(fs::exists(path));
+}
+
+TEST(REPLICATION, DISKLESS_SYNC) {
+  namespace fs = std::filesystem;
+  fs::path dir = fs::temp_directory_path() / "redis_server_replication";
+  fs::remove_all(dir);
+  fs::create_directories(dir / "master");
+  Redis::Config config;
+  config.save = "";
+  config.dir = (dir / "master").string();
+  config.replDisklessSyncDelay = 1;
+  // The cron timer of the master must not outlive its event loop
+  asio::io_context io_context;
+  auto master = std::make_shared<Redis::Server>(6379, 2, config);
+  auto request = [](Redis::Server &server, std::vector<std::string> args) {
+    auto replies = server.handleRequest(RESP::toStringArray(args));
+    std::string reply;
+    for (const auto &part : *replies) {
+      reply += part.view();
+    }
+    return reply;
+  };
+  constexpr int keys = 20000;
+  for (int i = 0; i < keys; ++i) {
+    request(*master, {"SET", "key:" + std::to_string(i), std::to_string(i)});
+  }
+  std::string large(3 << 20, 'x');
+  request(*master, {"SET", "large", large});
+  request(*master, {"SET", "expiring", "1", "PX", "1000000"});
+  TCPServer server(io_context, 12358, master);
+  server.start();
+  master->startCron(io_context);
+  std::thread t([&] { io_context.run(); });
+
+  // Writes keep coming while the snapshot is sent
+  std::atomic<bool> stop = false;
+  std::atomic<int> written = 0;
+  std::thread writer([&] {
+    for (int i = 0; !stop; ++i) {
+      request(*master, {"SET", "live:" + std::to_string(i), "1"});
+      written = i + 1;
+      std::this_thread::sleep_for(100us);
+    }
+  });
+
+  // Both replicas ask within the delay and share one snapshot
+  asio::io_context replicaContext;
+  std::vector<std::shared_ptr<Redis::Server>> replicas;
+  for (int i = 0; i < 2; ++i) {
+    fs::create_directories(dir / std::to_string(i));
+    config.dir = (dir / std::to_string(i)).string();
+    replicas.push_back(std::make_shared<Redis::Server>(
+        6380 + i, "localhost", 12358, replicaContext, i * 2, config));
+  }
+  std::thread replicaThread([&] { replicaContext.run(); });
+  auto online = [&](Redis::Server &replica) {
+    for (int i = 0; i < 1000; ++i) {
+      if (request(replica, {"INFO", "replication"})
+              .find("master_link_status:up") != std::string::npos) {
+        return true;
+      }
+      std::this_thread::sleep_for(10ms);
+    }
+    return false;
+  };
+  for (auto &replica : replicas) {
+    ASSERT_TRUE(online(*replica));
+  }
+  std::this_thread::sleep_for(50ms);
+  stop = true;
+  writer.join();
+  std::string info = request(*master, {"INFO", "replication"});
+  EXPECT_NE(info.find("connected_slaves:2"), std::string::npos) << info;
+  EXPECT_EQ(info.find("state=send_bulk"), std::string::npos) << info;
+
+  for (auto &replica : replicas) {
+    EXPECT_EQ(request(*replica, {"GET", "key:0"}), "$1\r\n0\r\n");
+    EXPECT_EQ(request(*replica, {"GET", "key:19999"}),
+              "$5\r\n19999\r\n");
+    EXPECT_EQ(request(*replica, {"GET", "large"}), RESP::toBString(large));
+    std::string ttl = request(*replica, {"PTTL", "expiring"});
+    EXPECT_NE(ttl, ":-1\r\n");
+    EXPECT_NE(ttl, ":-2\r\n");
+    // The writes applied during the sync were buffered, then propagated
+    std::string last = "live:" + std::to_string(written - 1);
+    bool propagated = false;
+    for (int i = 0; i < 500 && !propagated; ++i) {
+      propagated = request(*replica, {"GET", last}) == "$1\r\n1\r\n";
+      std::this_thread::sleep_for(10ms);
+    }
+    EXPECT_TRUE(propagated);
+    for (int i = 0; i < written; ++i) {
+      ASSERT_EQ(request(*replica, {"GET", "live:" + std::to_string(i)}),
+                "$1\r\n1\r\n")
+          << i;
+    }
+  }
+
+  replicaContext.stop();
+  replicaThread.join();
+  io_context.stop();
+  t.join();
+  fs::remove_all(dir);
+}
+
+TEST(REPLICATION, PARTIAL_RESYNC) {
+  namespace fs = std::filesystem;
+  fs::path dir = fs::temp_directory_path() / "redis_server_partial_resync";
+  fs::remove_all(dir);
+  fs::create_directories(dir / "master");
+  fs::create_directories(dir / "replica");
+  Redis::Config config;
+  config.save = "";
+  config.dir = (dir / "master").string();
+  config.replDisklessSyncDelay = 0;
+  asio::io_context io_context;
+  auto master = std::make_shared<Redis::Server>(6379, 0, config);
+  auto request = [](Redis::Server &server, std::vector<std::string> args) {
+    auto replies = server.handleRequest(RESP::toStringArray(args));
+    std::string reply;
+    for (const auto &part : *replies) {
+      reply += part.view();
+    }
+    return reply;
+  };
+  auto waitFor = [&](Redis::Server &server, std::vector<std::string> args,
+                     const std::string &expected) {
+    for (int i = 0; i < 500; ++i) {
+      if (request(server, args).find(expected) != std::string::npos) {
+        return true;
+      }
+      std::this_thread::sleep_for(10ms);
+    }
+    return false;
+  };
+  TCPServer server(io_context, 12359, master);
+  server.start();
+  master->startCron(io_context);
+  std::thread t([&] { io_context.run(); });
+
+  request(*master, {"SET", "before", "1"});
+  asio::io_context replicaContext;
+  config.dir = (dir / "replica").string();
+  auto replica = std::make_shared<Redis::Server>(6380, "localhost", 12359,
+                                                 replicaContext, 0, config);
+  std::thread replicaThread([&] { replicaContext.run(); });
+  ASSERT_TRUE(waitFor(*replica, {"INFO", "replication"},
+                      "master_link_status:up"));
+  request(*master, {"SET", "online", "1"});
+  ASSERT_TRUE(waitFor(*replica, {"GET", "online"}, "$1\r\n1\r\n"));
+
+  // The writes missed while disconnected come from the backlog
+  request(*master, {"CLIENT", "KILL", "TYPE", "replica"});
+  for (int i = 0; i < 100; ++i) {
+    request(*master, {"SET", "missed:" + std::to_string(i), "1"});
+  }
+  request(*master, {"SET", "missed:px", "1", "PX", "100000"});
+  request(*master, {"SET", "missed:expire", "1"});
+  request(*master, {"EXPIRE", "missed:expire", "100"});
+  ASSERT_TRUE(waitFor(*master, {"INFO", "stats"}, "sync_partial_ok:1"));
+  ASSERT_TRUE(waitFor(*replica, {"GET", "missed:99"}, "$1\r\n1\r\n"));
+  // The expiries are deadlines, applying them after the reconnection doesn't
+  // extend them
+  for (std::string key : {"missed:px", "missed:expire"}) {
+    ASSERT_TRUE(waitFor(*replica, {"GET", key}, "$1\r\n1\r\n"));
+    auto pttl = [&](Redis::Server &server) {
+      return std::stoll(request(server, {"PTTL", key}).substr(1));
+    };
+    std::int64_t masterTtl = pttl(*master);
+    std::int64_t replicaTtl = pttl(*replica);
+    EXPECT_GT(replicaTtl, 0) << key;
+    EXPECT_LE(replicaTtl, masterTtl) << key;
+  }
+  for (int i = 0; i < 100; ++i) {
+    EXPECT_EQ(request(*replica, {"GET", "missed:" + std::to_string(i)}),
+              "$1\r\n1\r\n");
+  }
+  std::string stats = request(*master, {"INFO", "stats"});
+  EXPECT_NE(stats.find("sync_full:1\r\n"), std::string::npos) << stats;
+  request(*master, {"SET", "after", "1"});
+  ASSERT_TRUE(waitFor(*replica, {"GET", "after"}, "$1\r\n1\r\n"));
+  // Both count the bytes of the stream the same way
+  std::string info = request(*master, {"INFO", "replication"});
+  std::size_t start = info.find("master_repl_offset:");
+  std::string offset = info.substr(start, info.find('\r', start) - start);
+  EXPECT_TRUE(waitFor(*replica, {"INFO", "replication"}, offset)) << offset;
+
+  // Writes overflowing the backlog need a full synchronization
+  request(*master, {"CONFIG", "SET", "repl-backlog-size", "16384"});
+  request(*master, {"SET", "resized", "1"});
+  request(*master, {"CLIENT", "KILL", "TYPE", "replica"});
+  std::string value(1024, 'x');
+  for (int i = 0; i < 32; ++i) {
+    request(*master, {"SET", "overflow:" + std::to_string(i), value});
+  }
+  ASSERT_TRUE(waitFor(*master, {"INFO", "stats"}, "sync_full:2"));
+  ASSERT_TRUE(waitFor(*master, {"INFO", "stats"}, "sync_partial_err:1"));
+  ASSERT_TRUE(waitFor(*replica, {"GET", "overflow:31"}, value));
+  EXPECT_EQ(request(*replica, {"GET", "overflow:0"}),
+            RESP::toBString(value));
+  EXPECT_EQ(request(*replica, {"GET", "before"}), "$1\r\n1\r\n");
+
+  replicaContext.stop();
+  replicaThread.join();
+  io_context.stop();
+  t.join();
+  fs::remove_all(dir);
+}
+
+TEST(REPLICATION, STALLED_REPLICA) {
+  namespace fs = std::filesystem;
+  fs::path dir = fs::temp_directory_path() / "redis_server_stalled_replica";
+  fs::remove_all(dir);
+  fs::create_directories(dir / "master");
+  fs::create_directories(dir / "replica");
+  Redis::Config config;
+  config.save = "";
+  config.dir = (dir / "master").string();
+  config.replDisklessSyncDelay = 1;
+  config.replTimeout = 1;
+  asio::io_context io_context;
+  auto master = std::make_shared<Redis::Server>(6379, 0, config);
+  auto request = [](Redis::Server &server, std::vector<std::string> args) {
+    auto replies = server.handleRequest(RESP::toStringArray(args));
+    std::string reply;
+    for (const auto &part : *replies) {
+      reply += part.view();
+    }
+    return reply;
+  };
+  auto waitFor = [&](Redis::Server &server, std::vector<std::string> args,
+                     const std::string &expected) {
+    for (int i = 0; i < 1000; ++i) {
+      if (request(server, args).find(expected) != std::string::npos) {
+        return true;
+      }
+      std::this_thread::sleep_for(10ms);
+    }
+    return false;
+  };
+  // A snapshot larger than the socket buffers, which doesn't compress
+  std::minstd_rand rng(5);
+  std::string value(1 << 20, '\0');
+  for (int i = 0; i < 48; ++i) {
+    for (char &c : value) {
+      c = static_cast<char>(rng());
+    }
+    request(*master, {"SET", "key:" + std::to_string(i), value});
+  }
+  TCPServer server(io_context, 12360, master);
+  server.start();
+  master->startCron(io_context);
+  std::thread t([&] { io_context.run(); });
+
+  // This one asks for the snapshot and never reads it
+  asio::io_context stalledContext;
+  tcp::socket stalled(stalledContext);
+  asio::connect(stalled, tcp::resolver(stalledContext)
+                             .resolve("localhost", "12360"));
+  asio::write(stalled,
+              asio::buffer(RESP::toStringArray({"PSYNC", "?", "-1"})));
+
+  asio::io_context replicaContext;
+  config.dir = (dir / "replica").string();
+  auto replica = std::make_shared<Redis::Server>(6380, "localhost", 12360,
+                                                 replicaContext, 0, config);
+  std::thread replicaThread([&] { replicaContext.run(); });
+  // The other replica isn't held back, the stalled one is disconnected and
+  // the child exits
+  ASSERT_TRUE(waitFor(*replica, {"INFO", "replication"},
+                      "master_link_status:up"));
+  EXPECT_EQ(request(*replica, {"GET", "key:47"}), RESP::toBString(value));
+  EXPECT_TRUE(waitFor(*master, {"INFO", "replication"},
+                      "connected_slaves:1"));
+  EXPECT_TRUE(
+      waitFor(*master, {"BGSAVE"}, "Background saving started"));
+
+  replicaContext.stop();
+  replicaThread.join();
+  io_context.stop();
+  t.join();
+  fs::remove_all(dir);
+}
+
+TEST(REPLICATION, PENDING_OUTPUT_LIMIT) {
+  namespace fs = std::filesystem;
+  fs::path dir = fs::temp_directory_path() / "redis_server_pending_limit";
+  fs::remove_all(dir);
+  fs::create_directories(dir);
+  Redis::Config config;
+  config.save = "";
+  config.dir = dir.string();
+  config.replDisklessSyncDelay = 0;
+  config.clientOutputBufferLimit =
+      "normal 0 0 0 replica 16mb 0 0 pubsub 0 0 0";
+  asio::io_context io_context;
+  auto master = std::make_shared<Redis::Server>(6379, 0, config);
+  auto request = [](Redis::Server &server, std::vector<std::string> args) {
+    auto replies = server.handleRequest(RESP::toStringArray(args));
+    std::string reply;
+    for (const auto &part : *replies) {
+      reply += part.view();
+    }
+    return reply;
+  };
+  auto waitFor = [&](std::vector<std::string> args,
+                     const std::string &expected) {
+    for (int i = 0; i < 1000; ++i) {
+      if (request(*master, args).find(expected) != std::string::npos) {
+        return true;
+      }
+      std::this_thread::sleep_for(10ms);
+    }
+    return false;
+  };
+  std::minstd_rand rng(7);
+  std::string value(1 << 20, '\0');
+  for (int i = 0; i < 48; ++i) {
+    for (char &c : value) {
+      c = static_cast<char>(rng());
+    }
+    request(*master, {"SET", "key:" + std::to_string(i), value});
+  }
+  TCPServer server(io_context, 12361, master);
+  server.start();
+  master->startCron(io_context);
+  std::thread t([&] { io_context.run(); });
+
+  // A replica which doesn't read stays in its synchronization, the writes
+  // buffered for it count toward its limit
+  asio::io_context stalledContext;
+  tcp::socket stalled(stalledContext);
+  asio::connect(stalled, tcp::resolver(stalledContext)
+                             .resolve("localhost", "12361"));
+  asio::write(stalled,
+              asio::buffer(RESP::toStringArray({"PSYNC", "?", "-1"})));
+  ASSERT_TRUE(waitFor({"INFO", "replication"}, "state=send_bulk"));
+  for (int i = 0; i < 16; ++i) {
+    request(*master, {"SET", "write:" + std::to_string(i), value});
+  }
+  EXPECT_TRUE(waitFor({"INFO", "replication"}, "connected_slaves:0"));
+  EXPECT_TRUE(waitFor({"BGSAVE"}, "Background saving started"));
+
+  io_context.stop();
+  t.join();
+  fs::remove_all(dir);
+}
+
+TEST(REPLICATION, EVICTION) {
+  namespace fs = std::filesystem;
+  fs::path dir = fs::temp_directory_path() / "redis_server_eviction";
+  fs::remove_all(dir);
+  fs::create_directories(dir / "master");
+  fs::create_directories(dir / "replica");
+  Redis::Config config;
+  config.save = "";
+  config.dir = (dir / "master").string();
+  config.replDisklessSyncDelay = 0;
+  asio::io_context io_context;
+  auto master = std::make_shared<Redis::Server>(6379, 0, config);
+  auto request = [](Redis::Server &server, std::vector<std::string> args) {
+    auto replies = server.handleRequest(RESP::toStringArray(args));
+    std::string reply;
+    for (const auto &part : *replies) {
+      reply += part.view();
+    }
+    return reply;
+  };
+  TCPServer server(io_context, 12362, master);
+  server.start();
+  master->startCron(io_context);
+  std::thread t([&] { io_context.run(); });
+  asio::io_context replicaContext;
+  config.dir = (dir / "replica").string();
+  auto replica = std::make_shared<Redis::Server>(6380, "localhost", 12362,
+                                                 replicaContext, 0, config);
+  std::thread replicaThread([&] { replicaContext.run(); });
+  bool online = false;
+  for (int i = 0; i < 1000 && !online; ++i) {
+    online = request(*replica, {"INFO", "replication"})
+                 .find("master_link_status:up") != std::string::npos;
+    std::this_thread::sleep_for(10ms);
+  }
+  ASSERT_TRUE(online);
+
+  // The keys evicted by the master are deleted on the replica too
+  request(*master, {"CONFIG", "SET", "maxmemory", "100000"});
+  request(*master, {"CONFIG", "SET", "maxmemory-policy", "allkeys-lru"});
+  std::string value(1000, 'v');
+  for (int i = 0; i < 500; ++i) {
+    request(*master, {"SET", "key:" + std::to_string(i), value});
+  }
+  request(*master, {"SET", "last", "1"});
+  std::string keys = request(*master, {"KEYS", "*"});
+  ASSERT_NE(keys.substr(0, 5), "*501\r");
+  bool synced = false;
+  for (int i = 0; i < 500 && !synced; ++i) {
+    synced = request(*replica, {"GET", "last"}) == "$1\r\n1\r\n";
+    std::this_thread::sleep_for(10ms);
+  }
+  ASSERT_TRUE(synced);
+  for (int i = 0; i < 500; ++i) {
+    std::string key = "key:" + std::to_string(i);
+    ASSERT_EQ(request(*replica, {"GET", key}), request(*master, {"GET", key}))
+        << key;
+  }
+
+  replicaContext.stop();
+  replicaThread.join();
+  io_context.stop();
+  t.join();
+  fs::remove_all(dir);
+}
@@ -0,0 +1,84 @@
+#include "TimingWheel.hpp"
+#include <gtest/gtest.h>
+#include <random>
+#include <vector>
+
+using Wheel = Redis::TimingWheel<int>;
+
+TEST(TIMING_WHEEL, FiresInOrder) {
+  Wheel wheel(1000);
+  // Deadlines spread over the first levels, and one in the past
+  std::vector<std::int64_t> deadlines = {1001, 1063, 1064, 1500,
+                                         5000, 999,  300000};
+  for (std::size_t i = 0; i < deadlines.size(); ++i) {
+    wheel.add(deadlines[i], static_cast<int>(i));
+  }
+  EXPECT_EQ(wheel.size(), deadlines.size());
+  std::vector<std::int64_t> fired;
+  for (std::int64_t now = 1000; now <= 400000; now += 7) {
+    wheel.advance(now, -1, [&](int i) {
+      // Never early, and at most one step late
+      EXPECT_LE(deadlines[i], now);
+      EXPECT_GT(deadlines[i], std::min<std::int64_t>(now - 7, 999));
+      fired.push_back(deadlines[i]);
+    });
+  }
+  EXPECT_EQ(wheel.size(), 0);
+  ASSERT_EQ(fired.size(), deadlines.size());
+  EXPECT_TRUE(std::is_sorted(fired.begin(), fired.end()));
+}
+
+TEST(TIMING_WHEEL, Cancel) {
+  Wheel wheel(0);
+  auto first = wheel.add(10, 1);
+  auto second = wheel.add(10, 2);
+  auto third = wheel.add(100000, 3);
+  EXPECT_EQ(wheel.when(third), 100000);
+  wheel.cancel(first);
+  wheel.cancel(third);
+  EXPECT_EQ(wheel.size(), 1);
+  std::vector<int> fired;
+  wheel.advance(200000, -1, [&](int value) { fired.push_back(value); });
+  EXPECT_EQ(fired, std::vector<int>{2});
+  // Freed timers are reused
+  EXPECT_EQ(wheel.add(200010, 4), second);
+  EXPECT_EQ(wheel.size(), 1);
+}
+
+TEST(TIMING_WHEEL, Limit) {
+  Wheel wheel(0);
+  for (int i = 0; i < 100; ++i) {
+    wheel.add(5, i);
+  }
+  int fired = 0;
+  EXPECT_EQ(wheel.advance(10, 30, [&](int) { ++fired; }), 30);
+  EXPECT_EQ(wheel.advance(10, 100, [&](int) { ++fired; }), 70);
+  EXPECT_EQ(fired, 100);
+  EXPECT_EQ(wheel.now(), 10);
+}
+
+TEST(TIMING_WHEEL, RandomDeadlines) {
+  Wheel wheel(0);
+  std::mt19937_64 rng(42);
+  std::vector<std::int64_t> deadlines;
+  for (int i = 0; i < 10000; ++i) {
+    // Up to ~4.6 hours, and a few beyond the last level
+    std::int64_t when = rng() % (i % 100 == 0 ? (1ll << 40) : (1ll << 24));
+    deadlines.push_back(when);
+    wheel.add(when, i);
+  }
+  std::size_t fired = 0;
+  std::int64_t now = 0;
+  while (wheel.size() > 0) {
+    now += 1 + rng() % 5000;
+    wheel.advance(now, -1, [&](int i) {
+      ASSERT_LE(deadlines[i], now);
+      ++fired;
+    });
+    if (now > (1ll << 24) && wheel.size() > 0) {
+      // Jump to the far deadlines
+      now = (1ll << 40);
+    }
+  }
+  EXPECT_EQ(fired, deadlines.size());
+}
@@ -0,0 +1,154 @@
+#include "RedisServer.hpp"
+#include "UringServer.hpp"
+#include <asio.hpp>
+#include <gtest/gtest.h>
+#include <string>
+#include <thread>
+
+#ifdef REDIS_SERVER_IO_URING
+using asio::ip::tcp;
+
+namespace {
+/**
+ * @brief Runs a UringServer on its own thread, the tests are skipped when the
+ * kernel can't run it.
+ */
+struct UringFixture {
+  explicit UringFixture(int port)
+      : redisServer(std::make_shared<Redis::Server>()),
+        server(port, redisServer), thread([this] { server.run(); }) {}
+
+  ~UringFixture() {
+    server.stop();
+    thread.join();
+  }
+
+  Redis::Server::SharedPtr redisServer;
+  UringServer server;
+  std::thread thread;
+};
+} // namespace
+
+TEST(URING_CONNECTION, PIPELINE) {
+  if (!UringServer::supported()) {
+    GTEST_SKIP() << "io_uring is not supported";
+  }
+  UringFixture fixture(12353);
+
+  asio::io_context clientContext;
+  tcp::socket socket(clientContext);
+  tcp::resolver resolver(clientContext);
+  asio::connect(socket, resolver.resolve("localhost", "12353"));
+
+  // 100 commands in a single write, the last one split across two writes
+  constexpr int commands = 100;
+  std::string batch;
+  for (int i = 0; i < commands; ++i) {
+    batch += "*1\r\n$4\r\nPING\r\n";
+  }
+  batch += "*2\r\n$4\r\nECHO\r\n$3\r\nh";
+  asio::write(socket, asio::buffer(batch));
+  std::this_thread::sleep_for(std::chrono::milliseconds(50));
+  asio::write(socket, asio::buffer(std::string("ey\r\n")));
+
+  std::string expected;
+  for (int i = 0; i < commands; ++i) {
+    expected += "+PONG\r\n";
+  }
+  expected += "+hey\r\n";
+  std::string received(expected.size(), '\0');
+  asio::error_code error;
+  asio::read(socket, asio::buffer(received), error);
+  ASSERT_FALSE(error);
+  EXPECT_EQ(received, expected);
+}
+
+TEST(URING_CONNECTION, LARGE_VALUE) {
+  if (!UringServer::supported()) {
+    GTEST_SKIP() << "io_uring is not supported";
+  }
+  UringFixture fixture(12354);
+
+  asio::io_context clientContext;
+  tcp::socket socket(clientContext);
+  tcp::resolver resolver(clientContext);
+  asio::connect(socket, resolver.resolve("localhost", "12354"));
+
+  // Spans many provided buffers and partial sends
+  std::string value(4 * 1024 * 1024, 'v');
+  std::string request = "*3\r\n$3\r\nSET\r\n$3\r\nkey\r\n$" +
+                        std::to_string(value.size()) + "\r\n" + value +
+                        "\r\n*2\r\n$3\r\nGET\r\n$3\r\nkey\r\n";
+  asio::write(socket, asio::buffer(request));
+
+  std::string expected = "+OK\r\n$" + std::to_string(value.size()) +
+                         "\r\n" + value + "\r\n";
+  std::string received(expected.size(), '\0');
+  asio::error_code error;
+  asio::read(socket, asio::buffer(received), error);
+  ASSERT_FALSE(error);
+  EXPECT_TRUE(received == expected);
+}
+
+TEST(URING_CONNECTION, TURN_BUDGET) {
+  if (!UringServer::supported()) {
+    GTEST_SKIP() << "io_uring is not supported";
+  }
+  UringFixture fixture(12357);
+  fixture.redisServer->handleRequest(
+      "*3\r\n$6\r\nCONFIG\r\n$3\r\nSET\r\n$20\r\nio-commands-per-turn"
+      "\r\n$1\r\n3\r\n");
+
+  asio::io_context clientContext;
+  tcp::socket socket(clientContext);
+  tcp::resolver resolver(clientContext);
+  asio::connect(socket, resolver.resolve("localhost", "12357"));
+
+  // Executed 3 commands per loop iteration
+  constexpr int commands = 100;
+  std::string batch;
+  std::string expected;
+  for (int i = 0; i < commands; ++i) {
+    std::string n = std::to_string(i);
+    batch += "*2\r\n$4\r\nECHO\r\n$" + std::to_string(n.size()) + "\r\n" +
+             n + "\r\n";
+    expected += "+" + n + "\r\n";
+  }
+  asio::write(socket, asio::buffer(batch));
+  std::string received(expected.size(), '\0');
+  asio::error_code error;
+  asio::read(socket, asio::buffer(received), error);
+  ASSERT_FALSE(error);
+  EXPECT_EQ(received, expected);
+}
+
+TEST(URING_CONNECTION, CLIENT_KILL) {
+  if (!UringServer::supported()) {
+    GTEST_SKIP() << "io_uring is not supported";
+  }
+  UringFixture fixture(12355);
+
+  asio::io_context clientContext;
+  tcp::socket socket(clientContext);
+  tcp::resolver resolver(clientContext);
+  asio::connect(socket, resolver.resolve("localhost", "12355"));
+
+  std::string request = "*2\r\n$6\r\nCLIENT\r\n$2\r\nID\r\n";
+  asio::write(socket, asio::buffer(request));
+  char reply[64];
+  std::size_t length = socket.read_some(asio::buffer(reply));
+  std::string id(reply + 1, length - 3);
+
+  // Killed from another thread, the loop closes the connection
+  Redis::Server::Reply replies;
+  fixture.redisServer->handleBuffer(
+      "*4\r\n$6\r\nCLIENT\r\n$4\r\nKILL\r\n$2\r\nID\r\n$" +
+          std::to_string(id.size()) + "\r\n" + id + "\r\n",
+      replies);
+  ASSERT_EQ(replies.size(), 1);
+  EXPECT_EQ(std::string(replies[0].data(), replies[0].size()), ":1\r\n");
+  asio::error_code error;
+  socket.read_some(asio::buffer(reply), error);
+  EXPECT_EQ(error, asio::error::eof);
+}
+#endif
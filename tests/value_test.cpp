@@ -0,0 +1,98 @@
+#include "Types.hpp"
+#include <cstring>
+#include <gtest/gtest.h>
+#include <string>
+#include <utility>
+
+using Redis::Value;
+using Encoding = Redis::Value::Encoding;
+
+TEST(VALUE, Encodings) {
+  EXPECT_EQ(Value().encoding(), Encoding::EMBSTR);
+  EXPECT_EQ(Value(), "");
+  EXPECT_EQ(Value("12345").encoding(), Encoding::INT);
+  EXPECT_EQ(Value("-9223372036854775808").encoding(), Encoding::INT);
+  EXPECT_EQ(Value("hello").encoding(), Encoding::EMBSTR);
+  EXPECT_EQ(Value("123456789012345").encodingName(), "int");
+  EXPECT_EQ(Value("fifteen bytes!!").encodingName(), "embstr");
+  EXPECT_EQ(Value("sixteen bytes!!!").encodingName(), "raw");
+  // Only canonical integers, the string must read back the same
+  for (const char *str : {"007", "+1", "-0", " 1", "1 ", "9223372036854775808",
+                          "1.5", "-"}) {
+    EXPECT_NE(Value(str).encoding(), Encoding::INT) << str;
+    EXPECT_EQ(Value(str), str);
+  }
+  EXPECT_EQ(Value("0").encoding(), Encoding::INT);
+  EXPECT_EQ(Value("-42").integer(), -42);
+}
+
+TEST(VALUE, ReadBack) {
+  std::string binary("a\0b\r\n", 5);
+  std::string longStr(1000, 'x');
+  for (const std::string &str :
+       {std::string("-9223372036854775808"), std::string("short"), binary,
+        longStr, std::string("")}) {
+    Value value(str);
+    EXPECT_EQ(value.str(), str);
+    EXPECT_EQ(value.size(), str.size());
+  }
+}
+
+TEST(VALUE, CopyAndMove) {
+  std::string longStr(100, 'y');
+  Value raw(longStr);
+  Value copy = raw;
+  EXPECT_EQ(copy, longStr);
+  Value moved = std::move(raw);
+  EXPECT_EQ(moved, longStr);
+  EXPECT_EQ(raw, "");
+  copy = Value("42");
+  EXPECT_EQ(copy.encoding(), Encoding::INT);
+  copy = moved;
+  EXPECT_EQ(copy, longStr);
+  // Assigning a view of the value itself
+  Value::IntBuffer buffer;
+  copy = copy.view(buffer).substr(10);
+  EXPECT_EQ(copy, longStr.substr(10));
+}
+
+TEST(VALUE, RecordSize) {
+  // Value, expiry and timer fit in 32 bytes
+  EXPECT_LE(sizeof(Redis::Record), 32);
+  Redis::Record record;
+  EXPECT_FALSE(record.hasExpiry());
+  EXPECT_FALSE(record.expired());
+  record.setExpiry(-1);
+  EXPECT_TRUE(record.expired());
+  record.setExpiry(60000);
+  EXPECT_FALSE(record.expired());
+}
+
+TEST(VALUE, SharedRawBuffer) {
+  std::string str(100, 'r');
+  Redis::SharedBuffer buffer;
+  {
+    Value value(str);
+    Value copy = value;
+    buffer = copy.buffer();
+    EXPECT_EQ(buffer.useCount(), 3);
+    EXPECT_EQ(copy.buffer().data(), value.buffer().data());
+  }
+  EXPECT_EQ(buffer.useCount(), 1);
+  EXPECT_EQ(buffer.view(), str);
+  EXPECT_EQ(Value("short").buffer().size(), 0);
+}
+
+TEST(VALUE, AdoptBuffer) {
+  auto buffer = Redis::SharedBuffer::allocate(100);
+  std::memset(buffer.mutableData(), 'a', buffer.size());
+  Value value(buffer);
+  EXPECT_EQ(value.encoding(), Encoding::RAW);
+  EXPECT_EQ(value.buffer().data(), buffer.data());
+  EXPECT_EQ(value, std::string(100, 'a'));
+  // Small buffers keep their compact encodings
+  EXPECT_EQ(Value(Redis::SharedBuffer::copyOf("12345678901234567")).encoding(),
+            Encoding::INT);
+  EXPECT_EQ(Value(Redis::SharedBuffer::copyOf("short")).encoding(),
+            Encoding::EMBSTR);
+}